@@ -172,6 +172,11 @@ namespace backend {
     void getMouseScreenPos(double& x, double& y) { x = 0; y = 0; }
     void setMouseScreenPos(double x, double y) {}
 
+    // The android render loop is driven by the looper, always render continuously
+    void setRenderOnDemand(bool enabled) {}
+    void setMaxFrameRate(int fps) {}
+    void requestRedraw() {}
+
     int renderLoop() {
         while (true) {
             int out_events;
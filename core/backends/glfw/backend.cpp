@@ -11,6 +11,9 @@
 #include <stb_image.h>
 #include <stb_image_resize.h>
 #include <gui/gui.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 namespace backend {
     const char* OPENGL_VERSIONS_GLSL[] = {
@@ -39,6 +42,10 @@ namespace backend {
 
     #define OPENGL_VERSION_COUNT (sizeof(OPENGL_VERSIONS_GLSL) / sizeof(char*))
 
+    // Render on demand: time after which a frame is drawn anyway, and extra frames drawn after an input event
+    const double ON_DEMAND_IDLE_TIMEOUT = 1.0;
+    const int ON_DEMAND_SETTLE_FRAMES = 3;
+
     bool maximized = false;
     bool fullScreen = false;
     int winHeight;
@@ -46,8 +53,12 @@ namespace backend {
     bool _maximized = maximized;
     int fsWidth, fsHeight, fsPosX, fsPosY;
     int _winWidth, _winHeight;
-    GLFWwindow* window;
+    GLFWwindow* window = NULL;
     GLFWmonitor* monitor;
+    // Read by the DSP threads requesting redraws
+    std::atomic<bool> renderOnDemand(false);
+    std::atomic<int> maxFrameRate(60);
+    std::atomic<bool> redrawRequested(false);
 
     static void glfw_error_callback(int error, const char* description) {
         flog::error("Glfw Error {0}: {1}", error, description);
@@ -69,6 +80,8 @@ namespace backend {
         winHeight = core::configManager.conf["windowSize"]["h"];
         maximized = core::configManager.conf["maximized"];
         fullScreen = core::configManager.conf["fullscreen"];
+        renderOnDemand = (bool)core::configManager.conf["renderOnDemand"];
+        maxFrameRate = std::max<int>((int)core::configManager.conf["maxFrameRate"], 1);
         core::configManager.release();
 
         // Setup window
@@ -229,10 +242,55 @@ namespace backend {
         ImGui_ImplGlfw_CursorPosCallback(window, x, y);
     }
 
+    void setRenderOnDemand(bool enabled) {
+        renderOnDemand = enabled;
+        requestRedraw();
+    }
+
+    void setMaxFrameRate(int fps) {
+        maxFrameRate = std::max<int>(fps, 1);
+    }
+
+    void requestRedraw() {
+        if (!renderOnDemand || !window) { return; }
+        redrawRequested = true;
+        glfwPostEmptyEvent();
+    }
+
+    void waitForRedraw(int& settleFrames, std::chrono::steady_clock::time_point lastFrame) {
+        if (settleFrames) {
+            settleFrames--;
+        }
+        else {
+            // Sleep until an input event, a redraw request or the idle timeout
+            auto waitStart = std::chrono::steady_clock::now();
+            glfwWaitEventsTimeout(ON_DEMAND_IDLE_TIMEOUT);
+            std::chrono::duration<double> waited = std::chrono::steady_clock::now() - waitStart;
+
+            // Woken up by input, give ImGui a few frames to settle (hover, popups, etc)
+            if (!redrawRequested.exchange(false) && waited.count() < ON_DEMAND_IDLE_TIMEOUT) {
+                settleFrames = ON_DEMAND_SETTLE_FRAMES;
+            }
+        }
+
+        // Respect the maximum frame rate, events arriving meanwhile are picked up just after
+        std::this_thread::sleep_until(lastFrame + std::chrono::microseconds(1000000 / maxFrameRate));
+        glfwPollEvents();
+    }
+
     int renderLoop() {
+        auto lastFrame = std::chrono::steady_clock::now();
+        int settleFrames = 0;
+
         // Main loop
         while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+            if (renderOnDemand) {
+                waitForRedraw(settleFrames, lastFrame);
+            }
+            else {
+                glfwPollEvents();
+            }
+            lastFrame = std::chrono::steady_clock::now();
 
             beginFrame();
             
@@ -7,6 +7,9 @@ namespace backend {
     void render(bool vsync = true);
     void getMouseScreenPos(double& x, double& y);
     void setMouseScreenPos(double x, double y);
+    void setRenderOnDemand(bool enabled);
+    void setMaxFrameRate(int fps);
+    void requestRedraw();
     int renderLoop();
     int end();
 }
\ No newline at end of file
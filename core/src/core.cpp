@@ -121,6 +121,10 @@ int sdrpp_main(int argc, char* argv[]) {
     defConfig["fftSmoothingSpeed"] = 100;
     defConfig["snrSmoothing"] = false;
     defConfig["snrSmoothingSpeed"] = 20;
+    defConfig["spectrogramHistory"] = false;
+    defConfig["spectrogramHistoryPath"] = "%ROOT%/spectrogram";
+    defConfig["spectrogramHistoryMaxSize"] = 2048;
+    defConfig["spectrogramHistoryMaxAge"] = 0;
     defConfig["fastFFT"] = false;
     defConfig["fftHeight"] = 300;
     defConfig["fftRate"] = 20;
@@ -159,6 +163,7 @@ int sdrpp_main(int argc, char* argv[]) {
     defConfig["menuElements"][7]["name"] = "Display";
     defConfig["menuElements"][7]["open"] = true;
 
+    defConfig["maxFrameRate"] = 60;
     defConfig["menuWidth"] = 300;
     defConfig["min"] = -120.0;
 
@@ -232,6 +237,7 @@ int sdrpp_main(int argc, char* argv[]) {
 
     defConfig["offsetMode"] = (int)0; // Off
     defConfig["offset"] = 0.0;
+    defConfig["renderOnDemand"] = false;
     defConfig["showMenu"] = true;
     defConfig["showWaterfall"] = true;
     defConfig["source"] = "";
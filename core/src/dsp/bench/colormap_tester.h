@@ -0,0 +1,73 @@
+#pragma once
+#include <chrono>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <utils/colormap.h>
+
+namespace dsp::bench {
+    class ColormapTester {
+    public:
+        ColormapTester() {}
+
+        ColormapTester(const uint32_t* palette, int paletteSize) { init(palette, paletteSize); }
+
+        void init(const uint32_t* palette, int paletteSize) {
+            _palette = palette;
+            _paletteSize = paletteSize;
+            colormap::buildLUT(_palette, _paletteSize, lut, COLORMAP_LUT_SIZE);
+            _init = true;
+        }
+
+        // Returns the number of pixels converted per second by the waterfall converter
+        double benchmark(int durationMs, int width, float min = -70.0f, float max = 0.0f) {
+            return run(durationMs, width, min, max, false);
+        }
+
+        // Returns the number of pixels converted per second by the scalar reference
+        double benchmarkReference(int durationMs, int width, float min = -70.0f, float max = 0.0f) {
+            return run(durationMs, width, min, max, true);
+        }
+
+    protected:
+        double run(int durationMs, int width, float min, float max, bool reference) {
+            assert(_init);
+
+            // Generate a line of dB values spanning a bit more than the displayed range
+            float* in = new float[width];
+            uint32_t* out = new uint32_t[width];
+            float span = (max - min) * 1.2f;
+            for (int i = 0; i < width; i++) {
+                in[i] = (min - (span - (max - min)) / 2.0f) + (span * (float)rand() / (float)RAND_MAX);
+            }
+
+            // Run test
+            uint64_t pixCount = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            auto end = start + std::chrono::milliseconds(durationMs);
+            auto now = start;
+            while (now < end) {
+                for (int i = 0; i < 64; i++) {
+                    if (reference) {
+                        colormap::dbToRGBAReference(in, out, width, min, max, _palette, _paletteSize);
+                    }
+                    else {
+                        colormap::dbToRGBA(in, out, width, min, max, lut, COLORMAP_LUT_SIZE);
+                    }
+                }
+                pixCount += 64 * width;
+                now = std::chrono::high_resolution_clock::now();
+            }
+            double elapsed = std::chrono::duration<double>(now - start).count();
+
+            delete[] in;
+            delete[] out;
+            return (double)pixCount / elapsed;
+        }
+
+        bool _init = false;
+        const uint32_t* _palette;
+        int _paletteSize;
+        uint32_t lut[COLORMAP_LUT_SIZE];
+    };
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <chrono>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "../convert/pcm.h"
+
+namespace dsp::bench {
+    class PCMTester {
+    public:
+        enum Conversion {
+            FLOAT_TO_UINT8,
+            UINT8_TO_FLOAT,
+            FLOAT_TO_INT16,
+            INT16_TO_FLOAT,
+            FLOAT_TO_INT24,
+            INT24_TO_FLOAT,
+            FLOAT_TO_INT32,
+            INT32_TO_FLOAT
+        };
+
+        PCMTester() {}
+
+        // Returns the number of samples converted per second by the shared converter
+        double benchmark(Conversion conv, int durationMs, int count = 8192) {
+            return run(conv, durationMs, count, false);
+        }
+
+        /**
+         * Returns the number of samples converted per second by the scalar reference.
+         * Conversions without a reference run the shared converter.
+         */
+        double benchmarkReference(Conversion conv, int durationMs, int count = 8192) {
+            return run(conv, durationMs, count, true);
+        }
+
+        /**
+         * Returns the largest difference between the shared converter and the scalar reference,
+         * in steps of the integer format. Conversions without a reference return 0.
+         */
+        int maxError(Conversion conv, int count = 8192) {
+            // The 8 bit reference doesn't clip, only give it samples in range
+            float range = (conv == FLOAT_TO_UINT8) ? 1.0f : 1.1f;
+            float* flt = new float[count];
+            float* fltRef = new float[count];
+            uint8_t* raw = new uint8_t[count * sizeof(int32_t)];
+            uint8_t* rawRef = new uint8_t[count * sizeof(int32_t)];
+            for (int i = 0; i < count; i++) {
+                flt[i] = (2.0f * range * (float)rand() / (float)RAND_MAX) - range;
+                fltRef[i] = flt[i];
+            }
+            for (int i = 0; i < count * (int)sizeof(int32_t); i++) {
+                raw[i] = rand();
+                rawRef[i] = raw[i];
+            }
+
+            convertBlock(conv, flt, raw, count, false);
+            convertBlock(conv, fltRef, rawRef, count, true);
+
+            int64_t err = 0;
+            for (int i = 0; i < count; i++) {
+                int64_t diff = 0;
+                switch (conv) {
+                case FLOAT_TO_UINT8:
+                    diff = (int64_t)raw[i] - rawRef[i];
+                    break;
+                case UINT8_TO_FLOAT:
+                    diff = llrintf((flt[i] - fltRef[i]) * convert::pcm::UINT8_SCALE);
+                    break;
+                case FLOAT_TO_INT24:
+                    diff = (int64_t)readInt24(&raw[i * 3]) - readInt24(&rawRef[i * 3]);
+                    break;
+                case INT24_TO_FLOAT:
+                    diff = llrintf((flt[i] - fltRef[i]) * convert::pcm::INT24_SCALE);
+                    break;
+                default:
+                    break;
+                }
+                diff = (diff < 0) ? -diff : diff;
+                err = (diff > err) ? diff : err;
+            }
+
+            delete[] flt;
+            delete[] fltRef;
+            delete[] raw;
+            delete[] rawRef;
+            return (int)err;
+        }
+
+        // Whether the shared converter matches the scalar reference within one step
+        bool check(Conversion conv, int count = 8192) {
+            return maxError(conv, count) <= 1;
+        }
+
+    protected:
+        static int32_t readInt24(const uint8_t* in) {
+            return (int32_t)(((uint32_t)in[0] << 8) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 24)) >> 8;
+        }
+
+        double run(Conversion conv, int durationMs, int count, bool reference) {
+            // Random samples slightly beyond full scale, and enough room for any integer format
+            float* flt = new float[count];
+            uint8_t* raw = new uint8_t[count * sizeof(int32_t)];
+            for (int i = 0; i < count; i++) {
+                flt[i] = (2.2f * (float)rand() / (float)RAND_MAX) - 1.1f;
+            }
+            for (int i = 0; i < count * (int)sizeof(int32_t); i++) {
+                raw[i] = rand();
+            }
+
+            // Run test, the buffers are passed through volatile pointers so that repeated conversions aren't optimized out
+            float* volatile fltPtr = flt;
+            uint8_t* volatile rawPtr = raw;
+            uint64_t sampCount = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            auto end = start + std::chrono::milliseconds(durationMs);
+            auto now = start;
+            while (now < end) {
+                for (int i = 0; i < 64; i++) {
+                    convertBlock(conv, fltPtr, rawPtr, count, reference);
+                }
+                sampCount += 64 * count;
+                now = std::chrono::high_resolution_clock::now();
+            }
+            double elapsed = std::chrono::duration<double>(now - start).count();
+
+            delete[] flt;
+            delete[] raw;
+            return (double)sampCount / elapsed;
+        }
+
+        void convertBlock(Conversion conv, float* flt, uint8_t* raw, int count, bool reference) {
+            switch (conv) {
+            case FLOAT_TO_UINT8:
+                if (reference) { convert::pcm::floatToUInt8Reference(flt, raw, count); }
+                else { convert::pcm::floatToUInt8(flt, raw, count); }
+                break;
+            case UINT8_TO_FLOAT:
+                if (reference) { convert::pcm::uint8ToFloatReference(raw, flt, count); }
+                else { convert::pcm::uint8ToFloat(raw, flt, count); }
+                break;
+            case FLOAT_TO_INT16:
+                convert::pcm::floatToInt16(flt, (int16_t*)raw, count);
+                break;
+            case INT16_TO_FLOAT:
+                convert::pcm::int16ToFloat((int16_t*)raw, flt, count);
+                break;
+            case FLOAT_TO_INT24:
+                if (reference) { convert::pcm::floatToInt24Reference(flt, raw, count); }
+                else { convert::pcm::floatToInt24(flt, raw, count); }
+                break;
+            case INT24_TO_FLOAT:
+                if (reference) { convert::pcm::int24ToFloatReference(raw, flt, count); }
+                else { convert::pcm::int24ToFloat(raw, flt, count); }
+                break;
+            case FLOAT_TO_INT32:
+                convert::pcm::floatToInt32(flt, (int32_t*)raw, count);
+                break;
+            case INT32_TO_FLOAT:
+                convert::pcm::int32ToFloat((int32_t*)raw, flt, count);
+                break;
+            }
+        }
+    };
+}
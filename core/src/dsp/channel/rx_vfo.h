@@ -32,6 +32,10 @@ namespace dsp::channel {
             base_type::init(in);
         }
 
+        inline double getOutSamplerate() { return _outSamplerate; }
+        inline double getBandwidth() { return _bandwidth; }
+        inline double getOffset() { return _offset; }
+
         void setInSamplerate(double inSamplerate) {
             assert(base_type::_block_init);
             std::lock_guard<std::recursive_mutex> lck(base_type::ctrlMtx);
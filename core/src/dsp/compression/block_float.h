@@ -0,0 +1,112 @@
+#pragma once
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <volk/volk.h>
+
+// Number of values (I and Q counted separately) sharing an exponent
+#define BFP_BLOCK_SIZE  64
+
+namespace dsp::compression::bfp {
+    // Each block is a signed exponent byte followed by the packed mantissas
+    inline int blockBytes(int bits) {
+        return 1 + ((BFP_BLOCK_SIZE * bits) / 8);
+    }
+
+    inline int encodedSize(int count, int bits) {
+        return ((count + BFP_BLOCK_SIZE - 1) / BFP_BLOCK_SIZE) * blockBytes(bits);
+    }
+
+    inline void pack(const int8_t* in, uint8_t* out, int bits) {
+        if (bits == 8) {
+            memcpy(out, in, BFP_BLOCK_SIZE);
+        }
+        else if (bits == 6) {
+            for (int i = 0; i < BFP_BLOCK_SIZE / 4; i++) {
+                const int8_t* v = &in[i * 4];
+                uint32_t word = (uint32_t)(v[0] & 0x3F) | ((uint32_t)(v[1] & 0x3F) << 6) | ((uint32_t)(v[2] & 0x3F) << 12) | ((uint32_t)(v[3] & 0x3F) << 18);
+                out[i * 3] = word;
+                out[i * 3 + 1] = word >> 8;
+                out[i * 3 + 2] = word >> 16;
+            }
+        }
+        else if (bits == 4) {
+            for (int i = 0; i < BFP_BLOCK_SIZE / 2; i++) {
+                out[i] = (uint8_t)(in[i * 2] & 0x0F) | (uint8_t)(in[i * 2 + 1] << 4);
+            }
+        }
+    }
+
+    inline void unpack(const uint8_t* in, int8_t* out, int bits) {
+        // Shifting left then arithmetic shifting right sign-extends the mantissas
+        if (bits == 8) {
+            memcpy(out, in, BFP_BLOCK_SIZE);
+        }
+        else if (bits == 6) {
+            for (int i = 0; i < BFP_BLOCK_SIZE / 4; i++) {
+                uint32_t word = (uint32_t)in[i * 3] | ((uint32_t)in[i * 3 + 1] << 8) | ((uint32_t)in[i * 3 + 2] << 16);
+                out[i * 4] = (int8_t)(word << 2) >> 2;
+                out[i * 4 + 1] = (int8_t)((word >> 6) << 2) >> 2;
+                out[i * 4 + 2] = (int8_t)((word >> 12) << 2) >> 2;
+                out[i * 4 + 3] = (int8_t)((word >> 18) << 2) >> 2;
+            }
+        }
+        else if (bits == 4) {
+            for (int i = 0; i < BFP_BLOCK_SIZE / 2; i++) {
+                out[i * 2] = (int8_t)(in[i] << 4) >> 4;
+                out[i * 2 + 1] = (int8_t)in[i] >> 4;
+            }
+        }
+    }
+
+    /**
+     * Encode count floats into blocks of BFP_BLOCK_SIZE values sharing an exponent.
+     * Unlike a single scale for the whole buffer, one strong impulse only costs resolution
+     * within its own block. Returns the number of bytes written.
+     */
+    inline int encode(const float* in, int count, int bits, uint8_t* out) {
+        int8_t mant[BFP_BLOCK_SIZE];
+        int bbytes = blockBytes(bits);
+        int maxMant = (1 << (bits - 1)) - 1;
+        int blocks = (count + BFP_BLOCK_SIZE - 1) / BFP_BLOCK_SIZE;
+        for (int b = 0; b < blocks; b++) {
+            const float* src = &in[b * BFP_BLOCK_SIZE];
+            uint8_t* blk = &out[b * bbytes];
+            int n = std::min<int>(count - (b * BFP_BLOCK_SIZE), BFP_BLOCK_SIZE);
+
+            // Find the block exponent from the largest magnitude
+            float maxVal = 0.0f;
+            for (int i = 0; i < n; i++) {
+                maxVal = std::max<float>(maxVal, fabsf(src[i]));
+            }
+            int exp;
+            frexpf(maxVal, &exp);
+            exp = std::clamp<int>(exp, -100, 127);
+            blk[0] = (uint8_t)(int8_t)exp;
+
+            // Scale, round and saturate to the mantissa width
+            volk_32f_s32f_convert_8i(mant, src, ldexpf(1.0f, bits - 1 - exp), n);
+            for (int i = 0; i < n; i++) {
+                mant[i] = std::clamp<int8_t>(mant[i], (int8_t)-maxMant, (int8_t)maxMant);
+            }
+            for (int i = n; i < BFP_BLOCK_SIZE; i++) { mant[i] = 0; }
+
+            pack(mant, &blk[1], bits);
+        }
+        return blocks * bbytes;
+    }
+
+    inline void decode(const uint8_t* in, int count, int bits, float* out) {
+        int8_t mant[BFP_BLOCK_SIZE];
+        int bbytes = blockBytes(bits);
+        int blocks = (count + BFP_BLOCK_SIZE - 1) / BFP_BLOCK_SIZE;
+        for (int b = 0; b < blocks; b++) {
+            const uint8_t* blk = &in[b * bbytes];
+            int n = std::min<int>(count - (b * BFP_BLOCK_SIZE), BFP_BLOCK_SIZE);
+            int exp = (int8_t)blk[0];
+            unpack(&blk[1], mant, bits);
+            volk_8i_s32f_convert_32f(&out[b * BFP_BLOCK_SIZE], mant, ldexpf(1.0f, bits - 1 - exp), n);
+        }
+    }
+}
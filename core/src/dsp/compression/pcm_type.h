@@ -4,6 +4,19 @@ namespace dsp::compression {
     enum PCMType {
         PCM_TYPE_I8,
         PCM_TYPE_I16,
-        PCM_TYPE_F32
+        PCM_TYPE_F32,
+        PCM_TYPE_BFP8,
+        PCM_TYPE_BFP6,
+        PCM_TYPE_BFP4
     };
-}
\ No newline at end of file
+
+    // Mantissa width of the block floating point types, 0 for the others
+    inline int bfpBits(PCMType type) {
+        switch (type) {
+        case PCM_TYPE_BFP8: return 8;
+        case PCM_TYPE_BFP6: return 6;
+        case PCM_TYPE_BFP4: return 4;
+        default:            return 0;
+        }
+    }
+}
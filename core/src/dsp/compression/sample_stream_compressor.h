@@ -1,6 +1,7 @@
 #pragma once
 #include "../processor.h"
 #include "pcm_type.h"
+#include "block_float.h"
 
 namespace dsp::compression {
     class SampleStreamCompressor : public Processor<complex_t, uint8_t> {
@@ -44,6 +45,13 @@ namespace dsp::compression {
                 return 8 + (count * sizeof(complex_t));
             }
 
+            // Block floating point types carry their own exponents, the scaler holds the sample count instead
+            int bits = bfpBits(pcmType);
+            if (bits) {
+                *(uint32_t*)scaler = count;
+                return 8 + bfp::encode((float*)in, count * 2, bits, (uint8_t*)dataBuf);
+            }
+
             // Find maximum value
             uint32_t maxIdx;
             volk_32f_index_max_32u(&maxIdx, (float*)in, count * 2);
@@ -1,6 +1,7 @@
 #pragma once
 #include "../processor.h"
 #include "pcm_type.h"
+#include "block_float.h"
 
 namespace dsp::compression {
     class SampleStreamDecompressor : public Processor<uint8_t, complex_t> {
@@ -29,6 +30,12 @@ namespace dsp::compression {
                 volk_8i_s32f_convert_32f((float*)out, (int8_t*)dataBuf, 128.0f / scaler, outCount * 2);
                 return outCount;
             }
+            else if (int bits = bfpBits((PCMType)sampleType)) {
+                int outCount = *(uint32_t*)&in[4];
+                if (outCount > STREAM_BUFFER_SIZE || bfp::encodedSize(outCount * 2, bits) > count - 8) { return 0; }
+                bfp::decode((const uint8_t*)dataBuf, outCount * 2, bits, (float*)out);
+                return outCount;
+            }
             
             return 0;
         }
@@ -0,0 +1,189 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <volk/volk.h>
+
+// Samples converted per block by the conversions going through a buffer on the stack
+#define PCM_BLOCK_SIZE 1024
+
+/**
+ * Conversions between float samples and the integer formats of recordings and network streams.
+ * Counts are in scalar samples, twice the number of complex or stereo samples. Integer samples
+ * use the full scale of their format, out of range floats are clipped. The formats volk knows go
+ * through it, the others use branchless loops over small blocks so that they get vectorized too.
+ */
+namespace dsp::convert::pcm {
+    const float UINT8_SCALE = 127.0f;
+    const float INT8_SCALE = 127.0f;
+    const float INT16_SCALE = 32767.0f;
+    const float INT24_SCALE = 8388607.0f;
+    const float INT32_SCALE = 2147483647.0f;
+
+    /**
+     * Convert to unsigned 8 bit samples centered on 128.
+     * Done as signed samples with the sign bit flipped, which gives the saturation of the signed
+     * volk kernel for free. Flipping the bit is a plain byte loop that gets vectorized.
+     */
+    inline void floatToUInt8(const float* in, uint8_t* out, int count) {
+        for (int i = 0; i < count; i += PCM_BLOCK_SIZE) {
+            int n = (count - i) < PCM_BLOCK_SIZE ? (count - i) : PCM_BLOCK_SIZE;
+            uint8_t* dst = &out[i];
+            volk_32f_s32f_convert_8i((int8_t*)dst, &in[i], UINT8_SCALE, n);
+            for (int j = 0; j < n; j++) {
+                dst[j] ^= 0x80;
+            }
+        }
+    }
+
+    // Unsigned samples are centered on 128 for WAV files, some hardware uses a different center
+    inline void uint8ToFloat(const uint8_t* in, float* out, int count, float center = 128.0f, float scale = UINT8_SCALE) {
+        float gain = 1.0f / scale;
+        for (int i = 0; i < count; i++) {
+            out[i] = ((float)in[i] - center) * gain;
+        }
+    }
+
+    inline void floatToInt8(const float* in, int8_t* out, int count, float scale = INT8_SCALE) {
+        volk_32f_s32f_convert_8i(out, in, scale, count);
+    }
+
+    inline void int8ToFloat(const int8_t* in, float* out, int count, float scale = INT8_SCALE) {
+        volk_8i_s32f_convert_32f(out, in, scale, count);
+    }
+
+    inline void floatToInt16(const float* in, int16_t* out, int count, float scale = INT16_SCALE) {
+        volk_32f_s32f_convert_16i(out, in, scale, count);
+    }
+
+    inline void int16ToFloat(const int16_t* in, float* out, int count, float scale = INT16_SCALE) {
+        volk_16i_s32f_convert_32f(out, in, scale, count);
+    }
+
+    /**
+     * Convert to packed little endian 24 bit samples, 3 bytes each.
+     * Groups of 4 samples are packed into 3 words instead of byte by byte, which the compiler
+     * can vectorize with shuffles. Assumes a little endian host like the rest of the file IO.
+     */
+    inline void floatToInt24(const float* in, uint8_t* out, int count) {
+        int32_t tmp[PCM_BLOCK_SIZE];
+        uint32_t words[(PCM_BLOCK_SIZE / 4) * 3];
+        for (int i = 0; i < count; i += PCM_BLOCK_SIZE) {
+            int n = (count - i) < PCM_BLOCK_SIZE ? (count - i) : PCM_BLOCK_SIZE;
+            const float* src = &in[i];
+            uint8_t* dst = &out[i * 3];
+
+            // Scale and clip, rounded by truncating the sample offset to be positive
+            for (int j = 0; j < n; j++) {
+                float v = (src[j] * INT24_SCALE) + 8388608.5f;
+                v = (v > 1.0f) ? v : 1.0f;
+                v = (v < 16777215.0f) ? v : 16777215.0f;
+                tmp[j] = (int32_t)v - 8388608;
+            }
+
+            // Pack
+            int groups = n / 4;
+            for (int j = 0; j < groups; j++) {
+                const int32_t* g = &tmp[j * 4];
+                words[(j * 3)] = ((uint32_t)g[0] & 0xFFFFFF) | ((uint32_t)g[1] << 24);
+                words[(j * 3) + 1] = (((uint32_t)g[1] >> 8) & 0xFFFF) | ((uint32_t)g[2] << 16);
+                words[(j * 3) + 2] = (((uint32_t)g[2] >> 16) & 0xFF) | ((uint32_t)g[3] << 8);
+            }
+            memcpy(dst, words, groups * 12);
+            for (int j = groups * 4; j < n; j++) {
+                dst[(j * 3)] = tmp[j];
+                dst[(j * 3) + 1] = tmp[j] >> 8;
+                dst[(j * 3) + 2] = tmp[j] >> 16;
+            }
+        }
+    }
+
+    inline void int24ToFloat(const uint8_t* in, float* out, int count) {
+        int32_t tmp[PCM_BLOCK_SIZE];
+        uint32_t words[(PCM_BLOCK_SIZE / 4) * 3];
+        for (int i = 0; i < count; i += PCM_BLOCK_SIZE) {
+            int n = (count - i) < PCM_BLOCK_SIZE ? (count - i) : PCM_BLOCK_SIZE;
+            const uint8_t* src = &in[i * 3];
+
+            // Unpack, each sample is moved to the top bytes and shifted back down to extend the sign
+            int groups = n / 4;
+            memcpy(words, src, groups * 12);
+            for (int j = 0; j < groups; j++) {
+                const uint32_t* g = &words[j * 3];
+                tmp[(j * 4)] = (int32_t)(g[0] << 8) >> 8;
+                tmp[(j * 4) + 1] = (int32_t)(((g[0] >> 16) & 0xFF00) | (g[1] << 16)) >> 8;
+                tmp[(j * 4) + 2] = (int32_t)(((g[1] >> 8) & 0xFFFF00) | (g[2] << 24)) >> 8;
+                tmp[(j * 4) + 3] = (int32_t)g[2] >> 8;
+            }
+            for (int j = groups * 4; j < n; j++) {
+                uint32_t v = ((uint32_t)src[(j * 3)] << 8) | ((uint32_t)src[(j * 3) + 1] << 16) | ((uint32_t)src[(j * 3) + 2] << 24);
+                tmp[j] = (int32_t)v >> 8;
+            }
+
+            volk_32i_s32f_convert_32f(&out[i], tmp, INT24_SCALE, n);
+        }
+    }
+
+    inline void floatToInt32(const float* in, int32_t* out, int count) {
+        volk_32f_s32f_convert_32i(out, in, INT32_SCALE, count);
+    }
+
+    inline void int32ToFloat(const int32_t* in, float* out, int count) {
+        volk_32i_s32f_convert_32f(out, in, INT32_SCALE, count);
+    }
+
+    // Largest magnitude of the samples, to tell silence apart
+    inline float peak(const float* in, int count) {
+        // Separate maximums for each lane, a single one would be a dependency chain
+        float lanes[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+            for (int j = 0; j < 8; j++) {
+                float v = fabsf(in[i + j]);
+                lanes[j] = (v > lanes[j]) ? v : lanes[j];
+            }
+        }
+        float max = 0.0f;
+        for (; i < count; i++) {
+            float v = fabsf(in[i]);
+            max = (v > max) ? v : max;
+        }
+        for (int j = 0; j < 8; j++) {
+            max = (lanes[j] > max) ? lanes[j] : max;
+        }
+        return max;
+    }
+
+    /**
+     * Scalar references of the conversions that used to be done one sample at a time.
+     * Only kept for benchmarking and for checking the shared conversions against them.
+     */
+    inline void floatToUInt8Reference(const float* in, uint8_t* out, int count) {
+        for (int i = 0; i < count; i++) {
+            out[i] = (in[i] * 127.0f) + 128.0f;
+        }
+    }
+
+    inline void floatToInt24Reference(const float* in, uint8_t* out, int count) {
+        for (int i = 0; i < count; i++) {
+            float v = (in[i] < -1.0f) ? -1.0f : ((in[i] > 1.0f) ? 1.0f : in[i]);
+            int32_t s = lrintf(v * INT24_SCALE);
+            out[(i * 3)] = s;
+            out[(i * 3) + 1] = s >> 8;
+            out[(i * 3) + 2] = s >> 16;
+        }
+    }
+
+    inline void int24ToFloatReference(const uint8_t* in, float* out, int count) {
+        for (int i = 0; i < count; i++) {
+            int32_t s = (int32_t)(((uint32_t)in[(i * 3)] << 8) | ((uint32_t)in[(i * 3) + 1] << 16) | ((uint32_t)in[(i * 3) + 2] << 24)) >> 8;
+            out[i] = (float)s / INT24_SCALE;
+        }
+    }
+
+    inline void uint8ToFloatReference(const uint8_t* in, float* out, int count, float center = 128.0f, float scale = UINT8_SCALE) {
+        for (int i = 0; i < count; i++) {
+            out[i] = ((float)in[i] - center) / scale;
+        }
+    }
+}
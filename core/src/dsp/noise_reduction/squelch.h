@@ -1,6 +1,10 @@
 #pragma once
+#include <atomic>
 #include "../processor.h"
 
+// Samples measured at once, the level is averaged over whole blocks in chunks of this size
+#define SQUELCH_MEASURE_CHUNK   4096
+
 // TODO: Rewrite better!!!!!
 namespace dsp::noise_reduction {
     class Squelch : public Processor<complex_t, complex_t> {
@@ -19,7 +23,7 @@ namespace dsp::noise_reduction {
         void init(stream<complex_t>* in, double level) {
             _level = level;
 
-            normBuffer = buffer::alloc<float>(STREAM_BUFFER_SIZE);
+            normBuffer = buffer::alloc<float>(SQUELCH_MEASURE_CHUNK);
 
             base_type::init(in);
         }
@@ -30,13 +34,40 @@ namespace dsp::noise_reduction {
             _level = level;
         }
 
-        inline int process(int count, const complex_t* in, complex_t* out) {
-            float sum;
-            volk_32fc_magnitude_32f(normBuffer, (lv_32fc_t*)in, count);
-            volk_32f_accumulator_s32f(&sum, normBuffer, count);
+        // State decided by the last block, can be polled from another thread
+        bool isOpen() {
+            return open;
+        }
+
+        // Same state, for polling without going through the owner of the block
+        const std::atomic<bool>* getState() {
+            return &open;
+        }
+
+        // Override the state while the block isn't running, e.g. open when bypassed
+        void setState(bool state) {
+            open = state;
+        }
+
+        // Compare the average magnitude of a block to the level without touching the samples
+        inline bool detect(const complex_t* in, int count) {
+            if (count <= 0) { return open; }
+            float sum = 0.0f;
+            for (int i = 0; i < count; i += SQUELCH_MEASURE_CHUNK) {
+                int len = std::min<int>(count - i, SQUELCH_MEASURE_CHUNK);
+                float part;
+                volk_32fc_magnitude_32f(normBuffer, (lv_32fc_t*)&in[i], len);
+                volk_32f_accumulator_s32f(&part, normBuffer, len);
+                sum += part;
+            }
             sum /= (float)count;
 
-            if (10.0f * log10f(sum) >= _level) {
+            open = (10.0f * log10f(sum) >= _level);
+            return open;
+        }
+
+        inline int process(int count, const complex_t* in, complex_t* out) {
+            if (detect(in, count)) {
                 memcpy(out, in, count * sizeof(complex_t));
             }
             else {
@@ -60,6 +91,7 @@ namespace dsp::noise_reduction {
     private:
         float* normBuffer;
         float _level = -50.0f;
+        std::atomic<bool> open = false;
                 
     };
 }
\ No newline at end of file
@@ -506,6 +506,7 @@ void MainWindow::draw() {
             ImGui::Text("Framerate: %.1f FPS", ImGui::GetIO().Framerate);
             ImGui::Text("Center Frequency: %.0f Hz", gui::waterfall.getCenterFrequency());
             ImGui::Text("Source name: %s", sourceName.c_str());
+            ImGui::Text("Dropped FFT frames: %llu", (unsigned long long)sigpath::iqFrontEnd.getDroppedFFTFrames());
             ImGui::Checkbox("Show demo window", &demoWindow);
             ImGui::Text("ImGui version: %s", ImGui::GetVersion());
 
@@ -577,7 +578,7 @@ void MainWindow::draw() {
 
         // Handle scrollwheel
         int wheel = ImGui::GetIO().MouseWheel;
-        if (wheel != 0 && (gui::waterfall.mouseInFFT || gui::waterfall.mouseInWaterfall)) {
+        if (wheel != 0 && (gui::waterfall.mouseInFFT || (gui::waterfall.mouseInWaterfall && !gui::waterfall.getScrollback()))) {
             double nfreq;
             if (vfo != NULL) {
                 // Select factor depending on modifier keys
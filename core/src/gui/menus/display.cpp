@@ -8,7 +8,10 @@
 #include <signal_path/signal_path.h>
 #include <gui/style.h>
 #include <utils/optionlist.h>
+#include <gui/widgets/folder_select.h>
+#include <backend.h>
 #include <algorithm>
+#include <time.h>
 
 namespace displaymenu {
     bool showWaterfall;
@@ -28,6 +31,14 @@ namespace displaymenu {
     int fftSmoothingSpeed = 100;
     bool snrSmoothing = false;
     int snrSmoothingSpeed = 20;
+    bool spectrogramHistory = false;
+    bool scrollback = false;
+    FolderSelect* historyFolderSelect = NULL;
+    char jumpTime[64] = "";
+    int historyMaxSize = 2048;
+    int historyMaxAge = 0;
+    bool renderOnDemand = false;
+    int maxFrameRate = 60;
 
     OptionList<int, int> fftSizes;
     OptionList<float, float> uiScales;
@@ -44,6 +55,10 @@ namespace displaymenu {
         gui::waterfall.setSNRSmoothingSpeed(std::min<float>((float)snrSmoothingSpeed / (float)(fftRate * 10.0f), 1.0f));
     }
 
+    void updateHistoryRetention() {
+        gui::waterfall.setHistoryRetention((int64_t)historyMaxSize * 1024 * 1024, (int64_t)historyMaxAge * 3600 * 1000);
+    }
+
     void init() {
         // Define FFT sizes
         fftSizes.define(524288, "524288", 524288);
@@ -93,6 +108,9 @@ namespace displaymenu {
 
         gui::menu.locked = core::configManager.conf["lockMenuOrder"];
 
+        renderOnDemand = core::configManager.conf["renderOnDemand"];
+        maxFrameRate = core::configManager.conf["maxFrameRate"];
+
         fftHold = core::configManager.conf["fftHold"];
         fftHoldSpeed = core::configManager.conf["fftHoldSpeed"];
         gui::waterfall.setFFTHold(fftHold);
@@ -104,6 +122,15 @@ namespace displaymenu {
         gui::waterfall.setSNRSmoothing(snrSmoothing);
         updateFFTSpeeds();
 
+        historyFolderSelect = new FolderSelect(core::configManager.conf["spectrogramHistoryPath"]);
+        spectrogramHistory = core::configManager.conf["spectrogramHistory"];
+        historyMaxSize = core::configManager.conf["spectrogramHistoryMaxSize"];
+        historyMaxAge = core::configManager.conf["spectrogramHistoryMaxAge"];
+        updateHistoryRetention();
+        if (spectrogramHistory && historyFolderSelect->pathIsValid()) {
+            spectrogramHistory = gui::waterfall.enableHistory(historyFolderSelect->expandString(historyFolderSelect->path));
+        }
+
         // Define and load UI scales
         uiScales.define(1.0f, "100%", 1.0f);
         uiScales.define(2.0f, "200%", 2.0f);
@@ -145,6 +172,24 @@ namespace displaymenu {
             core::configManager.release(true);
         }
 
+        if (ImGui::Checkbox("Render on Demand##_sdrpp", &renderOnDemand)) {
+            backend::setRenderOnDemand(renderOnDemand);
+            core::configManager.acquire();
+            core::configManager.conf["renderOnDemand"] = renderOnDemand;
+            core::configManager.release(true);
+        }
+        if (renderOnDemand) {
+            ImGui::LeftLabel("Max Framerate");
+            ImGui::FillWidth();
+            if (ImGui::InputInt("##sdrpp_max_frame_rate", &maxFrameRate, 1, 10)) {
+                maxFrameRate = std::max<int>(1, maxFrameRate);
+                backend::setMaxFrameRate(maxFrameRate);
+                core::configManager.acquire();
+                core::configManager.conf["maxFrameRate"] = maxFrameRate;
+                core::configManager.release(true);
+            }
+        }
+
         if (ImGui::Checkbox("FFT Hold##_sdrpp", &fftHold)) {
             gui::waterfall.setFFTHold(fftHold);
             core::configManager.acquire();
@@ -192,6 +237,67 @@ namespace displaymenu {
             core::configManager.release(true);
         }
 
+        if (ImGui::Checkbox("Spectrogram History##_sdrpp", &spectrogramHistory)) {
+            if (spectrogramHistory) {
+                spectrogramHistory = gui::waterfall.enableHistory(historyFolderSelect->expandString(historyFolderSelect->path));
+            }
+            else {
+                gui::waterfall.disableHistory();
+            }
+            core::configManager.acquire();
+            core::configManager.conf["spectrogramHistory"] = spectrogramHistory;
+            core::configManager.release(true);
+        }
+        if (historyFolderSelect->render("##_sdrpp_history_path")) {
+            if (historyFolderSelect->pathIsValid()) {
+                if (spectrogramHistory) {
+                    spectrogramHistory = gui::waterfall.enableHistory(historyFolderSelect->expandString(historyFolderSelect->path));
+                }
+                core::configManager.acquire();
+                core::configManager.conf["spectrogramHistoryPath"] = historyFolderSelect->path;
+                core::configManager.conf["spectrogramHistory"] = spectrogramHistory;
+                core::configManager.release(true);
+            }
+        }
+        if (spectrogramHistory) {
+            ImGui::LeftLabel("Max Size (MB)");
+            ImGui::FillWidth();
+            if (ImGui::InputInt("##sdrpp_history_max_size", &historyMaxSize, 256, 1024)) {
+                historyMaxSize = std::max<int>(0, historyMaxSize);
+                updateHistoryRetention();
+                core::configManager.acquire();
+                core::configManager.conf["spectrogramHistoryMaxSize"] = historyMaxSize;
+                core::configManager.release(true);
+            }
+            ImGui::LeftLabel("Max Age (hours)");
+            ImGui::FillWidth();
+            if (ImGui::InputInt("##sdrpp_history_max_age", &historyMaxAge, 1, 24)) {
+                historyMaxAge = std::max<int>(0, historyMaxAge);
+                updateHistoryRetention();
+                core::configManager.acquire();
+                core::configManager.conf["spectrogramHistoryMaxAge"] = historyMaxAge;
+                core::configManager.release(true);
+            }
+
+            scrollback = gui::waterfall.getScrollback();
+            if (ImGui::Checkbox("Scrollback##_sdrpp", &scrollback)) {
+                gui::waterfall.setScrollback(scrollback);
+            }
+            ImGui::LeftLabel("Jump to");
+            ImGui::SetNextItemWidth(menuWidth - ImGui::GetCursorPosX() - ImGui::CalcTextSize("Go").x - 20.0f);
+            ImGui::InputTextWithHint("##sdrpp_history_jump", "YYYY-MM-DD HH:MM:SS", jumpTime, sizeof(jumpTime));
+            ImGui::SameLine();
+            if (ImGui::Button("Go##sdrpp_history_jump")) {
+                tm ltm = {};
+                if (sscanf(jumpTime, "%d-%d-%d %d:%d:%d", &ltm.tm_year, &ltm.tm_mon, &ltm.tm_mday, &ltm.tm_hour, &ltm.tm_min, &ltm.tm_sec) == 6) {
+                    ltm.tm_year -= 1900;
+                    ltm.tm_mon -= 1;
+                    ltm.tm_isdst = -1;
+                    gui::waterfall.scrollbackTo((int64_t)mktime(&ltm) * 1000);
+                }
+            }
+        }
+
         ImGui::LeftLabel("High-DPI Scaling");
         ImGui::FillWidth();
         if (ImGui::Combo("##sdrpp_ui_scale", &uiScaleId, uiScales.txt)) {
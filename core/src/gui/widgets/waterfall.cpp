@@ -3,10 +3,13 @@
 #include <imgui_internal.h>
 #include <imutils.h>
 #include <algorithm>
+#include <chrono>
+#include <time.h>
 #include <volk/volk.h>
 #include <utils/flog.h>
 #include <gui/gui.h>
 #include <gui/style.h>
+#include <backend.h>
 
 float DEFAULT_COLOR_MAP[][3] = {
     { 0x00, 0x00, 0x20 },
@@ -89,6 +92,17 @@ inline void doZoom(int offset, int width, int inSize, int outSize, float* in, fl
     }
 }
 
+// Scale, clamp and round an FFT line to screen coordinates. Kept in single precision,
+// branchless and rounding through an integer conversion so that the compiler can vectorize it
+inline void scaleTrace(const float* in, ImVec2* out, int count, float xStart, float yBase, float scale, float yMin, float yMax) {
+    for (int i = 0; i < count; i++) {
+        float y = yBase - (in[i] * scale);
+        y = std::min<float>(std::max<float>(y, yMin), yMax);
+        out[i].x = xStart + (float)i;
+        out[i].y = (float)(int)(y + 0.5f);
+    }
+}
+
 namespace ImGui {
     WaterFall::WaterFall() {
         fftMin = -70.0;
@@ -105,6 +119,7 @@ namespace ImGui {
         lastWidgetSize.y = 0;
         latestFFT = new float[dataWidth];
         latestFFTHold = new float[dataWidth];
+        tracePoints = new ImVec2[dataWidth];
         waterfallFb = new uint32_t[1];
 
         viewBandwidth = 1.0;
@@ -160,29 +175,31 @@ namespace ImGui {
         }
 
         // Data
-        if (latestFFT != NULL && fftLines != 0) {
+        float yBase = fftAreaMax.y + (fftMin * scaleFactor);
+        if (latestFFT != NULL && fftLines != 0 && dataWidth > 1) {
+            scaleTrace(latestFFT, tracePoints, dataWidth, fftAreaMin.x, yBase, scaleFactor, fftAreaMin.y + 1, fftAreaMax.y);
+
+            // Shadow, one rectangle per column emitted as a single vertex batch
+            window->DrawList->PrimReserve((dataWidth - 1) * 6, (dataWidth - 1) * 4);
             for (int i = 1; i < dataWidth; i++) {
-                double aPos = fftAreaMax.y - ((latestFFT[i - 1] - fftMin) * scaleFactor);
-                double bPos = fftAreaMax.y - ((latestFFT[i] - fftMin) * scaleFactor);
-                aPos = std::clamp<double>(aPos, fftAreaMin.y + 1, fftAreaMax.y);
-                bPos = std::clamp<double>(bPos, fftAreaMin.y + 1, fftAreaMax.y);
-                window->DrawList->AddLine(ImVec2(fftAreaMin.x + i - 1, roundf(aPos)),
-                                          ImVec2(fftAreaMin.x + i, roundf(bPos)), trace, 1.0);
-                window->DrawList->AddLine(ImVec2(fftAreaMin.x + i, roundf(bPos)),
-                                          ImVec2(fftAreaMin.x + i, fftAreaMax.y), shadow, 1.0);
+                window->DrawList->PrimRect(tracePoints[i], ImVec2(tracePoints[i].x + 1.0f, fftAreaMax.y), shadow);
             }
+
+            // Trace, offset by half a pixel like AddLine does
+            for (int i = 0; i < dataWidth; i++) {
+                tracePoints[i].x += 0.5f;
+                tracePoints[i].y += 0.5f;
+            }
+            window->DrawList->AddPolyline(tracePoints, dataWidth, trace, 0, 1.0f);
         }
 
         // Hold
-        if (fftHold && latestFFT != NULL && latestFFTHold != NULL && fftLines != 0) {
-            for (int i = 1; i < dataWidth; i++) {
-                double aPos = fftAreaMax.y - ((latestFFTHold[i - 1] - fftMin) * scaleFactor);
-                double bPos = fftAreaMax.y - ((latestFFTHold[i] - fftMin) * scaleFactor);
-                aPos = std::clamp<double>(aPos, fftAreaMin.y + 1, fftAreaMax.y);
-                bPos = std::clamp<double>(bPos, fftAreaMin.y + 1, fftAreaMax.y);
-                window->DrawList->AddLine(ImVec2(fftAreaMin.x + i - 1, roundf(aPos)),
-                                          ImVec2(fftAreaMin.x + i, roundf(bPos)), traceHold, 1.0);
+        if (fftHold && latestFFT != NULL && latestFFTHold != NULL && fftLines != 0 && dataWidth > 1) {
+            scaleTrace(latestFFTHold, tracePoints, dataWidth, fftAreaMin.x + 0.5f, yBase, scaleFactor, fftAreaMin.y + 1, fftAreaMax.y);
+            for (int i = 0; i < dataWidth; i++) {
+                tracePoints[i].y += 0.5f;
             }
+            window->DrawList->AddPolyline(tracePoints, dataWidth, traceHold, 0, 1.0f);
         }
 
         FFTRedrawArgs args;
@@ -214,7 +231,17 @@ namespace ImGui {
             std::lock_guard<std::mutex> lck(texMtx);
             window->DrawList->AddImage((void*)(intptr_t)textureId, wfMin, wfMax);
         }
-        
+
+        // Show the time of the top line when browsing the history
+        if (scrollback) {
+            char buf[64];
+            time_t t = getScrollbackTime() / 1000;
+            tm* ltm = localtime(&t);
+            strftime(buf, sizeof(buf), "History: %Y-%m-%d %H:%M:%S", ltm);
+            ImVec2 txtPos(wfMin.x + (5.0f * style::uiScale), wfMin.y + (5.0f * style::uiScale));
+            window->DrawList->AddText(txtPos, IM_COL32(255, 255, 255, 255), buf);
+        }
+
         ImVec2 mPos = ImGui::GetMousePos();
 
         if (IS_IN_AREA(mPos, wfMin, wfMax) && !gui::mainWindow.lockWaterfallControls && !inputHandled) {
@@ -407,6 +434,12 @@ namespace ImGui {
             return;
         }
 
+        // If browsing the history, the mouse wheel scrolls through it when over the waterfall
+        if (scrollback && mouseWheel != 0 && IS_IN_AREA(mousePos, wfMin, wfMax)) {
+            scrollHistory((int64_t)mouseWheel * (ImGui::IsKeyDown(ImGuiKey_LeftShift) ? 100 : 10));
+            return;
+        }
+
         // If the mouse wheel is moved on the frequency scale
         if (mouseWheel != 0 && mouseInFreq) {
             viewOffset -= (double)mouseWheel * viewBandwidth / 20.0;
@@ -601,23 +634,22 @@ namespace ImGui {
         if (!waterfallVisible || rawFFTs == NULL) {
             return;
         }
+        if (scrollback) {
+            updateWaterfallFbFromHistory();
+            return;
+        }
         double offsetRatio = viewOffset / (wholeBandwidth / 2.0);
         int drawDataSize;
         int drawDataStart;
         // TODO: Maybe put on the stack for faster alloc?
         float* tempData = new float[dataWidth];
-        float pixel;
-        float dataRange = waterfallMax - waterfallMin;
         int count = std::min<float>(waterfallHeight, fftLines);
         if (rawFFTs != NULL && fftLines >= 0) {
             for (int i = 0; i < count; i++) {
                 drawDataSize = (viewBandwidth / wholeBandwidth) * rawFFTSize;
                 drawDataStart = (((double)rawFFTSize / 2.0) * (offsetRatio + 1)) - (drawDataSize / 2);
                 doZoom(drawDataStart, drawDataSize, rawFFTSize, dataWidth, &rawFFTs[((i + currentFFTLine) % waterfallHeight) * rawFFTSize], tempData);
-                for (int j = 0; j < dataWidth; j++) {
-                    pixel = (std::clamp<float>(tempData[j], waterfallMin, waterfallMax) - waterfallMin) / dataRange;
-                    waterfallFb[(i * dataWidth) + j] = waterfallPallet[(int)(pixel * (WATERFALL_RESOLUTION - 1))];
-                }
+                colormap::dbToRGBA(tempData, &waterfallFb[i * dataWidth], dataWidth, waterfallMin, waterfallMax, waterfallLut, COLORMAP_LUT_SIZE);
             }
 
             for (int i = count; i < waterfallHeight; i++) {
@@ -630,6 +662,38 @@ namespace ImGui {
         waterfallUpdate = true;
     }
 
+    void WaterFall::updateWaterfallFbFromHistory() {
+        historyLine.resize(history.getWidth());
+        historyZoom.resize(dataWidth);
+        float* line = historyLine.data();
+        float* tempData = historyZoom.data();
+        spectrogram::LineHeader hdr;
+        for (int i = 0; i < waterfallHeight; i++) {
+            // Past the start of the history or a line without a valid bandwidth, fill with black
+            if (!history.readLine(scrollbackLine - i, line, hdr) || !(hdr.bandwidth > 0.0)) {
+                for (int j = 0; j < dataWidth; j++) {
+                    waterfallFb[(i * dataWidth) + j] = (uint32_t)255 << 24;
+                }
+                continue;
+            }
+
+            // The line may have been recorded at another frequency, map the current view onto it
+            double binWidth = hdr.bandwidth / (double)history.getWidth();
+            int drawDataStart = (lowerFreq - (hdr.centerFreq - (hdr.bandwidth / 2.0))) / binWidth;
+            int drawDataSize = viewBandwidth / binWidth;
+            doZoom(drawDataStart, drawDataSize, history.getWidth(), dataWidth, line, tempData);
+            colormap::dbToRGBA(tempData, &waterfallFb[i * dataWidth], dataWidth, waterfallMin, waterfallMax, waterfallLut, COLORMAP_LUT_SIZE);
+        }
+        waterfallUpdate = true;
+    }
+
+    void WaterFall::scrollHistory(int64_t lines) {
+        std::lock_guard<std::recursive_mutex> lck(buf_mtx);
+        int64_t first = history.getFirstLine();
+        scrollbackLine = std::clamp<int64_t>(scrollbackLine + lines, first, first + std::max<int64_t>(history.getLineCount() - 1, 0));
+        updateWaterfallFb();
+    }
+
     void WaterFall::drawBandPlan() {
         int count = bandplan->bands.size();
         double horizScale = (double)dataWidth / viewBandwidth;
@@ -768,6 +832,12 @@ namespace ImGui {
         }
         latestFFTHold = new float[dataWidth];
 
+        // Reallocate trace vertices
+        if (tracePoints != NULL) {
+            delete[] tracePoints;
+        }
+        tracePoints = new ImVec2[dataWidth];
+
         // Reallocate smoothing buffer
         if (fftSmoothing) {
             if (smoothingBuf) { delete[] smoothingBuf; }
@@ -895,21 +965,25 @@ namespace ImGui {
 
         if (waterfallVisible) {
             doZoom(drawDataStart, drawDataSize, rawFFTSize, dataWidth, &rawFFTs[currentFFTLine * rawFFTSize], latestFFT);
-            memmove(&waterfallFb[dataWidth], waterfallFb, dataWidth * (waterfallHeight - 1) * sizeof(uint32_t));
-            float pixel;
-            float dataRange = waterfallMax - waterfallMin;
-            for (int j = 0; j < dataWidth; j++) {
-                pixel = (std::clamp<float>(latestFFT[j], waterfallMin, waterfallMax) - waterfallMin) / dataRange;
-                int id = (int)(pixel * (WATERFALL_RESOLUTION - 1));
-                waterfallFb[j] = waterfallPallet[id];
+
+            // The framebuffer is frozen while browsing the history
+            if (!scrollback) {
+                memmove(&waterfallFb[dataWidth], waterfallFb, dataWidth * (waterfallHeight - 1) * sizeof(uint32_t));
+                colormap::dbToRGBA(latestFFT, waterfallFb, dataWidth, waterfallMin, waterfallMax, waterfallLut, COLORMAP_LUT_SIZE);
+                waterfallUpdate = true;
             }
-            waterfallUpdate = true;
         }
         else {
             doZoom(drawDataStart, drawDataSize, rawFFTSize, dataWidth, rawFFTs, latestFFT);
             fftLines = 1;
         }
 
+        // Save the raw line to the history
+        if (history.isOpen()) {
+            int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            history.append(now, centerFreq, wholeBandwidth, waterfallVisible ? &rawFFTs[currentFFTLine * rawFFTSize] : rawFFTs, rawFFTSize);
+        }
+
         // Apply smoothing if enabled
         if (fftSmoothing && latestFFT != NULL && smoothingBuf != NULL && fftLines != 0) {
             std::lock_guard<std::mutex> lck2(smoothingBufMtx);
@@ -939,6 +1013,9 @@ namespace ImGui {
         }
 
         buf_mtx.unlock();
+
+        // A new line is available, have the GUI draw it
+        backend::requestRedraw();
     }
 
     void WaterFall::updatePallette(float colors[][3], int colorCount) {
@@ -954,6 +1031,7 @@ namespace ImGui {
             float b = (colors[lowerId][2] * (1.0 - ratio)) + (colors[upperId][2] * (ratio));
             waterfallPallet[i] = ((uint32_t)255 << 24) | ((uint32_t)b << 16) | ((uint32_t)g << 8) | (uint32_t)r;
         }
+        colormap::buildLUT(waterfallPallet, WATERFALL_RESOLUTION, waterfallLut, COLORMAP_LUT_SIZE);
         updateWaterfallFb();
     }
 
@@ -970,6 +1048,7 @@ namespace ImGui {
             float b = (colors[(lowerId * 3) + 2] * (1.0 - ratio)) + (colors[(upperId * 3) + 2] * (ratio));
             waterfallPallet[i] = ((uint32_t)255 << 24) | ((uint32_t)b << 16) | ((uint32_t)g << 8) | (uint32_t)r;
         }
+        colormap::buildLUT(waterfallPallet, WATERFALL_RESOLUTION, waterfallLut, COLORMAP_LUT_SIZE);
         updateWaterfallFb();
     }
 
@@ -1131,6 +1210,10 @@ namespace ImGui {
         }
     }
 
+    int WaterFall::getRawFFTSize() {
+        return rawFFTSize;
+    }
+
     void WaterFall::setRawFFTSize(int size) {
         std::lock_guard<std::recursive_mutex> lck(buf_mtx);
         rawFFTSize = size;
@@ -1381,6 +1464,52 @@ namespace ImGui {
         }
     };
 
+    bool WaterFall::enableHistory(std::string dir) {
+        std::lock_guard<std::recursive_mutex> lck(buf_mtx);
+        return history.open(dir, WATERFALL_HISTORY_WIDTH);
+    }
+
+    void WaterFall::setHistoryRetention(int64_t maxSize, int64_t maxAge) {
+        std::lock_guard<std::recursive_mutex> lck(buf_mtx);
+        history.setRetention(maxSize, maxAge);
+    }
+
+    void WaterFall::disableHistory() {
+        std::lock_guard<std::recursive_mutex> lck(buf_mtx);
+        setScrollback(false);
+        history.close();
+    }
+
+    bool WaterFall::isHistoryEnabled() {
+        return history.isOpen();
+    }
+
+    void WaterFall::setScrollback(bool enabled) {
+        std::lock_guard<std::recursive_mutex> lck(buf_mtx);
+        if (enabled == scrollback) { return; }
+        if (enabled && !history.isOpen()) { return; }
+        scrollback = enabled;
+        scrollbackLine = history.getFirstLine() + history.getLineCount() - 1;
+        updateWaterfallFb();
+    }
+
+    bool WaterFall::getScrollback() {
+        return scrollback;
+    }
+
+    void WaterFall::scrollbackTo(int64_t timestamp) {
+        std::lock_guard<std::recursive_mutex> lck(buf_mtx);
+        int64_t line = history.findLine(timestamp);
+        if (line < 0) { return; }
+        scrollback = true;
+        scrollbackLine = line;
+        updateWaterfallFb();
+    }
+
+    int64_t WaterFall::getScrollbackTime() {
+        return history.getTimestamp(scrollbackLine);
+    }
+
     void WaterFall::showWaterfall() {
         buf_mtx.lock();
         if (rawFFTs == NULL) {
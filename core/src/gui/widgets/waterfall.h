@@ -5,10 +5,13 @@
 #include <imgui/imgui.h>
 #include <imgui/imgui_internal.h>
 #include <utils/event.h>
+#include <utils/spectrogram_store.h>
+#include <utils/colormap.h>
 
 #include <utils/opengl_include_code.h>
 
 #define WATERFALL_RESOLUTION 1000000
+#define WATERFALL_HISTORY_WIDTH 4096
 
 namespace ImGui {
     class WaterfallVFO {
@@ -134,6 +137,7 @@ namespace ImGui {
         int getFFTHeight();
 
         void setRawFFTSize(int size);
+        int getRawFFTSize();
 
         void setFullWaterfallUpdate(bool fullUpdate);
 
@@ -151,6 +155,16 @@ namespace ImGui {
         float* acquireLatestFFT(int& width);
         void releaseLatestFFT();
 
+        bool enableHistory(std::string dir);
+        void setHistoryRetention(int64_t maxSize, int64_t maxAge);
+        void disableHistory();
+        bool isHistoryEnabled();
+
+        void setScrollback(bool enabled);
+        bool getScrollback();
+        void scrollbackTo(int64_t timestamp);
+        int64_t getScrollbackTime();
+
         bool centerFreqMoved = false;
         bool vfoFreqChanged = false;
         bool bandplanEnabled = false;
@@ -227,6 +241,8 @@ namespace ImGui {
         void onPositionChange();
         void onResize();
         void updateWaterfallFb();
+        void updateWaterfallFbFromHistory();
+        void scrollHistory(int64_t lines);
         void updateWaterfallTexture();
         void updateAllVFOs(bool checkRedrawRequired = false);
         bool calculateVFOSignalInfo(float* fftLine, WaterfallVFO* vfo, float& strength, float& snr);
@@ -234,6 +250,7 @@ namespace ImGui {
         bool waterfallUpdate = false;
 
         uint32_t waterfallPallet[WATERFALL_RESOLUTION];
+        uint32_t waterfallLut[COLORMAP_LUT_SIZE];
 
         ImVec2 widgetPos;
         ImVec2 widgetEndPos;
@@ -287,6 +304,7 @@ namespace ImGui {
         float* latestFFT = NULL;
         float* latestFFTHold = NULL;
         float* smoothingBuf = NULL;
+        ImVec2* tracePoints = NULL;
         int currentFFTLine = 0;
         int fftLines = 0;
 
@@ -323,5 +341,12 @@ namespace ImGui {
         ImVec2 mouseDownPos;
 
         ImVec2 lastMousePos;
+
+        // Spectrogram history
+        spectrogram::Store history;
+        bool scrollback = false;
+        int64_t scrollbackLine = 0;
+        std::vector<float> historyLine;
+        std::vector<float> historyZoom;
     };
 };
\ No newline at end of file
@@ -4,76 +4,672 @@
 #include <version.h>
 #include <config.h>
 #include <filesystem>
+#include <map>
+#include <algorithm>
 #include <dsp/types.h>
 #include <signal_path/signal_path.h>
 #include <gui/smgui.h>
 #include <utils/optionlist.h>
 #include "dsp/compression/sample_stream_compressor.h"
+#include "dsp/channel/rx_vfo.h"
+#include "dsp/buffer/reshaper.h"
+#include "dsp/window/nuttall.h"
+#include <volk/volk.h>
+#include <fftw3.h>
+#include "dsp/routing/splitter.h"
 #include "dsp/sink/handler_sink.h"
 #include <zstd.h>
+#include <random>
 
 namespace server {
+    // Compression chain shared by all clients streaming with the same PCM type
+    struct Encoder {
+        dsp::compression::PCMType pcmType;
+        dsp::stream<dsp::complex_t> input;
+        dsp::compression::SampleStreamCompressor comp;
+        dsp::sink::Handler<uint8_t> hnd;
+        ZSTD_CCtx* cctx;
+        std::mutex subMtx;
+        std::vector<Session> subscribers;
+    };
+
+    // Channel extracted on the server and streamed to a single client
+    struct ServerVFO {
+        uint32_t id;
+        ClientSession* session;
+        dsp::stream<dsp::complex_t> input;
+        dsp::channel::RxVFO ddc;
+        dsp::compression::SampleStreamCompressor comp;
+        dsp::sink::Handler<uint8_t> hnd;
+        ZSTD_CCtx* cctx;
+    };
+
+    // Spectrum computed on the server, shared by all clients asking for the same settings
+    struct ServerFFT {
+        FFTConfig config;
+        std::vector<ClientSession*> subscribers;
+        std::mutex subMtx;
+        int size;
+        int averaging;
+        int avgCount;
+        dsp::stream<dsp::complex_t> input;
+        dsp::buffer::Reshaper<dsp::complex_t> reshape;
+        dsp::sink::Handler<dsp::complex_t> sink;
+        float* window;
+        fftwf_complex* fftIn;
+        fftwf_complex* fftOut;
+        fftwf_plan plan;
+        float* power;
+        float* accum;
+        uint8_t* quant;
+        ZSTD_CCtx* cctx;
+    };
+
     dsp::stream<dsp::complex_t> dummyInput;
-    dsp::compression::SampleStreamCompressor comp;
-    dsp::sink::Handler<uint8_t> hnd;
-    net::Conn client;
-    uint8_t* rbuf = NULL;
-    uint8_t* sbuf = NULL;
-    uint8_t* bbuf = NULL;
-
-    PacketHeader* r_pkt_hdr = NULL;
-    uint8_t* r_pkt_data = NULL;
-    CommandHeader* r_cmd_hdr = NULL;
-    uint8_t* r_cmd_data = NULL;
-
-    PacketHeader* s_pkt_hdr = NULL;
-    uint8_t* s_pkt_data = NULL;
-    CommandHeader* s_cmd_hdr = NULL;
-    uint8_t* s_cmd_data = NULL;
-
-    PacketHeader* bb_pkt_hdr = NULL;
-    uint8_t* bb_pkt_data = NULL;
+    dsp::routing::Splitter<dsp::complex_t> split;
+    std::map<dsp::compression::PCMType, std::unique_ptr<Encoder>> encoders;
+    std::mutex encodersMtx;
 
-    SmGui::DrawListElem dummyElem;
+    std::vector<Session> sessions;
+    std::mutex sessionsMtx;
+
+    // Server-side FFTs, only created and destroyed under the command mutex
+    std::vector<ServerFFT*> ffts;
+    int nextSessionId = 0;
 
-    ZSTD_CCtx* cctx;
+    // Serializes command processing since the UI rendering state is global
+    std::recursive_mutex cmdMtx;
+
+    SmGui::DrawListElem dummyElem;
 
     net::Listener listener;
 
+    // Rejected connections are kept open for a moment so that the disconnect command gets sent
+    struct RejectedConn {
+        net::Conn conn;
+        std::chrono::steady_clock::time_point time;
+    };
+    std::vector<RejectedConn> rejected;
+    std::mutex rejectedMtx;
+    uint8_t disconnectPacket[sizeof(PacketHeader) + sizeof(CommandHeader)];
+
+    // Shared by the UDP data channels of all clients
+    net::Conn udpConn;
+    uint8_t udpRecvBuf[SERVER_UDP_PAYLOAD_SIZE];
+    std::random_device tokenRng;
+
     OptionList<std::string, std::string> sourceList;
     int sourceId = 0;
     bool running = false;
-    bool compression = false;
+    int streamingCount = 0;
     double sampleRate = 1000000.0;
 
-    int main() {
-        flog::info("=====| SERVER MODE |=====");
-
-        // Init DSP
-        comp.init(&dummyInput, dsp::compression::PCM_TYPE_I8);
-        hnd.init(&comp.out, _testServerHandler, NULL);
+    ClientSession::ClientSession(int id, net::Conn conn) {
+        this->id = id;
+        this->conn = std::move(conn);
+        tcpAddr = this->conn->getRemoteAddress();
         rbuf = new uint8_t[SERVER_MAX_PACKET_SIZE];
-        sbuf = new uint8_t[SERVER_MAX_PACKET_SIZE];
-        bbuf = new uint8_t[SERVER_MAX_PACKET_SIZE];
-        comp.start();
-        hnd.start();
+        pcmType = dsp::compression::PCM_TYPE_I16;
+        compression = false;
+        closing = false;
+        dropped = 0;
+        bytesSent = 0;
+        udpReady = false;
+        udpToken = 0;
+        senderThread = std::thread(&ClientSession::sendWorker, this);
+    }
+
+    ClientSession::~ClientSession() {
+        close();
+        delete[] rbuf;
+    }
+
+    void ClientSession::send(Packet pkt, bool droppable) {
+        {
+            std::lock_guard<std::mutex> lck(queueMtx);
+            if (stopSender) { return; }
+
+            // If the client can't keep up, drop the oldest data instead of stalling the DSP,
+            // that way the client always gets the most recent samples
+            if (droppable) {
+                if (droppableCount >= SERVER_SEND_QUEUE_SIZE) {
+                    for (auto it = queue.begin(); it != queue.end(); it++) {
+                        if (!it->second) { continue; }
+                        queue.erase(it);
+                        droppableCount--;
+                        dropped++;
+                        break;
+                    }
+                }
+                droppableCount++;
+            }
+            queue.push_back({ pkt, droppable });
+        }
+        queueCnd.notify_all();
+    }
+
+    void ClientSession::close() {
+        {
+            std::lock_guard<std::mutex> lck(queueMtx);
+            stopSender = true;
+        }
+        queueCnd.notify_all();
+
+        // Closing the connection also aborts a write in progress
+        if (conn) { conn->close(); }
+        if (senderThread.joinable()) { senderThread.join(); }
+    }
+
+    bool ClientSession::isOpen() {
+        return conn && conn->isOpen() && !closing;
+    }
+
+    int ClientSession::getQueueDepth() {
+        std::lock_guard<std::mutex> lck(queueMtx);
+        return droppableCount;
+    }
+
+    void ClientSession::sendWorker() {
+        while (true) {
+            std::pair<Packet, bool> entry;
+            {
+                std::unique_lock<std::mutex> lck(queueMtx);
+                queueCnd.wait(lck, [this]() { return !queue.empty() || stopSender; });
+                if (stopSender) { return; }
+                entry = queue.front();
+                queue.pop_front();
+                if (entry.second) { droppableCount--; }
+            }
+
+            // Data goes over UDP when available, a lost datagram doesn't stall the rest of the stream
+            if (entry.second && udpReady) {
+                sendDatagrams(entry.first);
+                bytesSent += entry.first->size();
+                continue;
+            }
+
+            if (!conn->write(entry.first->size(), entry.first->data())) {
+                std::lock_guard<std::mutex> lck(queueMtx);
+                stopSender = true;
+                closing = true;
+                return;
+            }
+            bytesSent += entry.first->size();
+        }
+    }
+
+    bool ClientSession::sendDatagrams(const Packet& pkt) {
+        struct sockaddr_in dest;
+        {
+            std::lock_guard<std::mutex> lck(udpMtx);
+            dest = udpAddr;
+        }
+        if (!udpConn) { return false; }
+
+        PacketHeader* phdr = (PacketHeader*)pkt->data();
+        uint8_t* payload = &pkt->data()[sizeof(PacketHeader)];
+        int size = pkt->size() - sizeof(PacketHeader);
+        int fragCount = (size + SERVER_UDP_PAYLOAD_SIZE - 1) / SERVER_UDP_PAYLOAD_SIZE;
+        if (!fragCount) { fragCount = 1; }
+
+        DatagramHeader dhdr;
+        dhdr.packetSeq = udpPacketSeq++;
+        dhdr.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        dhdr.packetSize = size;
+        dhdr.fragCount = fragCount;
+        dhdr.type = phdr->type;
 
-        // Initialize headers
-        r_pkt_hdr = (PacketHeader*)rbuf;
-        r_pkt_data = &rbuf[sizeof(PacketHeader)];
-        r_cmd_hdr = (CommandHeader*)r_pkt_data;
-        r_cmd_data = &rbuf[sizeof(PacketHeader) + sizeof(CommandHeader)];
+        // The fragments are sent straight from the packet, only the parity is computed on the side
+        int parityLen = 0;
+        for (int i = 0; i < fragCount; i++) {
+            int offset = i * SERVER_UDP_PAYLOAD_SIZE;
+            int len = std::min<int>(SERVER_UDP_PAYLOAD_SIZE, size - offset);
+            dhdr.seq = udpSeq++;
+            dhdr.index = i;
+            dhdr.parity = false;
+            net::ConnBuffer bufs[2] = {
+                { sizeof(DatagramHeader), (uint8_t*)&dhdr },
+                { len, &payload[offset] }
+            };
+            udpConn->writeTo(bufs, 2, dest);
 
-        s_pkt_hdr = (PacketHeader*)sbuf;
-        s_pkt_data = &sbuf[sizeof(PacketHeader)];
-        s_cmd_hdr = (CommandHeader*)s_pkt_data;
-        s_cmd_data = &sbuf[sizeof(PacketHeader) + sizeof(CommandHeader)];
+            // Accumulate the parity of the group
+            if (!(i % SERVER_UDP_FEC_GROUP)) {
+                memset(parity, 0, SERVER_UDP_PAYLOAD_SIZE);
+                parityLen = 0;
+            }
+            for (int j = 0; j < len; j++) { parity[j] ^= payload[offset + j]; }
+            parityLen = std::max<int>(parityLen, len);
 
-        bb_pkt_hdr = (PacketHeader*)bbuf;
-        bb_pkt_data = &bbuf[sizeof(PacketHeader)];
+            // Send the parity once the group is complete
+            if ((i % SERVER_UDP_FEC_GROUP) == SERVER_UDP_FEC_GROUP - 1 || i == fragCount - 1) {
+                dhdr.seq = udpSeq++;
+                dhdr.index = i / SERVER_UDP_FEC_GROUP;
+                dhdr.parity = true;
+                net::ConnBuffer pbufs[2] = {
+                    { sizeof(DatagramHeader), (uint8_t*)&dhdr },
+                    { parityLen, parity }
+                };
+                udpConn->writeTo(pbufs, 2, dest);
+            }
+        }
+        return true;
+    }
 
-        // Initialize compressor
-        cctx = ZSTD_createCCtx();
+    Session findSession(ClientSession* ptr) {
+        std::lock_guard<std::mutex> lck(sessionsMtx);
+        for (auto& session : sessions) {
+            if (session.get() == ptr) { return session; }
+        }
+        return NULL;
+    }
+
+    void subscribe(Session session) {
+        std::lock_guard<std::mutex> lck(encodersMtx);
+        dsp::compression::PCMType type = session->pcmType;
+
+        // Create the encoder if this is the first client using this PCM type
+        Encoder* enc;
+        auto it = encoders.find(type);
+        if (it == encoders.end()) {
+            auto newEnc = std::make_unique<Encoder>();
+            enc = newEnc.get();
+            enc->pcmType = type;
+            enc->cctx = ZSTD_createCCtx();
+            enc->comp.init(&enc->input, type);
+            enc->hnd.init(&enc->comp.out, _encoderHandler, enc);
+            enc->comp.start();
+            enc->hnd.start();
+            split.bindStream(&enc->input);
+            encoders[type] = std::move(newEnc);
+        }
+        else {
+            enc = it->second.get();
+        }
+
+        std::lock_guard<std::mutex> lck2(enc->subMtx);
+        enc->subscribers.push_back(session);
+    }
+
+    void unsubscribe(Session session) {
+        std::lock_guard<std::mutex> lck(encodersMtx);
+        auto it = encoders.find(session->pcmType);
+        if (it == encoders.end()) { return; }
+        Encoder* enc = it->second.get();
+
+        {
+            std::lock_guard<std::mutex> lck2(enc->subMtx);
+            auto sit = std::find(enc->subscribers.begin(), enc->subscribers.end(), session);
+            if (sit != enc->subscribers.end()) { enc->subscribers.erase(sit); }
+            if (!enc->subscribers.empty()) { return; }
+        }
+
+        // Destroy the encoder once nobody uses it anymore
+        split.unbindStream(&enc->input);
+        enc->comp.stop();
+        enc->hnd.stop();
+        ZSTD_freeCCtx(enc->cctx);
+        encoders.erase(it);
+    }
+
+    void addVFO(Session session, const VFOConfig& cfg) {
+        std::lock_guard<std::mutex> lck(session->vfoMtx);
+        ServerVFO* vfo = new ServerVFO;
+        vfo->id = cfg.id;
+        vfo->session = session.get();
+        vfo->cctx = ZSTD_createCCtx();
+        vfo->ddc.init(&vfo->input, sampleRate, cfg.sampleRate, cfg.bandwidth, cfg.offset);
+        vfo->comp.init(&vfo->ddc.out, session->pcmType);
+        vfo->hnd.init(&vfo->comp.out, _vfoHandler, vfo);
+        vfo->ddc.start();
+        vfo->comp.start();
+        vfo->hnd.start();
+        split.bindStream(&vfo->input);
+        session->vfos[cfg.id] = vfo;
+    }
+
+    void removeVFO(Session session, uint32_t id) {
+        std::lock_guard<std::mutex> lck(session->vfoMtx);
+        auto it = session->vfos.find(id);
+        if (it == session->vfos.end()) { return; }
+        ServerVFO* vfo = it->second;
+        split.unbindStream(&vfo->input);
+        vfo->ddc.stop();
+        vfo->comp.stop();
+        vfo->hnd.stop();
+        ZSTD_freeCCtx(vfo->cctx);
+        delete vfo;
+        session->vfos.erase(it);
+    }
+
+    void removeAllVFOs(Session session) {
+        std::vector<uint32_t> ids;
+        {
+            std::lock_guard<std::mutex> lck(session->vfoMtx);
+            for (auto const& [id, vfo] : session->vfos) { ids.push_back(id); }
+        }
+        for (auto id : ids) { removeVFO(session, id); }
+    }
+
+    double fftLoad(const FFTConfig& cfg) {
+        return (double)cfg.size * cfg.rate * (double)cfg.averaging;
+    }
+
+    ServerFFT* createFFT(const FFTConfig& cfg) {
+        ServerFFT* fft = new ServerFFT;
+        fft->config = cfg;
+        fft->size = cfg.size;
+        fft->averaging = cfg.averaging;
+        fft->avgCount = 0;
+
+        // Compute enough FFTs per second for the averaging, same reshaping as the IQ front end.
+        // Overlapping is limited to 4x, slow samplerates get a lower rate instead of burning CPU
+        int fftInterval = round(sampleRate / (cfg.rate * cfg.averaging));
+        fftInterval = std::max<int>(fftInterval, std::max<int>(fft->size / 4, 1));
+        int nzSize = std::min<int>(fftInterval, fft->size);
+        int skip = fftInterval - nzSize;
+
+        // Window alternating in sign so that the spectrum comes out centered
+        fft->window = new float[nzSize];
+        for (int i = 0; i < nzSize; i++) { fft->window[i] = dsp::window::nuttall(i, nzSize) * ((i % 2) ? -1.0f : 1.0f); }
+
+        fft->fftIn = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * fft->size);
+        fft->fftOut = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * fft->size);
+        memset(fft->fftIn, 0, sizeof(fftwf_complex) * fft->size);
+        fft->plan = fftwf_plan_dft_1d(fft->size, fft->fftIn, fft->fftOut, FFTW_FORWARD, FFTW_ESTIMATE);
+        fft->power = new float[fft->size];
+        fft->accum = new float[fft->size];
+        fft->quant = new uint8_t[fft->size];
+        fft->cctx = ZSTD_createCCtx();
+
+        fft->reshape.init(&fft->input, nzSize, skip);
+        fft->sink.init(&fft->reshape.out, _fftHandler, fft);
+        fft->reshape.start();
+        fft->sink.start();
+        split.bindStream(&fft->input);
+        return fft;
+    }
+
+    void destroyFFT(ServerFFT* fft) {
+        split.unbindStream(&fft->input);
+        fft->reshape.stop();
+        fft->sink.stop();
+        fftwf_destroy_plan(fft->plan);
+        fftwf_free(fft->fftIn);
+        fftwf_free(fft->fftOut);
+        ZSTD_freeCCtx(fft->cctx);
+        delete[] fft->window;
+        delete[] fft->power;
+        delete[] fft->accum;
+        delete[] fft->quant;
+        delete fft;
+    }
+
+    bool addFFT(Session session, const FFTConfig& cfg) {
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
+
+        // Share the FFT of another client with the same settings
+        ServerFFT* fft = NULL;
+        for (auto& f : ffts) {
+            if (f->config.size == cfg.size && f->config.rate == cfg.rate && f->config.averaging == cfg.averaging) {
+                fft = f;
+                break;
+            }
+        }
+
+        // Otherwise create one if the server has the CPU budget for it
+        if (!fft) {
+            double load = fftLoad(cfg);
+            for (auto& f : ffts) { load += fftLoad(f->config); }
+            if (load > SERVER_MAX_FFT_LOAD) { return false; }
+            fft = createFFT(cfg);
+            ffts.push_back(fft);
+        }
+
+        std::lock_guard<std::mutex> lck2(session->fftMtx);
+        {
+            std::lock_guard<std::mutex> lck3(fft->subMtx);
+            fft->subscribers.push_back(session.get());
+        }
+        session->fft = fft;
+        session->fftConfig = cfg;
+        return true;
+    }
+
+    void removeFFT(Session session) {
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
+        ServerFFT* fft;
+        {
+            std::lock_guard<std::mutex> lck2(session->fftMtx);
+            fft = session->fft;
+            if (!fft) { return; }
+            session->fft = NULL;
+        }
+
+        // Destroy the FFT with its last client
+        bool unused;
+        {
+            std::lock_guard<std::mutex> lck2(fft->subMtx);
+            fft->subscribers.erase(std::remove(fft->subscribers.begin(), fft->subscribers.end(), session.get()), fft->subscribers.end());
+            unused = fft->subscribers.empty();
+        }
+        if (!unused) { return; }
+        ffts.erase(std::remove(ffts.begin(), ffts.end(), fft), ffts.end());
+        destroyFFT(fft);
+    }
+
+    void setPCMType(Session session, dsp::compression::PCMType type) {
+        if (type == session->pcmType) { return; }
+
+        // Move the client over to the encoder of the new type
+        bool subscribed = session->streaming && session->fullIQ;
+        if (subscribed) { unsubscribe(session); }
+        session->pcmType = type;
+        if (subscribed) { subscribe(session); }
+
+        // The VFOs have their own compressors
+        std::lock_guard<std::mutex> lck(session->vfoMtx);
+        for (auto const& [id, vfo] : session->vfos) {
+            vfo->comp.setPCMType(type);
+        }
+    }
+
+    // Sample types from highest to lowest bitrate, used by the rate controller to step down
+    const dsp::compression::PCMType rateLadder[] = {
+        dsp::compression::PCM_TYPE_F32,
+        dsp::compression::PCM_TYPE_I16,
+        dsp::compression::PCM_TYPE_BFP8,
+        dsp::compression::PCM_TYPE_BFP6,
+        dsp::compression::PCM_TYPE_BFP4
+    };
+    const int rateLadderSize = sizeof(rateLadder) / sizeof(rateLadder[0]);
+
+    int rateLadderIndex(dsp::compression::PCMType type) {
+        // Int8 is about the same size as BFP8
+        if (type == dsp::compression::PCM_TYPE_I8) { type = dsp::compression::PCM_TYPE_BFP8; }
+        for (int i = 0; i < rateLadderSize; i++) {
+            if (rateLadder[i] == type) { return i; }
+        }
+        return rateLadderSize - 1;
+    }
+
+    // Level 0 is what the client asked for, level 1 forces zstd on and each following level steps down the ladder
+    int maxRateLevel(Session session) {
+        return 1 + (rateLadderSize - 1 - rateLadderIndex(session->clientPCMType));
+    }
+
+    void applyRateLevel(Session session) {
+        int level = session->rateLevel;
+        session->compression = session->clientCompression || level >= 1;
+        if (level <= 1) {
+            setPCMType(session, session->clientPCMType);
+        }
+        else {
+            setPCMType(session, rateLadder[rateLadderIndex(session->clientPCMType) + level - 1]);
+        }
+    }
+
+    void sendStreamFormat(Session session, uint32_t throughput) {
+        Packet pkt = newCommand(PACKET_TYPE_COMMAND, COMMAND_SET_STREAM_FORMAT, sizeof(StreamFormat));
+        StreamFormat* fmt = (StreamFormat*)commandData(pkt);
+        fmt->pcmType = session->pcmType;
+        fmt->compression = session->compression;
+        fmt->level = session->rateLevel;
+        fmt->queueDepth = session->getQueueDepth();
+        fmt->throughput = throughput;
+        session->send(pkt);
+    }
+
+    void updateRateControl(int elapsedMs) {
+        std::vector<Session> list;
+        {
+            std::lock_guard<std::mutex> lck(sessionsMtx);
+            list = sessions;
+        }
+
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
+        for (auto& session : list) {
+            // Measure what happened since the last interval
+            uint64_t dropped = session->dropped;
+            uint64_t bytesSent = session->bytesSent;
+            uint64_t newDrops = dropped - session->lastDropped;
+            uint32_t throughput = ((bytesSent - session->lastBytesSent) * 1000) / std::max<int>(elapsedMs, 1);
+            session->lastDropped = dropped;
+            session->lastBytesSent = bytesSent;
+            if (!session->adaptive || !session->streaming) { continue; }
+
+            // Step down as soon as the link is congested, step up only after it's been quiet for a while
+            int depth = session->getQueueDepth();
+            int level = session->rateLevel;
+            if (newDrops || depth > (SERVER_SEND_QUEUE_SIZE * 3) / 4) {
+                session->quietIntervals = 0;
+                level = std::min<int>(level + 1, maxRateLevel(session));
+            }
+            else if (depth <= 1 && ++session->quietIntervals >= SERVER_RATE_CONTROL_RECOVERY) {
+                session->quietIntervals = 0;
+                level = std::max<int>(level - 1, 0);
+            }
+            if (level == session->rateLevel) { continue; }
+
+            flog::info("Client {0}: rate level {1} -> {2} ({3} kB/s, {4} packets queued, {5} dropped)", session->id, session->rateLevel, level, throughput / 1000, depth, newDrops);
+            session->rateLevel = level;
+            applyRateLevel(session);
+            sendStreamFormat(session, throughput);
+        }
+    }
+
+    void startStreaming(Session session) {
+        if (session->streaming) { return; }
+        session->streaming = true;
+        if (session->fullIQ) { subscribe(session); }
+        if (streamingCount++ == 0) {
+            sigpath::sourceManager.start();
+            running = true;
+        }
+    }
+
+    void stopStreaming(Session session) {
+        if (!session->streaming) { return; }
+        session->streaming = false;
+        if (session->fullIQ) { unsubscribe(session); }
+        if (--streamingCount == 0) {
+            sigpath::sourceManager.stop();
+            running = false;
+        }
+    }
+
+    void grantControl(Session session) {
+        std::lock_guard<std::mutex> lck(sessionsMtx);
+        for (auto& other : sessions) {
+            if (other == session || !other->controller) { continue; }
+            other->controller = false;
+            sendControl(other);
+        }
+        session->controller = true;
+        sendControl(session);
+        flog::info("Client {0} now has control of the source", session->id);
+    }
+
+    void closeRejectedConns() {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<net::Conn> expired;
+        {
+            std::lock_guard<std::mutex> lck(rejectedMtx);
+            for (auto it = rejected.begin(); it != rejected.end();) {
+                if (now - it->time < std::chrono::milliseconds(SERVER_REJECT_LINGER_MS)) {
+                    it++;
+                    continue;
+                }
+                expired.push_back(std::move(it->conn));
+                it = rejected.erase(it);
+            }
+        }
+        for (auto& conn : expired) {
+            conn->close();
+        }
+    }
+
+    void removeClosedSessions() {
+        // Take the dead sessions out of the list
+        std::vector<Session> closed;
+        {
+            std::lock_guard<std::mutex> lck(sessionsMtx);
+            for (auto it = sessions.begin(); it != sessions.end();) {
+                if ((*it)->isOpen()) {
+                    it++;
+                    continue;
+                }
+                closed.push_back(*it);
+                it = sessions.erase(it);
+            }
+        }
+        if (closed.empty()) { return; }
+
+        // Closing joins the read thread, so this must be done without holding the command mutex
+        for (auto& session : closed) {
+            session->close();
+        }
+
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
+        bool controllerLeft = false;
+        for (auto& session : closed) {
+            flog::info("Client {0} disconnected ({1} baseband packets dropped)", session->id, (uint64_t)session->dropped);
+            stopStreaming(session);
+            removeAllVFOs(session);
+            removeFFT(session);
+            controllerLeft |= session->controller;
+        }
+
+        // Hand control over to the oldest remaining client
+        if (controllerLeft) {
+            Session next;
+            {
+                std::lock_guard<std::mutex> lck2(sessionsMtx);
+                if (!sessions.empty()) { next = sessions[0]; }
+            }
+            if (next) { grantControl(next); }
+        }
+    }
+
+    void checkUDPTimeouts() {
+        // Fall back to TCP if the client stopped sending hellos, it might have lost its NAT mapping
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lck(sessionsMtx);
+        for (auto& session : sessions) {
+            if (!session->udpReady) { continue; }
+            std::lock_guard<std::mutex> lck2(session->udpMtx);
+            if (now - session->lastHello < std::chrono::milliseconds(SERVER_UDP_TIMEOUT_MS)) { continue; }
+            session->udpReady = false;
+            flog::warn("UDP data channel of client {0} timed out, falling back to TCP", session->id);
+        }
+    }
+
+    int main() {
+        flog::info("=====| SERVER MODE |=====");
+
+        // Init DSP
+        split.init(&dummyInput);
+        split.start();
 
         // Load config
         core::configManager.acquire();
@@ -151,104 +747,292 @@ namespace server {
         // TODO: Use command line option
         std::string host = (std::string)core::args["addr"];
         int port = (int)core::args["port"];
+        PacketHeader* dhdr = (PacketHeader*)disconnectPacket;
+        CommandHeader* dchdr = (CommandHeader*)&disconnectPacket[sizeof(PacketHeader)];
+        dhdr->size = sizeof(disconnectPacket);
+        dhdr->type = PACKET_TYPE_COMMAND;
+        dchdr->cmd = COMMAND_DISCONNECT;
+
         listener = net::listen(host, port);
         listener->acceptAsync(_clientHandler, NULL);
 
+        // The UDP data channel uses the same port number
+        try {
+            udpConn = net::openUDP(host, port, "127.0.0.1", 0);
+            udpConn->readAsync(sizeof(udpRecvBuf), udpRecvBuf, _udpHandler, NULL, false);
+        }
+        catch (const std::exception& e) {
+            flog::warn("Could not open the UDP data channel: {0}", e.what());
+        }
+
         flog::info("Ready, listening on {0}:{1}", host, port);
-        while(1) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+        auto lastRateControl = std::chrono::steady_clock::now();
+        while(1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            removeClosedSessions();
+            closeRejectedConns();
+            checkUDPTimeouts();
+
+            auto now = std::chrono::steady_clock::now();
+            int elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastRateControl).count();
+            if (elapsedMs >= SERVER_RATE_CONTROL_INTERVAL_MS) {
+                lastRateControl = now;
+                updateRateControl(elapsedMs);
+            }
+        }
 
         return 0;
     }
 
     void _clientHandler(net::Conn conn, void* ctx) {
-        // Reject if someone else is already connected
-        if (client && client->isOpen()) {
-            flog::info("REJECTED Connection from {0}:{1}, another client is already connected.", "TODO", "TODO");
-            
-            // Issue a disconnect command to the client
-            uint8_t buf[sizeof(PacketHeader) + sizeof(CommandHeader)];
-            PacketHeader* tmp_phdr = (PacketHeader*)buf;
-            CommandHeader* tmp_chdr = (CommandHeader*)&buf[sizeof(PacketHeader)];
-            tmp_phdr->size = sizeof(PacketHeader) + sizeof(CommandHeader);
-            tmp_phdr->type = PACKET_TYPE_COMMAND;
-            tmp_chdr->cmd = COMMAND_DISCONNECT;
-            conn->write(tmp_phdr->size, buf);
-
-            // TODO: Find something cleaner
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
+        int count;
+        {
+            std::lock_guard<std::mutex> lck2(sessionsMtx);
+            count = sessions.size();
+        }
 
-            conn->close();
+        // Reject if the server is full
+        if (count >= SERVER_MAX_CLIENTS) {
+            flog::info("REJECTED Connection, {0} clients are already connected.", count);
             
+            // Issue a disconnect command to the client, the main thread closes the connection once it had time to go out
+            conn->writeAsync(sizeof(disconnectPacket), disconnectPacket);
+            {
+                std::lock_guard<std::mutex> lck2(rejectedMtx);
+                rejected.push_back({ std::move(conn), std::chrono::steady_clock::now() });
+            }
+
             // Start another async accept
             listener->acceptAsync(_clientHandler, NULL);
             return;
         }
 
-        flog::info("Connection from {0}:{1}", "TODO", "TODO");
-        client = std::move(conn);
-        client->readAsync(sizeof(PacketHeader), rbuf, _packetHandler, NULL);
+        // Perform settings reset if this is the only client
+        if (!count) {
+            sigpath::sourceManager.stop();
+            running = false;
+        }
 
-        // Perform settings reset
-        sigpath::sourceManager.stop();
-        comp.setPCMType(dsp::compression::PCM_TYPE_I16);
-        compression = false;
+        Session session = std::make_shared<ClientSession>(nextSessionId++, std::move(conn));
+        flog::info("Connection from client {0} ({1} connected)", session->id, count + 1);
+        {
+            std::lock_guard<std::mutex> lck2(sessionsMtx);
+            sessions.push_back(session);
+        }
 
-        sendSampleRate(sampleRate);
+        // The first client gets control of the source
+        sendSampleRate(session, sampleRate);
+        if (!count) {
+            grantControl(session);
+        }
+        else {
+            sendControl(session);
+        }
 
-        // TODO: Wait otherwise someone else could connect
+        session->conn->readAsync(sizeof(PacketHeader), session->rbuf, _packetHandler, session.get());
 
         listener->acceptAsync(_clientHandler, NULL);
     }
 
     void _packetHandler(int count, uint8_t* buf, void* ctx) {
+        ClientSession* _session = (ClientSession*)ctx;
         PacketHeader* hdr = (PacketHeader*)buf;
 
-        // Read the rest of the data (TODO: CHECK SIZE OR SHIT WILL BE FUCKED + ADD TIMEOUT)
-        int len = 0;
-        int read = 0;
+        // Stop reading from clients sending garbage, the connection will be closed by the main thread
+        if (hdr->size < sizeof(PacketHeader) || hdr->size > SERVER_MAX_PACKET_SIZE) {
+            flog::error("Invalid packet size from client {0}, disconnecting", _session->id);
+            _session->closing = true;
+            return;
+        }
+
+        // Read the rest of the packet without blocking the network thread
         int goal = hdr->size - sizeof(PacketHeader);
-        while (len < goal) {
-            read = client->read(goal - len, &buf[sizeof(PacketHeader) + len]);
-            if (read < 0) { return; };
-            len += read;
+        if (!goal) {
+            _packetBodyHandler(0, &buf[sizeof(PacketHeader)], ctx);
+            return;
         }
+        _session->conn->readAsync(goal, &buf[sizeof(PacketHeader)], _packetBodyHandler, ctx);
+    }
+
+    void _packetBodyHandler(int count, uint8_t* body, void* ctx) {
+        ClientSession* _session = (ClientSession*)ctx;
+        uint8_t* buf = _session->rbuf;
+        PacketHeader* hdr = (PacketHeader*)buf;
+
+        // Ignore sessions being removed
+        Session session = findSession(_session);
+        if (!session) { return; }
 
         // Parse and process
         if (hdr->type == PACKET_TYPE_COMMAND && hdr->size >= sizeof(PacketHeader) + sizeof(CommandHeader)) {
             CommandHeader* chdr = (CommandHeader*)&buf[sizeof(PacketHeader)];
-            commandHandler((Command)chdr->cmd, &buf[sizeof(PacketHeader) + sizeof(CommandHeader)], hdr->size - sizeof(PacketHeader) - sizeof(CommandHeader));
+            commandHandler(session, (Command)chdr->cmd, &buf[sizeof(PacketHeader) + sizeof(CommandHeader)], hdr->size - sizeof(PacketHeader) - sizeof(CommandHeader));
         }
         else {
-            sendError(ERROR_INVALID_PACKET);
+            sendError(session, ERROR_INVALID_PACKET);
         }
 
         // Start another async read
-        client->readAsync(sizeof(PacketHeader), rbuf, _packetHandler, NULL);
+        session->conn->readAsync(sizeof(PacketHeader), session->rbuf, _packetHandler, session.get());
+    }
+
+    void _udpHandler(int count, uint8_t* buf, void* ctx) {
+        DatagramHello* hello = (DatagramHello*)buf;
+        if (count == sizeof(DatagramHello) && hello->magic == SERVER_UDP_HELLO_MAGIC && hello->token) {
+            struct sockaddr_in addr = udpConn->getRemoteAddress();
+            std::lock_guard<std::mutex> lck(sessionsMtx);
+            for (auto& session : sessions) {
+                if (session->udpToken != hello->token) { continue; }
+
+                // The hello must come from the same host as the TCP connection, only the port can differ through NAT
+                if (addr.sin_addr.s_addr != session->tcpAddr.sin_addr.s_addr) {
+                    flog::warn("UDP hello for client {0} came from another host, ignoring", session->id);
+                    break;
+                }
+                {
+                    std::lock_guard<std::mutex> lck2(session->udpMtx);
+                    session->udpAddr = addr;
+                    session->lastHello = std::chrono::steady_clock::now();
+                }
+                if (!session->udpReady) {
+                    flog::info("Client {0} switched to the UDP data channel", session->id);
+                    session->udpReady = true;
+                }
+                break;
+            }
+        }
+
+        // Start another async read
+        udpConn->readAsync(sizeof(udpRecvBuf), udpRecvBuf, _udpHandler, NULL, false);
+    }
+
+    void _encoderHandler(uint8_t* data, int count, void* ctx) {
+        Encoder* enc = (Encoder*)ctx;
+        std::lock_guard<std::mutex> lck(enc->subMtx);
+
+        // Build each packet flavor at most once and share it between all clients that want it
+        Packet raw;
+        Packet compressed;
+        for (auto& session : enc->subscribers) {
+            if (session->compression) {
+                if (!compressed) {
+                    size_t bound = ZSTD_compressBound(count);
+                    compressed = newPacket(PACKET_TYPE_BASEBAND_COMPRESSED, bound);
+                    size_t len = ZSTD_compressCCtx(enc->cctx, &(*compressed)[sizeof(PacketHeader)], bound, data, count, 1);
+                    if (ZSTD_isError(len)) { return; }
+                    compressed->resize(sizeof(PacketHeader) + len);
+                    ((PacketHeader*)compressed->data())->size = compressed->size();
+                }
+                session->send(compressed, true);
+            }
+            else {
+                if (!raw) {
+                    raw = newPacket(PACKET_TYPE_BASEBAND, count);
+                    memcpy(&(*raw)[sizeof(PacketHeader)], data, count);
+                }
+                session->send(raw, true);
+            }
+        }
     }
 
-    void _testServerHandler(uint8_t* data, int count, void* ctx) {
-        // Compress data if needed and fill out header fields
-        if (compression) {
-            bb_pkt_hdr->type = PACKET_TYPE_BASEBAND_COMPRESSED;
-            bb_pkt_hdr->size = sizeof(PacketHeader) + (uint32_t)ZSTD_compressCCtx(cctx, &bbuf[sizeof(PacketHeader)], SERVER_MAX_PACKET_SIZE-sizeof(PacketHeader), data, count, 1);
+    void _vfoHandler(uint8_t* data, int count, void* ctx) {
+        ServerVFO* vfo = (ServerVFO*)ctx;
+        bool compress = vfo->session->compression;
+
+        // Build the packet, the samples follow the VFO header
+        Packet pkt;
+        int dataOffset = sizeof(PacketHeader) + sizeof(VFOHeader);
+        if (compress) {
+            size_t bound = ZSTD_compressBound(count);
+            pkt = newPacket(PACKET_TYPE_VFO, sizeof(VFOHeader) + bound);
+            size_t len = ZSTD_compressCCtx(vfo->cctx, &(*pkt)[dataOffset], bound, data, count, 1);
+            if (ZSTD_isError(len)) { return; }
+            pkt->resize(dataOffset + len);
+            ((PacketHeader*)pkt->data())->size = pkt->size();
         }
         else {
-            bb_pkt_hdr->type = PACKET_TYPE_BASEBAND;
-            bb_pkt_hdr->size = sizeof(PacketHeader) + count;
-            memcpy(&bbuf[sizeof(PacketHeader)], data, count);
+            pkt = newPacket(PACKET_TYPE_VFO, sizeof(VFOHeader) + count);
+            memcpy(&(*pkt)[dataOffset], data, count);
         }
+        VFOHeader* hdr = (VFOHeader*)&(*pkt)[sizeof(PacketHeader)];
+        hdr->id = vfo->id;
+        hdr->compressed = compress;
 
-        // Write to network
-        if (client && client->isOpen()) { client->write(bb_pkt_hdr->size, bbuf); }
+        vfo->session->send(pkt, true);
+    }
+
+    void _fftHandler(dsp::complex_t* data, int count, void* ctx) {
+        ServerFFT* fft = (ServerFFT*)ctx;
+
+        // Window and compute the power spectrum in dB
+        volk_32fc_32f_multiply_32fc((lv_32fc_t*)fft->fftIn, (lv_32fc_t*)data, fft->window, count);
+        fftwf_execute(fft->plan);
+
+        // Average in the linear power domain, only going to dB once the average is complete
+        if (fft->averaging > 1) {
+            if (!fft->avgCount) { memset(fft->accum, 0, fft->size * sizeof(float)); }
+            volk_32fc_magnitude_squared_32f(fft->power, (lv_32fc_t*)fft->fftOut, fft->size);
+            volk_32f_x2_add_32f(fft->accum, fft->accum, fft->power, fft->size);
+            if (++fft->avgCount < fft->averaging) { return; }
+            fft->avgCount = 0;
+
+            // Same normalization as the power spectrum
+            float norm = 1.0f / ((float)fft->averaging * (float)fft->size * (float)fft->size);
+            volk_32f_s32f_multiply_32f(fft->accum, fft->accum, norm, fft->size);
+            volk_32f_log2_32f(fft->power, fft->accum, fft->size);
+            volk_32f_s32f_multiply_32f(fft->power, fft->power, 10.0f * log10f(2.0f), fft->size);
+        }
+        else {
+            volk_32fc_s32f_power_spectrum_32f(fft->power, (lv_32fc_t*)fft->fftOut, fft->size, fft->size);
+        }
+
+        // Quantize to 8 bits over the range of the line
+        float min = fft->power[0];
+        float max = fft->power[0];
+        for (int i = 1; i < fft->size; i++) {
+            min = std::min<float>(min, fft->power[i]);
+            max = std::max<float>(max, fft->power[i]);
+        }
+        min = std::max<float>(min, -200.0f); // Empty bins are -inf
+        float step = std::max<float>((max - min) / 255.0f, 0.01f);
+        float invStep = 1.0f / step;
+        for (int i = 0; i < fft->size; i++) {
+            fft->quant[i] = (uint8_t)roundf(std::clamp<float>((fft->power[i] - min) * invStep, 0.0f, 255.0f));
+        }
+
+        // Neighboring bins are close, so store the differences which compress much better
+        for (int i = fft->size - 1; i > 0; i--) {
+            fft->quant[i] -= fft->quant[i - 1];
+        }
+
+        // Compress and send
+        size_t bound = ZSTD_compressBound(fft->size);
+        int dataOffset = sizeof(PacketHeader) + sizeof(FFTHeader);
+        Packet pkt = newPacket(PACKET_TYPE_FFT, sizeof(FFTHeader) + bound);
+        size_t len = ZSTD_compressCCtx(fft->cctx, &(*pkt)[dataOffset], bound, fft->quant, fft->size, 1);
+        if (ZSTD_isError(len)) { return; }
+        pkt->resize(dataOffset + len);
+        ((PacketHeader*)pkt->data())->size = pkt->size();
+        FFTHeader* hdr = (FFTHeader*)&(*pkt)[sizeof(PacketHeader)];
+        hdr->size = fft->size;
+        hdr->min = min;
+        hdr->step = step;
+
+        std::lock_guard<std::mutex> lck(fft->subMtx);
+        for (auto& session : fft->subscribers) {
+            session->send(pkt, true);
+        }
     }
 
     void setInput(dsp::stream<dsp::complex_t>* stream) {
-        comp.setInput(stream);
+        split.setInput(stream);
     }
 
-    void commandHandler(Command cmd, uint8_t* data, int len) {
+    void commandHandler(Session session, Command cmd, uint8_t* data, int len) {
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
         if (cmd == COMMAND_GET_UI) {
-            sendUI(COMMAND_GET_UI, "", dummyElem);
+            sendUI(session, COMMAND_GET_UI, "", dummyElem);
         }
         else if (cmd == COMMAND_UI_ACTION && len >= 3) {
             // Check if sending back data is needed
@@ -259,48 +1043,165 @@ namespace server {
             // Load id
             SmGui::DrawListElem diffId;
             int count = SmGui::DrawList::loadItem(diffId, &data[i], len);
-            if (count < 0) { sendError(ERROR_INVALID_ARGUMENT); return; }
-            if (diffId.type != SmGui::DRAW_LIST_ELEM_TYPE_STRING) { sendError(ERROR_INVALID_ARGUMENT); return; } 
+            if (count < 0) { sendError(session, ERROR_INVALID_ARGUMENT); return; }
+            if (diffId.type != SmGui::DRAW_LIST_ELEM_TYPE_STRING) { sendError(session, ERROR_INVALID_ARGUMENT); return; } 
             i += count;
             len -= count;
 
             // Load value
             SmGui::DrawListElem diffValue;
             count = SmGui::DrawList::loadItem(diffValue, &data[i], len);
-            if (count < 0) { sendError(ERROR_INVALID_ARGUMENT); return; }
+            if (count < 0) { sendError(session, ERROR_INVALID_ARGUMENT); return; }
             i += count;
             len -= count;
 
+            // Only the controller can change the source settings, others just get the current state back
+            if (!session->controller) {
+                sendError(session, ERROR_NOT_CONTROLLER);
+                if (sendback) { sendUI(session, COMMAND_UI_ACTION, "", dummyElem); }
+                return;
+            }
+
             // Render and send back
             if (sendback) {
-                sendUI(COMMAND_UI_ACTION, diffId.str, diffValue);
+                sendUI(session, COMMAND_UI_ACTION, diffId.str, diffValue);
             }
             else {
                 renderUI(NULL, diffId.str, diffValue);
             }
         }
         else if (cmd == COMMAND_START) {
-            sigpath::sourceManager.start();
-            running = true;
+            startStreaming(session);
         }
         else if (cmd == COMMAND_STOP) {
-            sigpath::sourceManager.stop();
-            running = false;
+            stopStreaming(session);
         }
         else if (cmd == COMMAND_SET_FREQUENCY && len == 8) {
-            sigpath::sourceManager.tune(*(double*)data);
-            sendCommandAck(COMMAND_SET_FREQUENCY, 0);
+            if (session->controller) {
+                sigpath::sourceManager.tune(*(double*)data);
+            }
+            else {
+                sendError(session, ERROR_NOT_CONTROLLER);
+            }
+            sendCommandAck(session, COMMAND_SET_FREQUENCY, 0);
         }
         else if (cmd == COMMAND_SET_SAMPLE_TYPE && len == 1) {
             dsp::compression::PCMType type = (dsp::compression::PCMType)*(uint8_t*)data;
-            comp.setPCMType(type);
+            if (type > dsp::compression::PCM_TYPE_BFP4) { sendError(session, ERROR_INVALID_ARGUMENT); return; }
+
+            // The client's choice becomes the best quality the rate controller will go back up to
+            session->clientPCMType = type;
+            session->rateLevel = 0;
+            applyRateLevel(session);
         }
         else if (cmd == COMMAND_SET_COMPRESSION && len == 1) {
-            compression = *(uint8_t*)data;
+            session->clientCompression = *(uint8_t*)data;
+            applyRateLevel(session);
+        }
+        else if (cmd == COMMAND_SET_ADAPTIVE && len == 1) {
+            session->adaptive = *(uint8_t*)data;
+            session->quietIntervals = 0;
+            if (!session->adaptive && session->rateLevel) {
+                session->rateLevel = 0;
+                applyRateLevel(session);
+                sendStreamFormat(session, 0);
+            }
+        }
+        else if (cmd == COMMAND_ADD_VFO && len == sizeof(VFOConfig)) {
+            VFOConfig* cfg = (VFOConfig*)data;
+            bool exists;
+            int count;
+            {
+                std::lock_guard<std::mutex> lck2(session->vfoMtx);
+                exists = (session->vfos.find(cfg->id) != session->vfos.end());
+                count = session->vfos.size();
+            }
+            if (exists || count >= SERVER_MAX_VFOS || cfg->sampleRate <= 0 || cfg->bandwidth <= 0 || cfg->bandwidth > cfg->sampleRate) {
+                sendError(session, ERROR_INVALID_ARGUMENT);
+                return;
+            }
+            addVFO(session, *cfg);
+        }
+        else if (cmd == COMMAND_SET_VFO && len == sizeof(VFOConfig)) {
+            VFOConfig* cfg = (VFOConfig*)data;
+            if (cfg->sampleRate <= 0 || cfg->bandwidth <= 0 || cfg->bandwidth > cfg->sampleRate) {
+                sendError(session, ERROR_INVALID_ARGUMENT);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lck2(session->vfoMtx);
+            auto it = session->vfos.find(cfg->id);
+            if (it == session->vfos.end()) {
+                sendError(session, ERROR_INVALID_ARGUMENT);
+                return;
+            }
+
+            // Only touch what changed since changing the samplerate restarts the DDC
+            dsp::channel::RxVFO& ddc = it->second->ddc;
+            if (cfg->sampleRate != ddc.getOutSamplerate()) {
+                ddc.setOutSamplerate(cfg->sampleRate, cfg->bandwidth);
+            }
+            else if (cfg->bandwidth != ddc.getBandwidth()) {
+                ddc.setBandwidth(cfg->bandwidth);
+            }
+            if (cfg->offset != ddc.getOffset()) {
+                ddc.setOffset(cfg->offset);
+            }
+        }
+        else if (cmd == COMMAND_REMOVE_VFO && len == sizeof(uint32_t)) {
+            removeVFO(session, *(uint32_t*)data);
+        }
+        else if (cmd == COMMAND_SET_FULL_IQ && len == 1) {
+            bool fullIQ = *(uint8_t*)data;
+            if (fullIQ == session->fullIQ) { return; }
+            if (session->streaming) {
+                if (fullIQ) {
+                    subscribe(session);
+                }
+                else {
+                    unsubscribe(session);
+                }
+            }
+            session->fullIQ = fullIQ;
+        }
+        else if (cmd == COMMAND_SET_FFT && len == sizeof(FFTConfig)) {
+            FFTConfig* cfg = (FFTConfig*)data;
+            if (cfg->size && (cfg->size > SERVER_MAX_FFT_SIZE || cfg->rate <= 0 || cfg->rate > SERVER_MAX_FFT_RATE || !cfg->averaging || cfg->averaging > SERVER_MAX_FFT_AVERAGING)) {
+                sendError(session, ERROR_INVALID_ARGUMENT);
+                return;
+            }
+            removeFFT(session);
+            if (cfg->size && !addFFT(session, *cfg)) {
+                flog::warn("Refused the FFT settings of client {0}, the server FFT budget is used up", session->id);
+                sendError(session, ERROR_INVALID_ARGUMENT);
+            }
+        }
+        else if (cmd == COMMAND_SET_UDP && len == 1) {
+            // The client gets a token to send back over UDP so that its address can be learned even through NAT
+            session->udpReady = false;
+            session->udpToken = 0;
+            if (!*(uint8_t*)data) { return; }
+            if (!udpConn) {
+                sendError(session, ERROR_INVALID_COMMAND);
+                return;
+            }
+            // Anyone can send datagrams to the port, the token must not be guessable
+            uint64_t token;
+            do {
+                token = ((uint64_t)tokenRng() << 32) | (uint64_t)tokenRng();
+            } while (!token);
+            session->udpToken = token;
+
+            Packet pkt = newCommand(PACKET_TYPE_COMMAND, COMMAND_SET_UDP_TOKEN, sizeof(uint64_t));
+            *(uint64_t*)commandData(pkt) = token;
+            session->send(pkt);
+        }
+        else if (cmd == COMMAND_REQUEST_CONTROL) {
+            grantControl(session);
         }
         else {
             flog::error("Invalid Command: {0} (len = {1})", (int)cmd, len);
-            sendError(ERROR_INVALID_COMMAND);
+            sendError(session, ERROR_INVALID_COMMAND);
         }
     }
 
@@ -339,49 +1240,95 @@ namespace server {
         }
     }
 
-    void sendUI(Command originCmd, std::string diffId, SmGui::DrawListElem diffValue) {
+    void sendUI(Session session, Command originCmd, std::string diffId, SmGui::DrawListElem diffValue) {
         // Render UI
         SmGui::DrawList dl;
         renderUI(&dl, diffId, diffValue);
 
         // Create response
         int size = dl.getSize();
-        dl.store(s_cmd_data, size);
+        Packet pkt = newCommand(PACKET_TYPE_COMMAND_ACK, originCmd, size);
+        dl.store(commandData(pkt), size);
 
         // Send to network
-        sendCommandAck(originCmd, size);
+        session->send(pkt);
+    }
+
+    void sendError(Session session, Error err) {
+        Packet pkt = newPacket(PACKET_TYPE_ERROR, 1);
+        (*pkt)[sizeof(PacketHeader)] = err;
+        session->send(pkt);
     }
 
-    void sendError(Error err) {
-        PacketHeader* hdr = (PacketHeader*)sbuf;
-        s_pkt_data[0] = err;
-        sendPacket(PACKET_TYPE_ERROR, 1);
+    void sendSampleRate(Session session, double sampleRate) {
+        Packet pkt = newCommand(PACKET_TYPE_COMMAND, COMMAND_SET_SAMPLERATE, sizeof(double));
+        *(double*)commandData(pkt) = sampleRate;
+        session->send(pkt);
     }
 
-    void sendSampleRate(double sampleRate) {
-        *(double*)s_cmd_data = sampleRate;
-        sendCommand(COMMAND_SET_SAMPLERATE, sizeof(double));
+    void sendControl(Session session) {
+        Packet pkt = newCommand(PACKET_TYPE_COMMAND, COMMAND_SET_CONTROL, 1);
+        commandData(pkt)[0] = session->controller;
+        session->send(pkt);
+    }
+
+    void sendCommandAck(Session session, Command cmd, int len) {
+        session->send(newCommand(PACKET_TYPE_COMMAND_ACK, cmd, len));
     }
 
     void setInputSampleRate(double samplerate) {
+        // Same locking as the commands, they also create and destroy the VFOs and FFTs
+        std::lock_guard<std::recursive_mutex> lck(cmdMtx);
         sampleRate = samplerate;
-        if (!client || !client->isOpen()) { return; }
-        sendSampleRate(sampleRate);
+        std::vector<Session> current;
+        {
+            std::lock_guard<std::mutex> lck2(sessionsMtx);
+            current = sessions;
+        }
+
+        for (auto& session : current) {
+            sendSampleRate(session, sampleRate);
+            {
+                std::lock_guard<std::mutex> lck2(session->vfoMtx);
+                for (auto const& [id, vfo] : session->vfos) {
+                    vfo->ddc.setInSamplerate(sampleRate);
+                }
+            }
+
+        }
+
+        // The FFT reshaping depends on the samplerate, rebuild the FFTs and move their clients over
+        for (auto& fft : ffts) {
+            ServerFFT* rebuilt = createFFT(fft->config);
+            {
+                std::lock_guard<std::mutex> lck2(fft->subMtx);
+                rebuilt->subscribers = fft->subscribers;
+            }
+            for (auto& session : rebuilt->subscribers) {
+                std::lock_guard<std::mutex> lck2(session->fftMtx);
+                session->fft = rebuilt;
+            }
+            destroyFFT(fft);
+            fft = rebuilt;
+        }
     }
 
-    void sendPacket(PacketType type, int len) {
-        s_pkt_hdr->type = type;
-        s_pkt_hdr->size = sizeof(PacketHeader) + len;
-        client->write(s_pkt_hdr->size, sbuf);
+    Packet newPacket(PacketType type, int len) {
+        Packet pkt = std::make_shared<std::vector<uint8_t>>(sizeof(PacketHeader) + len);
+        PacketHeader* hdr = (PacketHeader*)pkt->data();
+        hdr->type = type;
+        hdr->size = pkt->size();
+        return pkt;
     }
 
-    void sendCommand(Command cmd, int len) {
-        s_cmd_hdr->cmd = cmd;
-        sendPacket(PACKET_TYPE_COMMAND, sizeof(CommandHeader) + len);
+    Packet newCommand(PacketType type, Command cmd, int len) {
+        Packet pkt = newPacket(type, sizeof(CommandHeader) + len);
+        CommandHeader* hdr = (CommandHeader*)&(*pkt)[sizeof(PacketHeader)];
+        hdr->cmd = cmd;
+        return pkt;
     }
 
-    void sendCommandAck(Command cmd, int len) {
-        s_cmd_hdr->cmd = cmd;
-        sendPacket(PACKET_TYPE_COMMAND_ACK, sizeof(CommandHeader) + len);
+    uint8_t* commandData(Packet pkt) {
+        return &(*pkt)[sizeof(PacketHeader) + sizeof(CommandHeader)];
     }
 }
@@ -2,26 +2,140 @@
 #include <utils/networking.h>
 #include <dsp/stream.h>
 #include <dsp/types.h>
+#include <dsp/compression/pcm_type.h>
 #include <server_protocol.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Maximum number of clients connected at the same time
+#define SERVER_MAX_CLIENTS      16
+
+// Time given to rejected clients to receive the disconnect command before closing the connection
+#define SERVER_REJECT_LINGER_MS 500
+
+// Maximum number of baseband packets waiting to be sent to a single client
+#define SERVER_SEND_QUEUE_SIZE  8
+
+// Interval at which the rate controller evaluates each client
+#define SERVER_RATE_CONTROL_INTERVAL_MS 500
+
+// Number of quiet intervals before the rate controller raises the quality again
+#define SERVER_RATE_CONTROL_RECOVERY    10
+
+// Maximum number of server-side VFOs per client
+#define SERVER_MAX_VFOS         16
+
+// Limits of the server-side FFT
+#define SERVER_MAX_FFT_SIZE     524288
+#define SERVER_MAX_FFT_RATE     200
+#define SERVER_MAX_FFT_AVERAGING 64
+
+// Budget of all server-side FFTs together in bins per second (size x rate x averaging), clients asking for the same settings share an FFT
+#define SERVER_MAX_FFT_LOAD     (64.0 * 1024.0 * 1024.0)
 
 namespace server {
+    typedef std::shared_ptr<std::vector<uint8_t>> Packet;
+
+    struct ServerVFO;
+    struct ServerFFT;
+
+    class ClientSession {
+    public:
+        ClientSession(int id, net::Conn conn);
+        ~ClientSession();
+
+        // Queue a packet for sending, droppable packets are discarded if the queue is full
+        void send(Packet pkt, bool droppable = false);
+        void close();
+        bool isOpen();
+        int getQueueDepth();
+
+        int id;
+        net::Conn conn;
+        uint8_t* rbuf = NULL;
+
+        // Per-client stream settings
+        std::atomic<dsp::compression::PCMType> pcmType;
+        std::atomic<bool> compression;
+        bool streaming = false;
+        bool fullIQ = true;
+        bool controller = false;
+        std::atomic<bool> closing;
+
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> bytesSent;
+
+        // Rate control, the client's settings are the highest quality level (level 0)
+        bool adaptive = false;
+        dsp::compression::PCMType clientPCMType = dsp::compression::PCM_TYPE_I16;
+        bool clientCompression = false;
+        int rateLevel = 0;
+        int quietIntervals = 0;
+        uint64_t lastDropped = 0;
+        uint64_t lastBytesSent = 0;
+
+        // Server-side VFOs owned by this client
+        std::map<uint32_t, ServerVFO*> vfos;
+        std::mutex vfoMtx;
+
+        // UDP data channel, droppable packets go through it once the client's hello was received
+        std::atomic<bool> udpReady;
+        std::atomic<uint64_t> udpToken;
+        struct sockaddr_in tcpAddr = {};
+        struct sockaddr_in udpAddr = {};
+        std::chrono::steady_clock::time_point lastHello;
+        std::mutex udpMtx;
+
+        // Server-side spectrum, NULL when disabled
+        ServerFFT* fft = NULL;
+        FFTConfig fftConfig = {};
+        std::mutex fftMtx;
+
+    private:
+        void sendWorker();
+        bool sendDatagrams(const Packet& pkt);
+
+        uint32_t udpSeq = 0;
+        uint32_t udpPacketSeq = 0;
+        uint8_t parity[SERVER_UDP_PAYLOAD_SIZE];
+
+        std::mutex queueMtx;
+        std::condition_variable queueCnd;
+        std::deque<std::pair<Packet, bool>> queue;
+        int droppableCount = 0;
+        bool stopSender = false;
+        std::thread senderThread;
+    };
+
+    typedef std::shared_ptr<ClientSession> Session;
+
     void setInput(dsp::stream<dsp::complex_t>* stream);
     int main();
 
     void _clientHandler(net::Conn conn, void* ctx);
     void _packetHandler(int count, uint8_t* buf, void* ctx);
-    void _testServerHandler(uint8_t* data, int count, void* ctx);
+    void _packetBodyHandler(int count, uint8_t* body, void* ctx);
+    void _encoderHandler(uint8_t* data, int count, void* ctx);
+    void _vfoHandler(uint8_t* data, int count, void* ctx);
+    void _fftHandler(dsp::complex_t* data, int count, void* ctx);
+    void _udpHandler(int count, uint8_t* buf, void* ctx);
 
     void drawMenu();
 
-    void commandHandler(Command cmd, uint8_t* data, int len);
+    void commandHandler(Session session, Command cmd, uint8_t* data, int len);
     void renderUI(SmGui::DrawList* dl, std::string diffId, SmGui::DrawListElem diffValue);
-    void sendUI(Command originCmd, std::string diffId, SmGui::DrawListElem diffValue);
-    void sendError(Error err);
-    void sendSampleRate(double sampleRate);
+    void sendUI(Session session, Command originCmd, std::string diffId, SmGui::DrawListElem diffValue);
+    void sendError(Session session, Error err);
+    void sendSampleRate(Session session, double sampleRate);
+    void sendControl(Session session);
+    void sendCommandAck(Session session, Command cmd, int len);
     void setInputSampleRate(double samplerate);
 
-    void sendPacket(PacketType type, int len);
-    void sendCommand(Command cmd, int len);
-    void sendCommandAck(Command cmd, int len);
+    Packet newPacket(PacketType type, int len);
+    Packet newCommand(PacketType type, Command cmd, int len);
+    uint8_t* commandData(Packet pkt);
 }
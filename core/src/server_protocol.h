@@ -5,6 +5,17 @@
 
 #define SERVER_MAX_PACKET_SIZE  (STREAM_BUFFER_SIZE * sizeof(dsp::complex_t) * 2)
 
+// Payload of a datagram of the UDP data channel, small enough to avoid IP fragmentation
+#define SERVER_UDP_PAYLOAD_SIZE 1200
+
+// Number of datagrams protected by one XOR parity datagram
+#define SERVER_UDP_FEC_GROUP    8
+
+// The client registers its UDP address and keeps the NAT mapping open with hello datagrams
+#define SERVER_UDP_HELLO_MAGIC  0x53505544
+#define SERVER_UDP_KEEPALIVE_MS 1000
+#define SERVER_UDP_TIMEOUT_MS   5000
+
 namespace server {
     enum PacketType {
         // Client to Server
@@ -27,17 +38,29 @@ namespace server {
         COMMAND_GET_SAMPLERATE,
         COMMAND_SET_SAMPLE_TYPE,
         COMMAND_SET_COMPRESSION,
+        COMMAND_REQUEST_CONTROL,
+        COMMAND_ADD_VFO,
+        COMMAND_SET_VFO,
+        COMMAND_REMOVE_VFO,
+        COMMAND_SET_FULL_IQ,
+        COMMAND_SET_FFT,
+        COMMAND_SET_ADAPTIVE,
+        COMMAND_SET_UDP,
 
         // Server to client
         COMMAND_SET_SAMPLERATE = 0x80,
-        COMMAND_DISCONNECT
+        COMMAND_DISCONNECT,
+        COMMAND_SET_CONTROL,
+        COMMAND_SET_STREAM_FORMAT,
+        COMMAND_SET_UDP_TOKEN
     };
 
     enum Error {
         ERROR_NONE = 0x00,
         ERROR_INVALID_PACKET,
         ERROR_INVALID_COMMAND,
-        ERROR_INVALID_ARGUMENT
+        ERROR_INVALID_ARGUMENT,
+        ERROR_NOT_CONTROLLER
     };
     
 #pragma pack(push, 1)
@@ -49,5 +72,59 @@ namespace server {
     struct CommandHeader {
         uint32_t cmd;
     };
+
+    struct VFOConfig {
+        uint32_t id;
+        double sampleRate;
+        double bandwidth;
+        double offset;
+    };
+
+    // Prepended to the compressed samples of a PACKET_TYPE_VFO packet
+    struct VFOHeader {
+        uint32_t id;
+        uint8_t compressed;
+    };
+    // Sent by the server when the rate controller changes the stream format
+    struct StreamFormat {
+        uint8_t pcmType;
+        uint8_t compression;
+        uint8_t level;
+        uint8_t queueDepth;
+        uint32_t throughput; // Bytes per second
+    };
+
+    // A size of zero disables the server-side FFT
+    struct FFTConfig {
+        uint32_t size;
+        double rate;
+        uint32_t averaging;
+    };
+
+    // Prepended to the zstd compressed, delta coded 8 bit bins of a PACKET_TYPE_FFT packet
+    struct FFTHeader {
+        uint32_t size;
+        float min;
+        float step;
+    };
+
+    // Prepended to every datagram of the UDP data channel. Packets are split into fragments
+    // and each group of SERVER_UDP_FEC_GROUP fragments is followed by the XOR of their payloads.
+    struct DatagramHeader {
+        uint32_t seq;           // Sequence number of the datagram, parity included
+        uint32_t packetSeq;     // Sequence number of the packet the datagram belongs to
+        uint64_t timestamp;     // Send time in microseconds
+        uint32_t packetSize;    // Size of the packet payload, without its PacketHeader
+        uint16_t index;         // Index of the fragment, or of the group for a parity datagram
+        uint16_t fragCount;
+        uint8_t type;           // PacketType of the packet
+        uint8_t parity;
+    };
+
+    // Sent by the client to the server's UDP port with the token given by COMMAND_SET_UDP_TOKEN
+    struct DatagramHello {
+        uint32_t magic;
+        uint64_t token;
+    };
 #pragma pack(pop)
 }
\ No newline at end of file
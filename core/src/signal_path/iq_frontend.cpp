@@ -8,6 +8,7 @@
 IQFrontEnd::~IQFrontEnd() {
     if (!_init) { return; }
     stop();
+    freeFFTFrames();
     dsp::buffer::free(fftWindowBuf);
     fftwf_destroy_plan(fftwPlan);
     fftwf_free(fftInBuf);
@@ -64,6 +65,11 @@ void IQFrontEnd::init(dsp::stream<dsp::complex_t>* in, double sampleRate, bool b
     // Clear the rest of the FFT input buffer
     dsp::buffer::clear(fftInBuf, _fftSize - _nzFFTSize, _nzFFTSize);
 
+    // Size the FFT worker pool, leaving most cores to the VFOs
+    fftWorkerCount = std::clamp<int>(std::thread::hardware_concurrency() / 4, 1, 4);
+    fftQueueSize = fftWorkerCount * 2;
+    allocFFTFrames();
+
     split.bindStream(&fftIn);
 
     _init = true;
@@ -96,6 +102,8 @@ void IQFrontEnd::setSampleRate(double sampleRate) {
     for (auto& [name, vfo] : vfos) {
         vfo->tempStart();
     }
+
+    onSampleRateChanged.emit(getSampleRate());
 }
 
 void IQFrontEnd::setBuffering(bool enabled) {
@@ -217,6 +225,7 @@ void IQFrontEnd::start() {
     }
 
     // Start FFT chain
+    startFFTWorkers();
     reshape.start();
     fftSink.start();
 }
@@ -239,37 +248,167 @@ void IQFrontEnd::stop() {
     // Stop FFT chain
     reshape.stop();
     fftSink.stop();
+    stopFFTWorkers();
 }
 
 double IQFrontEnd::getEffectiveSamplerate() {
     return effectiveSr;
 }
 
+uint64_t IQFrontEnd::getDroppedFFTFrames() {
+    std::lock_guard<std::mutex> lck(fftQueueMtx);
+    return fftDropped;
+}
+
 void IQFrontEnd::handler(dsp::complex_t* data, int count, void* ctx) {
     IQFrontEnd* _this = (IQFrontEnd*)ctx;
 
-    // Apply window
-    volk_32fc_32f_multiply_32fc((lv_32fc_t*)_this->fftInBuf, (lv_32fc_t*)data, _this->fftWindowBuf, _this->_nzFFTSize);
+    // Find a free frame, drop this one if the workers can't keep up instead of stalling the splitter
+    FFTFrame* frame;
+    {
+        std::lock_guard<std::mutex> lck(_this->fftQueueMtx);
+        if (_this->fftWriteSeq - _this->fftDeliverSeq >= (uint64_t)_this->fftQueueSize) {
+            _this->fftDropped++;
+            return;
+        }
+        frame = &_this->fftFrames[_this->fftWriteSeq % _this->fftQueueSize];
+    }
 
-    // Execute FFT
-    fftwf_execute(_this->fftwPlan);
+    // Copy the samples, windowing is done by the workers
+    memcpy(frame->in, data, _this->_nzFFTSize * sizeof(dsp::complex_t));
 
-    // Aquire buffer
-    float* fftBuf = _this->_acquireFFTBuffer(_this->_fftCtx);
+    // Queue the frame
+    {
+        std::lock_guard<std::mutex> lck(_this->fftQueueMtx);
+        _this->fftWriteSeq++;
+    }
+    _this->fftQueueCnd.notify_one();
+}
 
-    // Convert the complex output of the FFT to dB amplitude
-    if (fftBuf) {
-        volk_32fc_s32f_power_spectrum_32f(fftBuf, (lv_32fc_t*)_this->fftOutBuf, _this->_fftSize, _this->_fftSize);
+void IQFrontEnd::allocFFTFrames() {
+    fftFrames.resize(fftQueueSize);
+    for (auto& frame : fftFrames) {
+        frame.in = (fftwf_complex*)fftwf_malloc(_fftSize * sizeof(fftwf_complex));
+        frame.power = dsp::buffer::alloc<float>(_fftSize);
+        frame.ready = false;
+
+        // Clear the zero-padded part of the frame, it's never written to
+        dsp::buffer::clear(frame.in, _fftSize - _nzFFTSize, _nzFFTSize);
     }
+}
 
-    // Release buffer
-    _this->_releaseFFTBuffer(_this->_fftCtx);
+void IQFrontEnd::freeFFTFrames() {
+    for (auto& frame : fftFrames) {
+        fftwf_free(frame.in);
+        dsp::buffer::free(frame.power);
+    }
+    fftFrames.clear();
+}
+
+void IQFrontEnd::startFFTWorkers() {
+    if (!fftWorkerThreads.empty()) { return; }
+    fftWorkersStop = false;
+    for (int i = 0; i < fftWorkerCount; i++) {
+        fftWorkerThreads.push_back(std::thread(&IQFrontEnd::fftWorker, this));
+    }
+}
+
+void IQFrontEnd::stopFFTWorkers() {
+    {
+        std::lock_guard<std::mutex> lck(fftQueueMtx);
+        fftWorkersStop = true;
+    }
+    fftQueueCnd.notify_all();
+    for (auto& th : fftWorkerThreads) {
+        if (th.joinable()) { th.join(); }
+    }
+    fftWorkerThreads.clear();
+
+    // Discard any frame that wasn't delivered
+    fftWriteSeq = 0;
+    fftProcSeq = 0;
+    fftDeliverSeq = 0;
+    for (auto& frame : fftFrames) {
+        frame.ready = false;
+    }
+}
+
+void IQFrontEnd::fftWorker() {
+    fftwf_complex* out = (fftwf_complex*)fftwf_malloc(_fftSize * sizeof(fftwf_complex));
+
+    while (true) {
+        // Grab a batch of consecutive frames
+        uint64_t first;
+        int count;
+        {
+            std::unique_lock<std::mutex> lck(fftQueueMtx);
+            fftQueueCnd.wait(lck, [this]() { return fftProcSeq < fftWriteSeq || fftWorkersStop; });
+            if (fftWorkersStop) { break; }
+            first = fftProcSeq;
+            count = std::min<int>(fftWriteSeq - fftProcSeq, FFT_MAX_BATCH_SIZE);
+            fftProcSeq += count;
+        }
+
+        for (uint64_t seq = first; seq < first + count; seq++) {
+            FFTFrame* frame = &fftFrames[seq % fftQueueSize];
+
+            // Apply window
+            volk_32fc_32f_multiply_32fc((lv_32fc_t*)frame->in, (lv_32fc_t*)frame->in, fftWindowBuf, _nzFFTSize);
+
+            // Execute FFT (the plan is shared, only the arrays differ)
+            fftwf_execute_dft(fftwPlan, frame->in, out);
+
+            // Convert the complex output of the FFT to dB amplitude
+            volk_32fc_s32f_power_spectrum_32f(frame->power, (lv_32fc_t*)out, _fftSize, _fftSize);
+
+            std::lock_guard<std::mutex> lck(fftQueueMtx);
+            frame->ready = true;
+        }
+
+        deliverFFTFrames();
+    }
+
+    fftwf_free(out);
+}
+
+void IQFrontEnd::deliverFFTFrames() {
+    // Only one thread may deliver at a time so that frames stay in order
+    std::lock_guard<std::mutex> dlck(fftDeliverMtx);
+    while (true) {
+        FFTFrame* frame;
+        {
+            std::lock_guard<std::mutex> lck(fftQueueMtx);
+            if (fftDeliverSeq == fftProcSeq) { return; }
+            frame = &fftFrames[fftDeliverSeq % fftQueueSize];
+            if (!frame->ready) { return; }
+        }
+
+        // Aquire buffer
+        float* fftBuf = _acquireFFTBuffer(_fftCtx);
+
+        // Copy the spectrum
+        if (fftBuf) {
+            memcpy(fftBuf, frame->power, _fftSize * sizeof(float));
+        }
+
+        // Release buffer
+        _releaseFFTBuffer(_fftCtx);
+
+        // Free the frame
+        {
+            std::lock_guard<std::mutex> lck(fftQueueMtx);
+            frame->ready = false;
+            fftDeliverSeq++;
+        }
+    }
 }
 
 void IQFrontEnd::updateFFTPath(bool updateWaterfall) {
     // Temp stop branch
     reshape.tempStop();
     fftSink.tempStop();
+    bool workersRunning = !fftWorkerThreads.empty();
+    stopFFTWorkers();
 
     // Update reshaper settings
     int skip;
@@ -300,10 +439,15 @@ void IQFrontEnd::updateFFTPath(bool updateWaterfall) {
     // Clear the rest of the FFT input buffer
     dsp::buffer::clear(fftInBuf, _fftSize - _nzFFTSize, _nzFFTSize);
 
+    // Reallocate the FFT frames
+    freeFFTFrames();
+    allocFFTFrames();
+
     // Update waterfall (TODO: This is annoying, it makes this module non testable and will constantly clear the waterfall for any reason)
     if (updateWaterfall) { gui::waterfall.setRawFFTSize(_fftSize); }
 
     // Restart branch
+    if (workersRunning) { startFFTWorkers(); }
     reshape.tempStart();
     fftSink.tempStart();
 }
\ No newline at end of file
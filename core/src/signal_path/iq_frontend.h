@@ -8,7 +8,13 @@
 #include "../dsp/channel/rx_vfo.h"
 #include "../dsp/sink/handler_sink.h"
 #include "../dsp/math/conjugate.h"
+#include "../utils/event.h"
 #include <fftw3.h>
+#include <thread>
+#include <condition_variable>
+
+// Maximum number of queued FFT frames handled by a worker in one go
+#define FFT_MAX_BATCH_SIZE 4
 
 class IQFrontEnd {
 public:
@@ -48,10 +54,28 @@ public:
 
     double getEffectiveSamplerate();
 
+    uint64_t getDroppedFFTFrames();
+
+    // Emitted with the new rate after the samplerate or the decimation changed, from the thread that changed it (UI or source worker)
+    Event<double> onSampleRateChanged;
+
 protected:
+    struct FFTFrame {
+        fftwf_complex* in;
+        float* power;
+        bool ready;
+    };
+
     static void handler(dsp::complex_t* data, int count, void* ctx);
     void updateFFTPath(bool updateWaterfall = false);
 
+    void allocFFTFrames();
+    void freeFFTFrames();
+    void startFFTWorkers();
+    void stopFFTWorkers();
+    void fftWorker();
+    void deliverFFTFrames();
+
     static inline double genDCBlockRate(double sampleRate) {
         return 50.0 / sampleRate;
     }
@@ -100,6 +124,21 @@ protected:
     fftwf_plan fftwPlan;
     float* fftDbOut;
 
+    // FFT worker pool. Frames are numbered in the order they leave the reshaper,
+    // processed in parallel and delivered to the waterfall in that same order.
+    int fftWorkerCount;
+    int fftQueueSize;
+    std::vector<FFTFrame> fftFrames;
+    std::vector<std::thread> fftWorkerThreads;
+    std::mutex fftQueueMtx;
+    std::condition_variable fftQueueCnd;
+    std::mutex fftDeliverMtx;
+    uint64_t fftWriteSeq = 0;
+    uint64_t fftProcSeq = 0;
+    uint64_t fftDeliverSeq = 0;
+    uint64_t fftDropped = 0;
+    bool fftWorkersStop = false;
+
     double effectiveSr;
 
     bool _init = false;
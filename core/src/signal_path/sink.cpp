@@ -3,11 +3,66 @@
 #include <imgui/imgui.h>
 #include <gui/style.h>
 #include <gui/icons.h>
+#include <dsp/sink/handler_sink.h>
+#include <utils/wav.h>
 
 #include <core.h>
 
 #define CONCAT(a, b) ((std::string(a) + b).c_str())
 
+// Used instead of the configured sinks while offline, writes the audio to a file or discards it
+class OfflineSink : public SinkManager::Sink {
+public:
+    OfflineSink(SinkManager::Stream* stream, std::string path) {
+        this->stream = stream;
+        this->path = path;
+        sink.init(stream->sinkOut, handler, this);
+    }
+
+    ~OfflineSink() {
+        stop();
+    }
+
+    void start() {
+        if (running) { return; }
+        if (!path.empty()) {
+            // Nothing is real-time anymore, the writer may hold back the DSP rather than drop audio
+            writer.setChannels(2);
+            writer.setSampleType(wav::SAMP_TYPE_INT16);
+            writer.setSamplerate(stream->getSampleRate());
+            writer.setBlocking(true);
+            if (!writer.open(path)) {
+                flog::error("Could not open '{0}' for offline audio output", path);
+            }
+        }
+        sink.start();
+        running = true;
+    }
+
+    void stop() {
+        if (!running) { return; }
+        sink.stop();
+        writer.close();
+        running = false;
+    }
+
+    void menuHandler() {
+        ImGui::TextUnformatted(path.empty() ? "Offline, audio discarded" : "Offline, writing to file");
+    }
+
+private:
+    static void handler(dsp::stereo_t* data, int count, void* ctx) {
+        OfflineSink* _this = (OfflineSink*)ctx;
+        _this->writer.write((float*)data, count);
+    }
+
+    SinkManager::Stream* stream;
+    std::string path;
+    dsp::sink::Handler<dsp::stereo_t> sink;
+    wav::Writer writer;
+    bool running = false;
+};
+
 SinkManager::SinkManager() {
     SinkManager::SinkProvider prov;
     prov.create = SinkManager::NullSink::create;
@@ -141,13 +196,9 @@ void SinkManager::registerStream(std::string name, SinkManager::Stream* stream)
         return;
     }
 
-    SinkManager::SinkProvider provider;
-
-    provider = providers["None"];
-
-    stream->sink = provider.create(stream, name, provider.ctx);
     stream->providerId = std::distance(providerNames.begin(), std::find(providerNames.begin(), providerNames.end(), "None"));
     stream->providerName = "None";
+    stream->sink = createSink(name, stream);
 
     streams[name] = stream;
     streamNames.push_back(name);
@@ -232,13 +283,31 @@ void SinkManager::setStreamSink(std::string name, std::string providerName) {
     delete stream->sink;
     stream->providerId = std::distance(providerNames.begin(), std::find(providerNames.begin(), providerNames.end(), providerName));
     stream->providerName = providerName;
-    SinkManager::SinkProvider prov = providers[providerName];
-    stream->sink = prov.create(stream, name, prov.ctx);
+    stream->sink = createSink(name, stream);
     if (stream->running) {
         stream->sink->start();
     }
 }
 
+void SinkManager::setOffline(bool offline, std::string outputDir) {
+    if (offline == this->offline && outputDir == offlineDir) { return; }
+    this->offline = offline;
+    offlineDir = outputDir;
+
+    // Swap the sink of every stream, keeping the configured provider for when going back online
+    for (auto& [name, stream] : streams) {
+        if (stream->running) {
+            stream->sink->stop();
+        }
+        delete stream->sink;
+        stream->sink = createSink(name, stream);
+        if (stream->running) {
+            stream->sink->start();
+        }
+    }
+    flog::info("Audio sinks are now {0}", offline ? "offline" : "online");
+}
+
 void SinkManager::showVolumeSlider(std::string name, std::string prefix, float width, float btnHeight, int btnBorder, bool sameLine) {
     // TODO: Replace map with some hashmap for it to be faster
     float height = ImGui::GetTextLineHeightWithSpacing() + 2;
@@ -313,10 +382,9 @@ void SinkManager::loadStreamConfig(std::string name) {
         stream->sink->stop();
     }
     delete stream->sink;
-    SinkManager::SinkProvider prov = providers[provName];
     stream->providerId = std::distance(providerNames.begin(), std::find(providerNames.begin(), providerNames.end(), provName));
     stream->providerName = provName;
-    stream->sink = prov.create(stream, name, prov.ctx);
+    stream->sink = createSink(name, stream);
     if (stream->running) {
         stream->sink->start();
     }
@@ -381,6 +449,21 @@ std::vector<std::string> SinkManager::getStreamNames() {
     return streamNames;
 }
 
+SinkManager::Sink* SinkManager::createSink(std::string name, Stream* stream) {
+    if (offline) {
+        if (offlineDir.empty()) { return new OfflineSink(stream, ""); }
+
+        // Stream names are user visible, keep only what's safe in a file name
+        std::string fileName = name;
+        for (auto& c : fileName) {
+            if (!isalnum(c) && c != '-' && c != '_') { c = '_'; }
+        }
+        return new OfflineSink(stream, offlineDir + "/" + fileName + ".wav");
+    }
+    SinkManager::SinkProvider prov = providers[stream->providerName];
+    return prov.create(stream, name, prov.ctx);
+}
+
 void SinkManager::refreshProviders() {
     providerNamesTxt.clear();
     for (auto& provName : providerNames) {
@@ -106,6 +106,15 @@ public:
     dsp::stream<dsp::stereo_t>* bindStream(std::string name);
     void unbindStream(std::string name, dsp::stream<dsp::stereo_t>* stream);
 
+    /**
+     * Replace the sink of every stream while the input is processed faster than real time,
+     * audio devices can't keep up with it. The configured sinks are restored once disabled.
+     * @param offline True to enable.
+     * @param outputDir Directory to write each stream into as a WAV file, empty to discard the audio.
+     */
+    void setOffline(bool offline, std::string outputDir = "");
+    bool isOffline() { return offline; }
+
     void loadSinksFromConfig();
     void showMenu();
 
@@ -123,10 +132,14 @@ private:
     void loadStreamConfig(std::string name);
     void saveStreamConfig(std::string name);
     void refreshProviders();
+    SinkManager::Sink* createSink(std::string name, Stream* stream);
 
     std::map<std::string, SinkProvider> providers;
     std::map<std::string, Stream*> streams;
     std::vector<std::string> providerNames;
     std::string providerNamesTxt;
     std::vector<std::string> streamNames;
+
+    bool offline = false;
+    std::string offlineDir;
 };
\ No newline at end of file
@@ -103,4 +103,8 @@ void SourceManager::setTuningMode(TuningMode mode) {
 void SourceManager::setPanadapterIF(double freq) {
     ifFreq = freq;
     tune(currentFreq);
-}
\ No newline at end of file
+}
+void SourceManager::signalEndOfStream() {
+    flog::info("End of stream from source '{0}'", selectedName);
+    onEndOfStream.emit(selectedName);
+}
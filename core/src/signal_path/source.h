@@ -37,12 +37,16 @@ public:
     void setTuningMode(TuningMode mode);
     void setPanadapterIF(double freq);
 
+    // Called by sources with a finite input (e.g. a file played offline) once all of it was delivered
+    void signalEndOfStream();
+
     std::vector<std::string> getSourceNames();
 
     Event<std::string> onSourceRegistered;
     Event<std::string> onSourceUnregister;
     Event<std::string> onSourceUnregistered;
     Event<double> onRetune;
+    Event<std::string> onEndOfStream;
 
 private:
     std::map<std::string, SourceHandler*> sources;
@@ -200,6 +200,13 @@ bool VFOManager::vfoExists(std::string name) {
     return (vfos.find(name) != vfos.end());
 }
 
+VFOManager::VFO* VFOManager::getVFO(std::string name) {
+    if (vfos.find(name) == vfos.end()) {
+        return NULL;
+    }
+    return vfos[name];
+}
+
 void VFOManager::updateFromWaterfall(ImGui::WaterFall* wtf) {
     for (auto const& [name, vfo] : vfos) {
         if (vfo->wtfVFO->centerOffsetChanged) {
@@ -0,0 +1,441 @@
+#include "async_writer.h"
+#include <utils/flog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+namespace async_io {
+    static uint8_t* allocAligned(size_t size) {
+#ifdef _WIN32
+        return (uint8_t*)_aligned_malloc(size, ASYNC_WRITER_ALIGNMENT);
+#else
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, ASYNC_WRITER_ALIGNMENT, size)) { return NULL; }
+        return (uint8_t*)ptr;
+#endif
+    }
+
+    static void freeAligned(uint8_t* ptr) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    static int openFile(const std::string& path, bool truncate, bool direct) {
+#ifdef _WIN32
+        return _open(path.c_str(), _O_WRONLY | _O_BINARY | _O_CREAT | (truncate ? _O_TRUNC : 0), _S_IREAD | _S_IWRITE);
+#else
+        int flags = O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0);
+#ifdef O_DIRECT
+        if (direct) { flags |= O_DIRECT; }
+#endif
+        return ::open(path.c_str(), flags, 0644);
+#endif
+    }
+
+    static void closeFile(int fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    Engine::Engine() {
+        workerThread = std::thread(&Engine::worker, this);
+    }
+
+    Engine::~Engine() {
+        {
+            std::lock_guard<std::mutex> lck(notifyMtx);
+            stopWorker = true;
+        }
+        notifyCnd.notify_all();
+        if (workerThread.joinable()) { workerThread.join(); }
+    }
+
+    void Engine::attach(Writer* writer) {
+        std::lock_guard<std::mutex> lck(writersMtx);
+        writers.push_back(writer);
+    }
+
+    void Engine::detach(Writer* writer) {
+        std::lock_guard<std::mutex> lck(writersMtx);
+        writers.erase(std::remove(writers.begin(), writers.end(), writer), writers.end());
+    }
+
+    void Engine::notify() {
+        {
+            std::lock_guard<std::mutex> lck(notifyMtx);
+            pending = true;
+        }
+        notifyCnd.notify_all();
+    }
+
+    void Engine::worker() {
+        while (true) {
+            // Wait for blocks to be handed over
+            {
+                std::unique_lock<std::mutex> lck(notifyMtx);
+                notifyCnd.wait(lck, [=]() { return pending || stopWorker; });
+                if (stopWorker) { break; }
+                pending = false;
+            }
+
+            // Write out everything that's ready
+            std::lock_guard<std::mutex> lck(writersMtx);
+            for (auto& writer : writers) {
+                writer->service();
+            }
+        }
+    }
+
+    Writer::Writer(Engine* engine) {
+        // Create a private engine if none is shared
+        if (!engine) {
+            ownEngine = new Engine();
+            engine = ownEngine;
+        }
+        this->engine = engine;
+        readIdx = 0;
+        writeIdx = 0;
+        position = 0;
+        highWater = 0;
+        dropped = 0;
+        error = false;
+    }
+
+    Writer::~Writer() {
+        close();
+        if (ownEngine) { delete ownEngine; }
+    }
+
+    void Writer::setBuffering(int blockSize, int blockCount) {
+        if (_open) { throw std::runtime_error("Cannot change parameters while file is open"); }
+        this->blockSize = std::max<int>(1, (blockSize + ASYNC_WRITER_ALIGNMENT - 1) / ASYNC_WRITER_ALIGNMENT) * ASYNC_WRITER_ALIGNMENT;
+        this->blockCount = std::max<int>(blockCount, 2);
+    }
+
+    void Writer::setDirectIO(bool enabled) {
+        if (_open) { throw std::runtime_error("Cannot change parameters while file is open"); }
+        direct = enabled;
+    }
+
+    void Writer::setPreallocation(uint64_t size) {
+        if (_open) { throw std::runtime_error("Cannot change parameters while file is open"); }
+        preallocSize = size;
+    }
+
+    bool Writer::open(std::string path) {
+        // Close previous file
+        if (_open) { close(); }
+        if (!openFile(path)) { return false; }
+
+        // Reset work values
+        readIdx = 0;
+        writeIdx = 0;
+        curLen = 0;
+        position = 0;
+        highWater = 0;
+        dropped = 0;
+        error = false;
+        patches.clear();
+
+        // Allocate the ring and hand it to the I/O thread
+        allocBlocks();
+        engine->attach(this);
+        _open = true;
+        return true;
+    }
+
+    bool Writer::isOpen() {
+        return _open;
+    }
+
+    void Writer::close() {
+        // Do nothing if the file is not open
+        if (!_open) { return; }
+
+        // Hand over the last block and wait for everything to be written
+        if (curLen) { publish(); }
+        engine->notify();
+        {
+            std::unique_lock<std::mutex> lck(drainMtx);
+            drainCnd.wait(lck, [=]() {
+                std::lock_guard<std::mutex> lck2(switchMtx);
+                return readIdx.load() == writeIdx.load() && switches.empty();
+            });
+        }
+        engine->detach(this);
+
+        // Apply the deferred writes and trim the file
+        if (!finalize(patches)) {
+            flog::error("Could not finalize '{}'", path);
+        }
+        patches.clear();
+
+        freeBlocks();
+        _open = false;
+    }
+
+    bool Writer::write(const uint8_t* data, size_t len, bool wait) {
+        if (!_open) { return false; }
+
+        // Drop the whole write if it doesn't fit, unless asked to wait for the disk
+        if (len > freeSpace()) {
+            // A partial block can't be handed over in the middle of a direct I/O file, its padding would end up in the file
+            uint64_t maxSpace = (uint64_t)blockSize * blockCount - (direct ? curLen : 0);
+            if (!wait || len > maxSpace) {
+                dropped += len;
+                return false;
+            }
+            if (curLen && !direct) { publish(); }
+            std::unique_lock<std::mutex> lck(drainMtx);
+            drainCnd.wait(lck, [=]() { return len <= freeSpace(); });
+        }
+
+        // Copy into the blocks, handing over the full ones
+        while (len) {
+            if (!curLen) { curStart = std::chrono::steady_clock::now(); }
+            int n = std::min<size_t>(len, blockSize - curLen);
+            memcpy(&blocks[writeIdx.load(std::memory_order_relaxed) % blockCount][curLen], data, n);
+            curLen += n;
+            data += n;
+            len -= n;
+            position += n;
+            if (curLen == blockSize) { publish(); }
+        }
+
+        // Update the high water mark
+        uint64_t buffered = (writeIdx.load(std::memory_order_relaxed) - readIdx.load(std::memory_order_relaxed)) * (uint64_t)blockSize + curLen;
+        if (buffered > highWater) { highWater = buffered; }
+
+        // Hand over partial blocks regularly so that slow streams still reach the disk
+        if (!direct && curLen && (std::chrono::steady_clock::now() - curStart) > std::chrono::milliseconds(ASYNC_WRITER_FLUSH_MS)) {
+            publish();
+        }
+
+        return true;
+    }
+
+    void Writer::writeAt(uint64_t pos, const uint8_t* data, size_t len) {
+        if (!_open) { return; }
+        Patch patch;
+        patch.pos = pos;
+        patch.data.assign(data, data + len);
+        patches.push_back(std::move(patch));
+    }
+
+    void Writer::split(std::string path) {
+        if (!_open) { return; }
+
+        // Everything queued so far belongs to the current file
+        if (curLen) { publish(); }
+        Switch sw;
+        sw.blockIdx = writeIdx.load(std::memory_order_relaxed);
+        sw.path = path;
+        sw.patches = std::move(patches);
+        patches.clear();
+        {
+            std::lock_guard<std::mutex> lck(switchMtx);
+            switches.push_back(std::move(sw));
+        }
+        position = 0;
+        engine->notify();
+    }
+
+    Stats Writer::getStats() {
+        Stats stats;
+        stats.capacity = (uint64_t)blockSize * blockCount;
+        stats.buffered = _open ? (writeIdx.load() - readIdx.load()) * (uint64_t)blockSize : 0;
+        stats.highWater = highWater;
+        stats.written = position;
+        stats.dropped = dropped;
+        stats.error = error;
+        return stats;
+    }
+
+    void Writer::allocBlocks() {
+        blocks.resize(blockCount);
+        lengths.resize(blockCount);
+        for (auto& block : blocks) {
+            block = allocAligned(blockSize);
+            if (!block) { throw std::runtime_error("Could not allocate the write buffer"); }
+
+            // Touch the pages now rather than on the DSP thread
+            memset(block, 0, blockSize);
+        }
+    }
+
+    void Writer::freeBlocks() {
+        for (auto& block : blocks) {
+            if (block) { freeAligned(block); }
+        }
+        blocks.clear();
+        lengths.clear();
+    }
+
+    uint64_t Writer::freeSpace() {
+        uint64_t used = writeIdx.load(std::memory_order_relaxed) - readIdx.load(std::memory_order_acquire);
+        if (used >= blockCount) { return 0; }
+        return (uint64_t)(blockSize - curLen) + (blockCount - used - 1) * (uint64_t)blockSize;
+    }
+
+    void Writer::publish() {
+        uint64_t w = writeIdx.load(std::memory_order_relaxed);
+        lengths[w % blockCount] = curLen;
+        curLen = 0;
+        writeIdx.store(w + 1, std::memory_order_release);
+        engine->notify();
+    }
+
+    void Writer::service() {
+        uint64_t r = readIdx.load(std::memory_order_relaxed);
+        uint64_t w = writeIdx.load(std::memory_order_acquire);
+
+        while (true) {
+            // Switch files before the first block of the next one
+            while (true) {
+                Switch sw;
+                {
+                    std::lock_guard<std::mutex> lck(switchMtx);
+                    if (switches.empty() || switches.front().blockIdx > r) { break; }
+                    sw = std::move(switches.front());
+                    switches.pop_front();
+                }
+                if (!finalize(sw.patches)) {
+                    flog::error("Could not finalize '{}'", path);
+                }
+                if (!openFile(sw.path)) {
+                    flog::error("Could not open '{}'", sw.path);
+                    error = true;
+                }
+            }
+            if (r == w) { break; }
+
+            int id = r % blockCount;
+            int len = lengths[id];
+
+            // Keep consuming after an error so that the producer never stalls
+            if (!error) {
+                // Direct I/O needs whole sectors, the padding is cut off when closing
+                size_t wlen = alignedIO ? ((len + ASYNC_WRITER_ALIGNMENT - 1) / ASYNC_WRITER_ALIGNMENT) * ASYNC_WRITER_ALIGNMENT : len;
+                preallocate(fileOffset + wlen);
+                if (!writeFile(blocks[id], wlen)) {
+                    flog::error("Could not write to '{}'", path);
+                    error = true;
+                }
+                fileOffset += len;
+            }
+
+            readIdx.store(++r, std::memory_order_release);
+            w = writeIdx.load(std::memory_order_acquire);
+        }
+
+        // Wake up close() if it's waiting
+        {
+            std::lock_guard<std::mutex> lck(drainMtx);
+        }
+        drainCnd.notify_all();
+    }
+
+    bool Writer::openFile(std::string path) {
+        // Open file, falling back to buffered I/O if the file system doesn't support direct I/O
+        alignedIO = false;
+        fd = async_io::openFile(path, true, direct);
+#ifdef O_DIRECT
+        if (direct && fd >= 0) {
+            alignedIO = true;
+        }
+        else if (direct) {
+            flog::warn("Direct I/O not supported for '{}', using buffered I/O", path);
+            fd = async_io::openFile(path, true, false);
+        }
+#endif
+        if (fd < 0) { return false; }
+#ifdef F_NOCACHE
+        if (direct) { fcntl(fd, F_NOCACHE, 1); }
+#endif
+
+        this->path = path;
+        fileOffset = 0;
+        preallocated = 0;
+        preallocActive = (preallocSize > 0);
+        return true;
+    }
+
+    bool Writer::writeFile(const uint8_t* data, size_t len) {
+        while (len) {
+#ifdef _WIN32
+            int n = _write(fd, data, (unsigned int)std::min<size_t>(len, 1 << 30));
+#else
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0 && errno == EINTR) { continue; }
+#endif
+            if (n <= 0) { return false; }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void Writer::preallocate(uint64_t end) {
+#ifdef __linux__
+        // Reserve space in large extents so the file doesn't fragment or stall when growing
+        while (preallocActive && end > preallocated) {
+            if (fallocate(fd, FALLOC_FL_KEEP_SIZE, preallocated, preallocSize)) {
+                preallocActive = false;
+                break;
+            }
+            preallocated += preallocSize;
+        }
+#endif
+    }
+
+    bool Writer::finalize(const std::vector<Patch>& patches) {
+        if (fd < 0) { return false; }
+        bool ok = !error;
+
+        // The deferred writes are not sector aligned, reopen without direct I/O
+        if (alignedIO) {
+            closeFile(fd);
+            fd = async_io::openFile(path, false, false);
+            if (fd < 0) { return false; }
+        }
+
+        // Apply the deferred writes in order
+        for (const auto& patch : patches) {
+#ifdef _WIN32
+            if (_lseeki64(fd, patch.pos, SEEK_SET) < 0) { ok = false; continue; }
+#else
+            if (lseek(fd, patch.pos, SEEK_SET) < 0) { ok = false; continue; }
+#endif
+            ok &= writeFile(patch.data.data(), patch.data.size());
+        }
+
+        // Cut off the padding and the preallocated space
+#ifdef _WIN32
+        ok &= !_chsize_s(fd, fileOffset);
+#else
+        ok &= !ftruncate(fd, fileOffset);
+#endif
+
+        closeFile(fd);
+        fd = -1;
+        return ok;
+    }
+}
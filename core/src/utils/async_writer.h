@@ -0,0 +1,195 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+// Default size of the blocks handed to the I/O thread
+#define ASYNC_WRITER_BLOCK_SIZE     (4*1024*1024)
+
+// Default number of blocks, the total is the amount of data that can wait for the disk
+#define ASYNC_WRITER_BLOCK_COUNT    64
+
+// Alignment of the blocks and of the writes, as required by direct I/O
+#define ASYNC_WRITER_ALIGNMENT      4096
+
+// Partially filled blocks are handed to the I/O thread after this long (not with direct I/O)
+#define ASYNC_WRITER_FLUSH_MS       1000
+
+// Amount of space reserved ahead of the end of the file, 0 to disable
+#define ASYNC_WRITER_PREALLOC_SIZE  (256*1024*1024)
+
+namespace async_io {
+    class Writer;
+
+    struct Stats {
+        uint64_t capacity;      // Size of the buffer in bytes
+        uint64_t buffered;      // Bytes waiting to be written
+        uint64_t highWater;     // Highest number of bytes that were waiting since the file was opened
+        uint64_t written;       // Bytes accepted since the file was opened
+        uint64_t dropped;       // Bytes that were dropped because the buffer was full
+        bool error;             // True if a write to the disk failed
+    };
+
+    /**
+     * I/O thread servicing any number of writers. A writer without an engine creates
+     * its own, share one between writers to bound the number of threads.
+     */
+    class Engine {
+        friend Writer;
+    public:
+        Engine();
+        ~Engine();
+
+    private:
+        void attach(Writer* writer);
+        void detach(Writer* writer);
+        void notify();
+        void worker();
+
+        std::mutex notifyMtx;
+        std::condition_variable notifyCnd;
+        bool pending = false;
+        bool stopWorker = false;
+
+        // Held while servicing so that a writer can't be detached mid-write
+        std::mutex writersMtx;
+        std::vector<Writer*> writers;
+
+        std::thread workerThread;
+    };
+
+    /**
+     * Write-behind file. write() copies the data into a ring of aligned blocks and never
+     * waits for the disk, data that doesn't fit is dropped and counted instead. Full blocks
+     * are written out sequentially by the engine's thread. Writes at an earlier position
+     * (e.g. header fields) are deferred until the file is closed. split() continues in a
+     * new file without a gap, the switch being done by the I/O thread as well.
+     */
+    class Writer {
+        friend Engine;
+    public:
+        Writer(Engine* engine = NULL);
+        ~Writer();
+
+        /**
+         * Set the size of the buffer. Can't be changed while open.
+         * @param blockSize Size of each block in bytes, rounded up to ASYNC_WRITER_ALIGNMENT.
+         * @param blockCount Number of blocks.
+         */
+        void setBuffering(int blockSize, int blockCount);
+
+        /**
+         * Bypass the page cache where supported (O_DIRECT on Linux, F_NOCACHE on MacOS).
+         * Can't be changed while open.
+         */
+        void setDirectIO(bool enabled);
+
+        /**
+         * Set the amount of space reserved ahead of the end of the file (fallocate on Linux).
+         * Can't be changed while open.
+         * @param size Size in bytes, 0 to disable.
+         */
+        void setPreallocation(uint64_t size);
+
+        bool open(std::string path);
+        bool isOpen();
+
+        // Wait for all data to be written, apply the deferred writes and close the file
+        void close();
+
+        /**
+         * Append data to the file. Never blocks on the disk unless asked to.
+         * @param data Data to write.
+         * @param len Number of bytes.
+         * @param wait Wait for space instead of dropping the data, for headers that must not be lost.
+         * Data that can't fit even once the buffer is drained is still dropped.
+         * @return True if the data was queued, false if it was dropped.
+         */
+        bool write(const uint8_t* data, size_t len, bool wait = false);
+
+        /**
+         * Overwrite data that was already written. Applied when the file is closed.
+         * @param pos Position in the file.
+         * @param data Data to write.
+         * @param len Number of bytes.
+         */
+        void writeAt(uint64_t pos, const uint8_t* data, size_t len);
+
+        /**
+         * Continue in a new file. The current one is finalized with its deferred writes once
+         * all of its data is written. Never blocks on the disk, errors are reported in the stats.
+         * @param path Path of the new file.
+         */
+        void split(std::string path);
+
+        // Position at which the next write() will go
+        uint64_t tell() { return position; }
+
+        Stats getStats();
+
+    private:
+        void allocBlocks();
+        void freeBlocks();
+        uint64_t freeSpace();
+        void publish();
+        void service();
+        bool openFile(std::string path);
+        bool writeFile(const uint8_t* data, size_t len);
+        void preallocate(uint64_t end);
+        struct Patch;
+        bool finalize(const std::vector<Patch>& patches);
+
+        Engine* engine;
+        Engine* ownEngine = NULL;
+        std::string path;
+        int fd = -1;
+        bool direct = false;
+        bool alignedIO = false;
+        uint64_t preallocSize = ASYNC_WRITER_PREALLOC_SIZE;
+        bool preallocActive = false;
+        uint64_t preallocated = 0;
+        uint64_t fileOffset = 0;
+
+        // Ring of blocks, writeIdx is only written by the producer and readIdx by the I/O thread
+        int blockSize = ASYNC_WRITER_BLOCK_SIZE;
+        int blockCount = ASYNC_WRITER_BLOCK_COUNT;
+        std::vector<uint8_t*> blocks;
+        std::vector<int> lengths;
+        std::atomic<uint64_t> readIdx;
+        std::atomic<uint64_t> writeIdx;
+        int curLen = 0;
+        std::chrono::steady_clock::time_point curStart;
+
+        // Signaled by the I/O thread when blocks were written
+        std::mutex drainMtx;
+        std::condition_variable drainCnd;
+
+        // Writes deferred until close
+        struct Patch {
+            uint64_t pos;
+            std::vector<uint8_t> data;
+        };
+        std::vector<Patch> patches;
+
+        // Pending file switches, done before writing the block at blockIdx
+        struct Switch {
+            uint64_t blockIdx;
+            std::string path;
+            std::vector<Patch> patches;
+        };
+        std::deque<Switch> switches;
+        std::mutex switchMtx;
+
+        bool _open = false;
+        std::atomic<uint64_t> position;
+        std::atomic<uint64_t> highWater;
+        std::atomic<uint64_t> dropped;
+        std::atomic<bool> error;
+    };
+}
@@ -0,0 +1,461 @@
+#include "bundle.h"
+#include <utils/flog.h>
+#include <volk/volk.h>
+#include <dsp/convert/pcm.h>
+#include <string.h>
+#include <chrono>
+#include <math.h>
+#include <algorithm>
+
+#define BUNDLE_FILE_MAGIC   "IQB1"
+#define BUNDLE_CHUNK_MAGIC  "IQBC"
+#define BUNDLE_INDEX_MAGIC  "IQBI"
+#define BUNDLE_RETUNE_MAGIC "IQBR"
+
+namespace bundle {
+    int sampleSize(SampleType type) {
+        return (type == SAMPLE_TYPE_INT16) ? 2 * sizeof(int16_t) : sizeof(dsp::complex_t);
+    }
+
+    Writer::Writer(async_io::Engine* engine) : file(engine) {}
+
+    Writer::~Writer() {
+        close();
+        clearChannels();
+    }
+
+    int Writer::addChannel(std::string name, double sampleRate, double frequency, double bandwidth, std::string mode) {
+        if (_open || channels.size() >= BUNDLE_MAX_CHANNELS) { return -1; }
+        Channel* ch = new Channel;
+        memset(&ch->info, 0, sizeof(ChannelInfo));
+        strncpy(ch->info.name, name.c_str(), sizeof(ch->info.name) - 1);
+        strncpy(ch->info.mode, mode.c_str(), sizeof(ch->info.mode) - 1);
+        ch->info.sampleRate = sampleRate;
+        ch->info.frequency = frequency;
+        ch->info.bandwidth = bandwidth;
+        channels.push_back(ch);
+        return channels.size() - 1;
+    }
+
+    void Writer::clearChannels() {
+        if (_open) { return; }
+        for (auto& ch : channels) {
+            delete ch;
+        }
+        channels.clear();
+    }
+
+    void Writer::setSampleType(SampleType type) {
+        if (_open) { return; }
+        _type = type;
+    }
+
+    void Writer::setCenterFrequency(double freq) {
+        if (_open) { return; }
+        _centerFreq = freq;
+    }
+
+    void Writer::setBuffering(int blockSize, int blockCount) {
+        file.setBuffering(blockSize, blockCount);
+    }
+
+    void Writer::setDirectIO(bool enabled) {
+        file.setDirectIO(enabled);
+    }
+
+    void Writer::setPreallocation(uint64_t size) {
+        file.setPreallocation(size);
+    }
+
+    bool Writer::open(std::string path) {
+        if (_open || channels.empty()) { return false; }
+        if (!file.open(path)) { return false; }
+
+        // Write the header and the channel table, the index position is filled in when closing
+        memcpy(hdr.magic, BUNDLE_FILE_MAGIC, 4);
+        hdr.headerSize = sizeof(FileHeader);
+        hdr.channelCount = channels.size();
+        hdr.sampleType = _type;
+        hdr.centerFreq = _centerFreq;
+        hdr.startTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        hdr.indexOffset = 0;
+        file.write((uint8_t*)&hdr, sizeof(FileHeader), true);
+        for (auto& ch : channels) {
+            file.write((uint8_t*)&ch->info, sizeof(ChannelInfo), true);
+        }
+
+        // Each channel fills its own chunk so that no lock is needed until it's full
+        for (int i = 0; i < channels.size(); i++) {
+            Channel* ch = channels[i];
+            ch->chunk = (uint8_t*)volk_malloc(sizeof(ChunkHeader) + BUNDLE_CHUNK_SAMPLES * sampleSize(_type), volk_get_alignment());
+            ch->fill = 0;
+            ch->timeline = 0;
+            ChunkHeader* chdr = (ChunkHeader*)ch->chunk;
+            memcpy(chdr->magic, BUNDLE_CHUNK_MAGIC, 4);
+            chdr->channel = i;
+        }
+        index.clear();
+        retunes.clear();
+
+        _open = true;
+        return true;
+    }
+
+    bool Writer::isOpen() {
+        return _open;
+    }
+
+    void Writer::close() {
+        if (!_open) { return; }
+
+        // Write the partial chunks, nothing writes to the channels anymore
+        for (auto& ch : channels) {
+            if (ch->fill) { flush(ch); }
+            volk_free(ch->chunk);
+            ch->chunk = NULL;
+        }
+
+        // Write the index and point the header to it
+        hdr.indexOffset = file.tell();
+        uint64_t count = index.size();
+        file.write((uint8_t*)BUNDLE_INDEX_MAGIC, 4, true);
+        file.write((uint8_t*)&count, sizeof(uint64_t), true);
+        if (count) {
+            file.write((uint8_t*)index.data(), count * sizeof(IndexEntry), true);
+        }
+
+        // Followed by the retunes, a record written between the chunks may have been dropped
+        count = retunes.size();
+        file.write((uint8_t*)BUNDLE_RETUNE_MAGIC, 4, true);
+        file.write((uint8_t*)&count, sizeof(uint64_t), true);
+        if (count) {
+            file.write((uint8_t*)retunes.data(), count * sizeof(RetuneRecord), true);
+        }
+
+        file.writeAt(0, (uint8_t*)&hdr, sizeof(FileHeader));
+        file.close();
+        index.clear();
+        retunes.clear();
+
+        _open = false;
+    }
+
+    void Writer::write(int channel, const dsp::complex_t* samples, int count) {
+        if (!_open || channel < 0 || channel >= channels.size()) { return; }
+        Channel* ch = channels[channel];
+        int size = sampleSize(_type);
+        uint8_t* data = &ch->chunk[sizeof(ChunkHeader)];
+        while (count) {
+            int n = std::min<int>(count, BUNDLE_CHUNK_SAMPLES - ch->fill);
+            if (_type == SAMPLE_TYPE_INT16) {
+                dsp::convert::pcm::floatToInt16((const float*)samples, (int16_t*)&data[ch->fill * size], n * 2);
+            }
+            else {
+                memcpy(&data[ch->fill * size], samples, n * size);
+            }
+            ch->fill += n;
+            samples += n;
+            count -= n;
+            if (ch->fill >= BUNDLE_CHUNK_SAMPLES) { flush(ch); }
+        }
+    }
+
+    void Writer::retune(int channel, double frequency, double bandwidth) {
+        if (!_open || channel < 0 || channel >= channels.size()) { return; }
+        Channel* ch = channels[channel];
+        RetuneRecord rec;
+        memcpy(rec.magic, BUNDLE_RETUNE_MAGIC, 4);
+        rec.channel = channel;
+        rec.sample = ch->timeline + ch->fill;
+        rec.frequency = frequency;
+        rec.bandwidth = bandwidth;
+
+        std::lock_guard<std::mutex> lck(fileMtx);
+        file.write((uint8_t*)&rec, sizeof(RetuneRecord));
+        retunes.push_back(rec);
+    }
+
+    double Writer::getDuration() {
+        double duration = 0.0;
+        for (auto& ch : channels) {
+            duration = std::max<double>(duration, (double)ch->timeline / ch->info.sampleRate);
+        }
+        return duration;
+    }
+
+    void Writer::flush(Channel* ch) {
+        ChunkHeader* chdr = (ChunkHeader*)ch->chunk;
+        chdr->sampleCount = ch->fill;
+        chdr->size = ch->fill * sampleSize(_type);
+        chdr->firstSample = ch->timeline;
+
+        // The position and the index entry must match the chunk that was actually queued
+        {
+            std::lock_guard<std::mutex> lck(fileMtx);
+            IndexEntry entry;
+            entry.offset = file.tell();
+            entry.firstSample = chdr->firstSample;
+            entry.channel = chdr->channel;
+            entry.sampleCount = chdr->sampleCount;
+            if (file.write(ch->chunk, sizeof(ChunkHeader) + chdr->size)) {
+                index.push_back(entry);
+            }
+        }
+
+        // A dropped chunk still advances the timeline to keep the channels in sync
+        ch->timeline += ch->fill;
+        ch->fill = 0;
+    }
+
+    Reader::~Reader() {
+        close();
+    }
+
+    bool Reader::open(std::string path) {
+        close();
+        file.open(path, std::ios::binary);
+        if (!file.is_open()) { return false; }
+
+        // Check the header
+        file.read((char*)&hdr, sizeof(FileHeader));
+        if (!file || memcmp(hdr.magic, BUNDLE_FILE_MAGIC, 4) || hdr.headerSize < sizeof(FileHeader) || !hdr.channelCount ||
+            hdr.channelCount > BUNDLE_MAX_CHANNELS || hdr.sampleType > SAMPLE_TYPE_FLOAT32) {
+            flog::error("'{}' is not a valid IQ bundle", path);
+            close();
+            return false;
+        }
+
+        // Load the channel table
+        file.seekg(hdr.headerSize);
+        channels.resize(hdr.channelCount);
+        for (auto& ch : channels) {
+            file.read((char*)&ch.info, sizeof(ChannelInfo));
+            ch.info.name[sizeof(ch.info.name) - 1] = 0;
+            ch.info.mode[sizeof(ch.info.mode) - 1] = 0;
+            if (!file || ch.info.sampleRate <= 0.0) {
+                flog::error("Invalid channel table in '{}'", path);
+                close();
+                return false;
+            }
+        }
+
+        // Use the index if the file was closed properly, otherwise find the chunks
+        std::vector<IndexEntry> index;
+        std::vector<RetuneRecord> retunes;
+        if (!hdr.indexOffset || !loadIndex(index, retunes)) {
+            if (hdr.indexOffset) { flog::warn("Invalid chunk index in '{}', scanning chunks", path); }
+            scanChunks(index, retunes);
+        }
+
+        // Each channel starts at the frequency of the table, then follows its retunes in order
+        for (int i = 0; i < channels.size(); i++) {
+            RetuneRecord first = {};
+            first.channel = i;
+            first.frequency = channels[i].info.frequency;
+            first.bandwidth = channels[i].info.bandwidth;
+            channels[i].retunes.push_back(first);
+        }
+        for (const auto& rec : retunes) {
+            if (rec.channel >= channels.size()) { continue; }
+            auto& chRetunes = channels[rec.channel].retunes;
+            if (rec.sample < chRetunes.back().sample) { continue; }
+            chRetunes.push_back(rec);
+        }
+
+        // Split the index by channel, the chunks of a channel must be in order
+        for (const auto& entry : index) {
+            if (entry.channel >= channels.size() || !entry.sampleCount || entry.sampleCount > BUNDLE_CHUNK_SAMPLES) { continue; }
+            Channel& ch = channels[entry.channel];
+            if (entry.firstSample < ch.sampleCount) { continue; }
+            ch.chunks.push_back(entry);
+            ch.sampleCount = entry.firstSample + entry.sampleCount;
+        }
+        bool empty = true;
+        for (const auto& ch : channels) {
+            if (!ch.chunks.empty()) { empty = false; }
+        }
+        if (empty) {
+            flog::error("'{}' contains no samples", path);
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Reader::close() {
+        if (file.is_open()) { file.close(); }
+        file.clear();
+        channels.clear();
+    }
+
+    bool Reader::loadIndex(std::vector<IndexEntry>& index, std::vector<RetuneRecord>& retunes) {
+        char magic[4];
+        uint64_t count;
+        file.seekg(hdr.indexOffset);
+        file.read(magic, 4);
+        file.read((char*)&count, sizeof(uint64_t));
+        if (!file || memcmp(magic, BUNDLE_INDEX_MAGIC, 4) || count > (1ull << 32)) {
+            file.clear();
+            return false;
+        }
+        index.resize(count);
+        file.read((char*)index.data(), count * sizeof(IndexEntry));
+        if (!file) {
+            file.clear();
+            index.clear();
+            return false;
+        }
+
+        // The retunes that follow are missing in files from before they were recorded
+        file.read(magic, 4);
+        file.read((char*)&count, sizeof(uint64_t));
+        if (!file || memcmp(magic, BUNDLE_RETUNE_MAGIC, 4) || count > (1ull << 32)) {
+            file.clear();
+            return true;
+        }
+        retunes.resize(count);
+        file.read((char*)retunes.data(), count * sizeof(RetuneRecord));
+        if (!file) {
+            file.clear();
+            retunes.clear();
+        }
+        return true;
+    }
+
+    bool Reader::scanChunks(std::vector<IndexEntry>& index, std::vector<RetuneRecord>& retunes) {
+        index.clear();
+        retunes.clear();
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = file.tellg();
+
+        uint64_t offset = hdr.headerSize + (uint64_t)hdr.channelCount * sizeof(ChannelInfo);
+        int size = sampleSize((SampleType)hdr.sampleType);
+        while (true) {
+            // Stop at the first incomplete or invalid chunk, it's the end of an interrupted recording
+            ChunkHeader chdr;
+            file.seekg(offset);
+            file.read((char*)&chdr, sizeof(ChunkHeader));
+
+            // Retune records sit between the chunks
+            if (file && !memcmp(chdr.magic, BUNDLE_RETUNE_MAGIC, 4)) {
+                RetuneRecord rec;
+                file.seekg(offset);
+                file.read((char*)&rec, sizeof(RetuneRecord));
+                if (!file || offset + sizeof(RetuneRecord) > fileSize) { break; }
+                retunes.push_back(rec);
+                offset += sizeof(RetuneRecord);
+                continue;
+            }
+
+            if (!file || memcmp(chdr.magic, BUNDLE_CHUNK_MAGIC, 4) || chdr.channel >= hdr.channelCount || !chdr.sampleCount) { break; }
+            if (chdr.size != chdr.sampleCount * size || offset + sizeof(ChunkHeader) + chdr.size > fileSize) { break; }
+
+            IndexEntry entry;
+            entry.offset = offset;
+            entry.firstSample = chdr.firstSample;
+            entry.channel = chdr.channel;
+            entry.sampleCount = chdr.sampleCount;
+            index.push_back(entry);
+            offset += sizeof(ChunkHeader) + chdr.size;
+        }
+        file.clear();
+        return true;
+    }
+
+    bool Reader::decodeChunk(Channel& ch, int id) {
+        const IndexEntry& entry = ch.chunks[id];
+        ChunkHeader chdr;
+        int size = sampleSize((SampleType)hdr.sampleType);
+        file.clear();
+        file.seekg(entry.offset);
+        file.read((char*)&chdr, sizeof(ChunkHeader));
+        if (!file || memcmp(chdr.magic, BUNDLE_CHUNK_MAGIC, 4) || chdr.sampleCount != entry.sampleCount || chdr.size != chdr.sampleCount * size) {
+            file.clear();
+            return false;
+        }
+
+        rawBuf.resize(chdr.size);
+        file.read((char*)rawBuf.data(), chdr.size);
+        if (!file) {
+            file.clear();
+            return false;
+        }
+
+        ch.samples.resize(chdr.sampleCount);
+        if (hdr.sampleType == SAMPLE_TYPE_INT16) {
+            dsp::convert::pcm::int16ToFloat((const int16_t*)rawBuf.data(), (float*)ch.samples.data(), chdr.sampleCount * 2);
+        }
+        else {
+            memcpy(ch.samples.data(), rawBuf.data(), chdr.size);
+        }
+        ch.chunkId = id;
+        return true;
+    }
+
+    bool Reader::seek(int channel, uint64_t sample) {
+        if (!isOpen() || channel < 0 || channel >= channels.size()) { return false; }
+        Channel& ch = channels[channel];
+        ch.position = std::min<uint64_t>(sample, ch.sampleCount);
+        return true;
+    }
+
+    double Reader::getFrequency(int channel, uint64_t sample) {
+        if (channel < 0 || channel >= channels.size()) { return 0.0; }
+        const auto& retunes = channels[channel].retunes;
+        auto it = std::upper_bound(retunes.begin(), retunes.end(), sample, [](uint64_t s, const RetuneRecord& r) {
+            return s < r.sample;
+        });
+        return std::prev(it)->frequency;
+    }
+
+    void Reader::getFrequencyRange(int channel, double& low, double& high) {
+        low = INFINITY;
+        high = -INFINITY;
+        if (channel < 0 || channel >= channels.size()) { return; }
+        for (const auto& rec : channels[channel].retunes) {
+            low = std::min<double>(low, rec.frequency);
+            high = std::max<double>(high, rec.frequency);
+        }
+    }
+
+    int Reader::read(int channel, dsp::complex_t* out, int count) {
+        if (!isOpen() || channel < 0 || channel >= channels.size()) { return 0; }
+        Channel& ch = channels[channel];
+        int read = 0;
+        while (read < count) {
+            // Decode the chunk containing the position, or the next one if it falls in a dropped chunk
+            if (ch.chunkId < 0 || ch.position < ch.chunks[ch.chunkId].firstSample || ch.position >= ch.chunks[ch.chunkId].firstSample + ch.chunks[ch.chunkId].sampleCount) {
+                uint64_t pos = ch.position;
+                auto it = std::upper_bound(ch.chunks.begin(), ch.chunks.end(), pos, [](uint64_t s, const IndexEntry& e) {
+                    return s < e.firstSample + e.sampleCount;
+                });
+                int id = it - ch.chunks.begin();
+                if (id >= ch.chunks.size()) { break; }
+
+                // Dropped chunks read as silence so that the channels stay aligned
+                const IndexEntry& next = ch.chunks[id];
+                if (ch.position < next.firstSample) {
+                    int n = std::min<uint64_t>(count - read, next.firstSample - ch.position);
+                    memset(&out[read], 0, n * sizeof(dsp::complex_t));
+                    read += n;
+                    ch.position += n;
+                    continue;
+                }
+                if (!decodeChunk(ch, id)) {
+                    flog::warn("Corrupted chunk {} of channel '{}'", id, ch.info.name);
+                    ch.samples.assign(next.sampleCount, { 0.0f, 0.0f });
+                    ch.chunkId = id;
+                }
+            }
+
+            const IndexEntry& entry = ch.chunks[ch.chunkId];
+            int offset = ch.position - entry.firstSample;
+            int n = std::min<int>(count - read, entry.sampleCount - offset);
+            memcpy(&out[read], &ch.samples[offset], n * sizeof(dsp::complex_t));
+            read += n;
+            ch.position += n;
+        }
+        return read;
+    }
+}
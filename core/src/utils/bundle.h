@@ -0,0 +1,201 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <dsp/types.h>
+#include "async_writer.h"
+
+#define BUNDLE_EXT              ".iqb"
+
+// Maximum number of channels in a bundle
+#define BUNDLE_MAX_CHANNELS     256
+
+// Samples of a channel per chunk, about a fraction of a second for usual VFO rates
+#define BUNDLE_CHUNK_SAMPLES    32768
+
+/**
+ * Multi-channel IQ bundles, the decimated output of several VFOs interleaved into a single
+ * file. Each channel is cut into chunks written in the order they fill up, so that many
+ * channels only cost one file and one sequential stream of large writes. A table after the
+ * header describes the channels, and a chunk index written at the end of the file gives the
+ * position of every chunk of each channel. It is rebuilt by scanning the chunks if the
+ * recording was not closed properly. Channels follow their VFO, a retune record between
+ * the chunks (and in a table after the index) gives the frequency from a sample onward.
+ */
+namespace bundle {
+    enum SampleType {
+        SAMPLE_TYPE_INT16,
+        SAMPLE_TYPE_FLOAT32
+    };
+
+#pragma pack(push, 1)
+    struct FileHeader {
+        char magic[4];          // "IQB1"
+        uint32_t headerSize;    // sizeof(FileHeader), the channel table starts right after
+        uint32_t channelCount;
+        uint32_t sampleType;
+        double centerFreq;      // Tuning of the source when the recording started
+        uint64_t startTime;     // Microseconds since the epoch
+        uint64_t indexOffset;   // Offset of the chunk index, 0 if the file was not closed
+    };
+
+    struct ChannelInfo {
+        char name[64];
+        char mode[16];          // Demodulator of the VFO when known, informative only
+        double sampleRate;
+        double frequency;       // Absolute center frequency of the channel
+        double bandwidth;
+    };
+
+    struct ChunkHeader {
+        char magic[4];          // "IQBC"
+        uint32_t channel;
+        uint32_t sampleCount;
+        uint32_t size;          // Size of the samples
+        uint64_t firstSample;   // Position of the first sample in the timeline of the channel
+    };
+
+    struct IndexEntry {
+        uint64_t offset;        // Offset of the chunk header in the file
+        uint64_t firstSample;
+        uint32_t channel;
+        uint32_t sampleCount;
+    };
+
+    struct RetuneRecord {
+        char magic[4];          // "IQBR"
+        uint32_t channel;
+        uint64_t sample;        // First sample of the channel at the new frequency
+        double frequency;       // Absolute center frequency of the channel
+        double bandwidth;
+    };
+#pragma pack(pop)
+
+    // Size of a complex sample
+    int sampleSize(SampleType type);
+
+    class Writer {
+    public:
+        Writer(async_io::Engine* engine = NULL);
+        ~Writer();
+
+        // Channels can only be changed while closed, returns the ID to write to
+        int addChannel(std::string name, double sampleRate, double frequency, double bandwidth, std::string mode = "");
+        void clearChannels();
+        int getChannelCount() { return channels.size(); }
+
+        // Can't be changed while open
+        void setSampleType(SampleType type);
+        void setCenterFrequency(double freq);
+
+        // Write-behind settings, see async_io::Writer
+        void setBuffering(int blockSize, int blockCount);
+        void setDirectIO(bool enabled);
+        void setPreallocation(uint64_t size);
+        async_io::Stats getIOStats() { return file.getStats(); }
+
+        bool open(std::string path);
+        bool isOpen();
+        void close();
+
+        /**
+         * Append samples to a channel. Each channel may be written from its own thread,
+         * but only one thread at a time per channel. Never blocks on the disk, a chunk that
+         * doesn't fit in the buffer is dropped and leaves a gap in the timeline of its channel.
+         */
+        void write(int channel, const dsp::complex_t* samples, int count);
+
+        // Record that a channel moved, applies from the next sample written. Same thread as write().
+        void retune(int channel, double frequency, double bandwidth);
+
+        // Longest duration written on any channel, in seconds
+        double getDuration();
+
+    private:
+        struct Channel {
+            ChannelInfo info;
+            uint8_t* chunk = NULL;  // Chunk header followed by the samples being filled
+            int fill = 0;
+            std::atomic<uint64_t> timeline = 0;
+        };
+
+        void flush(Channel* ch);
+
+        async_io::Writer file;
+        FileHeader hdr;
+        SampleType _type = SAMPLE_TYPE_INT16;
+        double _centerFreq = 0.0;
+        bool _open = false;
+        std::vector<Channel*> channels;
+
+        // Held while appending a chunk so that the chunks of different channels don't mix
+        std::mutex fileMtx;
+        std::vector<IndexEntry> index;
+        std::vector<RetuneRecord> retunes;
+    };
+
+    class Reader {
+    public:
+        Reader() {}
+        ~Reader();
+
+        bool open(std::string path);
+        bool isOpen() { return file.is_open(); }
+        void close();
+
+        double getCenterFrequency() { return hdr.centerFreq; }
+        uint64_t getStartTime() { return hdr.startTime; }
+        SampleType getSampleType() { return (SampleType)hdr.sampleType; }
+
+        int getChannelCount() { return channels.size(); }
+        const ChannelInfo& getChannel(int channel) { return channels[channel].info; }
+
+        // Length of the timeline of a channel in samples
+        uint64_t getSampleCount(int channel) { return channels[channel].sampleCount; }
+
+        // Position of the next sample read from a channel
+        uint64_t tell(int channel) { return channels[channel].position; }
+
+        bool seek(int channel, uint64_t sample);
+
+        // Frequency of a channel at a sample, taking the retunes into account
+        double getFrequency(int channel, uint64_t sample);
+
+        // Lowest and highest frequency a channel was tuned to
+        void getFrequencyRange(int channel, double& low, double& high);
+
+        /**
+         * Read the samples of a channel, each channel has its own position. Chunks dropped while recording read as silence.
+         * @param channel ID of the channel.
+         * @param out Buffer to read the samples into.
+         * @param count Maximum number of samples.
+         * @return Number of samples read, 0 at the end of the channel.
+         */
+        int read(int channel, dsp::complex_t* out, int count);
+
+    private:
+        struct Channel {
+            ChannelInfo info;
+            std::vector<IndexEntry> chunks;
+            std::vector<RetuneRecord> retunes;
+            uint64_t sampleCount = 0;
+            uint64_t position = 0;
+
+            // Decoded chunk
+            int chunkId = -1;
+            std::vector<dsp::complex_t> samples;
+        };
+
+        bool loadIndex(std::vector<IndexEntry>& index, std::vector<RetuneRecord>& retunes);
+        bool scanChunks(std::vector<IndexEntry>& index, std::vector<RetuneRecord>& retunes);
+        bool decodeChunk(Channel& ch, int id);
+
+        std::ifstream file;
+        FileHeader hdr = {};
+        std::vector<Channel> channels;
+        std::vector<uint8_t> rawBuf;
+    };
+}
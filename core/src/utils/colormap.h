@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+
+// Size of the compact colormap used to convert dB values to pixels, small enough to stay in L1
+#define COLORMAP_LUT_SIZE 4096
+
+// Number of pixels converted per block, the indices of a block are kept on the stack
+#define COLORMAP_BLOCK_SIZE 256
+
+namespace colormap {
+    /**
+     * Resample a full resolution palette into a compact lookup table.
+     * With 4096 levels the step is well below what can be told apart on a waterfall,
+     * but the table fits in L1 unlike the full palette.
+     */
+    inline void buildLUT(const uint32_t* palette, int paletteSize, uint32_t* lut, int lutSize) {
+        for (int i = 0; i < lutSize; i++) {
+            int64_t id = ((int64_t)i * (int64_t)(paletteSize - 1)) / (int64_t)(lutSize - 1);
+            lut[i] = palette[id];
+        }
+    }
+
+    /**
+     * Convert a line of dB values to RGBA pixels.
+     * The scaling and clamping is branchless so that it gets vectorized, only the final
+     * table lookup is done one pixel at a time. NaN and -inf map to the lowest color.
+     */
+    inline void dbToRGBA(const float* in, uint32_t* out, int count, float min, float max, const uint32_t* lut, int lutSize) {
+        int32_t ids[COLORMAP_BLOCK_SIZE];
+        float top = (float)(lutSize - 1);
+        float scale = top / (max - min);
+        for (int i = 0; i < count; i += COLORMAP_BLOCK_SIZE) {
+            int n = (count - i) < COLORMAP_BLOCK_SIZE ? (count - i) : COLORMAP_BLOCK_SIZE;
+            const float* src = &in[i];
+
+            // Scale, clamp and convert to indices
+            for (int j = 0; j < n; j++) {
+                float p = (src[j] - min) * scale;
+                p = (p > 0.0f) ? p : 0.0f;
+                p = (p < top) ? p : top;
+                ids[j] = (int32_t)p;
+            }
+
+            // Look up the colors
+            uint32_t* dst = &out[i];
+            for (int j = 0; j < n; j++) {
+                dst[j] = lut[ids[j]];
+            }
+        }
+    }
+
+    /**
+     * Scalar reference of dbToRGBA using the full resolution palette, as done before the
+     * compact table was introduced. Only kept for benchmarking.
+     */
+    inline void dbToRGBAReference(const float* in, uint32_t* out, int count, float min, float max, const uint32_t* palette, int paletteSize) {
+        float range = max - min;
+        for (int i = 0; i < count; i++) {
+            float v = (in[i] < min) ? min : ((in[i] > max) ? max : in[i]);
+            float pixel = (v - min) / range;
+            out[i] = palette[(int)(pixel * (paletteSize - 1))];
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#include "iq_history.h"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <dsp/buffer/buffer.h>
+
+IQHistory::Snapshot::~Snapshot() {
+    for (int i = 0; i < blocks.size(); i++) { release(i); }
+}
+
+const dsp::complex_t* IQHistory::Snapshot::getSamples(int id) {
+    Block& blk = blocks[id];
+    return blk.chunk ? &blk.chunk->samples[blk.offset] : NULL;
+}
+
+void IQHistory::Snapshot::release(int id) {
+    Block& blk = blocks[id];
+    if (!blk.chunk) { return; }
+    history->unpin(blk.chunk);
+    blk.chunk = NULL;
+}
+
+IQHistory::~IQHistory() {
+    free();
+}
+
+bool IQHistory::configure(double seconds, double samplerate, uint64_t maxBytes) {
+    free();
+    std::lock_guard<std::mutex> lck(mtx);
+    _seconds = 0.0;
+    _samplerate = samplerate;
+    dropped = 0;
+    if (seconds <= 0.0 || samplerate <= 0.0) { return true; }
+
+    // One more chunk than needed since the newest one is only partially filled
+    maxChunks = ceil((seconds * samplerate) / (double)IQ_HISTORY_CHUNK_SAMPLES) + 1;
+
+    // Shorten the history to fit the memory limit, spare chunks included
+    if (maxBytes) {
+        uint64_t chunkBytes = IQ_HISTORY_CHUNK_SAMPLES * sizeof(dsp::complex_t);
+        int64_t fit = (int64_t)(maxBytes / chunkBytes) - IQ_HISTORY_SPARE_CHUNKS;
+        maxChunks = std::clamp<int64_t>(fit, 2, maxChunks);
+    }
+    _seconds = std::min<double>(seconds, (double)(maxChunks - 1) * (double)IQ_HISTORY_CHUNK_SAMPLES / samplerate);
+
+    for (int i = 0; i < maxChunks + IQ_HISTORY_SPARE_CHUNKS; i++) {
+        dsp::complex_t* samples = dsp::buffer::alloc<dsp::complex_t>(IQ_HISTORY_CHUNK_SAMPLES);
+        if (!samples) {
+            for (auto& chunk : chunks) {
+                dsp::buffer::free(chunk->samples);
+                delete chunk;
+            }
+            chunks.clear();
+            freeChunks.clear();
+            maxChunks = 0;
+            _seconds = 0.0;
+            return false;
+        }
+        Chunk* chunk = new Chunk;
+        chunk->samples = samples;
+        chunk->count = 0;
+        chunk->pins = 0;
+        chunk->inRing = false;
+        chunks.push_back(chunk);
+        freeChunks.push_back(chunk);
+    }
+    return true;
+}
+
+void IQHistory::free() {
+    std::lock_guard<std::mutex> lck(mtx);
+    for (auto& chunk : chunks) {
+        dsp::buffer::free(chunk->samples);
+        delete chunk;
+    }
+    chunks.clear();
+    freeChunks.clear();
+    ring.clear();
+    current = NULL;
+    maxChunks = 0;
+}
+
+double IQHistory::getAvailable() {
+    std::lock_guard<std::mutex> lck(mtx);
+    if (_samplerate <= 0.0) { return 0.0; }
+    uint64_t count = 0;
+    for (const auto& chunk : ring) { count += chunk->count; }
+    return std::min<double>((double)count / _samplerate, _seconds);
+}
+
+void IQHistory::clear() {
+    std::lock_guard<std::mutex> lck(mtx);
+    for (auto& chunk : ring) {
+        chunk->inRing = false;
+        if (!chunk->pins) { freeChunks.push_back(chunk); }
+    }
+    ring.clear();
+    current = NULL;
+}
+
+void IQHistory::push(const dsp::complex_t* samples, int count) {
+    while (count) {
+        // Move on to a new chunk once the current one is full
+        if (!current || current->count >= IQ_HISTORY_CHUNK_SAMPLES) {
+            std::lock_guard<std::mutex> lck(mtx);
+            current = nextChunk();
+            if (!current) {
+                dropped += count;
+                return;
+            }
+        }
+
+        // Only this thread writes past the count, readers never look there
+        int n = std::min<int>(count, IQ_HISTORY_CHUNK_SAMPLES - current->count);
+        memcpy(&current->samples[current->count], samples, n * sizeof(dsp::complex_t));
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            current->count += n;
+        }
+        samples += n;
+        count -= n;
+    }
+}
+
+IQHistory::Chunk* IQHistory::nextChunk() {
+    if (!maxChunks) { return NULL; }
+
+    // Drop the oldest chunk from the history, a pinned one is returned to the pool by unpin()
+    if (ring.size() >= maxChunks) {
+        Chunk* oldest = ring.front();
+        ring.pop_front();
+        oldest->inRing = false;
+        if (!oldest->pins) { freeChunks.push_back(oldest); }
+    }
+
+    if (freeChunks.empty()) { return NULL; }
+    Chunk* chunk = freeChunks.back();
+    freeChunks.pop_back();
+    chunk->count = 0;
+    chunk->inRing = true;
+    ring.push_back(chunk);
+    return chunk;
+}
+
+void IQHistory::unpin(Chunk* chunk) {
+    std::lock_guard<std::mutex> lck(mtx);
+    chunk->pins--;
+    if (!chunk->pins && !chunk->inRing) { freeChunks.push_back(chunk); }
+}
+
+IQHistory::Snapshot* IQHistory::snapshot(double seconds) {
+    std::lock_guard<std::mutex> lck(mtx);
+    if (ring.empty()) { return NULL; }
+
+    // Walk back from the newest chunk until enough samples are found
+    uint64_t wanted = (uint64_t)(((seconds < 0.0) ? _seconds : std::min<double>(seconds, _seconds)) * _samplerate);
+    std::deque<Snapshot::Block> blocks;
+    uint64_t found = 0;
+    for (auto it = ring.rbegin(); it != ring.rend() && found < wanted; it++) {
+        Chunk* chunk = *it;
+        if (!chunk->count) { continue; }
+        int n = std::min<uint64_t>(chunk->count, wanted - found);
+        chunk->pins++;
+        blocks.push_front(Snapshot::Block{ chunk, chunk->count - n, n });
+        found += n;
+    }
+    if (!found) { return NULL; }
+
+    Snapshot* snap = new Snapshot;
+    snap->history = this;
+    snap->blocks.assign(blocks.begin(), blocks.end());
+    snap->sampleCount = found;
+    snap->samplerate = _samplerate;
+    return snap;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <dsp/types.h>
+
+// Number of samples per chunk of history
+#define IQ_HISTORY_CHUNK_SAMPLES    65536
+
+// Chunks allocated on top of the length so that the history keeps being filled while a save holds the oldest ones
+#define IQ_HISTORY_SPARE_CHUNKS     4
+
+/**
+ * Rolling history of the last seconds of baseband. The samples are kept in a fixed pool
+ * of chunks, the oldest chunk being reused once full, so the memory is bounded and nothing
+ * is allocated while running. A snapshot pins the chunks of the last seconds so that they
+ * can be written out while the history keeps being filled. If the history needs a chunk
+ * that is still pinned, it drops samples instead of waiting.
+ */
+class IQHistory {
+    struct Chunk;
+public:
+    class Snapshot {
+        friend IQHistory;
+    public:
+        ~Snapshot();
+
+        int getBlockCount() { return blocks.size(); }
+        uint64_t getSampleCount() { return sampleCount; }
+        double getSamplerate() { return samplerate; }
+
+        // Samples of a block, valid until the block is released
+        const dsp::complex_t* getSamples(int id);
+        int getCount(int id) { return blocks[id].count; }
+
+        // Let the history reuse the chunk of a block once it's written
+        void release(int id);
+
+    private:
+        struct Block {
+            Chunk* chunk;
+            int offset;
+            int count;
+        };
+
+        IQHistory* history = NULL;
+        std::vector<Block> blocks;
+        uint64_t sampleCount = 0;
+        double samplerate = 0.0;
+    };
+
+    IQHistory() {}
+    ~IQHistory();
+
+    /**
+     * Reallocate the pool, the content is lost. Not while samples are pushed or a snapshot exists.
+     * @param seconds Wanted length, shortened to fit in the memory limit.
+     * @param samplerate Samplerate of the baseband.
+     * @param maxBytes Memory limit of the pool, 0 for none.
+     * @return False if the memory couldn't be allocated, the history is then empty.
+     */
+    bool configure(double seconds, double samplerate, uint64_t maxBytes = 0);
+    void free();
+
+    // Length actually held, can be shorter than asked for because of the memory limit
+    double getLength() { return _seconds; }
+    double getSamplerate() { return _samplerate; }
+
+    // Seconds of baseband currently held
+    double getAvailable();
+
+    // Number of samples that couldn't be stored because the oldest chunks were pinned
+    uint64_t getDropped() { return dropped; }
+
+    void clear();
+
+    // Append samples, called from the DSP thread
+    void push(const dsp::complex_t* samples, int count);
+
+    /**
+     * Pin the last samples.
+     * @param seconds Amount of history wanted, everything if negative.
+     * @return Snapshot to delete once written, NULL if the history is empty.
+     */
+    Snapshot* snapshot(double seconds = -1.0);
+
+private:
+    struct Chunk {
+        dsp::complex_t* samples;
+        int count;
+        int pins;       // Number of snapshots using the chunk
+        bool inRing;    // Still part of the history
+    };
+
+    Chunk* nextChunk();
+    void unpin(Chunk* chunk);
+
+    std::mutex mtx;
+    std::vector<Chunk*> chunks;
+    std::vector<Chunk*> freeChunks;
+    std::deque<Chunk*> ring;
+    Chunk* current = NULL;
+    int maxChunks = 0;
+    double _seconds = 0.0;
+    double _samplerate = 0.0;
+    std::atomic<uint64_t> dropped = 0;
+};
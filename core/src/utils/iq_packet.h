@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+// Marks the optional header of the raw IQ streams sent over UDP
+#define IQ_PACKET_MAGIC 0x51495044
+
+namespace net {
+#pragma pack(push, 1)
+    // Prepended to each datagram when enabled, the samples follow right after it
+    struct IQPacketHeader {
+        uint32_t magic;
+        uint32_t seq;
+        uint64_t timestamp; // Microseconds since the epoch at which the packet was queued
+    };
+#pragma pack(pop)
+}
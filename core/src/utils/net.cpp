@@ -2,6 +2,7 @@
 #include <string.h>
 #include <codecvt>
 #include <stdexcept>
+#include <vector>
 
 #ifdef _WIN32
 #define WOULD_BLOCK (WSAGetLastError() == WSAEWOULDBLOCK)
@@ -109,6 +110,10 @@ namespace net {
         addr.sin_port = htons(port);
     }
 
+    bool Address::isMulticast() const {
+        return (getIP() & 0xF0000000) == 0xE0000000;
+    }
+
     // === Socket functions ===
 
     Socket::Socket(SockHandle_t sock, const Address* raddr) {
@@ -154,6 +159,126 @@ namespace net {
         return send((const uint8_t*)str.c_str(), str.length(), dest);
     }
 
+    int Socket::sendmulti(const uint8_t* const* datas, const int* lens, int count, const Address* dest) {
+        const sockaddr_in* daddr = dest ? &dest->addr : (raddr ? &raddr->addr : NULL);
+#ifdef __linux__
+        // Send everything in as few calls as possible
+        std::vector<mmsghdr> msgs(count);
+        std::vector<iovec> iovs(count);
+        for (int i = 0; i < count; i++) {
+            iovs[i].iov_base = (void*)datas[i];
+            iovs[i].iov_len = lens[i];
+            memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = (void*)daddr;
+            msgs[i].msg_hdr.msg_namelen = daddr ? sizeof(sockaddr_in) : 0;
+        }
+        int sent = 0;
+        while (sent < count) {
+            int err = ::sendmmsg(sock, &msgs[sent], count - sent, 0);
+            if (err <= 0) {
+                if (!WOULD_BLOCK) { close(); }
+                return sent ? sent : -1;
+            }
+            sent += err;
+        }
+        return sent;
+#else
+        for (int i = 0; i < count; i++) {
+            int err = sendto(sock, (const char*)datas[i], lens[i], 0, (sockaddr*)daddr, sizeof(sockaddr_in));
+            if (err <= 0) {
+                if (!WOULD_BLOCK) { close(); }
+                return i ? i : -1;
+            }
+        }
+        return count;
+#endif
+    }
+
+    int Socket::recvmulti(uint8_t* const* datas, size_t maxLen, int* lens, int count, int timeout) {
+        // Wait for the first datagram
+        if (timeout != NONBLOCKING) {
+            fd_set set;
+            FD_ZERO(&set);
+            FD_SET(sock, &set);
+            timeval tv;
+            tv.tv_sec = timeout / 1000;
+            tv.tv_usec = (timeout - tv.tv_sec*1000) * 1000;
+            int err = select(sock+1, &set, NULL, &set, (timeout > 0) ? &tv : NULL);
+            if (err <= 0) { return err; }
+        }
+
+#ifdef __linux__
+        // Take everything that's already queued in one call
+        std::vector<mmsghdr> msgs(count);
+        std::vector<iovec> iovs(count);
+        for (int i = 0; i < count; i++) {
+            iovs[i].iov_base = datas[i];
+            iovs[i].iov_len = maxLen;
+            memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int err = ::recvmmsg(sock, msgs.data(), count, MSG_DONTWAIT, NULL);
+        if (err <= 0) {
+            if (!WOULD_BLOCK) {
+                close();
+                return err;
+            }
+            return -1;
+        }
+        for (int i = 0; i < err; i++) { lens[i] = msgs[i].msg_len; }
+        return err;
+#else
+        int received = 0;
+        while (received < count) {
+            // Only receive more if it won't block
+            if (received) {
+                fd_set set;
+                FD_ZERO(&set);
+                FD_SET(sock, &set);
+                timeval tv = { 0, 0 };
+                if (select(sock+1, &set, NULL, NULL, &tv) <= 0) { break; }
+            }
+            int err = ::recvfrom(sock, (char*)datas[received], maxLen, 0, NULL, NULL);
+            if (err <= 0) {
+                if (!WOULD_BLOCK) {
+                    close();
+                    return received ? received : err;
+                }
+                break;
+            }
+            lens[received++] = err;
+        }
+        return received ? received : -1;
+#endif
+    }
+
+    bool Socket::setBufferSizes(int sendSize, int recvSize) {
+        if (sendSize && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&sendSize, sizeof(int)) < 0) { return false; }
+        if (recvSize && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&recvSize, sizeof(int)) < 0) { return false; }
+        return true;
+    }
+
+    int Socket::getRecvBufferSize() {
+        int size = 0;
+        socklen_t len = sizeof(int);
+        if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)&size, &len) < 0) { return -1; }
+        return size;
+    }
+
+    bool Socket::setMulticastTTL(int ttl) {
+        return setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(int)) >= 0;
+    }
+
+    bool Socket::joinMulticast(const Address& group, const Address& iface) {
+        ip_mreq mreq;
+        mreq.imr_multiaddr = group.addr.sin_addr;
+        mreq.imr_interface = iface.addr.sin_addr;
+        return setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) >= 0;
+    }
+
     int Socket::recv(uint8_t* data, size_t maxLen, bool forceLen, int timeout, Address* dest) {
         // Create FD set
         fd_set set;
@@ -93,6 +93,12 @@ namespace net {
          */
         void setPort(int port);
 
+        /**
+         * Check if the address is a multicast group.
+         * @return True if the IP is within 224.0.0.0/4.
+         */
+        bool isMulticast() const;
+
         struct sockaddr_in addr;
     };
 
@@ -148,6 +154,16 @@ namespace net {
          */
         int sendstr(const std::string& str, const Address* dest = NULL);
 
+        /**
+         * Send multiple datagrams with as few system calls as possible (sendmmsg on Linux).
+         * @param datas Datagrams to be sent.
+         * @param lens Length of each datagram.
+         * @param count Number of datagrams.
+         * @param dest Destination address. NULL to use the default remote address.
+         * @return Number of datagrams sent. -1 on error.
+         */
+        int sendmulti(const uint8_t* const* datas, const int* lens, int count, const Address* dest = NULL);
+
         /**
          * Receive data from socket.
          * @param data Buffer to read the data into.
@@ -169,6 +185,47 @@ namespace net {
          */
         int recvline(std::string& str, int maxLen = 0, int timeout = NO_TIMEOUT, Address* dest = NULL);
 
+        /**
+         * Receive multiple datagrams with as few system calls as possible (recvmmsg on Linux).
+         * Only the first datagram is waited for, the ones already queued are received along with it.
+         * @param datas Buffers to receive the datagrams into.
+         * @param maxLen Size of each buffer.
+         * @param lens Length of each received datagram.
+         * @param count Maximum number of datagrams to receive.
+         * @param timeout Timeout in milliseconds. Use NO_TIMEOUT or NONBLOCKING here if needed.
+         * @return Number of datagrams received. 0 means timed out or closed. -1 means would block or error.
+         */
+        int recvmulti(uint8_t* const* datas, size_t maxLen, int* lens, int count, int timeout = NO_TIMEOUT);
+
+        /**
+         * Set the size of the kernel socket buffers. The OS may cap it.
+         * @param sendSize Send buffer size in bytes, 0 to leave unchanged.
+         * @param recvSize Receive buffer size in bytes, 0 to leave unchanged.
+         * @return True on success, false on error.
+         */
+        bool setBufferSizes(int sendSize, int recvSize);
+
+        /**
+         * Get the size of the kernel receive buffer actually in use.
+         * @return Buffer size in bytes, -1 on error.
+         */
+        int getRecvBufferSize();
+
+        /**
+         * Set the TTL of outgoing multicast datagrams.
+         * @param ttl Number of hops.
+         * @return True on success, false on error.
+         */
+        bool setMulticastTTL(int ttl);
+
+        /**
+         * Join a multicast group to receive its datagrams.
+         * @param group Address of the multicast group.
+         * @param iface Address of the interface to join on. 0.0.0.0 lets the OS choose.
+         * @return True on success, false on error.
+         */
+        bool joinMulticast(const Address& group, const Address& iface = Address());
+
     private:
         Address* raddr = NULL;
         SockHandle_t sock;
@@ -2,6 +2,13 @@
 #include <assert.h>
 #include <utils/flog.h>
 #include <stdexcept>
+#ifdef NET_EVENT_LOOP_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+#include <errno.h>
+#endif
 
 namespace net {
 
@@ -9,13 +16,276 @@ namespace net {
     extern bool winsock_init = false;
 #endif
 
+    // Helpers hiding the differences between WinSock and BSD sockets
+    static bool wouldBlock() {
+#ifdef _WIN32
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+    }
+
+    static void setNonBlocking(Socket sock) {
+#ifdef _WIN32
+        u_long enable = 1;
+        ioctlsocket(sock, FIONBIO, &enable);
+#else
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    }
+
+    // Block until a non-blocking socket is ready, used by the synchronous calls
+    static bool waitReady(Socket sock, bool write) {
+        pollfd pfd = {};
+        pfd.fd = sock;
+        pfd.events = write ? POLLOUT : POLLIN;
+#ifdef _WIN32
+        int ret = WSAPoll(&pfd, 1, -1);
+#else
+        int ret = poll(&pfd, 1, -1);
+        if (ret < 0 && errno == EINTR) { return true; }
+#endif
+        return ret > 0 && !(pfd.revents & POLLNVAL);
+    }
+
+    static void closeSocket(Socket sock) {
+#ifdef _WIN32
+        closesocket(sock);
+#else
+        ::close(sock);
+#endif
+    }
+
+    EventLoop::EventLoop() {
+#ifdef NET_EVENT_LOOP_EPOLL
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeupFd < 0) {
+            throw std::runtime_error("Could not create event loop");
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeupFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &ev);
+#elif defined(_WIN32)
+        // WinSock can't poll pipes, so wake the loop up with a datagram sent to itself
+        wakeupRecv = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        wakeupSend = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        int addrLen = sizeof(addr);
+        if (bind(wakeupRecv, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            getsockname(wakeupRecv, (struct sockaddr*)&addr, &addrLen) < 0 ||
+            ::connect(wakeupSend, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            throw std::runtime_error("Could not create event loop");
+        }
+        setNonBlocking(wakeupRecv);
+#else
+        int fds[2];
+        if (pipe(fds) < 0) {
+            throw std::runtime_error("Could not create event loop");
+        }
+        wakeupRecv = fds[0];
+        wakeupSend = fds[1];
+        setNonBlocking(wakeupRecv);
+        setNonBlocking(wakeupSend);
+#endif
+        workerThread = std::thread(&EventLoop::worker, this);
+    }
+
+    EventLoop::~EventLoop() {
+        {
+            std::lock_guard lck(watchMtx);
+            stopWorker = true;
+        }
+        wakeup();
+        if (workerThread.joinable()) { workerThread.join(); }
+
+#ifdef NET_EVENT_LOOP_EPOLL
+        ::close(wakeupFd);
+        ::close(epollFd);
+#else
+        closeSocket(wakeupRecv);
+        closeSocket(wakeupSend);
+#endif
+    }
+
+    EventLoop* EventLoop::get() {
+        static EventLoop loop;
+        return &loop;
+    }
+
+    void EventLoop::add(Socket sock, IOHandler* handler) {
+        std::lock_guard lck(watchMtx);
+        watches[sock] = { handler, false, false };
+    }
+
+    void EventLoop::watch(Socket sock, bool read, bool write) {
+        {
+            std::lock_guard lck(watchMtx);
+            auto it = watches.find(sock);
+            if (it == watches.end()) { return; }
+            if (it->second.read == read && it->second.write == write) { return; }
+#ifdef NET_EVENT_LOOP_EPOLL
+            // Sockets are only in the epoll set while they're waited on, otherwise a hangup would be reported forever
+            bool wasArmed = it->second.read || it->second.write;
+            it->second.read = read;
+            it->second.write = write;
+            epoll_event ev = {};
+            ev.events = (read ? EPOLLIN : 0) | (write ? EPOLLOUT : 0);
+            ev.data.fd = sock;
+            if (!read && !write) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, NULL);
+            }
+            else {
+                epoll_ctl(epollFd, wasArmed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, sock, &ev);
+            }
+            return;
+#else
+            it->second.read = read;
+            it->second.write = write;
+#endif
+        }
+        wakeup();
+    }
+
+    void EventLoop::remove(Socket sock) {
+        std::unique_lock lck(watchMtx);
+        auto it = watches.find(sock);
+        if (it == watches.end()) { return; }
+        IOHandler* handler = it->second.handler;
+#ifdef NET_EVENT_LOOP_EPOLL
+        if (it->second.read || it->second.write) { epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, NULL); }
+#endif
+        watches.erase(it);
+
+        // Wait for the handler to return if it's being called right now
+        if (inLoopThread()) { return; }
+        dispatchCnd.wait(lck, [=]() { return dispatching != handler; });
+    }
+
+    bool EventLoop::inLoopThread() {
+        return std::this_thread::get_id() == workerThread.get_id();
+    }
+
+    void EventLoop::wakeup() {
+#ifdef NET_EVENT_LOOP_EPOLL
+        uint64_t one = 1;
+        ::write(wakeupFd, &one, sizeof(one));
+#elif defined(_WIN32)
+        char one = 1;
+        ::send(wakeupSend, &one, 1, 0);
+#else
+        char one = 1;
+        ::write(wakeupSend, &one, 1);
+#endif
+    }
+
+    void EventLoop::dispatch(Socket sock, bool readable, bool writable, bool error) {
+        IOHandler* handler;
+        {
+            std::lock_guard lck(watchMtx);
+            auto it = watches.find(sock);
+            if (it == watches.end()) { return; }
+            handler = it->second.handler;
+            dispatching = handler;
+        }
+
+        handler->ioReady(readable, writable, error);
+
+        {
+            std::lock_guard lck(watchMtx);
+            dispatching = NULL;
+        }
+        dispatchCnd.notify_all();
+    }
+
+    void EventLoop::worker() {
+#ifdef NET_EVENT_LOOP_EPOLL
+        epoll_event events[64];
+        while (true) {
+            int count = epoll_wait(epollFd, events, 64, -1);
+            if (count < 0) {
+                if (errno == EINTR) { continue; }
+                flog::error("Event loop failed: {0}", errno);
+                return;
+            }
+
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.fd == wakeupFd) {
+                    uint64_t val;
+                    ::read(wakeupFd, &val, sizeof(val));
+                    std::lock_guard lck(watchMtx);
+                    if (stopWorker) { return; }
+                    continue;
+                }
+                uint32_t ev = events[i].events;
+                dispatch(events[i].data.fd, ev & EPOLLIN, ev & EPOLLOUT, ev & (EPOLLERR | EPOLLHUP));
+            }
+        }
+#else
+        std::vector<pollfd> pfds;
+        while (true) {
+            // Rebuild the list of sockets to poll
+            pfds.clear();
+            {
+                std::lock_guard lck(watchMtx);
+                if (stopWorker) { return; }
+                pollfd pfd = {};
+                pfd.fd = wakeupRecv;
+                pfd.events = POLLIN;
+                pfds.push_back(pfd);
+                for (auto const& [sock, w] : watches) {
+                    if (!w.read && !w.write) { continue; }
+                    pfd.fd = sock;
+                    pfd.events = (w.read ? POLLIN : 0) | (w.write ? POLLOUT : 0);
+                    pfds.push_back(pfd);
+                }
+            }
+
+#ifdef _WIN32
+            int count = WSAPoll(pfds.data(), pfds.size(), -1);
+#else
+            int count = poll(pfds.data(), pfds.size(), -1);
+            if (count < 0 && errno == EINTR) { continue; }
+#endif
+            if (count < 0) {
+                flog::error("Event loop failed");
+                return;
+            }
+
+            // Drain the wakeup socket
+            if (pfds[0].revents) {
+                char buf[64];
+#ifdef _WIN32
+                while (::recv(wakeupRecv, buf, sizeof(buf), 0) > 0);
+#else
+                while (::read(wakeupRecv, buf, sizeof(buf)) > 0);
+#endif
+            }
+
+            for (int i = 1; i < pfds.size(); i++) {
+                short ev = pfds[i].revents;
+                if (!ev) { continue; }
+                dispatch(pfds[i].fd, ev & POLLIN, ev & POLLOUT, ev & (POLLERR | POLLHUP | POLLNVAL));
+            }
+        }
+#endif
+    }
+
+
     ConnClass::ConnClass(Socket sock, struct sockaddr_in raddr, bool udp) {
         _sock = sock;
         _udp = udp;
         remoteAddr = raddr;
         connectionOpen = true;
-        readWorkerThread = std::thread(&ConnClass::readWorker, this);
-        writeWorkerThread = std::thread(&ConnClass::writeWorker, this);
+
+        // All I/O is non-blocking, the synchronous calls wait for the socket to be ready themselves
+        setNonBlocking(_sock);
+        EventLoop::get()->add(_sock, this);
+        registered = true;
     }
 
     ConnClass::~ConnClass() {
@@ -23,30 +293,29 @@ namespace net {
     }
 
     void ConnClass::close() {
-        std::lock_guard lck(closeMtx);
-        // Set stopWorkers to true
+        // Only mark the connection as closing under the lock, removing it from the event loop waits
+        // for its handler to return and the handler may itself be calling close()
         {
-            std::lock_guard lck1(readQueueMtx);
-            std::lock_guard lck2(writeQueueMtx);
-            stopWorkers = true;
+            std::unique_lock lck(closeMtx);
+            if (closing) {
+                if (!EventLoop::get()->inLoopThread()) { closeCnd.wait(lck, [this]() { return !registered; }); }
+                return;
+            }
+            if (!registered) { return; }
+            closing = true;
         }
 
-        // Notify the workers of the change
-        readQueueCnd.notify_all();
-        writeQueueCnd.notify_all();
-
-        if (connectionOpen) {
-#ifdef _WIN32
-            closesocket(_sock);
-#else
-            ::shutdown(_sock, SHUT_RDWR);
-            ::close(_sock);
+        // Abort any synchronous call in progress and stop getting events
+#ifndef _WIN32
+        ::shutdown(_sock, SHUT_RDWR);
 #endif
+        EventLoop::get()->remove(_sock);
+        closeSocket(_sock);
+        {
+            std::lock_guard lck(closeMtx);
+            registered = false;
         }
-
-        // Wait for the theads to terminate
-        if (readWorkerThread.joinable()) { readWorkerThread.join(); }
-        if (writeWorkerThread.joinable()) { writeWorkerThread.join(); }
+        closeCnd.notify_all();
 
         {
             std::lock_guard lck(connectionOpenMtx);
@@ -60,39 +329,54 @@ namespace net {
     }
 
     void ConnClass::waitForEnd() {
-        std::unique_lock lck(readQueueMtx);
+        std::unique_lock lck(connectionOpenMtx);
         connectionOpenCnd.wait(lck, [this]() { return !connectionOpen; });
     }
 
+    void ConnClass::setClosed() {
+        {
+            std::lock_guard lck(connectionOpenMtx);
+            connectionOpen = false;
+        }
+        connectionOpenCnd.notify_all();
+    }
+
+    bool ConnClass::acceptDatagram(const struct sockaddr_in& from) {
+        // With a fixed remote, datagrams from anyone else are dropped. Otherwise the caller checks the sender
+        if (remoteAddr.sin_port && (from.sin_addr.s_addr != remoteAddr.sin_addr.s_addr || from.sin_port != remoteAddr.sin_port)) {
+            return false;
+        }
+        lastFromAddr = from;
+        return true;
+    }
+
     int ConnClass::read(int count, uint8_t* buf, bool enforceSize) {
         if (!connectionOpen) { return -1; }
         std::lock_guard lck(readMtx);
         int ret;
 
         if (_udp) {
-            socklen_t fromLen = sizeof(remoteAddr);
-            ret = recvfrom(_sock, (char*)buf, count, 0, (struct sockaddr*)&remoteAddr, &fromLen);
-            if (ret <= 0) {
-                {
-                    std::lock_guard lck(connectionOpenMtx);
-                    connectionOpen = false;
+            while (true) {
+                struct sockaddr_in from = {};
+                socklen_t fromLen = sizeof(from);
+                ret = recvfrom(_sock, (char*)buf, count, 0, (struct sockaddr*)&from, &fromLen);
+                if (ret < 0 && wouldBlock() && connectionOpen && waitReady(_sock, false)) { continue; }
+                if (ret <= 0) {
+                    setClosed();
+                    return -1;
                 }
-                connectionOpenCnd.notify_all();
-                return -1;
+                if (!acceptDatagram(from)) { continue; }
+                return count;
             }
-            return count;
         }
 
         int beenRead = 0;
         while (beenRead < count) {
             ret = recv(_sock, (char*)&buf[beenRead], count - beenRead, 0);
+            if (ret < 0 && wouldBlock() && connectionOpen && waitReady(_sock, false)) { continue; }
 
             if (ret <= 0) {
-                {
-                    std::lock_guard lck(connectionOpenMtx);
-                    connectionOpen = false;
-                }
-                connectionOpenCnd.notify_all();
+                setClosed();
                 return -1;
             }
 
@@ -105,39 +389,129 @@ namespace net {
     }
 
     bool ConnClass::write(int count, uint8_t* buf) {
+        ConnBuffer cbuf = { count, buf };
+        return write(&cbuf, 1);
+    }
+
+    bool ConnClass::write(const ConnBuffer* bufs, int bufCount) {
         if (!connectionOpen) { return false; }
         std::lock_guard lck(writeMtx);
         int ret;
 
-        if (_udp) {
-            ret = sendto(_sock, (char*)buf, count, 0, (struct sockaddr*)&remoteAddr, sizeof(remoteAddr));
-            if (ret <= 0) {
-                {
-                    std::lock_guard lck(connectionOpenMtx);
-                    connectionOpen = false;
-                }
-                connectionOpenCnd.notify_all();
-            }
-            return (ret > 0);
+        // Gather the buffers, the first one is advanced as data gets written
+        int total = 0;
+#ifdef _WIN32
+        std::vector<WSABUF> iov(bufCount);
+        for (int i = 0; i < bufCount; i++) {
+            iov[i].buf = (char*)bufs[i].buf;
+            iov[i].len = bufs[i].count;
+            total += bufs[i].count;
         }
+#else
+        std::vector<iovec> iov(bufCount);
+        for (int i = 0; i < bufCount; i++) {
+            iov[i].iov_base = bufs[i].buf;
+            iov[i].iov_len = bufs[i].count;
+            total += bufs[i].count;
+        }
+#endif
 
         int beenWritten = 0;
-        while (beenWritten < count) {
-            ret = send(_sock, (char*)buf, count, 0);
+        int first = 0;
+        while (beenWritten < total) {
+#ifdef _WIN32
+            DWORD sent = 0;
+            if (WSASendTo(_sock, &iov[first], bufCount - first, &sent, 0, _udp ? (struct sockaddr*)&remoteAddr : NULL, _udp ? sizeof(remoteAddr) : 0, NULL, NULL) == 0) {
+                ret = sent;
+            }
+            else {
+                ret = -1;
+            }
+#else
+            msghdr msg = {};
+            msg.msg_iov = &iov[first];
+            msg.msg_iovlen = bufCount - first;
+            if (_udp) {
+                msg.msg_name = &remoteAddr;
+                msg.msg_namelen = sizeof(remoteAddr);
+            }
+            ret = sendmsg(_sock, &msg, 0);
+#endif
+            if (ret < 0 && wouldBlock() && connectionOpen && waitReady(_sock, true)) { continue; }
             if (ret <= 0) {
-                {
-                    std::lock_guard lck(connectionOpenMtx);
-                    connectionOpen = false;
-                }
-                connectionOpenCnd.notify_all();
+                setClosed();
                 return false;
             }
+
+            // A datagram is sent whole or not at all
+            if (_udp) { return true; }
             beenWritten += ret;
+
+            // Skip what was written
+            while (first < bufCount && ret > 0) {
+#ifdef _WIN32
+                int len = iov[first].len;
+                if (ret < len) {
+                    iov[first].buf += ret;
+                    iov[first].len -= ret;
+                    break;
+                }
+#else
+                int len = iov[first].iov_len;
+                if (ret < len) {
+                    iov[first].iov_base = (uint8_t*)iov[first].iov_base + ret;
+                    iov[first].iov_len -= ret;
+                    break;
+                }
+#endif
+                ret -= len;
+                first++;
+            }
         }
         
         return true;
     }
 
+    bool ConnClass::writeTo(const ConnBuffer* bufs, int bufCount, const struct sockaddr_in& dest) {
+        if (!connectionOpen || !_udp) { return false; }
+        std::lock_guard lck(writeMtx);
+        int ret;
+#ifdef _WIN32
+        std::vector<WSABUF> iov(bufCount);
+        for (int i = 0; i < bufCount; i++) {
+            iov[i].buf = (char*)bufs[i].buf;
+            iov[i].len = bufs[i].count;
+        }
+        while (true) {
+            DWORD sent = 0;
+            ret = (WSASendTo(_sock, iov.data(), bufCount, &sent, 0, (struct sockaddr*)&dest, sizeof(dest), NULL, NULL) == 0) ? sent : -1;
+            if (ret < 0 && wouldBlock() && connectionOpen && waitReady(_sock, true)) { continue; }
+            return ret > 0;
+        }
+#else
+        std::vector<iovec> iov(bufCount);
+        for (int i = 0; i < bufCount; i++) {
+            iov[i].iov_base = bufs[i].buf;
+            iov[i].iov_len = bufs[i].count;
+        }
+        msghdr msg = {};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = bufCount;
+        msg.msg_name = (void*)&dest;
+        msg.msg_namelen = sizeof(dest);
+        while (true) {
+            ret = sendmsg(_sock, &msg, 0);
+            if (ret < 0 && wouldBlock() && connectionOpen && waitReady(_sock, true)) { continue; }
+            return ret > 0;
+        }
+#endif
+    }
+
+    struct sockaddr_in ConnClass::getRemoteAddress() {
+        std::lock_guard lck(readMtx);
+        return _udp ? lastFromAddr : remoteAddr;
+    }
+
     void ConnClass::readAsync(int count, uint8_t* buf, void (*handler)(int count, uint8_t* buf, void* ctx), void* ctx, bool enforceSize) {
         if (!connectionOpen) { return; }
         // Create entry
@@ -147,6 +521,7 @@ namespace net {
         entry.handler = handler;
         entry.ctx = ctx;
         entry.enforceSize = enforceSize;
+        entry.done = 0;
 
         // Add entry to queue
         {
@@ -154,8 +529,8 @@ namespace net {
             readQueue.push_back(entry);
         }
 
-        // Notify read worker
-        readQueueCnd.notify_all();
+        // Let the event loop know we want data
+        updateInterest();
     }
 
     void ConnClass::writeAsync(int count, uint8_t* buf) {
@@ -164,6 +539,7 @@ namespace net {
         ConnWriteEntry entry;
         entry.count = count;
         entry.buf = buf;
+        entry.done = 0;
 
         // Add entry to queue
         {
@@ -171,57 +547,109 @@ namespace net {
             writeQueue.push_back(entry);
         }
 
-        // Notify write worker
-        writeQueueCnd.notify_all();
+        // Let the event loop know we have data to send
+        updateInterest();
     }
 
-    void ConnClass::readWorker() {
-        while (true) {
-            // Wait for wakeup and exit if it's for terminating the thread
-            std::unique_lock lck(readQueueMtx);
-            readQueueCnd.wait(lck, [this]() { return (readQueue.size() > 0 || stopWorkers); });
-            if (stopWorkers || !connectionOpen) { return; }
-
-            // Pop first element off the list
-            ConnReadEntry entry = readQueue[0];
-            readQueue.erase(readQueue.begin());
-            lck.unlock();
-
-            // Read from socket and send data to the handler
-            int ret = read(entry.count, entry.buf, entry.enforceSize);
-            if (ret <= 0) {
-                {
-                    std::lock_guard lck(connectionOpenMtx);
-                    connectionOpen = false;
+    void ConnClass::updateInterest() {
+        std::lock_guard lck(interestMtx);
+        bool read, write;
+        {
+            std::lock_guard lck1(readQueueMtx);
+            std::lock_guard lck2(writeQueueMtx);
+            read = !readQueue.empty() && connectionOpen;
+            write = !writeQueue.empty() && connectionOpen;
+        }
+        EventLoop::get()->watch(_sock, read, write);
+    }
+
+    void ConnClass::ioReady(bool readable, bool writable, bool error) {
+        // Let the read or write fail to find out if the connection is really dead
+        if (readable || error) { handleRead(); }
+        if (writable || error) { handleWrite(); }
+        updateInterest();
+    }
+
+    void ConnClass::handleRead() {
+        while (connectionOpen) {
+            ConnReadEntry entry;
+            {
+                std::lock_guard lck(readQueueMtx);
+                if (readQueue.empty()) { return; }
+                entry = readQueue[0];
+            }
+
+            // Read as much as is available
+            int ret;
+            bool accepted = true;
+            {
+                std::lock_guard lck(readMtx);
+                if (_udp) {
+                    struct sockaddr_in from = {};
+                    socklen_t fromLen = sizeof(from);
+                    ret = recvfrom(_sock, (char*)entry.buf, entry.count, 0, (struct sockaddr*)&from, &fromLen);
+                    if (ret > 0) { accepted = acceptDatagram(from); }
                 }
-                connectionOpenCnd.notify_all();
+                else {
+                    ret = recv(_sock, (char*)&entry.buf[entry.done], entry.count - entry.done, 0);
+                }
+            }
+            if (ret < 0 && wouldBlock()) { return; }
+            if (ret <= 0) {
+                setClosed();
                 return;
             }
-            entry.handler(ret, entry.buf, entry.ctx);
+            if (!accepted) { continue; }
+            entry.done += ret;
+
+            // Save progress if the entry isn't complete yet
+            bool complete = _udp || !entry.enforceSize || entry.done >= entry.count;
+            {
+                std::lock_guard lck(readQueueMtx);
+                if (complete) {
+                    readQueue.erase(readQueue.begin());
+                }
+                else {
+                    readQueue[0].done = entry.done;
+                }
+            }
+
+            // Send data to the handler
+            if (complete) { entry.handler(entry.done, entry.buf, entry.ctx); }
         }
     }
 
-    void ConnClass::writeWorker() {
-        while (true) {
-            // Wait for wakeup and exit if it's for terminating the thread
-            std::unique_lock lck(writeQueueMtx);
-            writeQueueCnd.wait(lck, [this]() { return (writeQueue.size() > 0 || stopWorkers); });
-            if (stopWorkers || !connectionOpen) { return; }
-
-            // Pop first element off the list
-            ConnWriteEntry entry = writeQueue[0];
-            writeQueue.erase(writeQueue.begin());
-            lck.unlock();
-
-            // Write to socket
-            if (!write(entry.count, entry.buf)) {
-                {
-                    std::lock_guard lck(connectionOpenMtx);
-                    connectionOpen = false;
-                }
-                connectionOpenCnd.notify_all();
+    void ConnClass::handleWrite() {
+        std::lock_guard lck(writeMtx);
+        while (connectionOpen) {
+            ConnWriteEntry entry;
+            {
+                std::lock_guard lck(writeQueueMtx);
+                if (writeQueue.empty()) { return; }
+                entry = writeQueue[0];
+            }
+
+            int ret;
+            if (_udp) {
+                ret = sendto(_sock, (char*)entry.buf, entry.count, 0, (struct sockaddr*)&remoteAddr, sizeof(remoteAddr));
+            }
+            else {
+                ret = send(_sock, (char*)&entry.buf[entry.done], entry.count - entry.done, 0);
+            }
+            if (ret < 0 && wouldBlock()) { return; }
+            if (ret <= 0) {
+                setClosed();
                 return;
             }
+            entry.done += ret;
+
+            std::lock_guard lck2(writeQueueMtx);
+            if (_udp || entry.done >= entry.count) {
+                writeQueue.erase(writeQueue.begin());
+            }
+            else {
+                writeQueue[0].done = entry.done;
+            }
         }
     }
 
@@ -229,7 +657,9 @@ namespace net {
     ListenerClass::ListenerClass(Socket listenSock) {
         sock = listenSock;
         listening = true;
-        acceptWorkerThread = std::thread(&ListenerClass::worker, this);
+        setNonBlocking(sock);
+        EventLoop::get()->add(sock, this);
+        registered = true;
     }
 
     ListenerClass::~ListenerClass() {
@@ -240,20 +670,27 @@ namespace net {
         if (!listening) { return NULL; }
         std::lock_guard lck(acceptMtx);
         Socket _sock;
+        struct sockaddr_in raddr = {};
 
         // Accept socket
-        _sock = ::accept(sock, NULL, NULL);
+        while (true) {
+            socklen_t raddrLen = sizeof(raddr);
+            _sock = ::accept(sock, (struct sockaddr*)&raddr, &raddrLen);
 #ifdef _WIN32
-        if (_sock < 0 || _sock == SOCKET_ERROR) {
+            if (_sock == INVALID_SOCKET && wouldBlock() && listening && waitReady(sock, false)) { continue; }
+            if (_sock == INVALID_SOCKET) {
 #else
-        if (_sock < 0) {
+            if (_sock < 0 && wouldBlock() && listening && waitReady(sock, false)) { continue; }
+            if (_sock < 0) {
 #endif
-            listening = false;
-            throw std::runtime_error("Could not bind socket");
-            return NULL;
+                listening = false;
+                throw std::runtime_error("Could not bind socket");
+                return NULL;
+            }
+            break;
         }
 
-        return Conn(new ConnClass(_sock));
+        return Conn(new ConnClass(_sock, raddr));
     }
 
     void ListenerClass::acceptAsync(void (*handler)(Conn conn, void* ctx), void* ctx) {
@@ -269,28 +706,32 @@ namespace net {
             acceptQueue.push_back(entry);
         }
 
-        // Notify write worker
-        acceptQueueCnd.notify_all();
+        // Let the event loop know we're waiting for a connection
+        updateInterest();
     }
 
     void ListenerClass::close() {
+        // Same as for connections, the accept handler may be closing the listener
         {
-            std::lock_guard lck(acceptQueueMtx);
-            stopWorker = true;
+            std::unique_lock lck(closeMtx);
+            if (closing) {
+                if (!EventLoop::get()->inLoopThread()) { closeCnd.wait(lck, [this]() { return !registered; }); }
+                return;
+            }
+            if (!registered) { return; }
+            closing = true;
         }
-        acceptQueueCnd.notify_all();
 
-        if (listening) {
-#ifdef _WIN32
-            closesocket(sock);
-#else
-            ::shutdown(sock, SHUT_RDWR);
-            ::close(sock);
+#ifndef _WIN32
+        ::shutdown(sock, SHUT_RDWR);
 #endif
+        EventLoop::get()->remove(sock);
+        closeSocket(sock);
+        {
+            std::lock_guard lck(closeMtx);
+            registered = false;
         }
-
-        if (acceptWorkerThread.joinable()) { acceptWorkerThread.join(); }
-
+        closeCnd.notify_all();
 
         listening = false;
     }
@@ -299,32 +740,47 @@ namespace net {
         return listening;
     }
 
-    void ListenerClass::worker() {
-        while (true) {
-            // Wait for wakeup and exit if it's for terminating the thread
-            std::unique_lock lck(acceptQueueMtx);
-            acceptQueueCnd.wait(lck, [this]() { return (acceptQueue.size() > 0 || stopWorker); });
-            if (stopWorker || !listening) { return; }
-
-            // Pop first element off the list
-            ListenerAcceptEntry entry = acceptQueue[0];
-            acceptQueue.erase(acceptQueue.begin());
-            lck.unlock();
-
-            // Read from socket and send data to the handler
-            try {
-                Conn client = accept();
-                if (!client) {
-                    listening = false;
-                    return;
-                }
-                entry.handler(std::move(client), entry.ctx);
+    void ListenerClass::updateInterest() {
+        std::lock_guard lck(acceptQueueMtx);
+        EventLoop::get()->watch(sock, !acceptQueue.empty() && listening, false);
+    }
+
+    void ListenerClass::ioReady(bool readable, bool writable, bool error) {
+        while (listening) {
+            ListenerAcceptEntry entry;
+            {
+                std::lock_guard lck(acceptQueueMtx);
+                if (acceptQueue.empty()) { break; }
+                entry = acceptQueue[0];
+            }
+
+            // Accept the connection if there's one waiting
+            Socket _sock;
+            struct sockaddr_in raddr = {};
+            {
+                std::lock_guard lck(acceptMtx);
+                socklen_t raddrLen = sizeof(raddr);
+                _sock = ::accept(sock, (struct sockaddr*)&raddr, &raddrLen);
             }
-            catch (const std::exception& e) {
+#ifdef _WIN32
+            if (_sock == INVALID_SOCKET) {
+#else
+            if (_sock < 0) {
+#endif
+                if (wouldBlock()) { break; }
                 listening = false;
-                return;
+                break;
             }
+
+            {
+                std::lock_guard lck(acceptQueueMtx);
+                acceptQueue.erase(acceptQueue.begin());
+            }
+
+            // Send the connection to the handler
+            entry.handler(Conn(new ConnClass(_sock, raddr)), entry.ctx);
         }
+        updateInterest();
     }
 
 
@@ -373,7 +829,7 @@ namespace net {
             return NULL;
         }
 
-        return Conn(new ConnClass(sock));
+        return Conn(new ConnClass(sock, addr));
     }
 
     Listener listen(std::string host, uint16_t port) {
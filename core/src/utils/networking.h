@@ -7,6 +7,7 @@
 #include <memory>
 #include <thread>
 #include <condition_variable>
+#include <map>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -19,6 +20,14 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+// Linux gets the epoll backend, every other platform falls back to poll
+#if defined(__linux__)
+#define NET_EVENT_LOOP_EPOLL
 #endif
 
 namespace net {
@@ -28,20 +37,81 @@ namespace net {
     typedef int Socket;
 #endif
 
+    // Object notified by the event loop when its socket becomes ready
+    class IOHandler {
+    public:
+        virtual ~IOHandler() {}
+        virtual void ioReady(bool readable, bool writable, bool error) = 0;
+    };
+
+    /**
+     * Multiplexes all connections and listeners on a single I/O thread instead of
+     * running blocking worker threads for each of them. Handlers are called from the
+     * I/O thread, so they should not block for long.
+     */
+    class EventLoop {
+    public:
+        ~EventLoop();
+
+        static EventLoop* get();
+
+        void add(Socket sock, IOHandler* handler);
+        void watch(Socket sock, bool read, bool write);
+        // Once this returns the handler is no longer called, unless it's removing itself
+        void remove(Socket sock);
+        bool inLoopThread();
+
+    private:
+        EventLoop();
+        void worker();
+        void wakeup();
+        void dispatch(Socket sock, bool readable, bool writable, bool error);
+
+        struct Watch {
+            IOHandler* handler;
+            bool read;
+            bool write;
+        };
+
+        std::map<Socket, Watch> watches;
+        std::mutex watchMtx;
+        std::condition_variable dispatchCnd;
+        IOHandler* dispatching = NULL;
+        bool stopWorker = false;
+        std::thread workerThread;
+
+#ifdef NET_EVENT_LOOP_EPOLL
+        int epollFd = -1;
+        int wakeupFd = -1;
+#else
+        // Self-pipe, a pair of loopback UDP sockets on Windows
+        Socket wakeupRecv;
+        Socket wakeupSend;
+#endif
+    };
+
     struct ConnReadEntry {
         int count;
         uint8_t* buf;
         void (*handler)(int count, uint8_t* buf, void* ctx);
         void* ctx;
         bool enforceSize;
+        int done;
     };
 
     struct ConnWriteEntry {
         int count;
         uint8_t* buf;
+        int done;
     };
 
-    class ConnClass {
+    // Buffer of a scatter-gather write
+    struct ConnBuffer {
+        int count;
+        uint8_t* buf;
+    };
+
+    class ConnClass : public IOHandler {
     public:
         ConnClass(Socket sock, struct sockaddr_in raddr = {}, bool udp = false);
         ~ConnClass();
@@ -52,33 +122,46 @@ namespace net {
 
         int read(int count, uint8_t* buf, bool enforceSize = true);
         bool write(int count, uint8_t* buf);
+        // Write multiple buffers in one go, e.g. a header and its payload, without first copying them together
+        bool write(const ConnBuffer* bufs, int bufCount);
+        // Send a datagram to another address than the remote one, failures don't close the socket
+        bool writeTo(const ConnBuffer* bufs, int bufCount, const struct sockaddr_in& dest);
+        // Address of the peer for TCP, sender of the last accepted datagram for UDP
+        struct sockaddr_in getRemoteAddress();
         void readAsync(int count, uint8_t* buf, void (*handler)(int count, uint8_t* buf, void* ctx), void* ctx, bool enforceSize = true);
         void writeAsync(int count, uint8_t* buf);
 
+        void ioReady(bool readable, bool writable, bool error);
+
     private:
-        void readWorker();
-        void writeWorker();
+        void handleRead();
+        void handleWrite();
+        void updateInterest();
+        void setClosed();
+        bool acceptDatagram(const struct sockaddr_in& from);
 
-        bool stopWorkers = false;
         bool connectionOpen = false;
+        bool registered = false;
+        bool closing = false;
 
         std::mutex readMtx;
         std::mutex writeMtx;
         std::mutex readQueueMtx;
         std::mutex writeQueueMtx;
+        std::mutex interestMtx;
         std::mutex connectionOpenMtx;
         std::mutex closeMtx;
-        std::condition_variable readQueueCnd;
-        std::condition_variable writeQueueCnd;
+        std::condition_variable closeCnd;
         std::condition_variable connectionOpenCnd;
         std::vector<ConnReadEntry> readQueue;
         std::vector<ConnWriteEntry> writeQueue;
-        std::thread readWorkerThread;
-        std::thread writeWorkerThread;
 
         Socket _sock;
         bool _udp;
+        // Fixed once created, datagrams are only ever sent there
         struct sockaddr_in remoteAddr;
+        // Sender of the last accepted datagram, protected by the read mutex
+        struct sockaddr_in lastFromAddr = {};
     };
 
     typedef std::unique_ptr<ConnClass> Conn;
@@ -88,7 +171,7 @@ namespace net {
         void* ctx;
     };
 
-    class ListenerClass {
+    class ListenerClass : public IOHandler {
     public:
         ListenerClass(Socket listenSock);
         ~ListenerClass();
@@ -99,17 +182,20 @@ namespace net {
         void close();
         bool isListening();
 
+        void ioReady(bool readable, bool writable, bool error);
+
     private:
-        void worker();
+        void updateInterest();
 
         bool listening = false;
-        bool stopWorker = false;
+        bool registered = false;
+        bool closing = false;
 
         std::mutex acceptMtx;
         std::mutex acceptQueueMtx;
-        std::condition_variable acceptQueueCnd;
+        std::mutex closeMtx;
+        std::condition_variable closeCnd;
         std::vector<ListenerAcceptEntry> acceptQueue;
-        std::thread acceptWorkerThread;
 
         Socket sock;
     };
@@ -1,11 +1,16 @@
 #include "riff.h"
+#include <utils/flog.h>
 #include <string.h>
 #include <stdexcept>
 
 namespace riff {
     const char* RIFF_SIGNATURE      = "RIFF";
+    const char* RF64_SIGNATURE      = "RF64";
+    const char* DS64_SIGNATURE      = "ds64";
+    const char* DATA_SIGNATURE      = "data";
     const char* LIST_SIGNATURE      = "LIST";
     const size_t RIFF_LABEL_SIZE    = 4;
+    const uint32_t SIZE_IN_DS64     = 0xFFFFFFFF;
 
     // Writer::Writer(const Writer&& b) {
     //     //file = std::move(b.file);
@@ -15,12 +20,12 @@ namespace riff {
         close();
     }
 
-    bool Writer::open(std::string path, const char form[4]) {
+    bool Writer::open(std::string path, const char form[4], bool rf64) {
         std::lock_guard<std::recursive_mutex> lck(mtx);
 
         // Open file
-        file = std::ofstream(path, std::ios::out | std::ios::binary);
-        if (!file.is_open()) { return false; }
+        if (!file.open(path)) { return false; }
+        this->rf64 = rf64;
 
         // Begin RIFF chunk
         beginRIFF(form);
@@ -30,7 +35,7 @@ namespace riff {
 
     bool Writer::isOpen() {
         std::lock_guard<std::recursive_mutex> lck(mtx);
-        return file.is_open();
+        return file.isOpen();
     }
 
     void Writer::close() {
@@ -45,12 +50,52 @@ namespace riff {
         file.close();
     }
 
+    void Writer::split(std::string path) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+
+        if (chunks.size() != 1) {
+            throw std::runtime_error("Only the RIFF chunk may be open when splitting");
+        }
+
+        // Finish the current file and start the next one, the file switch is done by the I/O thread
+        endRIFF();
+        file.split(path);
+        char _form[4];
+        memcpy(_form, form, sizeof(_form));
+        beginRIFF(_form);
+    }
+
+    void Writer::setSampleCount(uint64_t count) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        sampleCount = count;
+    }
+
+    void Writer::setBuffering(int blockSize, int blockCount) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        file.setBuffering(blockSize, blockCount);
+    }
+
+    void Writer::setDirectIO(bool enabled) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        file.setDirectIO(enabled);
+    }
+
+    void Writer::setPreallocation(uint64_t size) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        file.setPreallocation(size);
+    }
+
+    async_io::Stats Writer::getIOStats() {
+        // Not locked, the stats are atomic and must not wait for a write
+        return file.getStats();
+    }
+
     void Writer::beginList(const char id[4]) {
         std::lock_guard<std::recursive_mutex> lck(mtx);
 
         // Create chunk with the LIST ID and write id
         beginChunk(LIST_SIGNATURE);
-        write((uint8_t*)id, RIFF_LABEL_SIZE);
+        write((uint8_t*)id, RIFF_LABEL_SIZE, true);
     }
 
     void Writer::endList() {
@@ -71,10 +116,11 @@ namespace riff {
 
         // Create and write header
         ChunkDesc desc;
-        desc.pos = file.tellp();
+        desc.pos = file.tell();
         memcpy(desc.hdr.id, id, sizeof(desc.hdr.id));
         desc.hdr.size = 0;
-        file.write((char*)&desc.hdr, sizeof(ChunkHeader));
+        desc.size = 0;
+        file.write((uint8_t*)&desc.hdr, sizeof(ChunkHeader), true);
 
         // Save descriptor
         chunks.push(desc);
@@ -91,28 +137,32 @@ namespace riff {
         ChunkDesc desc = chunks.top();
         chunks.pop();
 
-        // Write size
-        auto pos = file.tellp();
-        auto npos = desc.pos;
-        npos += 4;
-        file.seekp(npos);
-        file.write((char*)&desc.hdr.size, sizeof(desc.hdr.size));
-        file.seekp(pos);
+        // In RF64 files, the RIFF and data sizes are in the ds64 chunk
+        bool isData = !memcmp(desc.hdr.id, DATA_SIGNATURE, RIFF_LABEL_SIZE);
+        if (isData) { dataSize = desc.size; }
+        bool inDS64 = rf64 && (isData || chunks.empty());
+        desc.hdr.size = (inDS64 || desc.size > SIZE_IN_DS64) ? SIZE_IN_DS64 : desc.size;
+
+        // Write size, deferred until the file is closed
+        file.writeAt(desc.pos + 4, (uint8_t*)&desc.hdr.size, sizeof(desc.hdr.size));
 
         // If parent chunk, increment its size by the size of the sub-chunk plus the size of its header)
         if (!chunks.empty()) {
-            chunks.top().hdr.size += desc.hdr.size + sizeof(ChunkHeader);
+            chunks.top().size += desc.size + sizeof(ChunkHeader);
         }
     }
 
-    void Writer::write(const uint8_t* data, size_t len) {
+    bool Writer::write(const uint8_t* data, size_t len, bool wait) {
         std::lock_guard<std::recursive_mutex> lck(mtx);
 
         if (chunks.empty()) {
             throw std::runtime_error("No chunk to write into");
         }
-        file.write((char*)data, len);
-        chunks.top().hdr.size += len;
+
+        // Only count what was actually queued so that the chunk size stays correct
+        if (!file.write(data, len, wait)) { return false; }
+        chunks.top().size += len;
+        return true;
     }
 
     void Writer::beginRIFF(const char form[4]) {
@@ -123,8 +173,20 @@ namespace riff {
         }
 
         // Create chunk with RIFF ID and write form
-        beginChunk(RIFF_SIGNATURE);
-        write((uint8_t*)form, RIFF_LABEL_SIZE);
+        memcpy(this->form, form, RIFF_LABEL_SIZE);
+        dataSize = 0;
+        sampleCount = 0;
+        beginChunk(rf64 ? RF64_SIGNATURE : RIFF_SIGNATURE);
+        write((uint8_t*)form, RIFF_LABEL_SIZE, true);
+
+        // Reserve the ds64 chunk, it has to come first
+        if (rf64) {
+            DS64Chunk ds64 = {};
+            beginChunk(DS64_SIGNATURE);
+            ds64Pos = file.tell();
+            write((uint8_t*)&ds64, sizeof(DS64Chunk), true);
+            endChunk();
+        }
     }
 
     void Writer::endRIFF() {
@@ -133,10 +195,24 @@ namespace riff {
         if (chunks.empty()) {
             throw std::runtime_error("No chunk to end");
         }
-        if (memcmp(chunks.top().hdr.id, RIFF_SIGNATURE, RIFF_LABEL_SIZE)) {
+        if (chunks.size() != 1) {
             throw std::runtime_error("Top chunk not RIFF chunk");
         }
 
+        // Fill in the ds64 chunk
+        uint64_t riffSize = chunks.top().size;
+        if (rf64) {
+            DS64Chunk ds64;
+            ds64.riffSize = riffSize;
+            ds64.dataSize = dataSize;
+            ds64.sampleCount = sampleCount;
+            ds64.tableLength = 0;
+            file.writeAt(ds64Pos, (uint8_t*)&ds64, sizeof(DS64Chunk));
+        }
+        else if (riffSize > SIZE_IN_DS64) {
+            flog::warn("RIFF file larger than 4GB, its header will be wrong. Use RF64 instead.");
+        }
+
         endChunk();
     }
 }
\ No newline at end of file
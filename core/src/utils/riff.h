@@ -1,9 +1,9 @@
 #pragma once
 #include <mutex>
-#include <fstream>
 #include <string>
 #include <stack>
 #include <stdint.h>
+#include "async_writer.h"
 
 namespace riff {
 #pragma pack(push, 1)
@@ -11,38 +11,83 @@ namespace riff {
         char id[4];
         uint32_t size;
     };
+
+    // Holds the 64bit sizes of RF64 files (EBU Tech 3306)
+    struct DS64Chunk {
+        uint64_t riffSize;
+        uint64_t dataSize;
+        uint64_t sampleCount;
+        uint32_t tableLength;
+    };
 #pragma pack(pop)
 
     struct ChunkDesc {
         ChunkHeader hdr;
-        std::streampos pos;
+        uint64_t pos;
+        uint64_t size;
     };
 
     class Writer {
     public:
-        Writer() {}
+        Writer(async_io::Engine* engine = NULL) : file(engine) {}
         // Writer(const Writer&& b);
         ~Writer();
 
-        bool open(std::string path, const char form[4]);
+        /**
+         * Open a file and begin its RIFF chunk.
+         * @param path Path of the file.
+         * @param form Form type of the RIFF chunk.
+         * @param rf64 Write an RF64 file with a ds64 chunk so that it can exceed 4GB.
+         * @return True on success, false otherwise.
+         */
+        bool open(std::string path, const char form[4], bool rf64 = false);
         bool isOpen();
         void close();
 
+        /**
+         * Finish the file and continue in a new one of the same form without a gap.
+         * Only the RIFF chunk may be open.
+         * @param path Path of the new file.
+         */
+        void split(std::string path);
+
+        // Sample count stored in the ds64 chunk of RF64 files
+        void setSampleCount(uint64_t count);
+
+        // Write-behind settings, see async_io::Writer
+        void setBuffering(int blockSize, int blockCount);
+        void setDirectIO(bool enabled);
+        void setPreallocation(uint64_t size);
+        async_io::Stats getIOStats();
+
         void beginList(const char id[4]);
         void endList();
 
         void beginChunk(const char id[4]);
         void endChunk();
 
-        void write(const uint8_t* data, size_t len);
+        /**
+         * Write data into the current chunk.
+         * @param data Data to write.
+         * @param len Number of bytes.
+         * @param wait Wait for space in the buffer instead of dropping the data. Use for headers only.
+         * @return False if the data was dropped because the disk can't keep up.
+         */
+        bool write(const uint8_t* data, size_t len, bool wait = false);
 
     private:
         void beginRIFF(const char form[4]);
         void endRIFF();
 
         std::recursive_mutex mtx;
-        std::ofstream file;
+        async_io::Writer file;
         std::stack<ChunkDesc> chunks;
+
+        char form[4];
+        bool rf64 = false;
+        uint64_t ds64Pos = 0;
+        uint64_t dataSize = 0;
+        uint64_t sampleCount = 0;
     };
 
     // class Reader {
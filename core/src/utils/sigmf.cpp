@@ -0,0 +1,309 @@
+#include "sigmf.h"
+#include <json.hpp>
+#include <fstream>
+#include <string.h>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <dsp/buffer/buffer.h>
+#include <dsp/convert/pcm.h>
+#include <utils/flog.h>
+
+using nlohmann::json;
+
+namespace sigmf {
+    std::string dataTypeName(DataType type) {
+        switch (type) {
+        case DATA_TYPE_CU8:     return "cu8";
+        case DATA_TYPE_CI8:     return "ci8";
+        case DATA_TYPE_CI16_LE: return "ci16_le";
+        case DATA_TYPE_CF32_LE: return "cf32_le";
+        default:                return "";
+        }
+    }
+
+    DataType parseDataType(std::string name) {
+        if (name == "cu8") { return DATA_TYPE_CU8; }
+        if (name == "ci8") { return DATA_TYPE_CI8; }
+        if (name == "ci16_le") { return DATA_TYPE_CI16_LE; }
+        if (name == "cf32_le") { return DATA_TYPE_CF32_LE; }
+        return DATA_TYPE_INVALID;
+    }
+
+    int sampleSize(DataType type) {
+        switch (type) {
+        case DATA_TYPE_CU8:
+        case DATA_TYPE_CI8:     return 2;
+        case DATA_TYPE_CI16_LE: return 4;
+        case DATA_TYPE_CF32_LE: return 8;
+        default:                return 0;
+        }
+    }
+
+    // Days since the epoch of a date of the proleptic gregorian calendar, avoids the non portable timegm()
+    static int64_t daysFromCivil(int64_t y, int m, int d) {
+        y -= (m <= 2);
+        int64_t era = (y >= 0 ? y : y - 399) / 400;
+        int64_t yoe = y - era * 400;
+        int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    std::string formatDatetime(uint64_t us) {
+        time_t secs = us / 1000000;
+        tm* gtm = gmtime(&secs);
+        if (!gtm) { return ""; }
+        char buf[64];
+        sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d.%06dZ", gtm->tm_year + 1900, gtm->tm_mon + 1, gtm->tm_mday,
+                gtm->tm_hour, gtm->tm_min, gtm->tm_sec, (int)(us % 1000000));
+        return buf;
+    }
+
+    uint64_t parseDatetime(std::string str) {
+        int y, mo, d, h, mi;
+        double s;
+        if (sscanf(str.c_str(), "%d-%d-%dT%d:%d:%lf", &y, &mo, &d, &h, &mi, &s) != 6) { return 0; }
+        int64_t secs = daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60;
+        if (secs < 0) { return 0; }
+        return (uint64_t)secs * 1000000 + (uint64_t)(s * 1000000.0);
+    }
+
+    std::string basePath(std::string path) {
+        for (const char* ext : { SIGMF_META_EXT, SIGMF_DATA_EXT, ".sigmf" }) {
+            size_t len = strlen(ext);
+            if (path.size() > len && path.compare(path.size() - len, len, ext) == 0) {
+                return path.substr(0, path.size() - len);
+            }
+        }
+        return path;
+    }
+
+    bool loadMetadata(std::string path, Metadata& meta) {
+        try {
+            std::ifstream file(path);
+            if (!file.is_open()) { return false; }
+            json j = json::parse(file);
+
+            // Global info
+            json global = j["global"];
+            meta = Metadata();
+            meta.dataType = parseDataType(global["core:datatype"]);
+            meta.sampleRate = global.contains("core:sample_rate") ? (double)global["core:sample_rate"] : 0.0;
+            if (global.contains("core:description")) { meta.description = global["core:description"]; }
+            if (global.contains("core:recorder")) { meta.recorder = global["core:recorder"]; }
+            if (global.contains("core:num_channels") && (int)global["core:num_channels"] != 1) {
+                flog::error("SigMF recordings with more than one channel are not supported");
+                return false;
+            }
+
+            // Captures, sorted by the spec but don't rely on it
+            if (j.contains("captures")) {
+                for (auto& c : j["captures"]) {
+                    Capture cap;
+                    cap.sampleStart = c.contains("core:sample_start") ? (uint64_t)c["core:sample_start"] : 0;
+                    cap.headerBytes = c.contains("core:header_bytes") ? (uint64_t)c["core:header_bytes"] : 0;
+                    cap.frequency = c.contains("core:frequency") ? (double)c["core:frequency"] : 0.0;
+                    cap.datetime = c.contains("core:datetime") ? parseDatetime(c["core:datetime"]) : 0;
+                    meta.captures.push_back(cap);
+                }
+            }
+            std::sort(meta.captures.begin(), meta.captures.end(), [](const Capture& a, const Capture& b) { return a.sampleStart < b.sampleStart; });
+            if (meta.captures.empty() || meta.captures[0].sampleStart) {
+                meta.captures.insert(meta.captures.begin(), Capture{ 0, 0, 0.0, 0 });
+            }
+
+            if (j.contains("annotations")) {
+                for (auto& a : j["annotations"]) {
+                    Annotation ann;
+                    ann.sampleStart = a.contains("core:sample_start") ? (uint64_t)a["core:sample_start"] : 0;
+                    ann.sampleCount = a.contains("core:sample_count") ? (uint64_t)a["core:sample_count"] : 0;
+                    ann.freqLowerEdge = a.contains("core:freq_lower_edge") ? (double)a["core:freq_lower_edge"] : 0.0;
+                    ann.freqUpperEdge = a.contains("core:freq_upper_edge") ? (double)a["core:freq_upper_edge"] : 0.0;
+                    if (a.contains("core:label")) { ann.label = a["core:label"]; }
+                    meta.annotations.push_back(ann);
+                }
+            }
+        }
+        catch (const std::exception& e) {
+            flog::error("Could not parse SigMF metadata '{0}': {1}", path, e.what());
+            return false;
+        }
+        return true;
+    }
+
+    bool saveMetadata(std::string path, const Metadata& meta) {
+        json j;
+        j["global"]["core:datatype"] = dataTypeName(meta.dataType);
+        j["global"]["core:sample_rate"] = meta.sampleRate;
+        j["global"]["core:version"] = SIGMF_VERSION;
+        j["global"]["core:num_channels"] = 1;
+        if (!meta.description.empty()) { j["global"]["core:description"] = meta.description; }
+        if (!meta.recorder.empty()) { j["global"]["core:recorder"] = meta.recorder; }
+
+        j["captures"] = json::array();
+        for (const auto& cap : meta.captures) {
+            json c;
+            c["core:sample_start"] = cap.sampleStart;
+            c["core:frequency"] = cap.frequency;
+            if (cap.headerBytes) { c["core:header_bytes"] = cap.headerBytes; }
+            if (cap.datetime) { c["core:datetime"] = formatDatetime(cap.datetime); }
+            j["captures"].push_back(c);
+        }
+
+        j["annotations"] = json::array();
+        for (const auto& ann : meta.annotations) {
+            json a;
+            a["core:sample_start"] = ann.sampleStart;
+            if (ann.sampleCount) { a["core:sample_count"] = ann.sampleCount; }
+            a["core:freq_lower_edge"] = ann.freqLowerEdge;
+            a["core:freq_upper_edge"] = ann.freqUpperEdge;
+            if (!ann.label.empty()) { a["core:label"] = ann.label; }
+            j["annotations"].push_back(a);
+        }
+
+        std::ofstream file(path);
+        if (!file.is_open()) { return false; }
+        file << j.dump(4);
+        return file.good();
+    }
+
+    static uint64_t nowMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    Writer::Writer(async_io::Engine* engine) : file(engine) {
+        meta.dataType = DATA_TYPE_CI16_LE;
+        meta.sampleRate = 1000000.0;
+        meta.recorder = "SDR++";
+    }
+
+    Writer::~Writer() { close(); }
+
+    bool Writer::open(std::string path) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (file.isOpen()) { close(); }
+
+        std::string base = basePath(path);
+        metaPath = base + SIGMF_META_EXT;
+        if (!file.open(base + SIGMF_DATA_EXT)) { return false; }
+
+        // Reset work values
+        samplesWritten = 0;
+        meta.captures.clear();
+        meta.annotations.clear();
+        meta.captures.push_back(Capture{ 0, 0, _centerFreq, nowMicros() });
+        if (meta.dataType == DATA_TYPE_CI16_LE) {
+            bufI16 = dsp::buffer::alloc<int16_t>(SIGMF_CONVERT_SAMPLES * 2);
+        }
+
+        // Write the metadata right away so that the data can be used even if the recording isn't closed properly
+        if (!saveMetadata(metaPath, meta)) {
+            flog::error("Could not write SigMF metadata '{0}'", metaPath);
+        }
+        return true;
+    }
+
+    bool Writer::isOpen() {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        return file.isOpen();
+    }
+
+    void Writer::close() {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (!file.isOpen()) { return; }
+        file.close();
+
+        endAnnotations();
+        if (!saveMetadata(metaPath, meta)) {
+            flog::error("Could not write SigMF metadata '{0}'", metaPath);
+        }
+
+        if (bufI16) {
+            dsp::buffer::free(bufI16);
+            bufI16 = NULL;
+        }
+    }
+
+    void Writer::setSamplerate(double samplerate) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (file.isOpen()) { throw std::runtime_error("Cannot change parameters while file is open"); }
+        if (samplerate <= 0.0) { throw std::runtime_error("Samplerate must be non-zero"); }
+        meta.sampleRate = samplerate;
+    }
+
+    void Writer::setDataType(DataType type) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (file.isOpen()) { throw std::runtime_error("Cannot change parameters while file is open"); }
+        if (type != DATA_TYPE_CI16_LE && type != DATA_TYPE_CF32_LE) { throw std::runtime_error("Unsupported SigMF data type"); }
+        meta.dataType = type;
+    }
+
+    void Writer::setDescription(std::string description) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        meta.description = description;
+    }
+
+    void Writer::setCenterFrequency(double freq) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        _centerFreq = freq;
+        if (!file.isOpen()) { return; }
+
+        // Replace the last capture instead of leaving an empty one, its annotations will be added again
+        if (meta.captures.back().sampleStart == samplesWritten) {
+            meta.captures.back().frequency = freq;
+            meta.annotations.erase(std::remove_if(meta.annotations.begin(), meta.annotations.end(), [this](const Annotation& a) {
+                return !a.sampleCount && a.sampleStart == samplesWritten;
+            }), meta.annotations.end());
+            return;
+        }
+        endAnnotations();
+        meta.captures.push_back(Capture{ samplesWritten, 0, freq, nowMicros() });
+    }
+
+    void Writer::addAnnotation(const Annotation& annotation) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (!file.isOpen()) { return; }
+        meta.annotations.push_back(annotation);
+    }
+
+    void Writer::endAnnotations() {
+        for (auto& ann : meta.annotations) {
+            if (ann.sampleCount) { continue; }
+            ann.sampleCount = std::max<uint64_t>(samplesWritten - std::min<uint64_t>(ann.sampleStart, samplesWritten), 1);
+        }
+    }
+
+    void Writer::setBuffering(int blockSize, int blockCount) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        file.setBuffering(blockSize, blockCount);
+    }
+
+    void Writer::setDirectIO(bool enabled) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        file.setDirectIO(enabled);
+    }
+
+    void Writer::setPreallocation(uint64_t size) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        file.setPreallocation(size);
+    }
+
+    void Writer::write(const dsp::complex_t* samples, int count) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (!file.isOpen()) { return; }
+
+        // Dropped samples are not counted so that the sample indices match the data file
+        if (meta.dataType != DATA_TYPE_CI16_LE) {
+            if (file.write((const uint8_t*)samples, count * sizeof(dsp::complex_t))) { samplesWritten += count; }
+            return;
+        }
+
+        // Convert a block at a time
+        for (int i = 0; i < count; i += SIGMF_CONVERT_SAMPLES) {
+            int n = std::min<int>(count - i, SIGMF_CONVERT_SAMPLES);
+            dsp::convert::pcm::floatToInt16((const float*)&samples[i], bufI16, n * 2);
+            if (file.write((uint8_t*)bufI16, n * 2 * sizeof(int16_t))) { samplesWritten += n; }
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <dsp/types.h>
+#include "async_writer.h"
+
+#define SIGMF_VERSION       "1.0.0"
+#define SIGMF_META_EXT      ".sigmf-meta"
+#define SIGMF_DATA_EXT      ".sigmf-data"
+
+// Samples converted at once when writing integer data
+#define SIGMF_CONVERT_SAMPLES   8192
+
+/**
+ * SigMF recordings, a raw sample file (.sigmf-data) described by a JSON metadata file
+ * (.sigmf-meta). Only single channel complex data in the native byte order is supported.
+ * See https://github.com/sigmf/SigMF for the specification.
+ */
+namespace sigmf {
+    enum DataType {
+        DATA_TYPE_INVALID = -1,
+        DATA_TYPE_CU8,
+        DATA_TYPE_CI8,
+        DATA_TYPE_CI16_LE,
+        DATA_TYPE_CF32_LE
+    };
+
+    struct Capture {
+        uint64_t sampleStart;   // First sample of the capture
+        uint64_t headerBytes;   // Non-sample bytes before the first sample in the data file
+        double frequency;       // Center frequency in Hz
+        uint64_t datetime;      // Microseconds since the epoch, 0 if unknown
+    };
+
+    struct Annotation {
+        uint64_t sampleStart;
+        uint64_t sampleCount;   // 0 until the end of the recording
+        double freqLowerEdge;
+        double freqUpperEdge;
+        std::string label;
+    };
+
+    struct Metadata {
+        DataType dataType = DATA_TYPE_INVALID;
+        double sampleRate = 0.0;
+        std::string description;
+        std::string recorder;
+        std::vector<Capture> captures;
+        std::vector<Annotation> annotations;
+    };
+
+    // Name used in core:datatype and the reverse
+    std::string dataTypeName(DataType type);
+    DataType parseDataType(std::string name);
+
+    // Size of a complex sample
+    int sampleSize(DataType type);
+
+    // ISO 8601 UTC timestamps as used in core:datetime
+    std::string formatDatetime(uint64_t us);
+    uint64_t parseDatetime(std::string str);
+
+    // Path of the recording without the SigMF extension
+    std::string basePath(std::string path);
+
+    bool loadMetadata(std::string path, Metadata& meta);
+    bool saveMetadata(std::string path, const Metadata& meta);
+
+    class Writer {
+    public:
+        Writer(async_io::Engine* engine = NULL);
+        ~Writer();
+
+        /**
+         * Open a recording.
+         * @param path Path of the recording, the SigMF extensions are added to it.
+         */
+        bool open(std::string path);
+        bool isOpen();
+        void close();
+
+        // Can't be changed while open, only ci16_le and cf32_le can be written
+        void setSamplerate(double samplerate);
+        void setDataType(DataType type);
+        void setDescription(std::string description);
+
+        // Starts a new capture when called while open
+        void setCenterFrequency(double freq);
+
+        // Annotations still open (sample count of 0) are ended by a new capture or when closing
+        void addAnnotation(const Annotation& annotation);
+
+        // Write-behind settings, see async_io::Writer
+        void setBuffering(int blockSize, int blockCount);
+        void setDirectIO(bool enabled);
+        void setPreallocation(uint64_t size);
+        async_io::Stats getIOStats() { return file.getStats(); }
+
+        void write(const dsp::complex_t* samples, int count);
+
+        uint64_t getSamplesWritten() { return samplesWritten; }
+
+    private:
+        void endAnnotations();
+
+        std::recursive_mutex mtx;
+        async_io::Writer file;
+        Metadata meta;
+        std::string metaPath;
+        double _centerFreq = 0.0;
+        int16_t* bufI16 = NULL;
+        uint64_t samplesWritten = 0;
+    };
+}
@@ -0,0 +1,555 @@
+#include "spectrogram_store.h"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <filesystem>
+#include <utils/flog.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace spectrogram {
+    const char* SEGMENT_SIGNATURE   = "SPGM";
+    const uint32_t STORE_VERSION    = 1;
+    const float MIN_LEVEL           = -200.0f;
+    const float MAX_LEVEL           = 200.0f;
+
+    Store::~Store() {
+        close();
+    }
+
+    bool Store::open(std::string dir, int width, int linesPerSegment) {
+        close();
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+
+        // Create the directory if needed
+        if (!std::filesystem::is_directory(dir)) {
+            std::error_code ec;
+            if (!std::filesystem::create_directories(dir, ec)) {
+                flog::error("Could not create spectrogram history directory {0}", dir);
+                return false;
+            }
+        }
+
+        _dir = dir;
+        _width = width;
+        _linesPerSegment = linesPerSegment;
+        recordSize = sizeof(LineHeader) + _width;
+        firstSegment = 0;
+        firstLine = 0;
+        lineCount = 0;
+        lastTimestamp = 0;
+
+        // Load the existing segments listed in the index, the first ones may have been deleted by the retention limits
+        std::string indexPath = _dir + "/index.bin";
+        FILE* idx = fopen(indexPath.c_str(), "rb");
+        bool indexBroken = false;
+        if (idx) {
+            IndexEntry entry;
+            bool first = true;
+            while (fread(&entry, sizeof(IndexEntry), 1, idx) == 1) {
+                if (first) {
+                    firstSegment = entry.segment;
+                    firstLine = (int64_t)firstSegment * _linesPerSegment;
+                    first = false;
+                }
+                if (entry.segment != firstSegment + segments.size()) {
+                    indexBroken = true;
+                    break;
+                }
+                Segment seg;
+                if (!openSegment(entry.segment, false, seg)) {
+                    flog::error("Spectrogram history segment {0} is missing or invalid, ignoring the rest of the history", entry.segment);
+                    indexBroken = true;
+                    break;
+                }
+                SegmentHeader* shdr = (SegmentHeader*)seg.data;
+                if (shdr->width != (uint32_t)_width) {
+                    flog::error("Spectrogram history in {0} was recorded with a different width", _dir);
+                    closeSegment(seg);
+                    fclose(idx);
+                    for (auto& s : segments) { closeSegment(s); }
+                    segments.clear();
+                    return false;
+                }
+                seg.firstTimestamp = entry.firstTimestamp;
+                seg.lineCount = countLines(seg);
+                lineCount += seg.lineCount;
+                segments.push_back(seg);
+            }
+            fclose(idx);
+        }
+        if (!segments.empty() && segments.back().lineCount) {
+            Segment& last = segments.back();
+            lastTimestamp = lineAt(last, last.lineCount - 1)->timestamp;
+        }
+
+        // New segments are created after the loaded ones, move any other file in the way aside instead of overwriting it
+        quarantineSegments(firstSegment + segments.size());
+
+        // Open the index for appending, dropping the entries that couldn't be loaded
+        if (indexBroken) {
+            rewriteIndex();
+        }
+        else {
+            indexFile = fopen(indexPath.c_str(), "ab");
+        }
+        if (!indexFile) {
+            flog::error("Could not open spectrogram history index {0}", indexPath);
+            for (auto& s : segments) { closeSegment(s); }
+            segments.clear();
+            return false;
+        }
+
+        // Start the writer
+        pendingLines = 0;
+        writingLines = 0;
+        batchReady = false;
+        stopWorker = false;
+        workerThread = std::thread(&Store::worker, this);
+
+        {
+            std::lock_guard<std::mutex> lck2(batchMtx);
+            _open = true;
+        }
+        flog::info("Opened spectrogram history {0} ({1} lines)", _dir, lineCount);
+        return true;
+    }
+
+    bool Store::isOpen() {
+        std::lock_guard<std::mutex> lck(batchMtx);
+        return _open;
+    }
+
+    void Store::close() {
+        {
+            std::lock_guard<std::mutex> lck(batchMtx);
+            if (!_open) { return; }
+            _open = false;
+            stopWorker = true;
+        }
+        batchCnd.notify_all();
+        if (workerThread.joinable()) { workerThread.join(); }
+
+        // Write whatever is still buffered
+        if (batchReady) {
+            quantizeLines(writing, writingLines, quantized);
+            writeBatch(quantized);
+        }
+        quantizeLines(pending, pendingLines, quantized);
+        writeBatch(quantized);
+        pendingLines = 0;
+        writingLines = 0;
+        batchReady = false;
+
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        for (auto& seg : segments) {
+            flushSegment(seg, 0, seg.size);
+            closeSegment(seg);
+        }
+        segments.clear();
+        firstSegment = 0;
+        firstLine = 0;
+        lineCount = 0;
+        if (indexFile) {
+            fclose(indexFile);
+            indexFile = NULL;
+        }
+    }
+
+    int64_t Store::getFirstLine() {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        return firstLine;
+    }
+
+    int64_t Store::getLineCount() {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        return lineCount;
+    }
+
+    void Store::setRetention(int64_t maxSize, int64_t maxAge) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        this->maxSize = maxSize;
+        this->maxAge = maxAge;
+        if (indexFile) { applyRetention(); }
+    }
+
+    void Store::append(int64_t timestamp, double centerFreq, double bandwidth, const float* data, int count) {
+        std::lock_guard<std::mutex> lck(batchMtx);
+        if (!_open || count <= 0) { return; }
+
+        // Drop the line if the writer is too far behind rather than growing without bound
+        if (pendingLines >= SPECTROGRAM_MAX_PENDING_LINES) { return; }
+
+        // Timestamps must be strictly positive and never go backwards for the lookups to work
+        timestamp = std::max<int64_t>(std::max<int64_t>(timestamp, lastTimestamp), 1);
+        lastTimestamp = timestamp;
+
+        // Only copy the raw line, the writer thread resamples and quantizes it. The line buffers are reused between batches
+        if (pending.size() <= pendingLines) { pending.resize(pendingLines + 1); }
+        RawLine& line = pending[pendingLines++];
+        line.timestamp = timestamp;
+        line.centerFreq = centerFreq;
+        line.bandwidth = bandwidth;
+        line.data.assign(data, data + count);
+
+        // Hand the batch over to the writer if it's idle, otherwise keep accumulating
+        if (pendingLines >= SPECTROGRAM_BATCH_LINES && !batchReady) {
+            std::swap(pending, writing);
+            writingLines = pendingLines;
+            pendingLines = 0;
+            batchReady = true;
+            batchCnd.notify_one();
+        }
+    }
+
+    void Store::quantizeLines(const std::vector<RawLine>& lines, int count, std::vector<uint8_t>& out) {
+        out.resize(count * recordSize);
+        resampled.resize(_width);
+        for (int l = 0; l < count; l++) {
+            const RawLine& raw = lines[l];
+            const float* data = raw.data.data();
+            int rawCount = raw.data.size();
+
+            // Resample to the store width keeping the peak of each bin
+            float min = INFINITY;
+            float max = -INFINITY;
+            for (int i = 0; i < _width; i++) {
+                int start = ((int64_t)i * rawCount) / _width;
+                int end = std::max<int>(((int64_t)(i + 1) * rawCount) / _width, start + 1);
+                float val = data[start];
+                for (int j = start + 1; j < end; j++) {
+                    if (data[j] > val) { val = data[j]; }
+                }
+                val = std::clamp<float>(val, MIN_LEVEL, MAX_LEVEL);
+                resampled[i] = val;
+                if (val < min) { min = val; }
+                if (val > max) { max = val; }
+            }
+
+            // Quantize
+            LineHeader* hdr = (LineHeader*)&out[l * recordSize];
+            hdr->timestamp = raw.timestamp;
+            hdr->centerFreq = raw.centerFreq;
+            hdr->bandwidth = raw.bandwidth;
+            hdr->min = min;
+            hdr->step = (max > min) ? ((max - min) / 255.0f) : 1.0f;
+            uint8_t* line = &out[(l * recordSize) + sizeof(LineHeader)];
+            float scale = 1.0f / hdr->step;
+            for (int i = 0; i < _width; i++) {
+                line[i] = (uint8_t)std::min<float>(((resampled[i] - min) * scale) + 0.5f, 255.0f);
+            }
+        }
+    }
+
+    bool Store::readLine(int64_t id, float* data, LineHeader& hdr) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        id -= firstLine;
+        if (id < 0 || id >= lineCount) { return false; }
+
+        // Every segment but the last one is full
+        const Segment& seg = segments[id / _linesPerSegment];
+        LineHeader* lhdr = lineAt(seg, id % _linesPerSegment);
+        hdr = *lhdr;
+
+        // Dequantize
+        uint8_t* line = (uint8_t*)&lhdr[1];
+        for (int i = 0; i < _width; i++) {
+            data[i] = hdr.min + ((float)line[i] * hdr.step);
+        }
+        return true;
+    }
+
+    int64_t Store::getTimestamp(int64_t id) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        id -= firstLine;
+        if (id < 0 || id >= lineCount) { return 0; }
+        return lineAt(segments[id / _linesPerSegment], id % _linesPerSegment)->timestamp;
+    }
+
+    int64_t Store::findLine(int64_t timestamp) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        if (!lineCount) { return -1; }
+
+        // Find the last segment starting before the timestamp
+        auto segIt = std::upper_bound(segments.begin(), segments.end(), timestamp, [](int64_t ts, const Segment& seg) {
+            return ts < seg.firstTimestamp;
+        });
+        if (segIt == segments.begin()) { return firstLine; }
+        segIt--;
+
+        // Find the last line of that segment at or before the timestamp
+        int64_t low = 0;
+        int64_t high = segIt->lineCount - 1;
+        while (low < high) {
+            int64_t mid = (low + high + 1) / 2;
+            if (lineAt(*segIt, mid)->timestamp <= timestamp) {
+                low = mid;
+            }
+            else {
+                high = mid - 1;
+            }
+        }
+
+        return firstLine + ((segIt - segments.begin()) * (int64_t)_linesPerSegment) + low;
+    }
+
+    std::string Store::segmentPath(int id) {
+        char name[32];
+        sprintf(name, "/segment_%08d.spg", id);
+        return _dir + name;
+    }
+
+    bool Store::openSegment(int id, bool create, Segment& seg) {
+        std::string path = segmentPath(id);
+        seg.size = sizeof(SegmentHeader) + (_linesPerSegment * recordSize);
+        seg.firstTimestamp = 0;
+        seg.lineCount = 0;
+
+#ifdef _WIN32
+        seg.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (seg.file == INVALID_HANDLE_VALUE) { return false; }
+        if (!create) {
+            LARGE_INTEGER fsize;
+            if (!GetFileSizeEx(seg.file, &fsize) || (size_t)fsize.QuadPart < seg.size) {
+                CloseHandle(seg.file);
+                return false;
+            }
+        }
+        seg.mapping = CreateFileMappingA(seg.file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)seg.size >> 32), (DWORD)seg.size, NULL);
+        if (!seg.mapping) {
+            CloseHandle(seg.file);
+            return false;
+        }
+        seg.data = (uint8_t*)MapViewOfFile(seg.mapping, FILE_MAP_ALL_ACCESS, 0, 0, seg.size);
+        if (!seg.data) {
+            CloseHandle(seg.mapping);
+            CloseHandle(seg.file);
+            return false;
+        }
+#else
+        // Never overwrite an existing file when creating a segment
+        seg.fd = ::open(path.c_str(), O_RDWR | (create ? (O_CREAT | O_EXCL) : 0), 0644);
+        if (seg.fd < 0) { return false; }
+        if (create) {
+            if (ftruncate(seg.fd, seg.size)) {
+                ::close(seg.fd);
+                return false;
+            }
+        }
+        else {
+            struct stat st;
+            if (fstat(seg.fd, &st) || (size_t)st.st_size < seg.size) {
+                ::close(seg.fd);
+                return false;
+            }
+        }
+        void* ptr = mmap(NULL, seg.size, PROT_READ | PROT_WRITE, MAP_SHARED, seg.fd, 0);
+        if (ptr == MAP_FAILED) {
+            ::close(seg.fd);
+            return false;
+        }
+        seg.data = (uint8_t*)ptr;
+#endif
+
+        SegmentHeader* hdr = (SegmentHeader*)seg.data;
+        if (create) {
+            memcpy(hdr->signature, SEGMENT_SIGNATURE, 4);
+            hdr->version = STORE_VERSION;
+            hdr->width = _width;
+            hdr->capacity = _linesPerSegment;
+        }
+        else if (memcmp(hdr->signature, SEGMENT_SIGNATURE, 4) || hdr->version != STORE_VERSION || hdr->capacity != (uint32_t)_linesPerSegment) {
+            closeSegment(seg);
+            return false;
+        }
+
+        return true;
+    }
+
+    void Store::closeSegment(Segment& seg) {
+#ifdef _WIN32
+        UnmapViewOfFile(seg.data);
+        CloseHandle(seg.mapping);
+        CloseHandle(seg.file);
+#else
+        munmap(seg.data, seg.size);
+        ::close(seg.fd);
+#endif
+        seg.data = NULL;
+    }
+
+    void Store::flushSegment(Segment& seg, size_t offset, size_t len) {
+        if (!len) { return; }
+#ifdef _WIN32
+        FlushViewOfFile(&seg.data[offset], len);
+#else
+        // msync needs a page aligned address
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t start = (offset / pageSize) * pageSize;
+        msync(&seg.data[start], (offset - start) + len, MS_ASYNC);
+#endif
+    }
+
+    int64_t Store::countLines(Segment& seg) {
+        // Unused lines are zeroed, find the first one with a null timestamp
+        int64_t low = 0;
+        int64_t high = _linesPerSegment;
+        while (low < high) {
+            int64_t mid = (low + high) / 2;
+            if (lineAt(seg, mid)->timestamp) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    void Store::worker() {
+        while (true) {
+            int count;
+            {
+                std::unique_lock<std::mutex> lck(batchMtx);
+                batchCnd.wait(lck, [this]() { return batchReady || stopWorker; });
+                if (!batchReady) { break; }
+                std::swap(workerBatch, writing);
+                count = writingLines;
+                writingLines = 0;
+                batchReady = false;
+            }
+            quantizeLines(workerBatch, count, quantized);
+            writeBatch(quantized);
+        }
+    }
+
+    void Store::writeBatch(const std::vector<uint8_t>& batch) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        int count = batch.size() / recordSize;
+        int done = 0;
+        while (done < count) {
+            // Start a new segment if the last one is full
+            if (segments.empty() || segments.back().lineCount >= _linesPerSegment) {
+                Segment seg;
+                int id = firstSegment + segments.size();
+                if (!openSegment(id, true, seg)) {
+                    flog::error("Could not create spectrogram history segment {0}, dropping {1} lines", id, count - done);
+                    return;
+                }
+                seg.firstTimestamp = ((LineHeader*)&batch[done * recordSize])->timestamp;
+                segments.push_back(seg);
+
+                // Register it in the index
+                IndexEntry entry;
+                entry.segment = id;
+                entry.firstTimestamp = seg.firstTimestamp;
+                fwrite(&entry, sizeof(IndexEntry), 1, indexFile);
+                fflush(indexFile);
+            }
+
+            // Copy as many lines as fit in the segment
+            Segment& seg = segments.back();
+            int toWrite = std::min<int>(count - done, _linesPerSegment - seg.lineCount);
+            size_t offset = sizeof(SegmentHeader) + (seg.lineCount * recordSize);
+            memcpy(&seg.data[offset], &batch[done * recordSize], toWrite * recordSize);
+            flushSegment(seg, offset, toWrite * recordSize);
+            seg.lineCount += toWrite;
+            lineCount += toWrite;
+            done += toWrite;
+        }
+
+        applyRetention();
+    }
+
+    void Store::applyRetention() {
+        if (!maxSize && !maxAge) { return; }
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+
+        // Delete the oldest segments until the limits are met, never the one being written
+        int64_t newest = (!segments.empty() && segments.back().lineCount) ? lineAt(segments.back(), segments.back().lineCount - 1)->timestamp : 0;
+        int count = 0;
+        while (count < (int)segments.size() - 1) {
+            const Segment& seg = segments[count];
+            bool tooBig = maxSize && (int64_t)((segments.size() - count) * seg.size) > maxSize;
+            bool tooOld = maxAge && (newest - lineAt(seg, seg.lineCount - 1)->timestamp) > maxAge;
+            if (!tooBig && !tooOld) { break; }
+            count++;
+        }
+        if (!count) { return; }
+
+        // Remove them from the index first so that a crash can't leave it pointing to missing segments
+        std::vector<Segment> deleted(segments.begin(), segments.begin() + count);
+        int deletedFirst = firstSegment;
+        segments.erase(segments.begin(), segments.begin() + count);
+        firstSegment += count;
+        firstLine += (int64_t)count * _linesPerSegment;
+        lineCount -= (int64_t)count * _linesPerSegment;
+        if (!rewriteIndex()) {
+            flog::error("Could not rewrite the spectrogram history index");
+        }
+
+        for (int i = 0; i < count; i++) {
+            closeSegment(deleted[i]);
+            std::error_code ec;
+            std::filesystem::remove(segmentPath(deletedFirst + i), ec);
+        }
+        flog::info("Deleted {0} old spectrogram history segments", count);
+    }
+
+    void Store::quarantineSegments(int firstFree) {
+        // List them first, the directory is modified along the way
+        std::error_code ec;
+        std::vector<std::filesystem::path> found;
+        for (const auto& file : std::filesystem::directory_iterator(_dir, ec)) {
+            int id;
+            std::string name = file.path().filename().string();
+            if (sscanf(name.c_str(), "segment_%08d.spg", &id) != 1 || name.size() != 20 || id < firstFree) { continue; }
+            found.push_back(file.path());
+        }
+
+        for (const auto& path : found) {
+            std::string name = path.filename().string();
+
+            // Find a free name next to it
+            std::string bad = path.string() + ".bad";
+            for (int i = 1; std::filesystem::exists(bad); i++) {
+                bad = path.string() + ".bad" + std::to_string(i);
+            }
+            std::filesystem::rename(path, bad, ec);
+            if (ec) {
+                flog::error("Could not move aside spectrogram history segment {0}", name);
+            }
+            else {
+                flog::warn("Spectrogram history segment {0} is not part of the history, moved to {1}", name, bad);
+            }
+        }
+    }
+
+    bool Store::rewriteIndex() {
+        // Write the new index next to the old one and swap them
+        std::string indexPath = _dir + "/index.bin";
+        std::string tmpPath = _dir + "/index.tmp";
+        FILE* idx = fopen(tmpPath.c_str(), "wb");
+        if (!idx) { return false; }
+        for (int i = 0; i < (int)segments.size(); i++) {
+            IndexEntry entry;
+            entry.segment = firstSegment + i;
+            entry.firstTimestamp = segments[i].firstTimestamp;
+            fwrite(&entry, sizeof(IndexEntry), 1, idx);
+        }
+        fclose(idx);
+
+        if (indexFile) { fclose(indexFile); }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, indexPath, ec);
+        indexFile = fopen(indexPath.c_str(), "ab");
+        return !ec && indexFile;
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdint.h>
+
+// Number of lines buffered in RAM before being handed to the writer thread
+#define SPECTROGRAM_BATCH_LINES 32
+
+// Lines waiting for the writer thread beyond which new lines are dropped
+#define SPECTROGRAM_MAX_PENDING_LINES 256
+
+namespace spectrogram {
+#pragma pack(push, 1)
+    struct SegmentHeader {
+        char signature[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t capacity;
+    };
+
+    struct LineHeader {
+        int64_t timestamp; // Milliseconds since epoch, 0 means unused
+        double centerFreq;
+        double bandwidth;
+        float min;
+        float step;
+    };
+
+    struct IndexEntry {
+        uint32_t segment;
+        int64_t firstTimestamp;
+    };
+#pragma pack(pop)
+
+    /**
+     * Append-only on-disk spectrogram history.
+     * Lines are resampled to a fixed width, quantized to 8 bits and stored in fixed-size
+     * memory-mapped segment files. An index file lists the segments with the timestamp of
+     * their first line, so any timestamp can be found with two binary searches.
+     * Line IDs are absolute and stay valid when the oldest segments are deleted by the
+     * retention limits, the retained lines go from getFirstLine() to getFirstLine() + getLineCount() - 1.
+     */
+    class Store {
+    public:
+        Store() {}
+        ~Store();
+
+        bool open(std::string dir, int width, int linesPerSegment = 16384);
+        bool isOpen();
+        void close();
+
+        int getWidth() { return _width; }
+        int64_t getFirstLine();
+        int64_t getLineCount();
+
+        /**
+         * Limit the size of the history, the oldest segments are deleted once a limit is exceeded.
+         * The segment being written is always kept.
+         * @param maxSize Maximum size on disk in bytes, 0 for no limit.
+         * @param maxAge Maximum age of the lines in milliseconds, relative to the newest line. 0 for no limit.
+         */
+        void setRetention(int64_t maxSize, int64_t maxAge);
+
+        void append(int64_t timestamp, double centerFreq, double bandwidth, const float* data, int count);
+        bool readLine(int64_t id, float* data, LineHeader& hdr);
+        int64_t getTimestamp(int64_t id);
+        int64_t findLine(int64_t timestamp);
+
+    private:
+        struct Segment {
+            uint8_t* data;
+            size_t size;
+            int64_t firstTimestamp;
+            int64_t lineCount;
+#ifdef _WIN32
+            void* file;
+            void* mapping;
+#else
+            int fd;
+#endif
+        };
+
+        std::string segmentPath(int id);
+        bool openSegment(int id, bool create, Segment& seg);
+        void closeSegment(Segment& seg);
+        void flushSegment(Segment& seg, size_t offset, size_t len);
+        int64_t countLines(Segment& seg);
+        inline LineHeader* lineAt(const Segment& seg, int64_t line) {
+            return (LineHeader*)&seg.data[sizeof(SegmentHeader) + line * recordSize];
+        }
+
+        struct RawLine {
+            int64_t timestamp;
+            double centerFreq;
+            double bandwidth;
+            std::vector<float> data;
+        };
+
+        void worker();
+        void quantizeLines(const std::vector<RawLine>& lines, int count, std::vector<uint8_t>& out);
+        void writeBatch(const std::vector<uint8_t>& batch);
+        void quarantineSegments(int firstFree);
+        void applyRetention();
+        bool rewriteIndex();
+
+        std::recursive_mutex mtx;
+        std::string _dir;
+        int _width = 0;
+        int _linesPerSegment = 0;
+        size_t recordSize = 0;
+        bool _open = false;
+
+        std::vector<Segment> segments;
+        int firstSegment = 0;
+        int64_t firstLine = 0;
+        int64_t lineCount = 0;
+        int64_t maxSize = 0;
+        int64_t maxAge = 0;
+        FILE* indexFile = NULL;
+
+        // Batching
+        std::mutex batchMtx;
+        std::condition_variable batchCnd;
+        std::vector<RawLine> pending;
+        std::vector<RawLine> writing;
+        int pendingLines = 0;
+        int writingLines = 0;
+        int64_t lastTimestamp = 0;
+        bool batchReady = false;
+        bool stopWorker = false;
+        std::thread workerThread;
+
+        // Only used by the writer thread, or by close() once it has stopped
+        std::vector<RawLine> workerBatch;
+        std::vector<uint8_t> quantized;
+        std::vector<float> resampled;
+    };
+}
@@ -1,9 +1,9 @@
 #include "wav.h"
-#include <volk/volk.h>
 #include <stdexcept>
 #include <dsp/buffer/buffer.h>
-#include <dsp/stream.h>
+#include <dsp/convert/pcm.h>
 #include <map>
+#include <algorithm>
 
 namespace wav {
     const char* WAVE_FILE_TYPE          = "WAVE";
@@ -15,11 +15,16 @@ namespace wav {
     std::map<SampleType, int> SAMP_BITS = {
         { SAMP_TYPE_UINT8, 8 },
         { SAMP_TYPE_INT16, 16 },
+        { SAMP_TYPE_INT24, 24 },
         { SAMP_TYPE_INT32, 32 },
         { SAMP_TYPE_FLOAT32, 32 }
     };
-    
-    Writer::Writer(int channels, uint64_t samplerate, Format format, SampleType type) {
+
+    int bitDepth(SampleType type) {
+        return SAMP_BITS[type];
+    }
+
+    Writer::Writer(int channels, uint64_t samplerate, Format format, SampleType type, async_io::Engine* engine) : rw(engine) {
         // Validate channels and samplerate
         if (channels < 1) { throw std::runtime_error("Channel count must be greater or equal to 1"); }
         if (!samplerate) { throw std::runtime_error("Samplerate must be non-zero"); }
@@ -31,7 +36,10 @@ namespace wav {
         _type = type;
     }
 
-    Writer::~Writer() { close(); }
+    Writer::~Writer() {
+        close();
+        if (convBuf) { dsp::buffer::free(convBuf); }
+    }
 
     bool Writer::open(std::string path) {
         std::lock_guard<std::recursive_mutex> lck(mtx);
@@ -40,8 +48,12 @@ namespace wav {
 
         // Reset work values
         samplesWritten = 0;
+        segmentWritten = 0;
+        segmentIndex = 0;
+        basePath = path;
 
         // Fill header
+        if (!SAMP_BITS.count(_type)) { return false; }
         bytesPerSamp = (SAMP_BITS[_type] / 8) * _channels;
         hdr.codec = (_type == SAMP_TYPE_FLOAT32) ? CODEC_FLOAT : CODEC_PCM;
         hdr.channelCount = _channels;
@@ -50,36 +62,56 @@ namespace wav {
         hdr.bytesPerSample = bytesPerSamp;
         hdr.bytesPerSecond = bytesPerSamp * _samplerate;
 
-        // Precompute sizes and allocate buffers
-        switch (_type) {
-        case SAMP_TYPE_UINT8:
-            bufU8 = dsp::buffer::alloc<uint8_t>(STREAM_BUFFER_SIZE * _channels);
-            break;
-        case SAMP_TYPE_INT16:
-            bufI16 = dsp::buffer::alloc<int16_t>(STREAM_BUFFER_SIZE * _channels);
-            break;
-        case SAMP_TYPE_INT32:
-            bufI32 = dsp::buffer::alloc<int32_t>(STREAM_BUFFER_SIZE * _channels);
-            break;
-        case SAMP_TYPE_FLOAT32:
-            break;
-        default:
-            return false;
-            break;
+        // Conversions go through a buffer of a block of frames, kept from one file to the next
+        if (_type != SAMP_TYPE_FLOAT32 && convBufSize < WAV_CONVERT_FRAMES * bytesPerSamp) {
+            if (convBuf) { dsp::buffer::free(convBuf); }
+            convBufSize = WAV_CONVERT_FRAMES * bytesPerSamp;
+            convBuf = dsp::buffer::alloc<uint8_t>(convBufSize);
+        }
+
+        // Compute the segment length in samples
+        segmentLength = maxSegmentSamples;
+        if (maxSegmentBytes) {
+            uint64_t bytesLimit = std::max<uint64_t>(maxSegmentBytes / bytesPerSamp, 1);
+            segmentLength = segmentLength ? std::min<uint64_t>(segmentLength, bytesLimit) : bytesLimit;
         }
 
         // Open file
-        if (!rw.open(path, WAVE_FILE_TYPE)) { return false; }
+        if (!rw.open(segmentLength ? segmentPath(0) : path, WAVE_FILE_TYPE, _format == FORMAT_RF64)) { return false; }
+        beginFile();
+        
+        return true;
+    }
 
+    void Writer::beginFile() {
         // Write format chunk
         rw.beginChunk(FORMAT_MARKER);
-        rw.write((uint8_t*)&hdr, sizeof(FormatHeader));
+        rw.write((uint8_t*)&hdr, sizeof(FormatHeader), true);
         rw.endChunk();
 
         // Begin data chunk
         rw.beginChunk(DATA_MARKER);
-        
-        return true;
+    }
+
+    void Writer::nextSegment() {
+        // Finish the data chunk and continue in the next file
+        rw.endChunk();
+        rw.setSampleCount(segmentWritten);
+        rw.split(segmentPath(++segmentIndex));
+        beginFile();
+        segmentWritten = 0;
+    }
+
+    std::string Writer::segmentPath(int index) {
+        // Insert the segment number before the extension
+        char suffix[32];
+        sprintf(suffix, "_%04d", index);
+        size_t extPos = basePath.find_last_of('.');
+        size_t sepPos = basePath.find_last_of("/\\");
+        if (extPos == std::string::npos || (sepPos != std::string::npos && extPos < sepPos)) {
+            return basePath + suffix;
+        }
+        return basePath.substr(0, extPos) + suffix + basePath.substr(extPos);
     }
 
     bool Writer::isOpen() {
@@ -94,23 +126,10 @@ namespace wav {
 
         // Finish data chunk
         rw.endChunk();
+        rw.setSampleCount(segmentWritten);
 
         // Close the file
         rw.close();
-
-        // Free buffers
-        if (bufU8) {
-            dsp::buffer::free(bufU8);
-            bufU8 = NULL;
-        }
-        if (bufI16) {
-            dsp::buffer::free(bufI16);
-            bufI16 = NULL;
-        }
-        if (bufI32) {
-            dsp::buffer::free(bufI32);
-            bufI32 = NULL;
-        }
     }
 
     void Writer::setChannels(int channels) {
@@ -147,37 +166,84 @@ namespace wav {
         _type = type;
     }
 
+    void Writer::setSegmentLimits(uint64_t maxBytes, uint64_t maxSamples) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        // Do not allow settings to change while open
+        if (rw.isOpen()) { throw std::runtime_error("Cannot change parameters while file is open"); }
+        maxSegmentBytes = maxBytes;
+        maxSegmentSamples = maxSamples;
+    }
+
+    void Writer::setBuffering(int blockSize, int blockCount) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        rw.setBuffering(blockSize, blockCount);
+    }
+
+    void Writer::setDirectIO(bool enabled) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        rw.setDirectIO(enabled);
+    }
+
+    void Writer::setPreallocation(uint64_t size) {
+        std::lock_guard<std::recursive_mutex> lck(mtx);
+        rw.setPreallocation(size);
+    }
+
     void Writer::write(float* samples, int count) {
         std::lock_guard<std::recursive_mutex> lck(mtx);
         if (!rw.isOpen()) { return; }
-        
-        // Select different writer function depending on the chose depth
-        int tcount = count * _channels;
-        int tbytes = count * bytesPerSamp;
-        switch (_type) {
-        case SAMP_TYPE_UINT8:
-            // Volk doesn't support unsigned ints yet :/
-            for (int i = 0; i < tcount; i++) {
-                bufU8[i] = (samples[i] * 127.0f) + 128.0f;
+
+        // Without segments, write everything at once
+        if (!segmentLength) {
+            int queued = writeSamples(samples, count);
+            samplesWritten += queued;
+            segmentWritten += queued;
+            return;
+        }
+
+        // Cut the samples at the segment boundaries
+        while (count) {
+            int n = std::min<uint64_t>(count, segmentLength - segmentWritten);
+            int queued = writeSamples(samples, n);
+            samplesWritten += queued;
+            segmentWritten += queued;
+            samples += n * _channels;
+            count -= n;
+            if (segmentWritten >= segmentLength) { nextSegment(); }
+        }
+    }
+
+    int Writer::writeSamples(float* samples, int count) {
+        // Float samples are written as they are
+        if (_type == SAMP_TYPE_FLOAT32) {
+            return rw.write((uint8_t*)samples, count * bytesPerSamp, blocking) ? count : 0;
+        }
+
+        // Convert a block at a time, a block that doesn't fit in the write buffer is dropped on its own
+        int queued = 0;
+        for (int i = 0; i < count; i += WAV_CONVERT_FRAMES) {
+            int n = std::min<int>(count - i, WAV_CONVERT_FRAMES);
+            const float* src = &samples[i * _channels];
+            int tcount = n * _channels;
+            switch (_type) {
+            case SAMP_TYPE_UINT8:
+                dsp::convert::pcm::floatToUInt8(src, convBuf, tcount);
+                break;
+            case SAMP_TYPE_INT16:
+                dsp::convert::pcm::floatToInt16(src, (int16_t*)convBuf, tcount);
+                break;
+            case SAMP_TYPE_INT24:
+                dsp::convert::pcm::floatToInt24(src, convBuf, tcount);
+                break;
+            case SAMP_TYPE_INT32:
+                dsp::convert::pcm::floatToInt32(src, (int32_t*)convBuf, tcount);
+                break;
+            default:
+                return queued;
             }
-            rw.write(bufU8, tbytes);
-            break;
-        case SAMP_TYPE_INT16:
-            volk_32f_s32f_convert_16i(bufI16, samples, 32767.0f, tcount);
-            rw.write((uint8_t*)bufI16, tbytes);
-            break;
-        case SAMP_TYPE_INT32:
-            volk_32f_s32f_convert_32i(bufI32, samples, 2147483647.0f, tcount);
-            rw.write((uint8_t*)bufI32, tbytes);
-            break;
-        case SAMP_TYPE_FLOAT32:
-            rw.write((uint8_t*)samples, tbytes);
-            break;
-        default:
-            break;
+            if (rw.write(convBuf, n * bytesPerSamp, blocking)) { queued += n; }
         }
 
-        // Increment sample counter
-        samplesWritten += count;
+        return queued;
     }
 }
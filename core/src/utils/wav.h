@@ -5,6 +5,9 @@
 #include <mutex>
 #include "riff.h"
 
+// Frames converted at once, samples are converted a block at a time instead of all at once
+#define WAV_CONVERT_FRAMES 8192
+
 namespace wav {    
     #pragma pack(push, 1)
     struct FormatHeader {
@@ -26,7 +29,8 @@ namespace wav {
         SAMP_TYPE_UINT8,
         SAMP_TYPE_INT16,
         SAMP_TYPE_INT32,
-        SAMP_TYPE_FLOAT32
+        SAMP_TYPE_FLOAT32,
+        SAMP_TYPE_INT24     // Packed, 3 bytes per sample
     };
 
     enum Codec {
@@ -34,9 +38,12 @@ namespace wav {
         CODEC_FLOAT = 3
     };
 
+    // Size of a sample of one channel in bits
+    int bitDepth(SampleType type);
+
     class Writer {
     public:
-        Writer(int channels = 2, uint64_t samplerate = 48000, Format format = FORMAT_WAV, SampleType type = SAMP_TYPE_INT16);
+        Writer(int channels = 2, uint64_t samplerate = 48000, Format format = FORMAT_WAV, SampleType type = SAMP_TYPE_INT16, async_io::Engine* engine = NULL);
         ~Writer();
 
         bool open(std::string path);
@@ -48,11 +55,35 @@ namespace wav {
         void setFormat(Format format);
         void setSampleType(SampleType type);
 
+        /**
+         * Split the recording into segments that continue each other without a gap. The segments
+         * are named after the path given to open() with a _0000, _0001, ... suffix.
+         * Can't be changed while open.
+         * @param maxBytes Maximum size of the data of a segment, 0 for no limit.
+         * @param maxSamples Maximum number of samples in a segment, 0 for no limit.
+         */
+        void setSegmentLimits(uint64_t maxBytes, uint64_t maxSamples);
+
+        // Write-behind settings, see async_io::Writer
+        void setBuffering(int blockSize, int blockCount);
+        void setDirectIO(bool enabled);
+        void setPreallocation(uint64_t size);
+        async_io::Stats getIOStats() { return rw.getIOStats(); }
+
+        // Wait for the disk instead of dropping samples, for when the input isn't real-time
+        void setBlocking(bool enabled) { blocking = enabled; }
+
         size_t getSamplesWritten() { return samplesWritten; }
+        int getSegmentIndex() { return segmentIndex; }
 
         void write(float* samples, int count);
 
     private:
+        int writeSamples(float* samples, int count);
+        void beginFile();
+        void nextSegment();
+        std::string segmentPath(int index);
+
         std::recursive_mutex mtx;
         FormatHeader hdr;
         riff::Writer rw;
@@ -63,9 +94,16 @@ namespace wav {
         SampleType _type;
         size_t bytesPerSamp;
 
-        uint8_t* bufU8 = NULL;
-        int16_t* bufI16 = NULL;
-        int32_t* bufI32 = NULL;
+        uint8_t* convBuf = NULL;
+        size_t convBufSize = 0;
         size_t samplesWritten = 0;
+        bool blocking = false;
+
+        std::string basePath;
+        uint64_t maxSegmentBytes = 0;
+        uint64_t maxSegmentSamples = 0;
+        uint64_t segmentLength = 0;
+        uint64_t segmentWritten = 0;
+        int segmentIndex = 0;
     };
 }
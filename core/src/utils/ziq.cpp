@@ -0,0 +1,541 @@
+#include "ziq.h"
+#include <utils/flog.h>
+#include <dsp/compression/block_float.h>
+#include <volk/volk.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+#define ZIQ_FILE_MAGIC  "ZIQ1"
+#define ZIQ_FRAME_MAGIC "ZFRM"
+#define ZIQ_INDEX_MAGIC "ZIDX"
+
+namespace ziq {
+    // Group byte b of every element together, bytes of the same weight compress much better
+    static void shuffle(const uint8_t* in, uint8_t* out, int count, int width) {
+        for (int b = 0; b < width; b++) {
+            uint8_t* plane = &out[b * count];
+            for (int i = 0; i < count; i++) { plane[i] = in[(i * width) + b]; }
+        }
+    }
+
+    static void unshuffle(const uint8_t* in, uint8_t* out, int count, int width) {
+        for (int b = 0; b < width; b++) {
+            const uint8_t* plane = &in[b * count];
+            for (int i = 0; i < count; i++) { out[(i * width) + b] = plane[i]; }
+        }
+    }
+
+    int maxQuantizedSize(int count, dsp::compression::PCMType type) {
+        int bits = dsp::compression::bfpBits(type);
+        if (bits) { return dsp::compression::bfp::encodedSize(count * 2, bits); }
+        switch (type) {
+        case dsp::compression::PCM_TYPE_I8:     return count * 2 * sizeof(int8_t);
+        case dsp::compression::PCM_TYPE_I16:    return count * 2 * sizeof(int16_t);
+        default:                                return count * sizeof(dsp::complex_t);
+        }
+    }
+
+    int quantize(const dsp::complex_t* in, int count, dsp::compression::PCMType type, uint8_t* out, uint8_t* tmp) {
+        // Fixed full scale, same as the WAV recordings, so that levels are comparable between frames
+        int bits = dsp::compression::bfpBits(type);
+        if (bits) {
+            return dsp::compression::bfp::encode((const float*)in, count * 2, bits, out);
+        }
+        else if (type == dsp::compression::PCM_TYPE_I8) {
+            volk_32f_s32f_convert_8i((int8_t*)out, (const float*)in, 127.0f, count * 2);
+            return count * 2 * sizeof(int8_t);
+        }
+        else if (type == dsp::compression::PCM_TYPE_I16) {
+            volk_32f_s32f_convert_16i((int16_t*)tmp, (const float*)in, 32767.0f, count * 2);
+            shuffle(tmp, out, count * 2, sizeof(int16_t));
+            return count * 2 * sizeof(int16_t);
+        }
+        shuffle((const uint8_t*)in, out, count * 2, sizeof(float));
+        return count * sizeof(dsp::complex_t);
+    }
+
+    bool dequantize(const uint8_t* in, int len, int count, dsp::compression::PCMType type, dsp::complex_t* out, uint8_t* tmp) {
+        if (len != maxQuantizedSize(count, type)) { return false; }
+        int bits = dsp::compression::bfpBits(type);
+        if (bits) {
+            dsp::compression::bfp::decode(in, count * 2, bits, (float*)out);
+        }
+        else if (type == dsp::compression::PCM_TYPE_I8) {
+            volk_8i_s32f_convert_32f((float*)out, (const int8_t*)in, 127.0f, count * 2);
+        }
+        else if (type == dsp::compression::PCM_TYPE_I16) {
+            unshuffle(in, tmp, count * 2, sizeof(int16_t));
+            volk_16i_s32f_convert_32f((float*)out, (const int16_t*)tmp, 32767.0f, count * 2);
+        }
+        else if (type == dsp::compression::PCM_TYPE_F32) {
+            unshuffle(in, (uint8_t*)out, count * 2, sizeof(float));
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    Writer::Writer(async_io::Engine* engine) : file(engine) {
+        // Leave some cores to the DSP, zstd at low levels is fast enough that a few threads suffice
+        _threads = std::clamp<int>(std::thread::hardware_concurrency() / 2, 1, 4);
+        samplesWritten = 0;
+        samplesDropped = 0;
+        rawBytes = 0;
+        compressedBytes = 0;
+    }
+
+    Writer::~Writer() {
+        close();
+    }
+
+    bool Writer::open(std::string path) {
+        if (_open) { return false; }
+
+        // Frames of about a second, the seek granularity doesn't need to be finer
+        frameSamples = std::clamp<int>(round(_samplerate), BFP_BLOCK_SIZE, ZIQ_MAX_FRAME_SAMPLES);
+
+        if (!file.open(path)) { return false; }
+
+        // Write the header, the index position and the length are filled in when closing
+        memcpy(hdr.magic, ZIQ_FILE_MAGIC, 4);
+        hdr.headerSize = sizeof(FileHeader);
+        hdr.sampleRate = _samplerate;
+        hdr.centerFreq = _centerFreq;
+        hdr.startTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        hdr.pcmType = _type;
+        hdr.frameSamples = frameSamples;
+        hdr.indexOffset = 0;
+        hdr.sampleCount = 0;
+        file.write((uint8_t*)&hdr, sizeof(FileHeader), true);
+
+        // Allocate the frames, one is filled while the others are compressed
+        int frameCount = (_threads * ZIQ_FRAMES_PER_THREAD) + 1;
+        size_t bound = ZSTD_compressBound(maxQuantizedSize(frameSamples, _type));
+        for (int i = 0; i < frameCount; i++) {
+            Frame* frame = new Frame;
+            frame->samples = (dsp::complex_t*)volk_malloc(frameSamples * sizeof(dsp::complex_t), volk_get_alignment());
+            frame->data.resize(bound);
+            frames.push_back(frame);
+            freeFrames.push_back(frame);
+        }
+
+        current = NULL;
+        fill = 0;
+        timeline = 0;
+        nextSeq = 0;
+        commitSeq = 0;
+        index.clear();
+        samplesWritten = 0;
+        samplesDropped = 0;
+        rawBytes = 0;
+        compressedBytes = 0;
+
+        // Start the compression threads
+        stopWorkers = false;
+        for (int i = 0; i < _threads; i++) {
+            workers.push_back(std::thread(&Writer::worker, this));
+        }
+
+        _open = true;
+        return true;
+    }
+
+    bool Writer::isOpen() {
+        return _open;
+    }
+
+    void Writer::close() {
+        if (!_open) { return; }
+
+        // Compress the partial frame
+        if (current && fill) {
+            submit();
+        }
+        else if (current) {
+            std::lock_guard<std::mutex> lck(frameMtx);
+            freeFrames.push_back(current);
+            current = NULL;
+        }
+        fill = 0;
+
+        // Let the workers finish the queued frames, every frame is written once they exit
+        {
+            std::lock_guard<std::mutex> lck(frameMtx);
+            stopWorkers = true;
+        }
+        jobCnd.notify_all();
+        for (auto& w : workers) {
+            if (w.joinable()) { w.join(); }
+        }
+        workers.clear();
+
+        // Write the index and point the header to it
+        hdr.indexOffset = file.tell();
+        hdr.sampleCount = timeline;
+        uint64_t count = index.size();
+        file.write((uint8_t*)ZIQ_INDEX_MAGIC, 4, true);
+        file.write((uint8_t*)&count, sizeof(uint64_t), true);
+        if (count) {
+            file.write((uint8_t*)index.data(), count * sizeof(IndexEntry), true);
+        }
+        file.writeAt(0, (uint8_t*)&hdr, sizeof(FileHeader));
+        file.close();
+
+        for (auto& frame : frames) {
+            volk_free(frame->samples);
+            delete frame;
+        }
+        frames.clear();
+        freeFrames.clear();
+        jobs.clear();
+        done.clear();
+
+        _open = false;
+    }
+
+    void Writer::setSamplerate(double samplerate) {
+        if (_open) { return; }
+        _samplerate = samplerate;
+    }
+
+    void Writer::setCenterFrequency(double freq) {
+        if (_open) { return; }
+        _centerFreq = freq;
+    }
+
+    void Writer::setSampleType(dsp::compression::PCMType type) {
+        if (_open) { return; }
+        _type = type;
+    }
+
+    void Writer::setCompressionLevel(int level) {
+        if (_open) { return; }
+        _level = std::clamp<int>(level, 1, ZSTD_maxCLevel());
+    }
+
+    void Writer::setThreads(int threads) {
+        if (_open) { return; }
+        _threads = std::max<int>(threads, 1);
+    }
+
+    void Writer::setBuffering(int blockSize, int blockCount) {
+        file.setBuffering(blockSize, blockCount);
+    }
+
+    void Writer::setDirectIO(bool enabled) {
+        file.setDirectIO(enabled);
+    }
+
+    void Writer::write(const dsp::complex_t* samples, int count) {
+        if (!_open) { return; }
+        while (count) {
+            // Get a frame at the start of each one, if none is free the whole frame is dropped
+            if (!fill) { acquire(); }
+
+            int n = std::min<int>(count, frameSamples - fill);
+            if (current) {
+                memcpy(&current->samples[fill], samples, n * sizeof(dsp::complex_t));
+            }
+            else {
+                samplesDropped += n;
+            }
+            fill += n;
+            timeline += n;
+            samples += n;
+            count -= n;
+
+            if (fill == frameSamples) {
+                if (current) { submit(); }
+                fill = 0;
+            }
+        }
+    }
+
+    void Writer::acquire() {
+        std::lock_guard<std::mutex> lck(frameMtx);
+        if (freeFrames.empty()) {
+            current = NULL;
+            return;
+        }
+        current = freeFrames.back();
+        freeFrames.pop_back();
+    }
+
+    void Writer::submit() {
+        current->count = fill;
+        current->firstSample = timeline - fill;
+        current->seq = nextSeq++;
+        {
+            std::lock_guard<std::mutex> lck(frameMtx);
+            jobs.push_back(current);
+        }
+        jobCnd.notify_one();
+        current = NULL;
+    }
+
+    void Writer::worker() {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        std::vector<uint8_t> quant(maxQuantizedSize(frameSamples, _type));
+        std::vector<uint8_t> tmp(maxQuantizedSize(frameSamples, _type));
+
+        while (true) {
+            Frame* frame;
+            {
+                std::unique_lock<std::mutex> lck(frameMtx);
+                jobCnd.wait(lck, [this]() { return !jobs.empty() || stopWorkers; });
+                if (jobs.empty()) { break; }
+                frame = jobs.front();
+                jobs.pop_front();
+            }
+
+            // Quantize and compress, a frame that fails to compress is dropped
+            int rawSize = quantize(frame->samples, frame->count, _type, quant.data(), tmp.data());
+            size_t size = ZSTD_compressCCtx(cctx, frame->data.data(), frame->data.size(), quant.data(), rawSize, _level);
+            if (ZSTD_isError(size)) {
+                flog::error("Failed to compress IQ frame: {}", ZSTD_getErrorName(size));
+                size = 0;
+            }
+
+            memcpy(frame->hdr.magic, ZIQ_FRAME_MAGIC, 4);
+            frame->hdr.size = size;
+            frame->hdr.rawSize = rawSize;
+            frame->hdr.sampleCount = frame->count;
+            frame->hdr.firstSample = frame->firstSample;
+
+            commit(frame);
+        }
+
+        ZSTD_freeCCtx(cctx);
+    }
+
+    void Writer::commit(Frame* frame) {
+        std::lock_guard<std::mutex> lck(commitMtx);
+        done[frame->seq] = frame;
+
+        // Write out all frames that are next in order
+        while (true) {
+            auto it = done.find(commitSeq);
+            if (it == done.end()) { break; }
+            Frame* f = it->second;
+            done.erase(it);
+            commitSeq++;
+
+            if (f->hdr.size) {
+                // Wait for the disk here, the DSP thread drops frames instead if this falls behind
+                IndexEntry entry;
+                entry.firstSample = f->firstSample;
+                entry.offset = file.tell();
+                entry.sampleCount = f->count;
+                file.write((uint8_t*)&f->hdr, sizeof(FrameHeader), true);
+                file.write(f->data.data(), f->hdr.size, true);
+                index.push_back(entry);
+                samplesWritten += f->count;
+                rawBytes += f->count * sizeof(dsp::complex_t);
+                compressedBytes += sizeof(FrameHeader) + f->hdr.size;
+            }
+            else {
+                samplesDropped += f->count;
+            }
+
+            std::lock_guard<std::mutex> lck2(frameMtx);
+            freeFrames.push_back(f);
+        }
+    }
+
+    Reader::~Reader() {
+        close();
+    }
+
+    bool Reader::open(std::string path) {
+        close();
+        file.open(path, std::ios::binary);
+        if (!file.is_open()) { return false; }
+
+        // Check the header
+        file.read((char*)&hdr, sizeof(FileHeader));
+        if (!file || memcmp(hdr.magic, ZIQ_FILE_MAGIC, 4) || hdr.headerSize < sizeof(FileHeader) || hdr.sampleRate <= 0.0 ||
+            hdr.pcmType > dsp::compression::PCM_TYPE_BFP4 || !hdr.frameSamples || hdr.frameSamples > ZIQ_MAX_FRAME_SAMPLES) {
+            flog::error("'{}' is not a valid compressed IQ file", path);
+            close();
+            return false;
+        }
+
+        dctx = ZSTD_createDCtx();
+
+        // Use the index if the file was closed properly, otherwise find the frames
+        if (!hdr.indexOffset || !loadIndex()) {
+            if (hdr.indexOffset) { flog::warn("Invalid frame index in '{}', scanning frames", path); }
+            if (!scanFrames()) {
+                close();
+                return false;
+            }
+        }
+        if (index.empty()) {
+            flog::error("'{}' contains no frames", path);
+            close();
+            return false;
+        }
+
+        const IndexEntry& last = index.back();
+        sampleCount = std::max<uint64_t>(hdr.sampleCount, last.firstSample + last.sampleCount);
+
+        position = 0;
+        frameId = -1;
+        badFrame = -1;
+        return true;
+    }
+
+    void Reader::close() {
+        if (file.is_open()) { file.close(); }
+        file.clear();
+        if (dctx) {
+            ZSTD_freeDCtx(dctx);
+            dctx = NULL;
+        }
+        index.clear();
+        sampleCount = 0;
+        position = 0;
+        frameId = -1;
+        badFrame = -1;
+    }
+
+    bool Reader::loadIndex() {
+        char magic[4];
+        uint64_t count;
+        file.seekg(hdr.indexOffset);
+        file.read(magic, 4);
+        file.read((char*)&count, sizeof(uint64_t));
+        if (!file || memcmp(magic, ZIQ_INDEX_MAGIC, 4) || count > (1ull << 32)) {
+            file.clear();
+            return false;
+        }
+        index.resize(count);
+        file.read((char*)index.data(), count * sizeof(IndexEntry));
+        if (!file) {
+            file.clear();
+            index.clear();
+            return false;
+        }
+
+        // The frames must be in order for the binary search
+        for (int i = 1; i < index.size(); i++) {
+            if (index[i].firstSample < index[i - 1].firstSample + index[i - 1].sampleCount) {
+                index.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Reader::scanFrames() {
+        index.clear();
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = file.tellg();
+
+        uint64_t offset = hdr.headerSize;
+        uint64_t end = 0;
+        while (true) {
+            // Stop at the first incomplete or invalid frame, it's the end of an interrupted recording
+            FrameHeader fhdr;
+            file.seekg(offset);
+            file.read((char*)&fhdr, sizeof(FrameHeader));
+            if (!file || memcmp(fhdr.magic, ZIQ_FRAME_MAGIC, 4) || !fhdr.sampleCount || fhdr.firstSample < end) { break; }
+            if (offset + sizeof(FrameHeader) + fhdr.size > fileSize) { break; }
+
+            IndexEntry entry;
+            entry.firstSample = fhdr.firstSample;
+            entry.offset = offset;
+            entry.sampleCount = fhdr.sampleCount;
+            index.push_back(entry);
+            end = fhdr.firstSample + fhdr.sampleCount;
+            offset += sizeof(FrameHeader) + fhdr.size;
+        }
+        file.clear();
+        return true;
+    }
+
+    int Reader::findFrame(uint64_t sample) {
+        // First frame that ends after the sample
+        auto it = std::upper_bound(index.begin(), index.end(), sample, [](uint64_t s, const IndexEntry& e) {
+            return s < e.firstSample + e.sampleCount;
+        });
+        return it - index.begin();
+    }
+
+    bool Reader::decodeFrame(int id) {
+        const IndexEntry& entry = index[id];
+        FrameHeader fhdr;
+        file.clear();
+        file.seekg(entry.offset);
+        file.read((char*)&fhdr, sizeof(FrameHeader));
+        if (!file || memcmp(fhdr.magic, ZIQ_FRAME_MAGIC, 4) || fhdr.sampleCount != entry.sampleCount ||
+            fhdr.sampleCount > ZIQ_MAX_FRAME_SAMPLES || fhdr.rawSize > maxQuantizedSize(ZIQ_MAX_FRAME_SAMPLES, dsp::compression::PCM_TYPE_F32) ||
+            fhdr.size > ZSTD_compressBound(fhdr.rawSize)) {
+            file.clear();
+            return false;
+        }
+
+        compBuf.resize(fhdr.size);
+        file.read((char*)compBuf.data(), fhdr.size);
+        if (!file) {
+            file.clear();
+            return false;
+        }
+
+        quantBuf.resize(fhdr.rawSize);
+        tmpBuf.resize(fhdr.rawSize);
+        size_t len = ZSTD_decompressDCtx(dctx, quantBuf.data(), quantBuf.size(), compBuf.data(), compBuf.size());
+        if (ZSTD_isError(len)) { return false; }
+
+        frameSamples.resize(fhdr.sampleCount);
+        if (!dequantize(quantBuf.data(), len, fhdr.sampleCount, (dsp::compression::PCMType)hdr.pcmType, frameSamples.data(), tmpBuf.data())) {
+            return false;
+        }
+        frameId = id;
+        return true;
+    }
+
+    bool Reader::seek(uint64_t sample) {
+        if (!isOpen() || sample > sampleCount) { return false; }
+        position = sample;
+        return true;
+    }
+
+    int Reader::read(dsp::complex_t* out, int count) {
+        if (!isOpen()) { return 0; }
+        int read = 0;
+        while (read < count && position < sampleCount) {
+            // Decode the frame containing the position when entering a new one
+            if (frameId < 0 || position < index[frameId].firstSample || position >= index[frameId].firstSample + index[frameId].sampleCount) {
+                frameId = -1;
+                int id = findFrame(position);
+
+                // Frames dropped while recording and corrupted ones read as silence to keep the timeline
+                uint64_t gapEnd = (id < index.size()) ? index[id].firstSample : sampleCount;
+                if (position >= gapEnd && id != badFrame && !decodeFrame(id)) {
+                    flog::warn("Skipping corrupted IQ frame {}", id);
+                    badFrame = id;
+                }
+                if (id == badFrame) { gapEnd = index[id].firstSample + index[id].sampleCount; }
+                if (position < gapEnd) {
+                    int n = std::min<uint64_t>(count - read, gapEnd - position);
+                    memset(&out[read], 0, n * sizeof(dsp::complex_t));
+                    read += n;
+                    position += n;
+                    continue;
+                }
+            }
+
+            const IndexEntry& entry = index[frameId];
+            int offset = position - entry.firstSample;
+            int n = std::min<int>(count - read, entry.sampleCount - offset);
+            memcpy(&out[read], &frameSamples[offset], n * sizeof(dsp::complex_t));
+            read += n;
+            position += n;
+        }
+        return read;
+    }
+}
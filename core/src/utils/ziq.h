@@ -0,0 +1,206 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <condition_variable>
+#include <zstd.h>
+#include <dsp/types.h>
+#include <dsp/compression/pcm_type.h>
+#include "async_writer.h"
+
+// Upper limit of the frame length, frames are about one second long below this rate
+#define ZIQ_MAX_FRAME_SAMPLES   2097152
+
+// Number of frames that can wait for compression per worker thread
+#define ZIQ_FRAMES_PER_THREAD   2
+
+// Default zstd compression level, higher levels cost a lot of CPU for little gain on IQ
+#define ZIQ_DEFAULT_LEVEL       3
+
+/**
+ * Seekable compressed IQ recordings. The samples are cut into independently decodable
+ * frames of about one second. Each frame is quantized (PCM or block floating point),
+ * byte-shuffled so that zstd sees the mostly constant high bytes together, then compressed.
+ * A frame index written at the end of the file allows seeking to any sample. It is rebuilt
+ * by scanning the frames if the recording was not closed properly.
+ */
+namespace ziq {
+#pragma pack(push, 1)
+    struct FileHeader {
+        char magic[4];          // "ZIQ1"
+        uint32_t headerSize;    // sizeof(FileHeader), the frames start right after
+        double sampleRate;
+        double centerFreq;
+        uint64_t startTime;     // Microseconds since the epoch
+        uint32_t pcmType;
+        uint32_t frameSamples;  // Nominal number of samples per frame
+        uint64_t indexOffset;   // Offset of the frame index, 0 if the file was not closed
+        uint64_t sampleCount;   // Length of the timeline in samples, including dropped frames
+    };
+
+    struct FrameHeader {
+        char magic[4];          // "ZFRM"
+        uint32_t size;          // Size of the compressed payload
+        uint32_t rawSize;       // Size of the quantized data
+        uint32_t sampleCount;
+        uint64_t firstSample;   // Position of the first sample in the timeline
+    };
+
+    struct IndexEntry {
+        uint64_t firstSample;
+        uint64_t offset;        // Offset of the frame header in the file
+        uint32_t sampleCount;
+    };
+#pragma pack(pop)
+
+    // Worst case size of a quantized frame
+    int maxQuantizedSize(int count, dsp::compression::PCMType type);
+
+    // Quantize and shuffle samples, returns the number of bytes written
+    int quantize(const dsp::complex_t* in, int count, dsp::compression::PCMType type, uint8_t* out, uint8_t* tmp);
+
+    // Undo quantize(), returns false if the data is inconsistent
+    bool dequantize(const uint8_t* in, int len, int count, dsp::compression::PCMType type, dsp::complex_t* out, uint8_t* tmp);
+
+    class Writer {
+    public:
+        Writer(async_io::Engine* engine = NULL);
+        ~Writer();
+
+        bool open(std::string path);
+        bool isOpen();
+        void close();
+
+        // Can't be changed while open
+        void setSamplerate(double samplerate);
+        void setCenterFrequency(double freq);
+        void setSampleType(dsp::compression::PCMType type);
+        void setCompressionLevel(int level);
+        void setThreads(int threads);
+
+        // Write-behind settings, see async_io::Writer
+        void setBuffering(int blockSize, int blockCount);
+        void setDirectIO(bool enabled);
+        async_io::Stats getIOStats() { return file.getStats(); }
+
+        // Never blocks, whole frames are dropped if the compression or the disk can't keep up
+        void write(const dsp::complex_t* samples, int count);
+
+        uint64_t getSamplesWritten() { return samplesWritten; }
+        uint64_t getSamplesDropped() { return samplesDropped; }
+        uint64_t getRawBytes() { return rawBytes; }
+        uint64_t getCompressedBytes() { return compressedBytes; }
+
+    private:
+        struct Frame {
+            dsp::complex_t* samples = NULL;
+            int count = 0;
+            uint64_t firstSample = 0;
+            uint64_t seq = 0;
+            std::vector<uint8_t> data;
+            FrameHeader hdr;
+        };
+
+        void acquire();
+        void submit();
+        void worker();
+        void commit(Frame* frame);
+
+        async_io::Writer file;
+        FileHeader hdr;
+        double _samplerate = 1000000.0;
+        double _centerFreq = 0.0;
+        dsp::compression::PCMType _type = dsp::compression::PCM_TYPE_I16;
+        int _level = ZIQ_DEFAULT_LEVEL;
+        int _threads = 2;
+        int frameSamples = 0;
+        bool _open = false;
+
+        // Frame being filled by write(), NULL while the samples of a frame are dropped
+        Frame* current = NULL;
+        int fill = 0;
+        uint64_t timeline = 0;
+        uint64_t nextSeq = 0;
+
+        // Frames not in use, waiting for compression, and compressed but not written in order yet
+        std::vector<Frame*> frames;
+        std::vector<Frame*> freeFrames;
+        std::deque<Frame*> jobs;
+        std::map<uint64_t, Frame*> done;
+        uint64_t commitSeq = 0;
+        std::mutex frameMtx;
+        std::condition_variable jobCnd;
+        std::condition_variable freeCnd;
+        std::mutex commitMtx;
+        bool stopWorkers = false;
+        std::vector<std::thread> workers;
+
+        std::vector<IndexEntry> index;
+
+        std::atomic<uint64_t> samplesWritten;
+        std::atomic<uint64_t> samplesDropped;
+        std::atomic<uint64_t> rawBytes;
+        std::atomic<uint64_t> compressedBytes;
+    };
+
+    class Reader {
+    public:
+        Reader() {}
+        ~Reader();
+
+        bool open(std::string path);
+        bool isOpen() { return file.is_open(); }
+        void close();
+
+        double getSampleRate() { return hdr.sampleRate; }
+        double getCenterFrequency() { return hdr.centerFreq; }
+        uint64_t getStartTime() { return hdr.startTime; }
+        dsp::compression::PCMType getSampleType() { return (dsp::compression::PCMType)hdr.pcmType; }
+
+        // Length of the timeline in samples
+        uint64_t getSampleCount() { return sampleCount; }
+
+        // Position of the next sample read in the timeline
+        uint64_t tell() { return position; }
+
+        // Go to a sample of the timeline, only the frame containing it is decoded
+        bool seek(uint64_t sample);
+
+        /**
+         * Read samples, frames dropped while recording or corrupted read as zeros.
+         * @param out Buffer to read the samples into.
+         * @param count Maximum number of samples.
+         * @return Number of samples read, 0 at the end of the file.
+         */
+        int read(dsp::complex_t* out, int count);
+
+    private:
+        bool loadIndex();
+        bool scanFrames();
+        int findFrame(uint64_t sample);
+        bool decodeFrame(int id);
+
+        std::ifstream file;
+        FileHeader hdr = {};
+        std::vector<IndexEntry> index;
+        uint64_t sampleCount = 0;
+        uint64_t position = 0;
+
+        // Decoded frame
+        int frameId = -1;
+        int frameOffset = 0;
+        // Last frame that failed to decode, not retried on every read
+        int badFrame = -1;
+        std::vector<dsp::complex_t> frameSamples;
+        std::vector<uint8_t> compBuf;
+        std::vector<uint8_t> quantBuf;
+        std::vector<uint8_t> tmpBuf;
+        ZSTD_DCtx* dctx = NULL;
+    };
+}
@@ -75,11 +75,16 @@ public:
 
         stream.start();
 
+        endOfStreamHandler.handler = onEndOfStream;
+        endOfStreamHandler.ctx = this;
+        sigpath::sourceManager.onEndOfStream.bindHandler(&endOfStreamHandler);
+
         gui::menu.registerEntry(name, menuHandler, this, this);
     }
 
     ~M17DecoderModule() {
         gui::menu.removeEntry(name);
+        sigpath::sourceManager.onEndOfStream.unbindHandler(&endOfStreamHandler);
         // Stop DSP Here
         stream.stop();
         if (enabled) {
@@ -262,6 +267,14 @@ private:
         _this->lsf = lsf;
     }
 
+    static void onEndOfStream(std::string source, void* ctx) {
+        M17DecoderModule* _this = (M17DecoderModule*)ctx;
+
+        // The last call is over, don't keep showing it
+        std::lock_guard lck(_this->lsfMtx);
+        _this->lsf.valid = false;
+    }
+
     std::string name;
     bool enabled = true;
 
@@ -278,6 +291,7 @@ private:
 
     double audioSampRate = 48000;
     EventHandler<float> srChangeHandler;
+    EventHandler<std::string> endOfStreamHandler;
     SinkManager::Stream stream;
 
     bool showLines = false;
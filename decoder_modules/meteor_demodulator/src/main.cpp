@@ -77,11 +77,16 @@ public:
         symSink.start();
         sink.start();
 
+        endOfStreamHandler.handler = onEndOfStream;
+        endOfStreamHandler.ctx = this;
+        sigpath::sourceManager.onEndOfStream.bindHandler(&endOfStreamHandler);
+
         gui::menu.registerEntry(name, menuHandler, this, this);
         core::modComManager.registerInterface("meteor_demodulator", name, moduleInterfaceHandler, this);
     }
 
     ~MeteorDemodulatorModule() {
+        sigpath::sourceManager.onEndOfStream.unbindHandler(&endOfStreamHandler);
         if (recording) {
             std::lock_guard<std::mutex> lck(recMtx);
             recording = false;
@@ -223,6 +228,16 @@ private:
         dataWritten = 0;
     }
 
+    static void onEndOfStream(std::string source, void* ctx) {
+        MeteorDemodulatorModule* _this = (MeteorDemodulatorModule*)ctx;
+
+        // Close the symbol file so that it can be processed right away
+        if (_this->recording) {
+            flog::info("Meteor demodulator '{0}': End of stream, {1} bytes of symbols recorded", _this->name, _this->dataWritten);
+            _this->stopRecording();
+        }
+    }
+
     static void moduleInterfaceHandler(int code, void* in, void* out, void* ctx) {
         MeteorDemodulatorModule* _this = (MeteorDemodulatorModule*)ctx;
         if (code == METEOR_DEMODULATOR_IFACE_CMD_START) {
@@ -258,6 +273,8 @@ private:
     bool brokenModulation = false;
     bool oqpsk = false;
     int8_t* writeBuffer;
+
+    EventHandler<std::string> endOfStreamHandler;
 };
 
 MOD_EXPORT void _INIT_() {
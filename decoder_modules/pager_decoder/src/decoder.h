@@ -8,4 +8,7 @@ public:
     virtual void setVFO(VFOManager::VFO* vfo) = 0;
     virtual void start() = 0;
     virtual void stop() = 0;
+
+    // Called once the end of a finite input was reached, flushes anything still pending
+    virtual void endOfStream() {}
 };
\ No newline at end of file
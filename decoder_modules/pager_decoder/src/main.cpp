@@ -45,11 +45,17 @@ public:
         // Select the protocol
         selectProtocol(PROTOCOL_POCSAG);
 
+        // Flush the decoder once a file played offline is done
+        endOfStreamHandler.handler = onEndOfStream;
+        endOfStreamHandler.ctx = this;
+        sigpath::sourceManager.onEndOfStream.bindHandler(&endOfStreamHandler);
+
         gui::menu.registerEntry(name, menuHandler, this, this);
     }
 
     ~PagerDecoderModule() {
         gui::menu.removeEntry(name);
+        sigpath::sourceManager.onEndOfStream.unbindHandler(&endOfStreamHandler);
         // Stop DSP
         if (enabled) {
             decoder->stop();
@@ -114,6 +120,11 @@ public:
     }
 
 private:
+    static void onEndOfStream(std::string source, void* ctx) {
+        PagerDecoderModule* _this = (PagerDecoderModule*)ctx;
+        if (_this->enabled && _this->decoder) { _this->decoder->endOfStream(); }
+    }
+
     static void menuHandler(void* ctx) {
         PagerDecoderModule* _this = (PagerDecoderModule*)ctx;
 
@@ -147,6 +158,8 @@ private:
     VFOManager::VFO* vfo;
     std::unique_ptr<Decoder> decoder;
 
+    EventHandler<std::string> endOfStreamHandler;
+
     bool showLines = false;
 };
 
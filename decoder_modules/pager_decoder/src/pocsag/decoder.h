@@ -7,6 +7,7 @@
 #include <dsp/sink/handler_sink.h>
 #include "dsp.h"
 #include "pocsag.h"
+#include <mutex>
 
 #define BAUDRATE    2400
 #define SAMPLERATE  (BAUDRATE*10)
@@ -49,6 +50,11 @@ public:
         diag.draw();
     }
 
+    void endOfStream() {
+        std::lock_guard<std::mutex> lck(decMtx);
+        decoder.endOfStream();
+    }
+
     void setVFO(VFOManager::VFO* vfo) {
         this->vfo = vfo;
         vfo->setBandwidthLimits(12500, 12500, true);
@@ -73,6 +79,7 @@ public:
 private:
     static void _dataHandler(uint8_t* data, int count, void* ctx) {
         POCSAGDecoder* _this = (POCSAGDecoder*)ctx;
+        std::lock_guard<std::mutex> lck(_this->decMtx);
         _this->decoder.process(data, count);
     }
 
@@ -96,6 +103,7 @@ private:
     dsp::sink::Handler<float> diagHandler;
 
     pocsag::Decoder decoder;
+    std::mutex decMtx;
 
     ImGui::SymbolDiagram diag;
 
@@ -82,6 +82,13 @@ namespace pocsag {
         return true; // TODO
     }
 
+    void Decoder::endOfStream() {
+        flushMessage();
+        syncSR = 0;
+        synced = false;
+        batchOffset = 0;
+    }
+
     void Decoder::flushMessage() {
         if (!msg.empty()) {
             // Send out message
@@ -27,6 +27,9 @@ namespace pocsag {
 
         void process(uint8_t* symbols, int count);
 
+        // Send out the message being received and wait for a new sync
+        void endOfStream();
+
         NewEvent<Address, MessageType, const std::string&> onMessage;
 
     private:
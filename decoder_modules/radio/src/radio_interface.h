@@ -9,6 +9,8 @@ enum {
     RADIO_IFACE_CMD_SET_SQUELCH_ENABLED,
     RADIO_IFACE_CMD_GET_SQUELCH_LEVEL,
     RADIO_IFACE_CMD_SET_SQUELCH_LEVEL,
+    RADIO_IFACE_CMD_GET_SQUELCH_OPEN,
+    RADIO_IFACE_CMD_GET_SQUELCH_STATE,  // Pointer to a const std::atomic<bool> following the squelch, valid as long as the radio
 };
 
 enum {
@@ -534,6 +534,9 @@ private:
         if (!selectedDemod) { return; }
         ifChain.setBlockEnabled(&squelch, squelchEnabled, [=](dsp::stream<dsp::complex_t>* out){ selectedDemod->setInput(out); });
 
+        // Seen as open by whoever polls its state while bypassed
+        if (!squelchEnabled) { squelch.setState(true); }
+
         // Save config
         config.acquire();
         config.conf[name][selectedDemod->getName()]["squelchEnabled"] = squelchEnabled;
@@ -635,6 +638,15 @@ private:
             float* _in = (float*)in;
             _this->setSquelchLevel(*_in);
         }
+        else if (code == RADIO_IFACE_CMD_GET_SQUELCH_OPEN && out) {
+            // Always open when the squelch isn't used
+            bool* _out = (bool*)out;
+            *_out = !_this->squelchEnabled || _this->squelch.isOpen();
+        }
+        else if (code == RADIO_IFACE_CMD_GET_SQUELCH_STATE && out) {
+            const std::atomic<bool>** _out = (const std::atomic<bool>**)out;
+            *_out = _this->squelch.getState();
+        }
         else {
             return;
         }
@@ -59,10 +59,15 @@ public:
 
         selectDecoder(decoderNames[0], false);
 
+        endOfStreamHandler.handler = onEndOfStream;
+        endOfStreamHandler.ctx = this;
+        sigpath::sourceManager.onEndOfStream.bindHandler(&endOfStreamHandler);
+
         gui::menu.registerEntry(name, menuHandler, this, this);
     }
 
     ~WeatherSatDecoderModule() {
+        sigpath::sourceManager.onEndOfStream.unbindHandler(&endOfStreamHandler);
         decoder->stop();
     }
 
@@ -98,6 +103,11 @@ private:
         decoder->start();
     }
 
+    static void onEndOfStream(std::string source, void* ctx) {
+        WeatherSatDecoderModule* _this = (WeatherSatDecoderModule*)ctx;
+        if (_this->enabled) { _this->decoder->endOfStream(); }
+    }
+
     static void menuHandler(void* ctx) {
         WeatherSatDecoderModule* _this = (WeatherSatDecoderModule*)ctx;
 
@@ -128,6 +138,8 @@ private:
     int decoderId = 0;
 
     SatDecoder* decoder;
+
+    EventHandler<std::string> endOfStreamHandler;
 };
 
 MOD_EXPORT void _INIT_() {
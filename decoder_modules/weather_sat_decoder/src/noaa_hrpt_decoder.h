@@ -8,6 +8,7 @@
 #include <gui/widgets/symbol_diagram.h>
 #include <gui/widgets/line_push_image.h>
 #include <gui/gui.h>
+#include <utils/flog.h>
 
 #define NOAA_HRPT_VFO_SR 3000000.0f
 #define NOAA_HRPT_VFO_BW 2000000.0f
@@ -197,6 +198,10 @@ public:
         return false;
     }
 
+    void endOfStream() {
+        flog::info("NOAA HRPT decoder '{0}': End of stream, {1} AVHRR lines decoded", _name, avhrr1Image.getLineCount());
+    }
+
     // bool startRecording(std::string recPath) {
 
     // };
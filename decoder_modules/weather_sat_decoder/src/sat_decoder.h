@@ -13,4 +13,7 @@ public:
     virtual void stopRecording(){};
     virtual bool isRecording() { return false; };
     virtual void drawMenu(float menuWidth) = 0;
+
+    // Called once the end of a finite input was reached
+    virtual void endOfStream() {}
 };
\ No newline at end of file
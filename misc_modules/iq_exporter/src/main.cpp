@@ -11,6 +11,7 @@
 #include <dsp/buffer/reshaper.h>
 #include <gui/dialogs/dialog_box.h>
 #include <core.h>
+#include "udp_sender.h"
 
 SDRPP_MOD_INFO{
     /* Name:            */ "iq_exporter",
@@ -114,6 +115,17 @@ public:
             port = config.conf[name]["port"];
             port = std::clamp<int>(port, 1, 65535);
         }
+        if (config.conf[name].contains("rateLimit")) {
+            rateLimit = config.conf[name]["rateLimit"];
+            rateLimit = std::max<double>(rateLimit, 0.0);
+        }
+        if (config.conf[name].contains("multicastTTL")) {
+            multicastTTL = config.conf[name]["multicastTTL"];
+            multicastTTL = std::clamp<int>(multicastTTL, 1, 255);
+        }
+        if (config.conf[name].contains("packetHeader")) {
+            packetHeader = config.conf[name]["packetHeader"];
+        }
         if (config.conf[name].contains("running")) {
             autoStart = config.conf[name]["running"];
         }
@@ -208,8 +220,8 @@ public:
                 sock = net::connect(hostname, port);
             }
             else {
-                // Open UDP socket
-                sock = net::openudp(hostname, port, "0.0.0.0", 0, true);
+                // Start the batching UDP sender
+                udpSender = std::make_unique<UDPSender>(hostname, port, packetSize, packetHeader, rateLimit, multicastTTL);
             }
         }
         catch (const std::exception& e) {
@@ -253,6 +265,9 @@ public:
                 sock->close();
                 sock.reset();
             }
+
+            // Stop the UDP sender
+            udpSender.reset();
         }
 
         running = false;
@@ -344,6 +359,33 @@ private:
             config.release(true);
         }
 
+        // UDP output settings
+        if (_this->proto == PROTOCOL_UDP) {
+            ImGui::LeftLabel("Rate limit (Mbit/s)");
+            ImGui::FillWidth();
+            if (ImGui::InputDouble(("##iq_exporter_rate_" + _this->name).c_str(), &_this->rateLimit, 1.0, 10.0, "%.1f")) {
+                _this->rateLimit = std::max<double>(_this->rateLimit, 0.0);
+                config.acquire();
+                config.conf[_this->name]["rateLimit"] = _this->rateLimit;
+                config.release(true);
+            }
+
+            ImGui::LeftLabel("Multicast TTL");
+            ImGui::FillWidth();
+            if (ImGui::InputInt(("##iq_exporter_ttl_" + _this->name).c_str(), &_this->multicastTTL)) {
+                _this->multicastTTL = std::clamp<int>(_this->multicastTTL, 1, 255);
+                config.acquire();
+                config.conf[_this->name]["multicastTTL"] = _this->multicastTTL;
+                config.release(true);
+            }
+
+            if (ImGui::Checkbox(("Packet header##iq_exporter_hdr_" + _this->name).c_str(), &_this->packetHeader)) {
+                config.acquire();
+                config.conf[_this->name]["packetHeader"] = _this->packetHeader;
+                config.release(true);
+            }
+        }
+
         // Hostname and port field
         if (ImGui::InputText(("##iq_exporter_host_" + _this->name).c_str(), _this->hostname, sizeof(_this->hostname))) {
             config.acquire();
@@ -389,7 +431,11 @@ private:
         // Status text
         ImGui::TextUnformatted("Status:");
         ImGui::SameLine();
-        if (sockOpen) {
+        if (_this->udpSender) {
+            ImGui::TextColored(ImVec4(0.0, 1.0, 0.0, 1.0), _this->udpSender->isMulticast() ? "Multicasting" : "Sending");
+            ImGui::Text("Sent: %llu, Dropped: %llu", (unsigned long long)_this->udpSender->getSentCount(), (unsigned long long)_this->udpSender->getDroppedCount());
+        }
+        else if (sockOpen) {
             ImGui::TextColored(ImVec4(0.0, 1.0, 0.0, 1.0), (_this->proto == PROTOCOL_TCP_SERVER || _this->proto == PROTOCOL_TCP_CLIENT) ? "Connected" : "Sending");
         }
         else if (_this->listener && _this->listener->listening()) {
@@ -484,12 +530,42 @@ private:
         }
     }
 
+    void convert(const dsp::complex_t* data, int count, uint8_t* out) {
+        switch (sampType) {
+        case SAMPLE_TYPE_INT8:
+            volk_32f_s32f_convert_8i((int8_t*)out, (float*)data, 128.0f, count*2);
+            break;
+        case SAMPLE_TYPE_INT16:
+            volk_32f_s32f_convert_16i((int16_t*)out, (float*)data, 32768.0f, count*2);
+            break;
+        case SAMPLE_TYPE_INT32:
+            volk_32f_s32f_convert_32i((int32_t*)out, (float*)data, 2147483647.0f, count*2);
+            break;
+        case SAMPLE_TYPE_FLOAT32:
+            memcpy(out, data, count*sizeof(dsp::complex_t));
+            break;
+        default:
+            break;
+        }
+    }
+
     static void dataHandler(dsp::complex_t* data, int count, void* ctx) {
         IQExporterModule* _this = (IQExporterModule*)ctx;
 
         // Try to cquire lock on socket
         if (!_this->sockMtx.try_lock()) { return; }
 
+        // UDP output goes through the sender's ring, the samples are converted straight into it
+        if (_this->udpSender) {
+            uint8_t* slot = _this->udpSender->acquire();
+            if (slot) {
+                _this->convert(data, count, slot);
+                _this->udpSender->commit(count * _this->sampleSize());
+            }
+            _this->sockMtx.unlock();
+            return;
+        }
+
         // If not valid or open, give uo
         if (!_this->sock || !_this->sock->isOpen()) {
             // Unlock socket mutex
@@ -497,31 +573,14 @@ private:
             return;
         }
         
-        // Convert the samples or send directory for float32
-        int size;
-        switch (_this->sampType) {
-        case SAMPLE_TYPE_INT8:
-            volk_32f_s32f_convert_8i((int8_t*)_this->buffer, (float*)data, 128.0f, count*2);
-            size = sizeof(int8_t)*2;
-            break;
-        case SAMPLE_TYPE_INT16:
-            volk_32f_s32f_convert_16i((int16_t*)_this->buffer, (float*)data, 32768.0f, count*2);
-            size = sizeof(int16_t)*2;
-            break;
-        case SAMPLE_TYPE_INT32:
-            volk_32f_s32f_convert_32i((int32_t*)_this->buffer, (float*)data, 2147483647.0f, count*2);
-            size = sizeof(int32_t)*2;
-            break;
-        case SAMPLE_TYPE_FLOAT32:
+        // Convert the samples or send directly for float32
+        if (_this->sampType == SAMPLE_TYPE_FLOAT32) {
             _this->sock->send((uint8_t*)data, count*sizeof(dsp::complex_t));
-        default:
-            // Unlock socket mutex
-            _this->sockMtx.unlock();
-            return;
         }
-
-        // Send converted samples
-        _this->sock->send(_this->buffer, count*size);
+        else if (_this->sampleSize() > 0) {
+            _this->convert(data, count, _this->buffer);
+            _this->sock->send(_this->buffer, count*_this->sampleSize());
+        }
 
         // Unlock socket mutex
         _this->sockMtx.unlock();
@@ -542,6 +601,9 @@ private:
     int packetSizeId;
     char hostname[1024] = "localhost";
     int port = 1234;
+    double rateLimit = 0.0;
+    int multicastTTL = 1;
+    bool packetHeader = false;
     bool running = false;
     bool wasRunning = false;
 
@@ -566,6 +628,7 @@ private:
     std::mutex sockMtx;
     std::shared_ptr<net::Socket> sock;
     std::shared_ptr<net::Listener> listener;
+    std::unique_ptr<UDPSender> udpSender;
 };
 
 MOD_EXPORT void _INIT_() {
@@ -0,0 +1,122 @@
+#include "udp_sender.h"
+#include <utils/flog.h>
+#include <chrono>
+#include <string.h>
+#include <algorithm>
+
+UDPSender::UDPSender(std::string host, int port, int packetSize, bool header, double rateMbps, int ttl) {
+    this->packetSize = packetSize;
+    this->header = header;
+    bytesPerSec = rateMbps * 1000000.0 / 8.0;
+    slotSize = packetSize + (header ? sizeof(net::IQPacketHeader) : 0);
+    sent = 0;
+    dropped = 0;
+
+    // Open the socket, a large send buffer absorbs the batches
+    net::Address raddr(host, port);
+    multicast = raddr.isMulticast();
+    sock = net::openudp(raddr, "0.0.0.0", 0, true);
+    sock->setBufferSizes(4*1024*1024, 0);
+    if (multicast && !sock->setMulticastTTL(ttl)) {
+        flog::warn("[IQExporter] Could not set the multicast TTL");
+    }
+
+    // Allocate the ring
+    ring.resize(UDP_SENDER_RING_SIZE * slotSize);
+    lengths.resize(UDP_SENDER_RING_SIZE);
+
+    workerThread = std::thread(&UDPSender::worker, this);
+}
+
+UDPSender::~UDPSender() {
+    {
+        std::lock_guard<std::mutex> lck(ringMtx);
+        stopWorker = true;
+    }
+    ringCnd.notify_all();
+    if (workerThread.joinable()) { workerThread.join(); }
+    sock->close();
+}
+
+uint8_t* UDPSender::acquire() {
+    std::lock_guard<std::mutex> lck(ringMtx);
+
+    // Drop the packet rather than stalling the DSP when the network can't keep up
+    if (queued >= UDP_SENDER_RING_SIZE) {
+        dropped++;
+        return NULL;
+    }
+    return &ring[writeIdx * slotSize + (header ? sizeof(net::IQPacketHeader) : 0)];
+}
+
+void UDPSender::commit(int len) {
+    uint8_t* slot = &ring[writeIdx * slotSize];
+    if (header) {
+        net::IQPacketHeader* hdr = (net::IQPacketHeader*)slot;
+        hdr->magic = IQ_PACKET_MAGIC;
+        hdr->seq = seq++;
+        hdr->timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        len += sizeof(net::IQPacketHeader);
+    }
+    lengths[writeIdx] = std::min<int>(len, slotSize);
+
+    {
+        std::lock_guard<std::mutex> lck(ringMtx);
+        writeIdx = (writeIdx + 1) % UDP_SENDER_RING_SIZE;
+        queued++;
+    }
+    ringCnd.notify_all();
+}
+
+void UDPSender::worker() {
+    const uint8_t* datas[UDP_SENDER_BATCH_SIZE];
+    int lens[UDP_SENDER_BATCH_SIZE];
+
+    // Token bucket, allows a burst of one batch
+    double burst = (double)(UDP_SENDER_BATCH_SIZE * slotSize);
+    double tokens = burst;
+    auto lastRefill = std::chrono::steady_clock::now();
+
+    while (true) {
+        // Wait for packets
+        int first, count;
+        {
+            std::unique_lock<std::mutex> lck(ringMtx);
+            ringCnd.wait(lck, [this]() { return queued > 0 || stopWorker; });
+            if (stopWorker) { return; }
+            first = readIdx;
+            count = std::min<int>(std::min<int>(queued, UDP_SENDER_BATCH_SIZE), UDP_SENDER_RING_SIZE - readIdx);
+        }
+
+        // Build the batch
+        int batchBytes = 0;
+        for (int i = 0; i < count; i++) {
+            datas[i] = &ring[(first + i) * slotSize];
+            lens[i] = lengths[first + i];
+            batchBytes += lens[i];
+        }
+
+        // Wait until the bucket has enough tokens for the batch
+        if (bytesPerSec > 0.0) {
+            auto now = std::chrono::steady_clock::now();
+            tokens = std::min<double>(burst, tokens + std::chrono::duration<double>(now - lastRefill).count() * bytesPerSec);
+            lastRefill = now;
+            if (tokens < batchBytes) {
+                std::this_thread::sleep_for(std::chrono::duration<double>((batchBytes - tokens) / bytesPerSec));
+                now = std::chrono::steady_clock::now();
+                tokens = std::min<double>(burst, tokens + std::chrono::duration<double>(now - lastRefill).count() * bytesPerSec);
+                lastRefill = now;
+            }
+            tokens -= batchBytes;
+        }
+
+        // Send and release the slots
+        int ret = sock->sendmulti(datas, lens, count);
+        if (ret > 0) { sent += ret; }
+        {
+            std::lock_guard<std::mutex> lck(ringMtx);
+            readIdx = (readIdx + count) % UDP_SENDER_RING_SIZE;
+            queued -= count;
+        }
+    }
+}
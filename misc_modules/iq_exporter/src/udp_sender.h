@@ -0,0 +1,63 @@
+#pragma once
+#include <utils/net.h>
+#include <utils/iq_packet.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+// Number of packets that can wait to be sent
+#define UDP_SENDER_RING_SIZE    1024
+
+// Maximum number of packets sent with a single system call
+#define UDP_SENDER_BATCH_SIZE   64
+
+/**
+ * Sends fixed size UDP packets from a ring buffer on its own thread, in batches
+ * (sendmmsg where available) and paced by a token bucket so that bursts don't
+ * overflow the switch buffers. Multicast destinations are supported.
+ */
+class UDPSender {
+public:
+    UDPSender(std::string host, int port, int packetSize, bool header, double rateMbps, int ttl);
+    ~UDPSender();
+
+    // Get a slot to write a packet of up to packetSize bytes into, NULL if the ring is full
+    uint8_t* acquire();
+
+    // Queue the slot returned by acquire for sending
+    void commit(int len);
+
+    uint64_t getSentCount() { return sent; }
+    uint64_t getDroppedCount() { return dropped; }
+    bool isMulticast() { return multicast; }
+
+private:
+    void worker();
+
+    std::shared_ptr<net::Socket> sock;
+    bool multicast = false;
+    bool header;
+    int packetSize;
+    int slotSize;
+    double bytesPerSec;
+
+    // Ring of packets, slots between readIdx and writeIdx are waiting to be sent
+    std::vector<uint8_t> ring;
+    std::vector<int> lengths;
+    int readIdx = 0;
+    int writeIdx = 0;
+    int queued = 0;
+    uint32_t seq = 0;
+    std::mutex ringMtx;
+    std::condition_variable ringCnd;
+
+    bool stopWorker = false;
+    std::thread workerThread;
+
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> dropped;
+};
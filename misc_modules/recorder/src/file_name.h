@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <regex>
+#include <ctime>
+#include <stdio.h>
+
+/**
+ * Expand a file name template.
+ * $t: Recording type, $f: Frequency, $r: Mode, $h/$m/$s: Time, $d/$M/$y: Date.
+ */
+inline std::string formatFileName(std::string templ, std::string type, double freq, std::string modeStr) {
+    // Get data
+    time_t now = time(0);
+    tm ltm;
+#ifdef _WIN32
+    localtime_s(&ltm, &now);
+#else
+    localtime_r(&now, &ltm);
+#endif
+
+    // Format to string
+    char freqStr[128];
+    char hourStr[128];
+    char minStr[128];
+    char secStr[128];
+    char dayStr[128];
+    char monStr[128];
+    char yearStr[128];
+    sprintf(freqStr, "%.0lfHz", freq);
+    sprintf(hourStr, "%02d", ltm.tm_hour);
+    sprintf(minStr, "%02d", ltm.tm_min);
+    sprintf(secStr, "%02d", ltm.tm_sec);
+    sprintf(dayStr, "%02d", ltm.tm_mday);
+    sprintf(monStr, "%02d", ltm.tm_mon + 1);
+    sprintf(yearStr, "%02d", ltm.tm_year + 1900);
+
+    // Replace in template
+    templ = std::regex_replace(templ, std::regex("\\$t"), type);
+    templ = std::regex_replace(templ, std::regex("\\$f"), freqStr);
+    templ = std::regex_replace(templ, std::regex("\\$h"), hourStr);
+    templ = std::regex_replace(templ, std::regex("\\$m"), minStr);
+    templ = std::regex_replace(templ, std::regex("\\$s"), secStr);
+    templ = std::regex_replace(templ, std::regex("\\$d"), dayStr);
+    templ = std::regex_replace(templ, std::regex("\\$M"), monStr);
+    templ = std::regex_replace(templ, std::regex("\\$y"), yearStr);
+    templ = std::regex_replace(templ, std::regex("\\$r"), modeStr);
+    return templ;
+}
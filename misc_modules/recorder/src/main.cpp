@@ -7,6 +7,7 @@
 #include <dsp/routing/splitter.h>
 #include <dsp/audio/volume.h>
 #include <dsp/convert/stereo_to_mono.h>
+#include <dsp/convert/pcm.h>
 #include <thread>
 #include <ctime>
 #include <gui/gui.h>
@@ -21,11 +22,45 @@
 #include <core.h>
 #include <utils/optionlist.h>
 #include <utils/wav.h>
+#include <utils/ziq.h>
+#include <utils/sigmf.h>
+#include <utils/iq_history.h>
+#include <utils/bundle.h>
 #include <radio_interface.h>
+#include "file_name.h"
+#include "triggered_recorder.h"
 
 #define CONCAT(a, b) ((std::string(a) + b).c_str())
 
-#define SILENCE_LVL 10e-6
+// Write-behind buffering of audio recordings, a lot less data than baseband
+#define AUDIO_BLOCK_SIZE    (256*1024)
+#define AUDIO_BLOCK_COUNT   32
+
+// Limits of the baseband history
+#define HISTORY_MIN_LENGTH  1
+#define HISTORY_MAX_LENGTH  3600
+
+// Limits of the memory used by the baseband history in MB
+#define HISTORY_MIN_MEMORY  64
+#define HISTORY_MAX_MEMORY  65536
+
+// Limits of the triggered recording times
+#define TRIGGER_MAX_PRE_ROLL    10.0f
+#define TRIGGER_MAX_HANG_TIME   60.0f
+
+enum Container {
+    CONTAINER_WAV,
+    CONTAINER_RF64,
+    CONTAINER_ZIQ,
+    CONTAINER_SIGMF,
+    CONTAINER_BUNDLE
+};
+
+enum SplitMode {
+    SPLIT_MODE_NONE,
+    SPLIT_MODE_SIZE,
+    SPLIT_MODE_TIME
+};
 
 SDRPP_MOD_INFO{
     /* Name:            */ "recorder",
@@ -38,23 +73,58 @@ SDRPP_MOD_INFO{
 ConfigManager config;
 
 class RecorderModule : public ModuleManager::Instance {
+    // Copy of a VFO feeding one channel of a bundle, following the VFO as it moves
+    struct BundleChannel {
+        RecorderModule* module;
+        int id;
+        std::string vfoName;
+        std::string mirrorName;
+        VFOManager::VFO* src;
+        dsp::channel::RxVFO* vfo;
+        dsp::sink::Handler<dsp::complex_t> sink;
+        double samplerate;
+        double frequency;
+        double bandwidth;
+    };
+
 public:
-    RecorderModule(std::string name) : folderSelect("%ROOT%/recordings") {
+    RecorderModule(std::string name) : folderSelect("%ROOT%/recordings"), triggeredRec(name) {
         this->name = name;
         root = (std::string)core::args["root"];
         strcpy(nameTemplate, "$t_$f_$h-$m-$s_$d-$M-$y");
 
         // Define option lists
-        containers.define("WAV", wav::FORMAT_WAV);
-        // containers.define("RF64", wav::FORMAT_RF64); // Disabled for now
+        containers.define("WAV", CONTAINER_WAV);
+        containers.define("RF64", CONTAINER_RF64);
+        containers.define("ZIQ", "Compressed IQ", CONTAINER_ZIQ);
+        containers.define("SigMF", CONTAINER_SIGMF);
+        containers.define("Bundle", "Multi-VFO bundle", CONTAINER_BUNDLE);
         sampleTypes.define(wav::SAMP_TYPE_UINT8, "Uint8", wav::SAMP_TYPE_UINT8);
         sampleTypes.define(wav::SAMP_TYPE_INT16, "Int16", wav::SAMP_TYPE_INT16);
+        sampleTypes.define(wav::SAMP_TYPE_INT24, "Int24", wav::SAMP_TYPE_INT24);
         sampleTypes.define(wav::SAMP_TYPE_INT32, "Int32", wav::SAMP_TYPE_INT32);
         sampleTypes.define(wav::SAMP_TYPE_FLOAT32, "Float32", wav::SAMP_TYPE_FLOAT32);
+        ziqTypes.define("int8", "Int8", dsp::compression::PCM_TYPE_I8);
+        ziqTypes.define("int16", "Int16", dsp::compression::PCM_TYPE_I16);
+        ziqTypes.define("float32", "Float32", dsp::compression::PCM_TYPE_F32);
+        ziqTypes.define("bfp8", "BFP 8", dsp::compression::PCM_TYPE_BFP8);
+        ziqTypes.define("bfp6", "BFP 6", dsp::compression::PCM_TYPE_BFP6);
+        ziqTypes.define("bfp4", "BFP 4", dsp::compression::PCM_TYPE_BFP4);
+        sigmfTypes.define("ci16_le", "Int16", sigmf::DATA_TYPE_CI16_LE);
+        sigmfTypes.define("cf32_le", "Float32", sigmf::DATA_TYPE_CF32_LE);
+        bundleTypes.define("int16", "Int16", bundle::SAMPLE_TYPE_INT16);
+        bundleTypes.define("float32", "Float32", bundle::SAMPLE_TYPE_FLOAT32);
+        splitModes.define("none", "None", SPLIT_MODE_NONE);
+        splitModes.define("size", "By size", SPLIT_MODE_SIZE);
+        splitModes.define("time", "By time", SPLIT_MODE_TIME);
 
         // Load default config for option lists
-        containerId = containers.valueId(wav::FORMAT_WAV);
+        containerId = containers.valueId(CONTAINER_WAV);
         sampleTypeId = sampleTypes.valueId(wav::SAMP_TYPE_INT16);
+        ziqTypeId = ziqTypes.valueId(dsp::compression::PCM_TYPE_I16);
+        sigmfTypeId = sigmfTypes.valueId(sigmf::DATA_TYPE_CI16_LE);
+        bundleTypeId = bundleTypes.valueId(bundle::SAMPLE_TYPE_INT16);
+        splitModeId = splitModes.valueId(SPLIT_MODE_NONE);
 
         // Load config
         config.acquire();
@@ -70,6 +140,23 @@ public:
         if (config.conf[name].contains("sampleType") && sampleTypes.keyExists(config.conf[name]["sampleType"])) {
             sampleTypeId = sampleTypes.keyId(config.conf[name]["sampleType"]);
         }
+        if (config.conf[name].contains("ziqType") && ziqTypes.keyExists(config.conf[name]["ziqType"])) {
+            ziqTypeId = ziqTypes.keyId(config.conf[name]["ziqType"]);
+        }
+        if (config.conf[name].contains("ziqLevel")) {
+            ziqLevel = std::clamp<int>(config.conf[name]["ziqLevel"], 1, ZSTD_maxCLevel());
+        }
+        if (config.conf[name].contains("sigmfType") && sigmfTypes.keyExists(config.conf[name]["sigmfType"])) {
+            sigmfTypeId = sigmfTypes.keyId(config.conf[name]["sigmfType"]);
+        }
+        if (config.conf[name].contains("bundleType") && bundleTypes.keyExists(config.conf[name]["bundleType"])) {
+            bundleTypeId = bundleTypes.keyId(config.conf[name]["bundleType"]);
+        }
+        if (config.conf[name].contains("bundleChannels")) {
+            for (auto& [vfoName, sel] : config.conf[name]["bundleChannels"].items()) {
+                bundleSelection[vfoName] = sel;
+            }
+        }
         if (config.conf[name].contains("audioStream")) {
             selectedStreamName = config.conf[name]["audioStream"];
         }
@@ -82,6 +169,42 @@ public:
         if (config.conf[name].contains("ignoreSilence")) {
             ignoreSilence = config.conf[name]["ignoreSilence"];
         }
+        if (config.conf[name].contains("bufferSize")) {
+            bufferSize = std::clamp<int>(config.conf[name]["bufferSize"], 16, 16384);
+        }
+        if (config.conf[name].contains("directIO")) {
+            directIO = config.conf[name]["directIO"];
+        }
+        if (config.conf[name].contains("splitMode") && splitModes.keyExists(config.conf[name]["splitMode"])) {
+            splitModeId = splitModes.keyId(config.conf[name]["splitMode"]);
+        }
+        if (config.conf[name].contains("splitSize")) {
+            splitSize = std::max<int>((int)config.conf[name]["splitSize"], 1);
+        }
+        if (config.conf[name].contains("splitTime")) {
+            splitTime = std::max<int>((int)config.conf[name]["splitTime"], 1);
+        }
+        if (config.conf[name].contains("preallocate")) {
+            preallocate = config.conf[name]["preallocate"];
+        }
+        if (config.conf[name].contains("history")) {
+            historyEnabled = config.conf[name]["history"];
+        }
+        if (config.conf[name].contains("historyLength")) {
+            historyLength = std::clamp<int>((int)config.conf[name]["historyLength"], HISTORY_MIN_LENGTH, HISTORY_MAX_LENGTH);
+        }
+        if (config.conf[name].contains("historyMemory")) {
+            historyMemory = std::clamp<int>((int)config.conf[name]["historyMemory"], HISTORY_MIN_MEMORY, HISTORY_MAX_MEMORY);
+        }
+        if (config.conf[name].contains("triggered")) {
+            triggered = config.conf[name]["triggered"];
+        }
+        if (config.conf[name].contains("preRoll")) {
+            preRoll = std::clamp<float>(config.conf[name]["preRoll"], 0.0f, TRIGGER_MAX_PRE_ROLL);
+        }
+        if (config.conf[name].contains("hangTime")) {
+            hangTime = std::clamp<float>(config.conf[name]["hangTime"], 0.0f, TRIGGER_MAX_HANG_TIME);
+        }
         if (config.conf[name].contains("nameTemplate")) {
             std::string _nameTemplate = config.conf[name]["nameTemplate"];
             if (_nameTemplate.length() > sizeof(nameTemplate)-1) {
@@ -102,6 +225,14 @@ public:
         basebandSink.init(NULL, complexHandler, this);
         stereoSink.init(&stereoStream, stereoHandler, this);
         monoSink.init(&s2m.out, monoHandler, this);
+        historySink.init(&historyStream, historyHandler, this);
+
+        retuneHandler.handler = onRetune;
+        retuneHandler.ctx = this;
+        historySrChangedHandler.handler = onHistorySampleRateChanged;
+        historySrChangedHandler.ctx = this;
+        bundleRetuneHandler.handler = onBundleRetune;
+        bundleRetuneHandler.ctx = this;
 
         gui::menu.registerEntry(name, menuHandler, this);
         core::modComManager.registerInterface("recorder", name, moduleInterfaceHandler, this);
@@ -112,9 +243,13 @@ public:
         core::modComManager.unregisterInterface(name);
         gui::menu.removeEntry(name);
         stop();
+        stopHistory();
         deselectStream();
         sigpath::sinkManager.onStreamRegistered.unbindHandler(&onStreamRegisteredHandler);
         sigpath::sinkManager.onStreamUnregister.unbindHandler(&onStreamUnregisterHandler);
+        sigpath::vfoManager.onVfoCreated.unbindHandler(&vfoCreatedHandler);
+        sigpath::vfoManager.onVfoDelete.unbindHandler(&vfoDeleteHandler);
+        sigpath::iqFrontEnd.onSampleRateChanged.unbindHandler(&historySrChangedHandler);
         meter.stop();
     }
 
@@ -134,8 +269,21 @@ public:
         onStreamUnregisterHandler.handler = streamUnregisterHandler;
         sigpath::sinkManager.onStreamUnregister.bindHandler(&onStreamUnregisterHandler);
 
+        // Triggered recordings follow the VFOs
+        vfoCreatedHandler.ctx = this;
+        vfoCreatedHandler.handler = onVfoCreated;
+        sigpath::vfoManager.onVfoCreated.bindHandler(&vfoCreatedHandler);
+        vfoDeleteHandler.ctx = this;
+        vfoDeleteHandler.handler = onVfoDelete;
+        sigpath::vfoManager.onVfoDelete.bindHandler(&vfoDeleteHandler);
+
+        // The history is reallocated when the samplerate changes
+        sigpath::iqFrontEnd.onSampleRateChanged.bindHandler(&historySrChangedHandler);
+
         // Select the stream
         selectStream(selectedStreamName);
+
+        if (historyEnabled) { startHistory(); }
     }
 
     void enable() {
@@ -154,6 +302,18 @@ public:
         std::lock_guard<std::recursive_mutex> lck(recMtx);
         if (recording) { return; }
 
+        if (triggered) {
+            startTriggered();
+            return;
+        }
+
+        // Compressed IQ, SigMF and bundles can only hold baseband
+        container = containers[containerId];
+        if (container != CONTAINER_WAV && container != CONTAINER_RF64 && recMode == RECORDER_MODE_AUDIO) {
+            flog::error("{0} recordings are only supported in baseband mode", containers.name(containerId));
+            return;
+        }
+
         // Configure the wav writer
         if (recMode == RECORDER_MODE_AUDIO) {
             if (selectedStreamName.empty()) { return; }
@@ -162,10 +322,42 @@ public:
         else {
             samplerate = sigpath::iqFrontEnd.getSampleRate();
         }
-        writer.setFormat(containers[containerId]);
+        if (container == CONTAINER_ZIQ) {
+            startCompressed();
+            return;
+        }
+        if (container == CONTAINER_SIGMF) {
+            startSigMF();
+            return;
+        }
+        if (container == CONTAINER_BUNDLE) {
+            startBundle();
+            return;
+        }
+        writer.setFormat((containers[containerId] == CONTAINER_RF64) ? wav::FORMAT_RF64 : wav::FORMAT_WAV);
         writer.setChannels((recMode == RECORDER_MODE_AUDIO && !stereo) ? 1 : 2);
         writer.setSampleType(sampleTypes[sampleTypeId]);
         writer.setSamplerate(samplerate);
+        if (recMode == RECORDER_MODE_AUDIO) {
+            writer.setBuffering(AUDIO_BLOCK_SIZE, AUDIO_BLOCK_COUNT);
+            writer.setDirectIO(false);
+        }
+        else {
+            writer.setBuffering(ASYNC_WRITER_BLOCK_SIZE, ((uint64_t)bufferSize * 1024 * 1024) / ASYNC_WRITER_BLOCK_SIZE);
+            writer.setDirectIO(directIO);
+        }
+
+        // Configure segments, reserving a whole segment at once when its size is known
+        SplitMode splitMode = splitModes[splitModeId];
+        uint64_t maxBytes = (splitMode == SPLIT_MODE_SIZE) ? (uint64_t)splitSize * 1024 * 1024 : 0;
+        uint64_t maxSamples = (splitMode == SPLIT_MODE_TIME) ? (uint64_t)splitTime * 60 * samplerate : 0;
+        writer.setSegmentLimits(maxBytes, maxSamples);
+        if (!preallocate) {
+            writer.setPreallocation(0);
+        }
+        else {
+            writer.setPreallocation(maxBytes ? maxBytes + 4096 : ASYNC_WRITER_PREALLOC_SIZE);
+        }
 
         // Open file
         std::string vfoName = (recMode == RECORDER_MODE_AUDIO) ? selectedStreamName : "";
@@ -176,33 +368,25 @@ public:
             return;
         }
 
-        // Open audio stream or baseband
-        if (recMode == RECORDER_MODE_AUDIO) {
-            // Start correct path depending on 
-            if (stereo) {
-                stereoSink.start();
-            }
-            else {
-                s2m.start();
-                monoSink.start();
-            }
-            splitter.bindStream(&stereoStream);
-        }
-        else {
-            // Create and bind IQ stream
-            basebandStream = new dsp::stream<dsp::complex_t>();
-            basebandSink.setInput(basebandStream);
-            basebandSink.start();
-            sigpath::iqFrontEnd.bindIQStream(basebandStream);
-        }
-
-        recording = true;
+        startStream();
     }
 
     void stop() {
         std::lock_guard<std::recursive_mutex> lck(recMtx);
         if (!recording) { return; }
 
+        if (triggeredRec.isRunning()) {
+            triggeredRec.stop();
+            recording = false;
+            return;
+        }
+
+        if (container == CONTAINER_BUNDLE) {
+            stopBundle();
+            recording = false;
+            return;
+        }
+
         // Close audio stream or baseband
         if (recMode == RECORDER_MODE_AUDIO) {
             splitter.unbindStream(&stereoStream);
@@ -219,12 +403,400 @@ public:
         }
 
         // Close file
-        writer.close();
+        if (container == CONTAINER_ZIQ) {
+            ziqWriter.close();
+        }
+        else if (container == CONTAINER_SIGMF) {
+            sigpath::sourceManager.onRetune.unbindHandler(&retuneHandler);
+            sigmfWriter.close();
+        }
+        else {
+            writer.close();
+        }
         
         recording = false;
     }
 
 private:
+    void startCompressed() {
+        ziqWriter.setSamplerate(samplerate);
+        ziqWriter.setCenterFrequency(gui::waterfall.getCenterFrequency());
+        ziqWriter.setSampleType(ziqTypes[ziqTypeId]);
+        ziqWriter.setCompressionLevel(ziqLevel);
+        ziqWriter.setBuffering(ASYNC_WRITER_BLOCK_SIZE, ((uint64_t)bufferSize * 1024 * 1024) / ASYNC_WRITER_BLOCK_SIZE);
+        ziqWriter.setDirectIO(directIO);
+
+        std::string expandedPath = expandString(folderSelect.path + "/" + genFileName(nameTemplate, recMode, "") + ".ziq");
+        if (!ziqWriter.open(expandedPath)) {
+            flog::error("Failed to open file for recording: {0}", expandedPath);
+            return;
+        }
+
+        startStream();
+    }
+
+    void startSigMF() {
+        sigmfWriter.setSamplerate(samplerate);
+        sigmfWriter.setCenterFrequency(gui::waterfall.getCenterFrequency());
+        sigmfWriter.setDataType(sigmfTypes[sigmfTypeId]);
+        sigmfWriter.setBuffering(ASYNC_WRITER_BLOCK_SIZE, ((uint64_t)bufferSize * 1024 * 1024) / ASYNC_WRITER_BLOCK_SIZE);
+        sigmfWriter.setDirectIO(directIO);
+        sigmfWriter.setPreallocation(preallocate ? ASYNC_WRITER_PREALLOC_SIZE : 0);
+
+        std::string expandedPath = expandString(folderSelect.path + "/" + genFileName(nameTemplate, recMode, ""));
+        if (!sigmfWriter.open(expandedPath)) {
+            flog::error("Failed to open file for recording: {0}", expandedPath);
+            return;
+        }
+        annotateVFOs(gui::waterfall.getCenterFrequency());
+
+        // Every retune starts a new capture
+        sigpath::sourceManager.onRetune.bindHandler(&retuneHandler);
+
+        startStream();
+    }
+
+    void startBundle() {
+        double centerFreq = gui::waterfall.getCenterFrequency();
+        bundleCenterFreq = centerFreq;
+        sigpath::sourceManager.onRetune.bindHandler(&bundleRetuneHandler);
+        bundleWriter.clearChannels();
+        bundleWriter.setCenterFrequency(centerFreq);
+        bundleWriter.setSampleType(bundleTypes[bundleTypeId]);
+        bundleWriter.setBuffering(ASYNC_WRITER_BLOCK_SIZE, ((uint64_t)bufferSize * 1024 * 1024) / ASYNC_WRITER_BLOCK_SIZE);
+        bundleWriter.setDirectIO(directIO);
+        bundleWriter.setPreallocation(preallocate ? ASYNC_WRITER_PREALLOC_SIZE : 0);
+
+        // Record a copy of the output of each selected VFO, at the samplerate it had when the recording started
+        for (auto const& [vfoName, wtfVFO] : gui::waterfall.vfos) {
+            if (!isBundleSelected(vfoName)) { continue; }
+            VFOManager::VFO* vfo = sigpath::vfoManager.getVFO(vfoName);
+            if (!vfo || !vfo->dspVFO) { continue; }
+            double sr = vfo->dspVFO->getOutSamplerate();
+            double bw = vfo->dspVFO->getBandwidth();
+            double offset = vfo->dspVFO->getOffset();
+            int id = bundleWriter.addChannel(vfoName, sr, centerFreq + offset, bw, getModeString(RECORDER_MODE_BASEBAND, vfoName));
+            if (id < 0) { break; }
+
+            BundleChannel* ch = new BundleChannel;
+            ch->module = this;
+            ch->id = id;
+            ch->vfoName = vfoName;
+            ch->mirrorName = name + "_bundle_" + vfoName;
+            ch->src = vfo;
+            ch->samplerate = sr;
+            ch->frequency = centerFreq + offset;
+            ch->bandwidth = bw;
+            ch->vfo = sigpath::iqFrontEnd.addVFO(ch->mirrorName, sr, bw, offset);
+            if (!ch->vfo) {
+                delete ch;
+                continue;
+            }
+            ch->sink.init(&ch->vfo->out, bundleHandler, ch);
+            bundleChannels.push_back(ch);
+        }
+        if (bundleChannels.empty()) {
+            flog::error("No VFO to record");
+            stopBundle();
+            return;
+        }
+
+        std::string expandedPath = expandString(folderSelect.path + "/" + genFileName(nameTemplate, recMode, "") + BUNDLE_EXT);
+        if (!bundleWriter.open(expandedPath)) {
+            flog::error("Failed to open file for recording: {0}", expandedPath);
+            stopBundle();
+            return;
+        }
+
+        for (auto& ch : bundleChannels) {
+            ch->sink.start();
+        }
+        recording = true;
+    }
+
+    void stopBundle() {
+        sigpath::sourceManager.onRetune.unbindHandler(&bundleRetuneHandler);
+        for (auto& ch : bundleChannels) {
+            ch->sink.stop();
+            sigpath::iqFrontEnd.removeVFO(ch->mirrorName);
+            delete ch;
+        }
+        bundleChannels.clear();
+        bundleWriter.close();
+    }
+
+    bool isBundleSelected(std::string vfoName) {
+        // VFOs are recorded unless deselected
+        return bundleSelection.find(vfoName) == bundleSelection.end() || bundleSelection[vfoName];
+    }
+
+    static void onBundleRetune(double freq, void* ctx) {
+        RecorderModule* _this = (RecorderModule*)ctx;
+        _this->bundleCenterFreq = freq;
+    }
+
+    static void bundleHandler(dsp::complex_t* data, int count, void* ctx) {
+        BundleChannel* ch = (BundleChannel*)ctx;
+
+        // Follow the VFO and the source, the samplerate stays the one of the channel
+        double offset = ch->src->dspVFO->getOffset();
+        if (offset != ch->vfo->getOffset()) { ch->vfo->setOffset(offset); }
+        double bandwidth = std::min<double>(ch->src->dspVFO->getBandwidth(), ch->samplerate);
+        if (bandwidth != ch->vfo->getBandwidth()) { ch->vfo->setBandwidth(bandwidth); }
+
+        // Tell the file from which sample the channel is somewhere else
+        double frequency = ch->module->bundleCenterFreq + offset;
+        if (frequency != ch->frequency || bandwidth != ch->bandwidth) {
+            ch->frequency = frequency;
+            ch->bandwidth = bandwidth;
+            ch->module->bundleWriter.retune(ch->id, frequency, bandwidth);
+        }
+
+        ch->module->bundleWriter.write(ch->id, data, count);
+    }
+
+    void startTriggered() {
+        TriggerSettings settings;
+        settings.baseband = (recMode == RECORDER_MODE_BASEBAND);
+        settings.stereo = stereo;
+        settings.sampleType = sampleTypes[sampleTypeId];
+        settings.preRoll = preRoll;
+        settings.hangTime = hangTime;
+        settings.folder = expandString(folderSelect.path);
+        settings.nameTemplate = nameTemplate;
+
+        // Every VFO or every audio stream is a channel
+        std::vector<std::string> channels;
+        if (settings.baseband) {
+            for (auto const& [vfoName, vfo] : gui::waterfall.vfos) {
+                channels.push_back(vfoName);
+            }
+        }
+        else {
+            for (int i = 0; i < audioStreams.size(); i++) {
+                channels.push_back(audioStreams.key(i));
+            }
+        }
+
+        triggeredRec.start(settings, channels);
+        recording = true;
+    }
+
+    static void onVfoCreated(VFOManager::VFO* vfo, void* ctx) {
+        RecorderModule* _this = (RecorderModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->recMtx);
+        if (_this->triggeredRec.isRunning() && _this->recMode == RECORDER_MODE_BASEBAND) {
+            _this->triggeredRec.addChannel(vfo->getName());
+        }
+    }
+
+    static void onVfoDelete(VFOManager::VFO* vfo, void* ctx) {
+        RecorderModule* _this = (RecorderModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->recMtx);
+        _this->triggeredRec.removeChannel(vfo->getName());
+
+        // The channel of a bundle just ends, the others keep going
+        for (auto it = _this->bundleChannels.begin(); it != _this->bundleChannels.end(); it++) {
+            BundleChannel* ch = *it;
+            if (ch->vfoName != vfo->getName()) { continue; }
+            ch->sink.stop();
+            sigpath::iqFrontEnd.removeVFO(ch->mirrorName);
+            delete ch;
+            _this->bundleChannels.erase(it);
+            break;
+        }
+    }
+
+    // Describe where each VFO is in the current capture
+    void annotateVFOs(double centerFreq) {
+        for (auto const& [vfoName, vfo] : gui::waterfall.vfos) {
+            sigmf::Annotation ann;
+            ann.sampleStart = sigmfWriter.getSamplesWritten();
+            ann.sampleCount = 0;
+            ann.freqLowerEdge = centerFreq + vfo->lowerOffset;
+            ann.freqUpperEdge = centerFreq + vfo->upperOffset;
+            ann.label = vfoName;
+            if (core::modComManager.getModuleName(vfoName) == "radio") {
+                int mode = -1;
+                core::modComManager.callInterface(vfoName, RADIO_IFACE_CMD_GET_MODE, NULL, &mode);
+                if (mode >= 0) { ann.label += std::string(" (") + radioModeToString[mode] + ")"; }
+            }
+            sigmfWriter.addAnnotation(ann);
+        }
+    }
+
+    static void onRetune(double freq, void* ctx) {
+        RecorderModule* _this = (RecorderModule*)ctx;
+        std::lock_guard<std::recursive_mutex> lck(_this->recMtx);
+        if (!_this->recording || _this->container != CONTAINER_SIGMF) { return; }
+        _this->sigmfWriter.setCenterFrequency(freq);
+        _this->annotateVFOs(freq);
+    }
+
+    uint64_t getSamplesWritten() {
+        switch (container) {
+        case CONTAINER_ZIQ:     return ziqWriter.getSamplesWritten();
+        case CONTAINER_SIGMF:   return sigmfWriter.getSamplesWritten();
+        case CONTAINER_BUNDLE:  return bundleWriter.getDuration() * samplerate;
+        default:                return writer.getSamplesWritten();
+        }
+    }
+
+    async_io::Stats getIOStats() {
+        switch (container) {
+        case CONTAINER_ZIQ:     return ziqWriter.getIOStats();
+        case CONTAINER_SIGMF:   return sigmfWriter.getIOStats();
+        case CONTAINER_BUNDLE:  return bundleWriter.getIOStats();
+        default:                return writer.getIOStats();
+        }
+    }
+
+    void startHistory() {
+        std::lock_guard<std::mutex> lck(historyMtx);
+        if (historyRunning) { return; }
+        configureHistory(sigpath::iqFrontEnd.getSampleRate());
+        historySink.start();
+        sigpath::iqFrontEnd.bindIQStream(&historyStream);
+        historyRunning = true;
+    }
+
+    void stopHistory() {
+        {
+            std::lock_guard<std::mutex> lck(historyMtx);
+            if (historyRunning) {
+                sigpath::iqFrontEnd.unbindIQStream(&historyStream);
+                historySink.stop();
+                historyRunning = false;
+                historyReady = false;
+                historyReconfigure = false;
+            }
+        }
+
+        // The memory can only be freed once the save is done with it
+        if (saveThread.joinable()) { saveThread.join(); }
+        history.free();
+    }
+
+    // Reallocate the history for a samplerate, with the history mutex held
+    void configureHistory(double samplerate) {
+        // Wait for the DSP thread to be done with the old memory, it drops samples until the history is ready again
+        std::lock_guard<std::mutex> lck(historyPushMtx);
+        historyReady = false;
+        if (!history.configure(historyLength, samplerate, (uint64_t)historyMemory * 1024 * 1024)) {
+            flog::error("Could not allocate {0}MB for the history", historyMemory);
+            return;
+        }
+        if (history.getLength() < historyLength) {
+            flog::warn("History limited to {0:.0f}s by the memory limit", history.getLength());
+        }
+        historyReady = true;
+    }
+
+    static void onHistorySampleRateChanged(double samplerate, void* ctx) {
+        RecorderModule* _this = (RecorderModule*)ctx;
+        std::lock_guard<std::mutex> lck(_this->historyMtx);
+        if (!_this->historyRunning) { return; }
+
+        // The memory can't be reallocated while a save uses it, the save does it once done
+        if (_this->saving) {
+            std::lock_guard<std::mutex> lck2(_this->historyPushMtx);
+            _this->historyReady = false;
+            _this->historyReconfigure = true;
+            return;
+        }
+        _this->configureHistory(samplerate);
+    }
+
+    /**
+     * Write the last seconds of baseband to a new file in the background.
+     * @param seconds Amount of history to save, everything if negative.
+     * @return True if the save was started.
+     */
+    bool saveHistory(double seconds = -1.0) {
+        std::lock_guard<std::mutex> lck(historyMtx);
+        if (!historyRunning || saving) { return false; }
+        if (saveThread.joinable()) { saveThread.join(); }
+
+        // Pin the samples right away, they're written while the history keeps going
+        IQHistory::Snapshot* snap = history.snapshot(seconds);
+        if (!snap) { return false; }
+
+        wav::SampleType type = sampleTypes[sampleTypeId];
+        bool rf64 = (containers[containerId] == CONTAINER_RF64);
+        std::string path = expandString(folderSelect.path + "/" + genFileName(nameTemplate, RECORDER_MODE_BASEBAND, "") + "_history.wav");
+        saveProgress = 0;
+        saveTotal = snap->getSampleCount();
+        saving = true;
+        saveThread = std::thread(&RecorderModule::historyWorker, this, snap, path, type, rf64);
+        return true;
+    }
+
+    void historyWorker(IQHistory::Snapshot* snap, std::string path, wav::SampleType type, bool rf64) {
+        // Too large for a plain WAV file, switch to RF64
+        uint64_t bytes = snap->getSampleCount() * 2 * (wav::bitDepth(type) / 8);
+        rf64 |= (bytes > 0xFFFFFF00ULL);
+
+        // Nothing may be dropped, it's the only copy
+        wav::Writer histWriter(2, snap->getSamplerate(), rf64 ? wav::FORMAT_RF64 : wav::FORMAT_WAV, type);
+        histWriter.setBlocking(true);
+        histWriter.setPreallocation(0);
+        if (histWriter.open(path)) {
+            flog::info("Saving {0:.1f}s of history to '{1}'", (double)snap->getSampleCount() / snap->getSamplerate(), path);
+            for (int i = 0; i < snap->getBlockCount(); i++) {
+                histWriter.write((float*)snap->getSamples(i), snap->getCount(i));
+                snap->release(i);
+                saveProgress += snap->getCount(i);
+            }
+            histWriter.close();
+        }
+        else {
+            flog::error("Failed to open file for the history: {0}", path);
+        }
+
+        delete snap;
+
+        // Apply a samplerate change that happened during the save
+        std::lock_guard<std::mutex> lck(historyMtx);
+        if (historyReconfigure) {
+            historyReconfigure = false;
+            if (historyRunning) { configureHistory(sigpath::iqFrontEnd.getSampleRate()); }
+        }
+        saving = false;
+    }
+
+    static void historyHandler(dsp::complex_t* data, int count, void* ctx) {
+        RecorderModule* _this = (RecorderModule*)ctx;
+
+        // Never wait on a reallocation, the samples are dropped until the history is ready
+        std::unique_lock<std::mutex> lck(_this->historyPushMtx, std::try_to_lock);
+        if (!lck.owns_lock() || !_this->historyReady) { return; }
+        _this->history.push(data, count);
+    }
+
+    void startStream() {
+        // Open audio stream or baseband
+        if (recMode == RECORDER_MODE_AUDIO) {
+            // Start correct path depending on 
+            if (stereo) {
+                stereoSink.start();
+            }
+            else {
+                s2m.start();
+                monoSink.start();
+            }
+            splitter.bindStream(&stereoStream);
+        }
+        else {
+            // Create and bind IQ stream
+            basebandStream = new dsp::stream<dsp::complex_t>();
+            basebandSink.setInput(basebandStream);
+            basebandSink.start();
+            sigpath::iqFrontEnd.bindIQStream(basebandStream);
+        }
+
+        recording = true;
+    }
+
     static void menuHandler(void* ctx) {
         RecorderModule* _this = (RecorderModule*)ctx;
         float menuWidth = ImGui::GetContentRegionAvail().x;
@@ -249,6 +821,12 @@ private:
         ImGui::Columns(1, CONCAT("EndRecorderModeColumns##_", _this->name), false);
         ImGui::EndGroup();
 
+        if (ImGui::Checkbox(CONCAT("Triggered by squelch##_recorder_triggered_", _this->name), &_this->triggered)) {
+            config.acquire();
+            config.conf[_this->name]["triggered"] = _this->triggered;
+            config.release(true);
+        }
+
         // Recording path
         if (_this->folderSelect.render("##_recorder_fold_" + _this->name)) {
             if (_this->folderSelect.pathIsValid()) {
@@ -266,20 +844,12 @@ private:
             config.release(true);
         }
 
-        ImGui::LeftLabel("Container");
-        ImGui::FillWidth();
-        if (ImGui::Combo(CONCAT("##_recorder_container_", _this->name), &_this->containerId, _this->containers.txt)) {
-            config.acquire();
-            config.conf[_this->name]["container"] = _this->containers.key(_this->containerId);
-            config.release(true);
+        // Triggered recordings are always one WAV file per transmission
+        if (_this->triggered) {
+            _this->triggerMenu();
         }
-
-        ImGui::LeftLabel("Sample type");
-        ImGui::FillWidth();
-        if (ImGui::Combo(CONCAT("##_recorder_st_", _this->name), &_this->sampleTypeId, _this->sampleTypes.txt)) {
-            config.acquire();
-            config.conf[_this->name]["sampleType"] = _this->sampleTypes.key(_this->sampleTypeId);
-            config.release(true);
+        else {
+            _this->containerMenu();
         }
 
         if (_this->recording) { style::endDisabled(); }
@@ -326,6 +896,8 @@ private:
             }
         }
 
+        _this->historyMenu();
+
         // Record button
         bool canRecord = _this->folderSelect.pathIsValid();
         if (_this->recMode == RECORDER_MODE_AUDIO) { canRecord &= !_this->selectedStreamName.empty(); }
@@ -335,11 +907,20 @@ private:
             }
             ImGui::TextColored(ImGui::GetStyleColorVec4(ImGuiCol_Text), "Idle --:--:--");
         }
+        else if (_this->triggeredRec.isRunning()) {
+            if (ImGui::Button(CONCAT("Stop##_recorder_rec_", _this->name), ImVec2(menuWidth, 0))) {
+                _this->stop();
+            }
+            int active = _this->triggeredRec.getActiveCount();
+            ImGui::TextColored(active ? ImVec4(1.0f, 0.0f, 0.0f, 1.0f) : ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "Recording %d/%d channels", active, _this->triggeredRec.getChannelCount());
+            ImGui::Text("%d files", _this->triggeredRec.getFileCount());
+        }
         else {
             if (ImGui::Button(CONCAT("Stop##_recorder_rec_", _this->name), ImVec2(menuWidth, 0))) {
                 _this->stop();
             }
-            uint64_t seconds = _this->writer.getSamplesWritten() / _this->samplerate;
+            uint64_t samples = _this->getSamplesWritten();
+            uint64_t seconds = samples / _this->samplerate;
             time_t diff = seconds;
             tm* dtm = gmtime(&diff);
 
@@ -349,6 +930,271 @@ private:
             else {
                 ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Recording %02d:%02d:%02d", dtm->tm_hour, dtm->tm_min, dtm->tm_sec);
             }
+
+            if (_this->container == CONTAINER_ZIQ) {
+                uint64_t comp = _this->ziqWriter.getCompressedBytes();
+                ImGui::Text("Ratio %.2f", comp ? (double)_this->ziqWriter.getRawBytes() / (double)comp : 0.0);
+            }
+            else if ((_this->container == CONTAINER_WAV || _this->container == CONTAINER_RF64) && _this->splitModes[_this->splitModeId] != SPLIT_MODE_NONE) {
+                ImGui::Text("Segment %d", _this->writer.getSegmentIndex() + 1);
+            }
+
+            // Show how well the disk keeps up
+            async_io::Stats stats = _this->getIOStats();
+            char buf[128];
+            sprintf(buf, "Peak %.0f%%", 100.0 * (double)stats.highWater / (double)stats.capacity);
+            ImGui::ProgressBar((float)stats.buffered / (float)stats.capacity, ImVec2(menuWidth, 0), buf);
+            if (stats.error) {
+                ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Write error");
+            }
+            else if (stats.dropped) {
+                ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Dropped %.1f MB", (double)stats.dropped / (1024.0 * 1024.0));
+            }
+            else if (_this->container == CONTAINER_ZIQ && _this->ziqWriter.getSamplesDropped()) {
+                ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Dropped %.1f s", (double)_this->ziqWriter.getSamplesDropped() / (double)_this->samplerate);
+            }
+        }
+    }
+
+    void containerMenu() {
+        ImGui::LeftLabel("Container");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_container_", name), &containerId, containers.txt)) {
+            config.acquire();
+            config.conf[name]["container"] = containers.key(containerId);
+            config.release(true);
+        }
+
+        // Compressed IQ, SigMF and bundles have their own sample types and are written as a single file
+        Container cont = containers[containerId];
+        if (cont == CONTAINER_ZIQ) {
+            compressionMenu();
+        }
+        else if (cont == CONTAINER_SIGMF) {
+            sigmfMenu();
+        }
+        else if (cont == CONTAINER_BUNDLE) {
+            bundleMenu();
+        }
+        else {
+            wavMenu();
+        }
+        if (cont != CONTAINER_WAV && cont != CONTAINER_RF64 && recMode == RECORDER_MODE_AUDIO) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Only supported in baseband mode");
+        }
+
+        // Show additional baseband options
+        if (recMode == RECORDER_MODE_BASEBAND) {
+            ImGui::LeftLabel("Buffer (MB)");
+            ImGui::FillWidth();
+            if (ImGui::InputInt(CONCAT("##_recorder_buffer_", name), &bufferSize, 16, 256)) {
+                bufferSize = std::clamp<int>(bufferSize, 16, 16384);
+                config.acquire();
+                config.conf[name]["bufferSize"] = bufferSize;
+                config.release(true);
+            }
+
+            if (ImGui::Checkbox(CONCAT("Direct I/O##_recorder_direct_", name), &directIO)) {
+                config.acquire();
+                config.conf[name]["directIO"] = directIO;
+                config.release(true);
+            }
+        }
+    }
+
+    void triggerMenu() {
+        ImGui::LeftLabel("Sample type");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_st_", name), &sampleTypeId, sampleTypes.txt)) {
+            config.acquire();
+            config.conf[name]["sampleType"] = sampleTypes.key(sampleTypeId);
+            config.release(true);
+        }
+
+        ImGui::LeftLabel("Pre-roll (s)");
+        ImGui::FillWidth();
+        if (ImGui::InputFloat(CONCAT("##_recorder_pre_roll_", name), &preRoll, 0.5f, 1.0f, "%.1f")) {
+            preRoll = std::clamp<float>(preRoll, 0.0f, TRIGGER_MAX_PRE_ROLL);
+            config.acquire();
+            config.conf[name]["preRoll"] = preRoll;
+            config.release(true);
+        }
+
+        ImGui::LeftLabel("Hang time (s)");
+        ImGui::FillWidth();
+        if (ImGui::InputFloat(CONCAT("##_recorder_hang_time_", name), &hangTime, 0.5f, 1.0f, "%.1f")) {
+            hangTime = std::clamp<float>(hangTime, 0.0f, TRIGGER_MAX_HANG_TIME);
+            config.acquire();
+            config.conf[name]["hangTime"] = hangTime;
+            config.release(true);
+        }
+    }
+
+    void wavMenu() {
+        ImGui::LeftLabel("Sample type");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_st_", name), &sampleTypeId, sampleTypes.txt)) {
+            config.acquire();
+            config.conf[name]["sampleType"] = sampleTypes.key(sampleTypeId);
+            config.release(true);
+        }
+
+        ImGui::LeftLabel("Split files");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_split_", name), &splitModeId, splitModes.txt)) {
+            config.acquire();
+            config.conf[name]["splitMode"] = splitModes.key(splitModeId);
+            config.release(true);
+        }
+        if (splitModes[splitModeId] == SPLIT_MODE_SIZE) {
+            ImGui::LeftLabel("Split size (MB)");
+            ImGui::FillWidth();
+            if (ImGui::InputInt(CONCAT("##_recorder_split_size_", name), &splitSize, 256, 1024)) {
+                splitSize = std::max<int>(splitSize, 1);
+                config.acquire();
+                config.conf[name]["splitSize"] = splitSize;
+                config.release(true);
+            }
+        }
+        else if (splitModes[splitModeId] == SPLIT_MODE_TIME) {
+            ImGui::LeftLabel("Split time (min)");
+            ImGui::FillWidth();
+            if (ImGui::InputInt(CONCAT("##_recorder_split_time_", name), &splitTime, 1, 10)) {
+                splitTime = std::max<int>(splitTime, 1);
+                config.acquire();
+                config.conf[name]["splitTime"] = splitTime;
+                config.release(true);
+            }
+        }
+
+        if (ImGui::Checkbox(CONCAT("Preallocate##_recorder_prealloc_", name), &preallocate)) {
+            config.acquire();
+            config.conf[name]["preallocate"] = preallocate;
+            config.release(true);
+        }
+    }
+
+    void compressionMenu() {
+        ImGui::LeftLabel("Compression");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_ziq_type_", name), &ziqTypeId, ziqTypes.txt)) {
+            config.acquire();
+            config.conf[name]["ziqType"] = ziqTypes.key(ziqTypeId);
+            config.release(true);
+        }
+
+        ImGui::LeftLabel("Level");
+        ImGui::FillWidth();
+        if (ImGui::InputInt(CONCAT("##_recorder_ziq_level_", name), &ziqLevel, 1, 1)) {
+            ziqLevel = std::clamp<int>(ziqLevel, 1, ZSTD_maxCLevel());
+            config.acquire();
+            config.conf[name]["ziqLevel"] = ziqLevel;
+            config.release(true);
+        }
+    }
+
+    void historyMenu() {
+        if (ImGui::Checkbox(CONCAT("Time machine##_recorder_history_", name), &historyEnabled)) {
+            if (historyEnabled) {
+                startHistory();
+            }
+            else {
+                stopHistory();
+            }
+            config.acquire();
+            config.conf[name]["history"] = historyEnabled;
+            config.release(true);
+        }
+        if (!historyEnabled) { return; }
+
+        // The memory can't be reallocated while a save is using it
+        if (saving) { style::beginDisabled(); }
+        ImGui::LeftLabel("History (s)");
+        ImGui::FillWidth();
+        if (ImGui::InputInt(CONCAT("##_recorder_history_len_", name), &historyLength, 1, 10)) {
+            historyLength = std::clamp<int>(historyLength, HISTORY_MIN_LENGTH, HISTORY_MAX_LENGTH);
+            stopHistory();
+            startHistory();
+            config.acquire();
+            config.conf[name]["historyLength"] = historyLength;
+            config.release(true);
+        }
+        ImGui::LeftLabel("Max memory (MB)");
+        ImGui::FillWidth();
+        if (ImGui::InputInt(CONCAT("##_recorder_history_mem_", name), &historyMemory, 64, 1024)) {
+            historyMemory = std::clamp<int>(historyMemory, HISTORY_MIN_MEMORY, HISTORY_MAX_MEMORY);
+            stopHistory();
+            startHistory();
+            config.acquire();
+            config.conf[name]["historyMemory"] = historyMemory;
+            config.release(true);
+        }
+        if (saving) { style::endDisabled(); }
+        if (historyRunning && history.getLength() < historyLength) {
+            ImGui::TextColored(ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "Limited to %.0fs by the memory", history.getLength());
+        }
+
+        float menuWidth = ImGui::GetContentRegionAvail().x;
+        if (saving) {
+            char buf[64];
+            sprintf(buf, "Saving %.0f%%", 100.0 * (double)saveProgress / (double)std::max<uint64_t>(saveTotal, 1));
+            ImGui::ProgressBar((float)saveProgress / (float)std::max<uint64_t>(saveTotal, 1), ImVec2(menuWidth, 0), buf);
+        }
+        else {
+            double available = history.getAvailable();
+            char buf[64];
+            sprintf(buf, "Save last %.0fs##_recorder_history_save_%s", available, name.c_str());
+            if (!folderSelect.pathIsValid() || available <= 0.0) { style::beginDisabled(); }
+            if (ImGui::Button(buf, ImVec2(menuWidth, 0))) {
+                saveHistory();
+            }
+            if (!folderSelect.pathIsValid() || available <= 0.0) { style::endDisabled(); }
+        }
+        if (history.getDropped()) {
+            ImGui::TextColored(ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "History paused during a save");
+        }
+    }
+
+    void sigmfMenu() {
+        ImGui::LeftLabel("Sample type");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_sigmf_type_", name), &sigmfTypeId, sigmfTypes.txt)) {
+            config.acquire();
+            config.conf[name]["sigmfType"] = sigmfTypes.key(sigmfTypeId);
+            config.release(true);
+        }
+
+        if (ImGui::Checkbox(CONCAT("Preallocate##_recorder_prealloc_", name), &preallocate)) {
+            config.acquire();
+            config.conf[name]["preallocate"] = preallocate;
+            config.release(true);
+        }
+    }
+
+    void bundleMenu() {
+        ImGui::LeftLabel("Sample type");
+        ImGui::FillWidth();
+        if (ImGui::Combo(CONCAT("##_recorder_bundle_type_", name), &bundleTypeId, bundleTypes.txt)) {
+            config.acquire();
+            config.conf[name]["bundleType"] = bundleTypes.key(bundleTypeId);
+            config.release(true);
+        }
+
+        if (ImGui::Checkbox(CONCAT("Preallocate##_recorder_prealloc_", name), &preallocate)) {
+            config.acquire();
+            config.conf[name]["preallocate"] = preallocate;
+            config.release(true);
+        }
+
+        ImGui::TextUnformatted("VFOs");
+        for (auto const& [vfoName, vfo] : gui::waterfall.vfos) {
+            bool sel = isBundleSelected(vfoName);
+            if (ImGui::Checkbox((vfoName + "##_recorder_bundle_vfo_" + name).c_str(), &sel)) {
+                bundleSelection[vfoName] = sel;
+                config.acquire();
+                config.conf[name]["bundleChannels"][vfoName] = sel;
+                config.release(true);
+            }
         }
     }
 
@@ -379,7 +1225,7 @@ private:
             selectedStreamName.clear();
             return;
         }
-        if (recording && recMode == RECORDER_MODE_AUDIO) { stop(); }
+        if (recording && recMode == RECORDER_MODE_AUDIO && !triggeredRec.isRunning()) { stop(); }
         stopAudioPath();
         sigpath::sinkManager.unbindStream(selectedStreamName, audioStream);
         selectedStreamName.clear();
@@ -403,6 +1249,9 @@ private:
 
         // Add new stream to the list
         _this->audioStreams.define(name, name, name);
+        if (_this->triggeredRec.isRunning() && _this->recMode == RECORDER_MODE_AUDIO) {
+            _this->triggeredRec.addChannel(name);
+        }
 
         // If no stream is selected, select new stream. If not, update the menu ID. 
         if (_this->selectedStreamName.empty()) {
@@ -418,6 +1267,7 @@ private:
 
         // Remove stream from list
         _this->audioStreams.undefineKey(name);
+        _this->triggeredRec.removeChannel(name);
 
         // If the stream is in used, deselect it and reselect default. Otherwise, update ID.
         if (_this->selectedStreamName == name) {
@@ -453,50 +1303,23 @@ private:
 
     std::string genFileName(std::string templ, int mode, std::string name) {
         // Get data
-        time_t now = time(0);
-        tm* ltm = localtime(&now);
-        char buf[1024];
         double freq = gui::waterfall.getCenterFrequency();
         if (gui::waterfall.vfos.find(name) != gui::waterfall.vfos.end()) {
             freq += gui::waterfall.vfos[name]->generalOffset;
         }
 
         // Select the recording type string
-        std::string type = (recMode == RECORDER_MODE_AUDIO) ? "audio" : "baseband";
-
-        // Format to string
-        char freqStr[128];
-        char hourStr[128];
-        char minStr[128];
-        char secStr[128];
-        char dayStr[128];
-        char monStr[128];
-        char yearStr[128];
-        const char* modeStr = (recMode == RECORDER_MODE_AUDIO) ? "Unknown" : "IQ";
-        sprintf(freqStr, "%.0lfHz", freq);
-        sprintf(hourStr, "%02d", ltm->tm_hour);
-        sprintf(minStr, "%02d", ltm->tm_min);
-        sprintf(secStr, "%02d", ltm->tm_sec);
-        sprintf(dayStr, "%02d", ltm->tm_mday);
-        sprintf(monStr, "%02d", ltm->tm_mon + 1);
-        sprintf(yearStr, "%02d", ltm->tm_year + 1900);
+        std::string type = (mode == RECORDER_MODE_AUDIO) ? "audio" : "baseband";
+        return formatFileName(templ, type, freq, getModeString(mode, name));
+    }
+
+    std::string getModeString(int mode, std::string name) {
         if (core::modComManager.getModuleName(name) == "radio") {
-            int mode = -1;
-            core::modComManager.callInterface(name, RADIO_IFACE_CMD_GET_MODE, NULL, &mode);
-            if (mode >= 0) { modeStr = radioModeToString[mode]; };
+            int radioMode = -1;
+            core::modComManager.callInterface(name, RADIO_IFACE_CMD_GET_MODE, NULL, &radioMode);
+            if (radioMode >= 0) { return radioModeToString[radioMode]; };
         }
-
-        // Replace in template
-        templ = std::regex_replace(templ, std::regex("\\$t"), type);
-        templ = std::regex_replace(templ, std::regex("\\$f"), freqStr);
-        templ = std::regex_replace(templ, std::regex("\\$h"), hourStr);
-        templ = std::regex_replace(templ, std::regex("\\$m"), minStr);
-        templ = std::regex_replace(templ, std::regex("\\$s"), secStr);
-        templ = std::regex_replace(templ, std::regex("\\$d"), dayStr);
-        templ = std::regex_replace(templ, std::regex("\\$M"), monStr);
-        templ = std::regex_replace(templ, std::regex("\\$y"), yearStr);
-        templ = std::regex_replace(templ, std::regex("\\$r"), modeStr);
-        return templ;
+        return (mode == RECORDER_MODE_AUDIO) ? "Unknown" : "IQ";
     }
 
     std::string expandString(std::string input) {
@@ -506,20 +1329,21 @@ private:
 
     static void complexHandler(dsp::complex_t* data, int count, void* ctx) {
         RecorderModule* _this = (RecorderModule*)ctx;
+        if (_this->container == CONTAINER_ZIQ) {
+            _this->ziqWriter.write(data, count);
+            return;
+        }
+        if (_this->container == CONTAINER_SIGMF) {
+            _this->sigmfWriter.write(data, count);
+            return;
+        }
         _this->writer.write((float*)data, count);
     }
 
     static void stereoHandler(dsp::stereo_t* data, int count, void* ctx) {
         RecorderModule* _this = (RecorderModule*)ctx;
         if (_this->ignoreSilence) {
-            float absMax = 0.0f;
-            float* _data = (float*)data;
-            int _count = count * 2;
-            for (int i = 0; i < _count; i++) {
-                float val = fabsf(_data[i]);
-                if (val > absMax) { absMax = val; }
-            }
-            _this->ignoringSilence = (absMax < SILENCE_LVL);
+            _this->ignoringSilence = (dsp::convert::pcm::peak((float*)data, count * 2) < SILENCE_LVL);
             if (_this->ignoringSilence) { return; }
         }
         _this->writer.write((float*)data, count);
@@ -528,12 +1352,7 @@ private:
     static void monoHandler(float* data, int count, void* ctx) {
         RecorderModule* _this = (RecorderModule*)ctx;
         if (_this->ignoreSilence) {
-            float absMax = 0.0f;
-            for (int i = 0; i < count; i++) {
-                float val = fabsf(data[i]);
-                if (val > absMax) { absMax = val; }
-            }
-            _this->ignoringSilence = (absMax < SILENCE_LVL);
+            _this->ignoringSilence = (dsp::convert::pcm::peak(data, count) < SILENCE_LVL);
             if (_this->ignoringSilence) { return; }
         }
         _this->writer.write(data, count);
@@ -557,6 +1376,11 @@ private:
         else if (code == RECORDER_IFACE_CMD_STOP) {
             if (_this->recording) { _this->stop(); }
         }
+        else if (code == RECORDER_IFACE_CMD_SAVE_HISTORY) {
+            double* _in = (double*)in;
+            bool ok = _this->saveHistory(_in ? *_in : -1.0);
+            if (out) { *(bool*)out = ok; }
+        }
     }
 
     std::string name;
@@ -564,8 +1388,12 @@ private:
     std::string root;
     char nameTemplate[1024];
 
-    OptionList<std::string, wav::Format> containers;
+    OptionList<std::string, Container> containers;
     OptionList<int, wav::SampleType> sampleTypes;
+    OptionList<std::string, dsp::compression::PCMType> ziqTypes;
+    OptionList<std::string, sigmf::DataType> sigmfTypes;
+    OptionList<std::string, bundle::SampleType> bundleTypes;
+    OptionList<std::string, SplitMode> splitModes;
     FolderSelect folderSelect;
 
     int recMode = RECORDER_MODE_AUDIO;
@@ -575,11 +1403,29 @@ private:
     std::string selectedStreamName = "";
     float audioVolume = 1.0f;
     bool ignoreSilence = false;
+    int bufferSize = 256;
+    bool directIO = false;
+    int ziqTypeId;
+    int ziqLevel = ZIQ_DEFAULT_LEVEL;
+    int sigmfTypeId;
+    int bundleTypeId;
+    std::map<std::string, bool> bundleSelection;
+    int splitModeId;
+    int splitSize = 2048;
+    int splitTime = 60;
+    bool preallocate = true;
     dsp::stereo_t audioLvl = { -100.0f, -100.0f };
 
     bool recording = false;
     bool ignoringSilence = false;
+    Container container = CONTAINER_WAV;
     wav::Writer writer;
+    ziq::Writer ziqWriter;
+    sigmf::Writer sigmfWriter;
+    bundle::Writer bundleWriter;
+    std::atomic<double> bundleCenterFreq = 0.0;
+    EventHandler<double> bundleRetuneHandler;
+    std::vector<BundleChannel*> bundleChannels;
     std::recursive_mutex recMtx;
     dsp::stream<dsp::complex_t>* basebandStream;
     dsp::stream<dsp::stereo_t> stereoStream;
@@ -600,6 +1446,35 @@ private:
 
     EventHandler<std::string> onStreamRegisteredHandler;
     EventHandler<std::string> onStreamUnregisterHandler;
+    EventHandler<double> retuneHandler;
+
+    // Baseband history
+    bool historyEnabled = false;
+    int historyLength = 30;
+    int historyMemory = 1024;
+    bool historyRunning = false;
+    // Cleared while the history is reallocated, protected by the push mutex
+    bool historyReady = false;
+    // Samplerate change to apply once the running save is done
+    bool historyReconfigure = false;
+    std::mutex historyPushMtx;
+    EventHandler<double> historySrChangedHandler;
+    IQHistory history;
+    dsp::stream<dsp::complex_t> historyStream;
+    dsp::sink::Handler<dsp::complex_t> historySink;
+    std::mutex historyMtx;
+    std::thread saveThread;
+    std::atomic<bool> saving = false;
+    std::atomic<uint64_t> saveProgress = 0;
+    uint64_t saveTotal = 0;
+
+    // Squelch triggered recording
+    bool triggered = false;
+    float preRoll = 1.0f;
+    float hangTime = 2.0f;
+    TriggeredRecorder triggeredRec;
+    EventHandler<VFOManager::VFO*> vfoCreatedHandler;
+    EventHandler<VFOManager::VFO*> vfoDeleteHandler;
 
 };
 
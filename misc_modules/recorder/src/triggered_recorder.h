@@ -0,0 +1,566 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+#include <dsp/types.h>
+#include <dsp/stream.h>
+#include <dsp/sink/handler_sink.h>
+#include <dsp/channel/rx_vfo.h>
+#include <dsp/convert/pcm.h>
+#include <signal_path/signal_path.h>
+#include <gui/gui.h>
+#include <core.h>
+#include <utils/flog.h>
+#include <utils/wav.h>
+#include <utils/async_writer.h>
+#include <radio_interface.h>
+#include "file_name.h"
+
+// Amplitude under which audio is considered silent
+#define SILENCE_LVL 10e-6
+
+// Write-behind buffering of each triggered file, kept small since there can be many at once
+#define TRIGGERED_BLOCK_SIZE    (64*1024)
+#define TRIGGERED_BLOCK_COUNT   16
+
+// Frames handled at once when audio is downmixed to mono
+#define TRIGGERED_CHUNK_SIZE    4096
+
+// Seconds of ring on top of the pre-roll, holding what comes in while a file is being opened
+#define TRIGGERED_OPEN_MARGIN   2.0
+
+struct TriggerSettings {
+    bool baseband = false;      // Record the IQ of each VFO instead of its audio
+    bool stereo = true;
+    wav::SampleType sampleType = wav::SAMP_TYPE_INT16;
+    double preRoll = 1.0;       // Seconds kept from before the squelch opened
+    double hangTime = 2.0;      // Seconds the squelch has to stay closed before the file is closed
+    std::string folder;
+    std::string nameTemplate;
+};
+
+/**
+ * Opens and closes files in the background. Naming, creating and closing a file
+ * touch the disk, which must never happen on a DSP thread.
+ */
+class TriggeredIO {
+public:
+    TriggeredIO() {
+        workerThread = std::thread(&TriggeredIO::worker, this);
+    }
+
+    // Handles everything that was queued before returning
+    ~TriggeredIO() {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            stopWorker = true;
+        }
+        cnd.notify_all();
+        if (workerThread.joinable()) { workerThread.join(); }
+    }
+
+    // Call a handler from the worker
+    void run(void (*handler)(void* ctx), void* ctx) {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            queue.push_back(Request{ handler, ctx, NULL });
+        }
+        cnd.notify_all();
+    }
+
+    // Forget the handlers queued for a context, waits for the one running if any
+    void cancel(void* ctx) {
+        std::unique_lock<std::mutex> lck(mtx);
+        queue.erase(std::remove_if(queue.begin(), queue.end(), [=](const Request& req) { return req.handler && req.ctx == ctx; }), queue.end());
+        cnd.wait(lck, [=]() { return busy != ctx; });
+    }
+
+    // Take ownership of a writer, it's closed and deleted by the worker
+    void close(wav::Writer* writer) {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            queue.push_back(Request{ NULL, NULL, writer });
+        }
+        cnd.notify_all();
+    }
+
+private:
+    struct Request {
+        void (*handler)(void* ctx);
+        void* ctx;
+        wav::Writer* writer;
+    };
+
+    void worker() {
+        while (true) {
+            Request req;
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                cnd.wait(lck, [this]() { return !queue.empty() || stopWorker; });
+                if (queue.empty()) { return; }
+                req = queue.front();
+                queue.pop_front();
+                busy = req.ctx;
+            }
+
+            if (req.handler) {
+                req.handler(req.ctx);
+            }
+            else {
+                req.writer->close();
+                delete req.writer;
+            }
+
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                busy = NULL;
+            }
+            cnd.notify_all();
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable cnd;
+    std::deque<Request> queue;
+    void* busy = NULL;
+    bool stopWorker = false;
+    std::thread workerThread;
+};
+
+/**
+ * Records the audio or the IQ of one VFO to a new file each time its squelch opens.
+ * The last seconds before the opening are kept in a ring so that the start of the
+ * transmission isn't lost, the file is closed once the squelch stayed closed for the
+ * hang time. Files are opened and closed by a shared I/O thread and written by a shared
+ * engine. While a file is being opened the ring keeps everything received, the I/O
+ * thread drains it into the new file before handing the file over to the DSP thread.
+ */
+class TriggeredChannel {
+public:
+    TriggeredChannel(std::string name, std::string recorderName, const TriggerSettings& settings, async_io::Engine* engine, TriggeredIO* io) {
+        this->name = name;
+        this->settings = settings;
+        this->engine = engine;
+        this->io = io;
+        mirrorName = recorderName + "_" + name;
+    }
+
+    ~TriggeredChannel() {
+        stop();
+    }
+
+    bool start() {
+        if (running) { return true; }
+
+        // The VFO is used for the file names and must outlive the channel
+        vfo = sigpath::vfoManager.getVFO(name);
+        if (settings.baseband) {
+            // Duplicate the VFO, its own output already goes to its module
+            if (!vfo || !vfo->dspVFO) { return false; }
+            samplerate = vfo->dspVFO->getOutSamplerate();
+            channels = 2;
+            mirror = sigpath::iqFrontEnd.addVFO(mirrorName, samplerate, vfo->dspVFO->getBandwidth(), vfo->dspVFO->getOffset());
+            if (!mirror) { return false; }
+            modeStr = "IQ";
+        }
+        else {
+            samplerate = sigpath::sinkManager.getStreamSampleRate(name);
+            channels = settings.stereo ? 2 : 1;
+            modeStr = "Unknown";
+        }
+        if (samplerate <= 0.0) {
+            stop();
+            return false;
+        }
+
+        // The squelch state of the radio is polled directly, the interface is too slow for every block
+        squelchState = NULL;
+        if (core::modComManager.getModuleName(name) == "radio") {
+            int mode = -1;
+            core::modComManager.callInterface(name, RADIO_IFACE_CMD_GET_MODE, NULL, &mode);
+            if (mode >= 0 && mode < (int)(sizeof(modeNames) / sizeof(modeNames[0]))) { modeStr = modeNames[mode]; }
+            core::modComManager.callInterface(name, RADIO_IFACE_CMD_GET_SQUELCH_STATE, NULL, &squelchState);
+        }
+
+        // Pre-roll ring, with room for what comes in while the file is opened
+        preRollFrames = settings.preRoll * samplerate;
+        ringFrames = std::max<int>((settings.preRoll + TRIGGERED_OPEN_MARGIN) * samplerate, 1);
+        ring = dsp::buffer::alloc<float>(ringFrames * channels);
+        if (!ring) {
+            stop();
+            return false;
+        }
+        ringWritten = 0;
+        if (channels == 1) { monoBuf = dsp::buffer::alloc<float>(TRIGGERED_CHUNK_SIZE); }
+        hangFrames = settings.hangTime * samplerate;
+        closedFrames = 0;
+        opening = false;
+        openFailed = false;
+
+        // Start receiving
+        if (settings.baseband) {
+            iqSink.init(&mirror->out, iqHandler, this);
+            iqSink.start();
+        }
+        else {
+            audioStream = sigpath::sinkManager.bindStream(name);
+            if (!audioStream) {
+                stop();
+                return false;
+            }
+            audioSink.init(audioStream, audioHandler, this);
+            audioSink.start();
+        }
+
+        running = true;
+        return true;
+    }
+
+    void stop() {
+        if (audioStream) {
+            audioSink.stop();
+            sigpath::sinkManager.unbindStream(name, audioStream);
+            audioStream = NULL;
+        }
+        if (mirror) {
+            iqSink.stop();
+            sigpath::iqFrontEnd.removeVFO(mirrorName);
+            mirror = NULL;
+        }
+
+        // Nothing writes anymore, drop a pending open and hand the file over
+        if (io) { io->cancel(this); }
+        opening = false;
+        closeFile();
+        vfo = NULL;
+        squelchState = NULL;
+
+        if (ring) {
+            dsp::buffer::free(ring);
+            ring = NULL;
+        }
+        if (monoBuf) {
+            dsp::buffer::free(monoBuf);
+            monoBuf = NULL;
+        }
+        running = false;
+    }
+
+    std::string getName() { return name; }
+
+    // True while a file is open
+    bool isRecording() { return recording; }
+
+    int getFileCount() { return fileCount; }
+
+private:
+    static void audioHandler(dsp::stereo_t* data, int count, void* ctx) {
+        TriggeredChannel* _this = (TriggeredChannel*)ctx;
+        bool open = _this->squelchOpen((float*)data, count * 2);
+        if (_this->channels == 2) {
+            _this->process((float*)data, count, open);
+            return;
+        }
+
+        // Downmix by chunks to keep the buffer small
+        for (int i = 0; i < count; i += TRIGGERED_CHUNK_SIZE) {
+            int len = std::min<int>(count - i, TRIGGERED_CHUNK_SIZE);
+            for (int j = 0; j < len; j++) {
+                _this->monoBuf[j] = (data[i + j].l + data[i + j].r) * 0.5f;
+            }
+            _this->process(_this->monoBuf, len, open);
+        }
+    }
+
+    static void iqHandler(dsp::complex_t* data, int count, void* ctx) {
+        TriggeredChannel* _this = (TriggeredChannel*)ctx;
+
+        // Follow the VFO, the sample rate stays the one of the file
+        double offset = _this->vfo->dspVFO->getOffset();
+        if (offset != _this->mirror->getOffset()) { _this->mirror->setOffset(offset); }
+        double bandwidth = std::min<double>(_this->vfo->dspVFO->getBandwidth(), _this->samplerate);
+        if (bandwidth != _this->mirror->getBandwidth()) { _this->mirror->setBandwidth(bandwidth); }
+
+        _this->process((float*)data, count, _this->squelchOpen(NULL, 0));
+    }
+
+    bool squelchOpen(const float* data, int len) {
+        // Use the squelch of the radio when there's one
+        if (squelchState) { return *squelchState; }
+
+        // Otherwise anything but silence, baseband is never silent
+        return !len || dsp::convert::pcm::peak(data, len) >= SILENCE_LVL;
+    }
+
+    void process(const float* frames, int count, bool open) {
+        if (open) {
+            closedFrames = 0;
+            // The writer is only looked at once the I/O thread is done with it
+            if (!opening && !writer && !openFailed) { requestOpen(); }
+        }
+        else {
+            closedFrames += count;
+            openFailed = false;
+        }
+
+        // Everything goes to the ring while the I/O thread opens the file, it takes the file over under the lock
+        if (opening) {
+            std::lock_guard<std::mutex> lck(handoffMtx);
+            if (opening) {
+                pushRing(frames, count);
+                return;
+            }
+        }
+
+        if (writer) {
+            writer->write((float*)frames, count);
+            if (!open && closedFrames >= hangFrames) { closeFile(); }
+        }
+
+        pushRing(frames, count);
+    }
+
+    void pushRing(const float* frames, int count) {
+        // Only the end of a block larger than the ring is kept
+        uint64_t pos = ringWritten;
+        if (count > ringFrames) {
+            frames += (count - ringFrames) * channels;
+            pos += count - ringFrames;
+            count = ringFrames;
+        }
+        int start = pos % ringFrames;
+        int first = std::min<int>(count, ringFrames - start);
+        memcpy(&ring[start * channels], frames, first * channels * sizeof(float));
+        memcpy(ring, &frames[first * channels], (count - first) * channels * sizeof(float));
+        ringWritten = pos + count;
+    }
+
+    void requestOpen() {
+        // The I/O thread starts reading at the pre-roll
+        uint64_t written = ringWritten;
+        ringRead = written - std::min<uint64_t>(written, preRollFrames);
+        openFreq = gui::waterfall.getCenterFrequency() + (vfo ? vfo->getOffset() : 0.0);
+        opening = true;
+        io->run(openHandler, this);
+    }
+
+    static void openHandler(void* ctx) {
+        TriggeredChannel* _this = (TriggeredChannel*)ctx;
+        _this->openFile();
+    }
+
+    // Called by the I/O thread
+    void openFile() {
+        // Name the file after the channel, two transmissions in the same second get a suffix
+        std::string base = settings.folder + "/" + formatFileName(settings.nameTemplate, settings.baseband ? "baseband" : "audio", openFreq, modeStr) + "_" + name;
+        std::string path = base + ".wav";
+        for (int i = 1; std::filesystem::exists(path); i++) {
+            path = base + "_" + std::to_string(i) + ".wav";
+        }
+
+        // The ring is drained without dropping anything, the DSP thread writes without blocking once it has the file
+        wav::Writer* w = new wav::Writer(channels, samplerate, wav::FORMAT_WAV, settings.sampleType, engine);
+        w->setBuffering(TRIGGERED_BLOCK_SIZE, TRIGGERED_BLOCK_COUNT);
+        w->setPreallocation(0);
+        w->setBlocking(true);
+        if (!w->open(path)) {
+            flog::error("Failed to open file for recording: {0}", path);
+            delete w;
+            std::lock_guard<std::mutex> lck(handoffMtx);
+            openFailed = true;
+            opening = false;
+            return;
+        }
+
+        // Catch up with the DSP thread, only the last bit is written with it waiting on the lock
+        while (ringWritten - ringRead > TRIGGERED_CHUNK_SIZE) {
+            drainRing(w, ringWritten);
+        }
+        std::lock_guard<std::mutex> lck(handoffMtx);
+        drainRing(w, ringWritten);
+        w->setBlocking(false);
+        writer = w;
+        fileCount++;
+        recording = true;
+        opening = false;
+    }
+
+    void drainRing(wav::Writer* w, uint64_t end) {
+        // The DSP thread overwrote what wasn't read yet if opening took longer than the margin
+        if (end - ringRead > ringFrames) {
+            flog::warn("Opening a triggered recording of '{0}' took too long, samples were lost", name);
+            ringRead = end - ringFrames;
+        }
+        int start = ringRead % ringFrames;
+        int count = end - ringRead;
+        int first = std::min<int>(count, ringFrames - start);
+        w->write(&ring[start * channels], first);
+        w->write(ring, count - first);
+        ringRead = end;
+    }
+
+    void closeFile() {
+        if (!writer) { return; }
+        io->close(writer);
+        writer = NULL;
+        recording = false;
+    }
+
+    std::string name;
+    std::string mirrorName;
+    std::string modeStr;
+    TriggerSettings settings;
+    async_io::Engine* engine;
+    TriggeredIO* io;
+    bool running = false;
+
+    double samplerate = 0.0;
+    int channels = 2;
+
+    // Open state of the squelch of the radio, NULL when not a radio
+    const std::atomic<bool>* squelchState = NULL;
+
+    // Audio input
+    dsp::stream<dsp::stereo_t>* audioStream = NULL;
+    dsp::sink::Handler<dsp::stereo_t> audioSink;
+    float* monoBuf = NULL;
+
+    // Baseband input
+    VFOManager::VFO* vfo = NULL;
+    dsp::channel::RxVFO* mirror = NULL;
+    dsp::sink::Handler<dsp::complex_t> iqSink;
+
+    // Pre-roll, written by the DSP thread and read by the I/O thread while a file is opened
+    float* ring = NULL;
+    int ringFrames = 0;
+    uint64_t preRollFrames = 0;
+    std::atomic<uint64_t> ringWritten = 0;
+    uint64_t ringRead = 0;
+
+    // Handing the new file over from the I/O thread to the DSP thread
+    std::mutex handoffMtx;
+    std::atomic<bool> opening = false;
+    std::atomic<bool> openFailed = false;
+    double openFreq = 0.0;
+
+    wav::Writer* writer = NULL;
+    uint64_t hangFrames = 0;
+    uint64_t closedFrames = 0;
+    std::atomic<bool> recording = false;
+    std::atomic<int> fileCount = 0;
+
+    static constexpr const char* modeNames[] = { "NFM", "WFM", "AM", "DSB", "USB", "CW", "LSB", "RAW" };
+};
+
+/**
+ * Set of triggered channels sharing one I/O thread, so that a large number of
+ * channels doesn't mean as many threads writing to the disk.
+ */
+class TriggeredRecorder {
+public:
+    TriggeredRecorder(std::string name) {
+        this->name = name;
+    }
+
+    ~TriggeredRecorder() {
+        stop();
+    }
+
+    void start(const TriggerSettings& settings, const std::vector<std::string>& channelNames) {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (running) { return; }
+        this->settings = settings;
+        engine = new async_io::Engine();
+        io = new TriggeredIO();
+        removedFiles = 0;
+        running = true;
+        for (const auto& chName : channelNames) {
+            addChannelLocked(chName);
+        }
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (!running) { return; }
+        for (auto& [chName, ch] : channels) {
+            delete ch;
+        }
+        channels.clear();
+
+        // The I/O thread finishes the pending files before the engine goes away
+        delete io;
+        io = NULL;
+        delete engine;
+        engine = NULL;
+        running = false;
+    }
+
+    bool isRunning() { return running; }
+
+    void addChannel(std::string chName) {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (!running) { return; }
+        addChannelLocked(chName);
+    }
+
+    void removeChannel(std::string chName) {
+        std::lock_guard<std::mutex> lck(mtx);
+        auto it = channels.find(chName);
+        if (it == channels.end()) { return; }
+        removedFiles += it->second->getFileCount();
+        delete it->second;
+        channels.erase(it);
+    }
+
+    int getChannelCount() {
+        std::lock_guard<std::mutex> lck(mtx);
+        return channels.size();
+    }
+
+    // Number of channels currently writing a file
+    int getActiveCount() {
+        std::lock_guard<std::mutex> lck(mtx);
+        int count = 0;
+        for (auto& [chName, ch] : channels) {
+            if (ch->isRecording()) { count++; }
+        }
+        return count;
+    }
+
+    int getFileCount() {
+        std::lock_guard<std::mutex> lck(mtx);
+        int count = removedFiles;
+        for (auto& [chName, ch] : channels) {
+            count += ch->getFileCount();
+        }
+        return count;
+    }
+
+private:
+    void addChannelLocked(std::string chName) {
+        if (channels.find(chName) != channels.end()) { return; }
+        TriggeredChannel* ch = new TriggeredChannel(chName, name, settings, engine, io);
+        if (!ch->start()) {
+            flog::warn("Could not start triggered recording of '{0}'", chName);
+            delete ch;
+            return;
+        }
+        channels[chName] = ch;
+    }
+
+    std::string name;
+    TriggerSettings settings;
+    std::mutex mtx;
+    bool running = false;
+    async_io::Engine* engine = NULL;
+    TriggeredIO* io = NULL;
+    std::map<std::string, TriggeredChannel*> channels;
+    int removedFiles = 0;
+};
@@ -308,12 +308,15 @@ private:
         SigctlServerModule* _this = (SigctlServerModule*)ctx;
         //flog::info("New client!");
 
+        // Only one client at a time, handlers run on the network event loop so others are turned away instead of waiting
+        if (_this->client && _this->client->isOpen()) {
+            _client->close();
+            _this->listener->acceptAsync(clientHandler, _this);
+            return;
+        }
         _this->client = std::move(_client);
+        _this->command.clear();
         _this->client->readAsync(1024, _this->dataBuf, dataHandler, _this, false);
-        _this->client->waitForEnd();
-        _this->client->close();
-
-        //flog::info("Client disconnected!");
 
         _this->listener->acceptAsync(clientHandler, _this);
     }
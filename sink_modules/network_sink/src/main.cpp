@@ -6,6 +6,7 @@
 #include <signal_path/sink.h>
 #include <dsp/buffer/packer.h>
 #include <dsp/convert/stereo_to_mono.h>
+#include <dsp/convert/pcm.h>
 #include <dsp/sink/handler_sink.h>
 #include <utils/flog.h>
 #include <config.h>
@@ -243,7 +244,7 @@ private:
         std::lock_guard lck(_this->connMtx);
         if (!_this->conn || !_this->conn->isOpen()) { return; }
 
-        volk_32f_s32f_convert_16i(_this->netBuf, (float*)samples, 32768.0f, count);
+        dsp::convert::pcm::floatToInt16(samples, _this->netBuf, count);
 
         _this->conn->write(count * sizeof(int16_t), (uint8_t*)_this->netBuf);
     }
@@ -253,7 +254,7 @@ private:
         std::lock_guard lck(_this->connMtx);
         if (!_this->conn || !_this->conn->isOpen()) { return; }
 
-        volk_32f_s32f_convert_16i(_this->netBuf, (float*)samples, 32768.0f, count * 2);
+        dsp::convert::pcm::floatToInt16((float*)samples, _this->netBuf, count * 2);
 
         _this->conn->write(count * 2 * sizeof(int16_t), (uint8_t*)_this->netBuf);
     }
@@ -261,16 +262,15 @@ private:
     static void clientHandler(net::Conn client, void* ctx) {
         NetworkSink* _this = (NetworkSink*)ctx;
 
+        // Only one client at a time, handlers run on the network event loop so others are turned away instead of waiting
         {
             std::lock_guard lck(_this->connMtx);
-            _this->conn = std::move(client);
-        }
-
-        if (_this->conn) {
-            _this->conn->waitForEnd();
-            _this->conn->close();
-        }
-        else {
+            if (_this->conn && _this->conn->isOpen()) {
+                client->close();
+            }
+            else {
+                _this->conn = std::move(client);
+            }
         }
 
         _this->listener->acceptAsync(clientHandler, _this);
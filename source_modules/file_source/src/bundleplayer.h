@@ -0,0 +1,235 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <volk/volk.h>
+#include <utils/bundle.h>
+#include <dsp/multirate/rational_resampler.h>
+#include <dsp/channel/frequency_xlator.h>
+
+// Output samples produced at once, the work buffers of each channel are sized after it
+#define BUNDLE_PLAYER_BLOCK         65536
+
+// The output rate is a multiple of this so that the resampling ratios stay simple
+#define BUNDLE_PLAYER_RATE_STEP     250000.0
+
+// Widest span of channels that can be replayed together
+#define BUNDLE_PLAYER_MAX_RATE      20000000.0
+
+/**
+ * Replays a subset of the channels of an IQ bundle as a single baseband. Each selected
+ * channel is resampled to a common rate and shifted back to its frequency around the
+ * middle of the span, so that every channel shows up where it was recorded and can be
+ * tuned to with a VFO like a live signal. Channels that were retuned while recording move
+ * with their retunes, the span covers every frequency they were at.
+ */
+class BundlePlayer {
+public:
+    BundlePlayer(std::string path) {
+        if (!reader.open(path)) { return; }
+        selected.resize(reader.getChannelCount(), true);
+        valid = configure();
+    }
+
+    ~BundlePlayer() {
+        freeChannels();
+        reader.close();
+    }
+
+    bool isValid() {
+        return valid;
+    }
+
+    int getChannelCount() {
+        return reader.getChannelCount();
+    }
+
+    const bundle::ChannelInfo& getChannel(int id) {
+        return reader.getChannel(id);
+    }
+
+    bool isSelected(int id) {
+        return selected[id];
+    }
+
+    /**
+     * Select the channels to replay. Not while playing.
+     * @return False if the selection can't be replayed, the previous selection is kept.
+     */
+    bool setSelected(int id, bool enabled) {
+        bool prev = selected[id];
+        selected[id] = enabled;
+        if (!configure()) {
+            selected[id] = prev;
+            configure();
+            return false;
+        }
+        return true;
+    }
+
+    double getSampleRate() {
+        return sampleRate;
+    }
+
+    double getCenterFrequency() {
+        return centerFreq;
+    }
+
+    // Length in output samples, the one of the longest selected channel
+    uint64_t getSampleCount() {
+        return sampleCount;
+    }
+
+    uint64_t tell() {
+        return position;
+    }
+
+    // Start over at the end instead of stopping
+    void setLoop(bool enabled) {
+        loop = enabled;
+    }
+
+    void seek(uint64_t sample) {
+        position = std::min<uint64_t>(sample, sampleCount);
+        for (auto& ch : channels) {
+            reader.seek(ch->id, (uint64_t)round((double)position * ch->inRate / sampleRate));
+            ch->resamp.reset();
+            ch->fill = 0;
+        }
+    }
+
+    /**
+     * Mix the selected channels.
+     * @param out Buffer to write the samples to.
+     * @param count Number of samples wanted.
+     * @return Number of samples written, 0 at the end.
+     */
+    int read(dsp::complex_t* out, int count) {
+        int done = 0;
+        while (done < count) {
+            if (position >= sampleCount) {
+                if (!loop || !sampleCount) { break; }
+                seek(0);
+            }
+            int n = std::min<int>(std::min<uint64_t>(count - done, sampleCount - position), BUNDLE_PLAYER_BLOCK);
+            memset(&out[done], 0, n * sizeof(dsp::complex_t));
+            for (auto& ch : channels) {
+                mixChannel(ch, &out[done], n);
+            }
+            done += n;
+            position += n;
+        }
+        return done;
+    }
+
+private:
+    struct Channel {
+        int id;
+        double inRate;
+        double frequency;
+        dsp::multirate::RationalResampler<dsp::complex_t> resamp;
+        dsp::channel::FrequencyXlator xlator;
+        dsp::complex_t* in = NULL;
+        dsp::complex_t* resampled = NULL;
+        int fill = 0;
+        int inSize = 0;
+    };
+
+    bool configure() {
+        // Span of the selected channels
+        double low = INFINITY;
+        double high = -INFINITY;
+        double maxRate = 0.0;
+        for (int i = 0; i < reader.getChannelCount(); i++) {
+            if (!selected[i]) { continue; }
+            const bundle::ChannelInfo& info = reader.getChannel(i);
+            double chLow, chHigh;
+            reader.getFrequencyRange(i, chLow, chHigh);
+            low = std::min<double>(low, chLow - info.sampleRate / 2.0);
+            high = std::max<double>(high, chHigh + info.sampleRate / 2.0);
+            maxRate = std::max<double>(maxRate, info.sampleRate);
+        }
+        if (maxRate <= 0.0) { return false; }
+
+        // Leave some room at the edges for the anti-imaging filters
+        double rate = ceil(std::max<double>((high - low) * 1.25, maxRate) / BUNDLE_PLAYER_RATE_STEP) * BUNDLE_PLAYER_RATE_STEP;
+        if (rate > BUNDLE_PLAYER_MAX_RATE) { return false; }
+
+        freeChannels();
+        sampleRate = rate;
+        centerFreq = (low + high) / 2.0;
+        sampleCount = 0;
+        for (int i = 0; i < reader.getChannelCount(); i++) {
+            if (!selected[i]) { continue; }
+            const bundle::ChannelInfo& info = reader.getChannel(i);
+            Channel* ch = new Channel;
+            ch->id = i;
+            ch->inRate = info.sampleRate;
+            ch->frequency = info.frequency;
+            ch->resamp.init(NULL, info.sampleRate, sampleRate);
+            ch->xlator.init(NULL, info.frequency - centerFreq, sampleRate);
+
+            // A block of input yields at most a block of output plus what one more sample can produce
+            double ratio = sampleRate / info.sampleRate;
+            ch->inSize = (BUNDLE_PLAYER_BLOCK / ratio) + 2;
+            ch->in = dsp::buffer::alloc<dsp::complex_t>(ch->inSize);
+            ch->resampled = dsp::buffer::alloc<dsp::complex_t>(BUNDLE_PLAYER_BLOCK * 2 + (int)ceil(ratio) * 4 + 64);
+            channels.push_back(ch);
+
+            sampleCount = std::max<uint64_t>(sampleCount, ceil((double)reader.getSampleCount(i) * ratio));
+        }
+        seek(0);
+        return true;
+    }
+
+    void mixChannel(Channel* ch, dsp::complex_t* out, int count) {
+        // Follow the retunes of the channel, close enough at the scale of a block
+        double frequency = reader.getFrequency(ch->id, reader.tell(ch->id));
+        if (frequency != ch->frequency) {
+            ch->frequency = frequency;
+            ch->xlator.setOffset(frequency - centerFreq, sampleRate);
+        }
+
+        // Resample until there's enough for the block, silence once the channel ended
+        while (ch->fill < count) {
+            double ratio = sampleRate / ch->inRate;
+            int want = std::clamp<int>(ceil((count - ch->fill) / ratio), 1, ch->inSize);
+            int read = reader.read(ch->id, ch->in, want);
+            if (!read) {
+                memset(&ch->resampled[ch->fill], 0, (count - ch->fill) * sizeof(dsp::complex_t));
+                ch->fill = count;
+                break;
+            }
+            ch->fill += ch->resamp.process(read, ch->in, &ch->resampled[ch->fill]);
+        }
+
+        // Shift to the frequency of the channel and add it
+        ch->xlator.process(count, ch->resampled, ch->resampled);
+        volk_32f_x2_add_32f((float*)out, (float*)out, (float*)ch->resampled, count * 2);
+
+        // Keep what's left for the next block
+        ch->fill -= count;
+        memmove(ch->resampled, &ch->resampled[count], ch->fill * sizeof(dsp::complex_t));
+    }
+
+    void freeChannels() {
+        for (auto& ch : channels) {
+            dsp::buffer::free(ch->in);
+            dsp::buffer::free(ch->resampled);
+            delete ch;
+        }
+        channels.clear();
+    }
+
+    bundle::Reader reader;
+    bool valid = false;
+    bool loop = true;
+    std::vector<bool> selected;
+    std::vector<Channel*> channels;
+    double sampleRate = 0.0;
+    double centerFreq = 0.0;
+    uint64_t sampleCount = 0;
+    uint64_t position = 0;
+};
@@ -3,18 +3,36 @@
 #include <utils/flog.h>
 #include <module.h>
 #include <gui/gui.h>
+#include <gui/style.h>
 #include <signal_path/signal_path.h>
 #include <wavreader.h>
+#include <sigmfreader.h>
+#include <bundleplayer.h>
+#include <utils/ziq.h>
+#include <dsp/convert/pcm.h>
 #include <core.h>
 #include <gui/widgets/file_select.h>
+#include <gui/widgets/folder_select.h>
+#include <gui/main_window.h>
+#include <utils/optionlist.h>
 #include <filesystem>
 #include <regex>
 #include <gui/tuner.h>
 #include <algorithm>
 #include <stdexcept>
+#include <atomic>
+#include <chrono>
 
 #define CONCAT(a, b) ((std::string(a) + b).c_str())
 
+// Silence sent after the end of the file when offline so that the last samples get through every block
+#define OFFLINE_DRAIN_TIME  0.5
+
+enum PlaybackMode {
+    PLAYBACK_MODE_REALTIME,
+    PLAYBACK_MODE_OFFLINE
+};
+
 SDRPP_MOD_INFO{
     /* Name:            */ "file_source",
     /* Description:     */ "Wav file source module for SDR++",
@@ -27,13 +45,26 @@ ConfigManager config;
 
 class FileSourceModule : public ModuleManager::Instance {
 public:
-    FileSourceModule(std::string name) : fileSelect("", { "Wav IQ Files (*.wav)", "*.wav", "All Files", "*" }) {
+    FileSourceModule(std::string name) : fileSelect("", { "Wav IQ Files (*.wav)", "*.wav", "Compressed IQ Files (*.ziq)", "*.ziq", "SigMF Recordings (*.sigmf-meta)", "*.sigmf-meta", "IQ Bundles (*.iqb)", "*.iqb", "All Files", "*" }), audioFolderSelect("%ROOT%/recordings") {
         this->name = name;
 
         if (core::args["server"].b()) { return; }
 
+        playbackModes.define("realtime", "Real-time", PLAYBACK_MODE_REALTIME);
+        playbackModes.define("offline", "As fast as possible", PLAYBACK_MODE_OFFLINE);
+        playbackModeId = playbackModes.valueId(PLAYBACK_MODE_REALTIME);
+
         config.acquire();
         fileSelect.setPath(config.conf["path"], true);
+        if (config.conf.contains("playbackMode") && playbackModes.keyExists(config.conf["playbackMode"])) {
+            playbackModeId = playbackModes.keyId(config.conf["playbackMode"]);
+        }
+        if (config.conf.contains("audioToFile")) {
+            audioToFile = config.conf["audioToFile"];
+        }
+        if (config.conf.contains("audioPath")) {
+            audioFolderSelect.setPath(config.conf["audioPath"]);
+        }
         config.release();
 
         handler.ctx = this;
@@ -90,21 +121,40 @@ private:
     static void start(void* ctx) {
         FileSourceModule* _this = (FileSourceModule*)ctx;
         if (_this->running) { return; }
-        if (_this->reader == NULL) { return; }
+        if (!_this->fileOpen()) { return; }
+
+        // Offline, the audio devices can't follow so the audio goes to files or nowhere
+        _this->offline = (_this->playbackModes[_this->playbackModeId] == PLAYBACK_MODE_OFFLINE);
+        if (_this->offline) {
+            bool toFile = _this->audioToFile && _this->audioFolderSelect.pathIsValid();
+            sigpath::sinkManager.setOffline(true, toFile ? _this->audioFolderSelect.expandString(_this->audioFolderSelect.path) : "");
+        }
+        if (_this->reader) { _this->reader->setLoop(!_this->offline); }
+        if (_this->sigmfReader) { _this->sigmfReader->setLoop(!_this->offline); }
+        if (_this->bundlePlayer) { _this->bundlePlayer->setLoop(!_this->offline); }
+
+        _this->finished = false;
+        _this->runStart = std::chrono::steady_clock::now();
+        _this->runStartPos = _this->playPos;
         _this->running = true;
-        _this->workerThread = _this->float32Mode ? std::thread(floatWorker, _this) : std::thread(worker, _this);
+        _this->workerThread = std::thread(worker, _this);
         flog::info("FileSourceModule '{0}': Start!", _this->name);
     }
 
     static void stop(void* ctx) {
         FileSourceModule* _this = (FileSourceModule*)ctx;
         if (!_this->running) { return; }
-        if (_this->reader == NULL) { return; }
+        if (!_this->fileOpen()) { return; }
         _this->stream.stopWriter();
         _this->workerThread.join();
         _this->stream.clearWriteStop();
         _this->running = false;
-        _this->reader->rewind();
+        _this->seekTarget = -1;
+        _this->seek(0);
+        if (_this->offline) {
+            sigpath::sinkManager.setOffline(false);
+            _this->offline = false;
+        }
         flog::info("FileSourceModule '{0}': Stop!", _this->name);
     }
 
@@ -116,28 +166,49 @@ private:
     static void menuHandler(void* ctx) {
         FileSourceModule* _this = (FileSourceModule*)ctx;
 
+        // The worker can't stop the source itself, stop once it has sent the whole file
+        if (_this->running && _this->finished) {
+            gui::mainWindow.setPlayState(false);
+        }
+
+        // Follow the captures of SigMF recordings, the tuning has to be done from the UI thread
+        if (_this->retunePending.exchange(false)) {
+            tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", _this->centerFreq);
+        }
+
         if (_this->fileSelect.render("##file_source_" + _this->name)) {
             if (_this->fileSelect.pathIsValid()) {
                 if (_this->reader != NULL) {
                     _this->reader->close();
                     delete _this->reader;
+                    _this->reader = NULL;
+                }
+                if (_this->ziqReader != NULL) {
+                    delete _this->ziqReader;
+                    _this->ziqReader = NULL;
+                }
+                if (_this->sigmfReader != NULL) {
+                    delete _this->sigmfReader;
+                    _this->sigmfReader = NULL;
+                }
+                if (_this->bundlePlayer != NULL) {
+                    delete _this->bundlePlayer;
+                    _this->bundlePlayer = NULL;
                 }
                 try {
-                    _this->reader = new WavReader(_this->fileSelect.path);
-                    if (_this->reader->getSampleRate() == 0) {
-                        _this->reader->close();
-                        delete _this->reader;
-                        _this->reader = NULL;
-                        throw std::runtime_error("Sample rate may not be zero");
+                    std::string ext = std::filesystem::path(_this->fileSelect.path).extension().string();
+                    if (ext == ".ziq") {
+                        _this->openCompressed(_this->fileSelect.path);
+                    }
+                    else if (ext == SIGMF_META_EXT || ext == SIGMF_DATA_EXT) {
+                        _this->openSigMF(_this->fileSelect.path);
+                    }
+                    else if (ext == BUNDLE_EXT) {
+                        _this->openBundle(_this->fileSelect.path);
+                    }
+                    else {
+                        _this->openWav(_this->fileSelect.path);
                     }
-                    _this->sampleRate = _this->reader->getSampleRate();
-                    core::setInputSampleRate(_this->sampleRate);
-                    std::string filename = std::filesystem::path(_this->fileSelect.path).filename().string();
-                    _this->centerFreq = _this->getFrequency(filename);
-                    tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", _this->centerFreq);
-                    //gui::freqSelect.minFreq = _this->centerFreq - (_this->sampleRate/2);
-                    //gui::freqSelect.maxFreq = _this->centerFreq + (_this->sampleRate/2);
-                    //gui::freqSelect.limitFreq = true;
                 }
                 catch (const std::exception& e) {
                     flog::error("Error: {}", e.what());
@@ -148,36 +219,376 @@ private:
             }
         }
 
+        // Timeline, seeks are done by the worker while running so that they happen between blocks
+        if (_this->fileOpen()) {
+            double length = (double)_this->getSampleCount() / _this->sampleRate;
+            double pos = (double)_this->playPos / _this->sampleRate;
+            double zero = 0.0;
+            char lenStr[32];
+            char timeStr[64];
+            formatTime(lenStr, length);
+            formatTime(timeStr, pos);
+            strcat(timeStr, " / ");
+            strcat(timeStr, lenStr);
+            ImGui::FillWidth();
+            if (ImGui::SliderScalar("##file_source_pos", ImGuiDataType_Double, &pos, &zero, &length, timeStr)) {
+                uint64_t sample = std::clamp<double>(pos, 0.0, length) * _this->sampleRate;
+                if (_this->running) {
+                    _this->seekTarget = sample;
+                }
+                else {
+                    _this->seek(sample);
+                }
+            }
+        }
+
+        // Offline progress
+        if (_this->running && _this->offline) {
+            double total = std::max<double>((double)_this->getSampleCount() - (double)_this->runStartPos, 1.0);
+            double done = (double)_this->playPos - (double)_this->runStartPos;
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _this->runStart).count();
+            char buf[64];
+            sprintf(buf, "%.0f%% (%.1fx real-time)", 100.0 * done / total, (elapsed > 0.0) ? (done / _this->sampleRate) / elapsed : 0.0);
+            ImGui::ProgressBar(std::clamp<float>(done / total, 0.0f, 1.0f), ImVec2(ImGui::GetContentRegionAvail().x, 0), buf);
+        }
+
+        if (_this->running) { style::beginDisabled(); }
+        ImGui::LeftLabel("Playback");
+        ImGui::FillWidth();
+        if (ImGui::Combo("##_file_source_playback", &_this->playbackModeId, _this->playbackModes.txt)) {
+            config.acquire();
+            config.conf["playbackMode"] = _this->playbackModes.key(_this->playbackModeId);
+            config.release(true);
+        }
+        if (_this->playbackModes[_this->playbackModeId] == PLAYBACK_MODE_OFFLINE) {
+            if (ImGui::Checkbox("Write audio to files##_file_source", &_this->audioToFile)) {
+                config.acquire();
+                config.conf["audioToFile"] = _this->audioToFile;
+                config.release(true);
+            }
+            if (_this->audioToFile && _this->audioFolderSelect.render("##_file_source_audio_path")) {
+                if (_this->audioFolderSelect.pathIsValid()) {
+                    config.acquire();
+                    config.conf["audioPath"] = _this->audioFolderSelect.path;
+                    config.release(true);
+                }
+            }
+        }
         ImGui::Checkbox("Float32 Mode##_file_source", &_this->float32Mode);
+        if (_this->bundlePlayer) { _this->bundleMenu(); }
+        if (_this->running) { style::endDisabled(); }
+    }
+
+    void bundleMenu() {
+        // The selected channels are mixed into one baseband, the rate depends on their span
+        ImGui::Text("Channels");
+        for (int i = 0; i < bundlePlayer->getChannelCount(); i++) {
+            const bundle::ChannelInfo& info = bundlePlayer->getChannel(i);
+            char label[128];
+            if (info.mode[0]) {
+                sprintf(label, "%s (%s, %.3lf MHz)##_file_source_ch_%d", info.name, info.mode, info.frequency / 1e6, i);
+            }
+            else {
+                sprintf(label, "%s (%.3lf MHz)##_file_source_ch_%d", info.name, info.frequency / 1e6, i);
+            }
+            bool sel = bundlePlayer->isSelected(i);
+            if (ImGui::Checkbox(label, &sel)) {
+                if (bundlePlayer->setSelected(i, sel)) {
+                    sampleRate = bundlePlayer->getSampleRate();
+                    centerFreq = bundlePlayer->getCenterFrequency();
+                    playPos = 0;
+                    core::setInputSampleRate(sampleRate);
+                    tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", centerFreq);
+                }
+                else {
+                    flog::error("The selected channels are too far apart to be replayed together");
+                }
+            }
+        }
+    }
+
+    static void formatTime(char* str, double seconds) {
+        uint64_t secs = seconds;
+        sprintf(str, "%02d:%02d:%02d", (int)(secs / 3600), (int)((secs / 60) % 60), (int)(secs % 60));
+    }
+
+    bool fileOpen() {
+        return reader || ziqReader || sigmfReader || bundlePlayer;
+    }
+
+    uint64_t getSampleCount() {
+        if (bundlePlayer) { return bundlePlayer->getSampleCount(); }
+        if (ziqReader) { return ziqReader->getSampleCount(); }
+        if (sigmfReader) { return sigmfReader->getSampleCount(); }
+        if (reader) { return reader->getSampleCount(); }
+        return 0;
+    }
+
+    void seek(uint64_t sample) {
+        if (bundlePlayer) {
+            bundlePlayer->seek(sample);
+        }
+        else if (ziqReader) {
+            ziqReader->seek(sample);
+        }
+        else if (sigmfReader) {
+            sigmfReader->seek(sample);
+        }
+        else if (reader) {
+            reader->seek(sample);
+        }
+        playPos = sample;
+    }
+
+    // Called by the worker between blocks, returns true if the position changed
+    bool applySeek() {
+        int64_t target = seekTarget.exchange(-1);
+        if (target < 0) { return false; }
+        seek(target);
+
+        // Drop what was buffered from the old position so the jump is heard immediately
+        sigpath::iqFrontEnd.flushInputBuffer();
+        return true;
+    }
+
+    uint64_t tell() {
+        if (bundlePlayer) { return bundlePlayer->tell(); }
+        if (ziqReader) { return ziqReader->tell(); }
+        if (sigmfReader) { return sigmfReader->tell(); }
+        if (reader) { return reader->tell(); }
+        return 0;
+    }
+
+    void openWav(std::string path) {
+        reader = new WavReader(path);
+        if (reader->getSampleRate() == 0) {
+            reader->close();
+            delete reader;
+            reader = NULL;
+            throw std::runtime_error("Sample rate may not be zero");
+        }
+        if (!reader->isValid()) {
+            delete reader;
+            reader = NULL;
+            throw std::runtime_error("Invalid, empty or unsupported WAV file");
+        }
+        if (reader->getChannelCount() != 2) {
+            delete reader;
+            reader = NULL;
+            throw std::runtime_error("WAV file must have two channels (I and Q)");
+        }
+        sampleRate = reader->getSampleRate();
+        playPos = 0;
+        core::setInputSampleRate(sampleRate);
+        std::string filename = std::filesystem::path(path).filename().string();
+        centerFreq = getFrequency(filename);
+        tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", centerFreq);
+        //gui::freqSelect.minFreq = centerFreq - (sampleRate/2);
+        //gui::freqSelect.maxFreq = centerFreq + (sampleRate/2);
+        //gui::freqSelect.limitFreq = true;
+    }
+
+    void openCompressed(std::string path) {
+        ziqReader = new ziq::Reader();
+        if (!ziqReader->open(path)) {
+            delete ziqReader;
+            ziqReader = NULL;
+            throw std::runtime_error("Invalid compressed IQ file");
+        }
+
+        // The header has the exact tuning, no need to guess it from the name
+        sampleRate = ziqReader->getSampleRate();
+        playPos = 0;
+        core::setInputSampleRate(sampleRate);
+        centerFreq = ziqReader->getCenterFrequency();
+        tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", centerFreq);
+    }
+
+    void openSigMF(std::string path) {
+        sigmfReader = new SigMFReader(path);
+        if (!sigmfReader->isValid()) {
+            delete sigmfReader;
+            sigmfReader = NULL;
+            throw std::runtime_error("Invalid or unsupported SigMF recording");
+        }
+
+        // The metadata has the exact tuning of each capture
+        sampleRate = sigmfReader->getSampleRate();
+        playPos = 0;
+        core::setInputSampleRate(sampleRate);
+        centerFreq = sigmfReader->getFrequency();
+        tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", centerFreq);
+    }
+
+    void openBundle(std::string path) {
+        bundlePlayer = new BundlePlayer(path);
+        if (!bundlePlayer->isValid()) {
+            delete bundlePlayer;
+            bundlePlayer = NULL;
+            throw std::runtime_error("Invalid IQ bundle or channels too far apart");
+        }
+
+        // The rate and the tuning follow the selected channels
+        sampleRate = bundlePlayer->getSampleRate();
+        playPos = 0;
+        core::setInputSampleRate(sampleRate);
+        centerFreq = bundlePlayer->getCenterFrequency();
+        tuner::tune(tuner::TUNER_MODE_IQ_ONLY, "", centerFreq);
     }
 
     static void worker(void* ctx) {
         FileSourceModule* _this = (FileSourceModule*)ctx;
-        double sampleRate = std::max(_this->reader->getSampleRate(), (uint32_t)1);
-        int blockSize = std::min((int)(sampleRate / 200.0f), (int)STREAM_BUFFER_SIZE);
-        int16_t* inBuf = new int16_t[blockSize * 2];
+        double sampleRate = std::max<double>(_this->sampleRate, 1.0);
+        int blockSize = std::max<int>(std::min((int)(sampleRate / 200.0), (int)STREAM_BUFFER_SIZE), 1);
+
+        // Real-time playback is paced by the clock, offline playback only by the DSP
+        auto start = std::chrono::steady_clock::now();
+        uint64_t sent = 0;
 
         while (true) {
-            _this->reader->readSamples(inBuf, blockSize * 2 * sizeof(int16_t));
-            volk_16i_s32f_convert_32f((float*)_this->stream.writeBuf, inBuf, 32768.0f, blockSize * 2);
-            if (!_this->stream.swap(blockSize)) { break; };
+            if (_this->applySeek()) {
+                start = std::chrono::steady_clock::now();
+                sent = 0;
+            }
+
+            int count;
+            if (_this->bundlePlayer) {
+                count = _this->bundlePlayer->read(_this->stream.writeBuf, blockSize);
+            }
+            else if (_this->ziqReader) {
+                count = _this->readCompressed(blockSize);
+            }
+            else if (_this->sigmfReader) {
+                count = _this->readSigMF(blockSize);
+            }
+            else if (_this->reader->isFloat() || (_this->float32Mode && _this->reader->getBitDepth() == 32)) {
+                count = _this->readFloat32(blockSize);
+            }
+            else {
+                count = _this->readPCM(blockSize);
+            }
+
+            if (!count) {
+                // The whole file was sent
+                if (_this->offline) { break; }
+
+                // Send silence if nothing can be read at all
+                memset(_this->stream.writeBuf, 0, blockSize * sizeof(dsp::complex_t));
+                count = blockSize;
+            }
+
+            _this->playPos = _this->tell();
+            if (!_this->stream.swap(count)) { return; }
+
+            if (!_this->offline) {
+                sent += count;
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((double)sent / sampleRate)));
+            }
+        }
+
+        // Push the last samples through the whole chain before telling the decoders it's over
+        int drainBlocks = std::max<int>((OFFLINE_DRAIN_TIME * sampleRate) / blockSize, 1);
+        for (int i = 0; i < drainBlocks; i++) {
+            memset(_this->stream.writeBuf, 0, blockSize * sizeof(dsp::complex_t));
+            if (!_this->stream.swap(blockSize)) { return; }
         }
+        sigpath::sourceManager.signalEndOfStream();
+        _this->finished = true;
+    }
 
-        delete[] inBuf;
+    int readPCM(int blockSize) {
+        // Convert straight out of the mapping, a block may wrap around the end of the file.
+        // The reader only accepts 8, 16, 24 and 32 bit PCM.
+        int sampSize = reader->getBitDepth() / 8;
+        int count = 0;
+        while (count < blockSize) {
+            size_t len;
+            const uint8_t* data = reader->readMapped((blockSize - count) * 2 * sampSize, len);
+            if (!data) { break; }
+            int n = len / (2 * sampSize);
+            float* out = (float*)&stream.writeBuf[count];
+            switch (sampSize) {
+            case 1:
+                dsp::convert::pcm::uint8ToFloat(data, out, n * 2);
+                break;
+            case 2:
+                dsp::convert::pcm::int16ToFloat((const int16_t*)data, out, n * 2);
+                break;
+            case 3:
+                dsp::convert::pcm::int24ToFloat(data, out, n * 2);
+                break;
+            case 4:
+                dsp::convert::pcm::int32ToFloat((const int32_t*)data, out, n * 2);
+                break;
+            }
+            count += n;
+        }
+        return count;
     }
 
-    static void floatWorker(void* ctx) {
-        FileSourceModule* _this = (FileSourceModule*)ctx;
-        double sampleRate = std::max(_this->reader->getSampleRate(), (uint32_t)1);
-        int blockSize = std::min((int)(sampleRate / 200.0f), (int)STREAM_BUFFER_SIZE);
-        dsp::complex_t* inBuf = new dsp::complex_t[blockSize];
+    int readFloat32(int blockSize) {
+        int count = 0;
+        while (count < blockSize) {
+            size_t len;
+            const uint8_t* data = reader->readMapped((blockSize - count) * sizeof(dsp::complex_t), len);
+            if (!data) { break; }
+            int n = len / sizeof(dsp::complex_t);
+            memcpy(&stream.writeBuf[count], data, n * sizeof(dsp::complex_t));
+            count += n;
+        }
+        return count;
+    }
 
-        while (true) {
-            _this->reader->readSamples(_this->stream.writeBuf, blockSize * sizeof(dsp::complex_t));
-            if (!_this->stream.swap(blockSize)) { break; };
+    int readSigMF(int blockSize) {
+        // Blocks end at the capture boundaries, the frequency of a block is the one of its first sample
+        double freq = sigmfReader->getFrequency();
+        if (freq != centerFreq) {
+            centerFreq = freq;
+            retunePending = true;
+        }
+
+        int frameSize = sigmf::sampleSize(sigmfReader->getDataType());
+        size_t len;
+        const uint8_t* data = sigmfReader->readMapped(blockSize * frameSize, len);
+        if (!data) { return 0; }
+        int count = len / frameSize;
+
+        // Convert straight out of the mapping
+        switch (sigmfReader->getDataType()) {
+        case sigmf::DATA_TYPE_CU8:
+            dsp::convert::pcm::uint8ToFloat(data, (float*)stream.writeBuf, count * 2, 127.5f, 128.0f);
+            break;
+        case sigmf::DATA_TYPE_CI8:
+            dsp::convert::pcm::int8ToFloat((const int8_t*)data, (float*)stream.writeBuf, count * 2, 128.0f);
+            break;
+        case sigmf::DATA_TYPE_CI16_LE:
+            dsp::convert::pcm::int16ToFloat((const int16_t*)data, (float*)stream.writeBuf, count * 2, 32768.0f);
+            break;
+        case sigmf::DATA_TYPE_CF32_LE:
+            memcpy(stream.writeBuf, data, count * sizeof(dsp::complex_t));
+            break;
+        default:
+            return 0;
         }
+        return count;
+    }
 
-        delete[] inBuf;
+    int readCompressed(int blockSize) {
+        // Decode straight into the stream, looping back to the start at the end of the file unless offline
+        int count = 0;
+        bool looped = false;
+        while (count < blockSize) {
+            int read = ziqReader->read(&stream.writeBuf[count], blockSize - count);
+            if (read) {
+                count += read;
+                looped = false;
+                continue;
+            }
+            if (looped || offline) { break; }
+            ziqReader->seek(0);
+            looped = true;
+        }
+        return count;
     }
 
     double getFrequency(std::string filename) {
@@ -194,6 +605,22 @@ private:
     dsp::stream<dsp::complex_t> stream;
     SourceManager::SourceHandler handler;
     WavReader* reader = NULL;
+    ziq::Reader* ziqReader = NULL;
+    SigMFReader* sigmfReader = NULL;
+    BundlePlayer* bundlePlayer = NULL;
+    std::atomic<bool> retunePending = false;
+    std::atomic<uint64_t> playPos = 0;
+    std::atomic<int64_t> seekTarget = -1;
+
+    // Offline processing
+    OptionList<std::string, PlaybackMode> playbackModes;
+    int playbackModeId;
+    bool audioToFile = false;
+    FolderSelect audioFolderSelect;
+    bool offline = false;
+    std::atomic<bool> finished = false;
+    std::chrono::steady_clock::time_point runStart;
+    uint64_t runStartPos = 0;
     bool running = false;
     bool enabled = true;
     float sampleRate = 1000000;
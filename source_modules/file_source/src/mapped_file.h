@@ -0,0 +1,181 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Alignment of the mapped window, the allocation granularity on Windows and a multiple of the page size elsewhere
+#define MAPPED_FILE_ALIGNMENT   65536
+
+// Size of the mapped window when the address space is too small to map the whole file
+#define MAPPED_FILE_WINDOW_32   (256*1024*1024)
+
+// Amount of data the OS is asked to read ahead of the playback position
+#define MAPPED_FILE_READ_AHEAD  (16*1024*1024)
+
+/**
+ * Read-only memory mapping of a file, so that samples can be converted without an
+ * intermediate copy and any position can be reached instantly. 64bit systems map
+ * the whole file, others a sliding window.
+ */
+class MappedFile {
+public:
+    MappedFile() {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(std::string path) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) { return false; }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(fileHandle, &size) || !size.QuadPart) {
+            close();
+            return false;
+        }
+        fileSize = size.QuadPart;
+        mapping = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            close();
+            return false;
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { return false; }
+        struct stat st;
+        if (fstat(fd, &st) || !st.st_size) {
+            close();
+            return false;
+        }
+        fileSize = st.st_size;
+#endif
+
+        // Map the whole file if the address space allows it
+        windowSize = (sizeof(void*) >= 8) ? fileSize : MAPPED_FILE_WINDOW_32;
+        if (!mapWindow(0)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool isOpen() {
+        return mapBase != NULL;
+    }
+
+    uint64_t getSize() {
+        return fileSize;
+    }
+
+    /**
+     * Get the data at a position of the file, moving the window if needed.
+     * @param pos Position in the file.
+     * @param maxBytes Maximum number of bytes wanted.
+     * @param len Number of bytes available at the returned pointer, can be less than asked near the end of the window.
+     * @return Pointer to the data, valid until the next call. NULL if the data can't be mapped.
+     */
+    const uint8_t* get(uint64_t pos, size_t maxBytes, size_t& len) {
+        len = 0;
+        if (!mapBase || pos >= fileSize) { return NULL; }
+        uint64_t end = std::min<uint64_t>(pos + maxBytes, fileSize);
+        if (pos < mapOffset || end > mapOffset + mapLen) {
+            if (!mapWindow(pos)) { return NULL; }
+        }
+        len = std::min<uint64_t>(end, mapOffset + mapLen) - pos;
+        readAhead(pos + len);
+        return &mapBase[pos - mapOffset];
+    }
+
+    // Forget the read ahead state after a jump
+    void resetReadAhead() {
+        advisedEnd = 0;
+    }
+
+    void close() {
+        unmapWindow();
+#ifdef _WIN32
+        if (mapping) {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+            fileHandle = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+        fileSize = 0;
+    }
+
+private:
+    bool mapWindow(uint64_t pos) {
+        unmapWindow();
+        mapOffset = pos - (pos % MAPPED_FILE_ALIGNMENT);
+        mapLen = std::min<uint64_t>(windowSize, fileSize - mapOffset);
+        advisedEnd = 0;
+#ifdef _WIN32
+        mapBase = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(mapOffset >> 32), (DWORD)mapOffset, mapLen);
+        if (!mapBase) { return false; }
+#else
+        void* ptr = mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fd, mapOffset);
+        if (ptr == MAP_FAILED) { return false; }
+        mapBase = (uint8_t*)ptr;
+
+        // Playback is mostly sequential, let the kernel read ahead aggressively
+        madvise(mapBase, mapLen, MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    void unmapWindow() {
+        if (!mapBase) { return; }
+#ifdef _WIN32
+        UnmapViewOfFile(mapBase);
+#else
+        munmap(mapBase, mapLen);
+#endif
+        mapBase = NULL;
+        mapLen = 0;
+    }
+
+    void readAhead(uint64_t pos) {
+#ifndef _WIN32
+        // Request the next part of the file in advance, a few times per read ahead window
+        if (pos + (MAPPED_FILE_READ_AHEAD / 2) < advisedEnd) { return; }
+        uint64_t start = std::max<uint64_t>(pos, advisedEnd);
+        uint64_t end = std::min<uint64_t>(pos + MAPPED_FILE_READ_AHEAD, mapOffset + mapLen);
+        if (start >= end) { return; }
+        uint64_t pageStart = start - ((start - mapOffset) % MAPPED_FILE_ALIGNMENT);
+        madvise(&mapBase[pageStart - mapOffset], end - pageStart, MADV_WILLNEED);
+        advisedEnd = end;
+#endif
+    }
+
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+    uint64_t fileSize = 0;
+    uint64_t windowSize = 0;
+    uint8_t* mapBase = NULL;
+    uint64_t mapOffset = 0;
+    uint64_t mapLen = 0;
+    uint64_t advisedEnd = 0;
+};
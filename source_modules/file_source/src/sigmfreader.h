@@ -0,0 +1,125 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utils/sigmf.h>
+#include "mapped_file.h"
+
+/**
+ * Reads the samples of a SigMF recording straight out of a memory mapping. Each capture
+ * can have its own center frequency, reads stop at the capture boundaries so that the
+ * frequency can be changed between blocks.
+ */
+class SigMFReader {
+public:
+    SigMFReader(std::string path) {
+        std::string base = sigmf::basePath(path);
+        if (!sigmf::loadMetadata(base + SIGMF_META_EXT, meta)) { return; }
+        frameSize = sigmf::sampleSize(meta.dataType);
+        if (!frameSize || meta.sampleRate <= 0.0) { return; }
+        if (!mapped.open(base + SIGMF_DATA_EXT)) { return; }
+
+        // Locate the captures in the data file, header bytes add up from one capture to the next
+        uint64_t headerBytes = 0;
+        for (const auto& cap : meta.captures) {
+            headerBytes += cap.headerBytes;
+            captureOffsets.push_back(cap.sampleStart * frameSize + headerBytes);
+        }
+        if (captureOffsets.back() >= mapped.getSize()) { return; }
+        sampleCount = meta.captures.back().sampleStart + (mapped.getSize() - captureOffsets.back()) / frameSize;
+
+        valid = true;
+    }
+
+    ~SigMFReader() {
+        close();
+    }
+
+    bool isValid() {
+        return valid;
+    }
+
+    double getSampleRate() {
+        return meta.sampleRate;
+    }
+
+    sigmf::DataType getDataType() {
+        return meta.dataType;
+    }
+
+    uint64_t getSampleCount() {
+        return sampleCount;
+    }
+
+    // Sample that will be returned next
+    uint64_t tell() {
+        return position;
+    }
+
+    // Center frequency of the capture containing the next sample
+    double getFrequency() {
+        return meta.captures[captureId].frequency;
+    }
+
+    // Start over at the end of the data instead of stopping
+    void setLoop(bool enabled) {
+        loop = enabled;
+    }
+
+    void seek(uint64_t sample) {
+        position = std::min<uint64_t>(sample, sampleCount);
+        captureId = findCapture(position);
+        mapped.resetReadAhead();
+    }
+
+    /**
+     * Get the samples at the current position directly from the mapping and move past them.
+     * Never crosses a capture boundary. Loops back to the start at the end of the data if enabled.
+     * @param maxBytes Maximum number of bytes wanted.
+     * @param len Number of bytes available at the returned pointer, a multiple of the sample size.
+     * @return Pointer to the samples, valid until the next call. NULL at the end or if the data can't be mapped.
+     */
+    const uint8_t* readMapped(size_t maxBytes, size_t& len) {
+        len = 0;
+        if (!valid) { return NULL; }
+        if (position >= sampleCount) {
+            if (!loop) { return NULL; }
+            seek(0);
+        }
+
+        // Stop at the end of the capture
+        uint64_t end = (captureId + 1 < (int)meta.captures.size()) ? meta.captures[captureId + 1].sampleStart : sampleCount;
+        uint64_t count = std::min<uint64_t>(maxBytes / frameSize, end - position);
+        const sigmf::Capture& cap = meta.captures[captureId];
+        const uint8_t* data = mapped.get(captureOffsets[captureId] + (position - cap.sampleStart) * frameSize, count * frameSize, len);
+        len -= len % frameSize;
+        if (!data || !len) { return NULL; }
+
+        position += len / frameSize;
+        if (position >= end && captureId + 1 < (int)meta.captures.size()) { captureId++; }
+        return data;
+    }
+
+    void close() {
+        mapped.close();
+        valid = false;
+    }
+
+private:
+    int findCapture(uint64_t sample) {
+        auto it = std::upper_bound(meta.captures.begin(), meta.captures.end(), sample, [](uint64_t s, const sigmf::Capture& cap) { return s < cap.sampleStart; });
+        return std::max<int>((it - meta.captures.begin()) - 1, 0);
+    }
+
+    bool valid = false;
+    bool loop = true;
+    sigmf::Metadata meta;
+    std::vector<uint64_t> captureOffsets;
+    int frameSize = 0;
+    uint64_t sampleCount = 0;
+    uint64_t position = 0;
+    int captureId = 0;
+
+    MappedFile mapped;
+};
@@ -1,31 +1,117 @@
-#pragma once
-
 #pragma once
 #include <stdint.h>
 #include <string.h>
 #include <fstream>
+#include <algorithm>
+#include "mapped_file.h"
 
 #define WAV_SIGNATURE       "RIFF"
+#define RF64_SIGNATURE      "RF64"
 #define WAV_TYPE            "WAVE"
 #define WAV_FORMAT_MARK     "fmt "
 #define WAV_DATA_MARK       "data"
+#define WAV_DS64_MARK       "ds64"
 #define WAV_SAMPLE_TYPE_PCM 1
+#define WAV_SAMPLE_TYPE_FLOAT 3
+#define WAV_SAMPLE_TYPE_EXTENSIBLE 0xFFFE
+#define WAV_SIZE_IN_DS64    0xFFFFFFFF
 
+/**
+ * Reads the samples of a WAV or RF64 file straight out of a memory mapping, so that
+ * they can be converted without an intermediate copy and any position can be reached
+ * instantly.
+ */
 class WavReader {
 public:
     WavReader(std::string path) {
-        file = std::ifstream(path.c_str(), std::ios::binary);
-        file.read((char*)&hdr, sizeof(WavHeader_t));
+        std::ifstream file(path.c_str(), std::ios::binary);
         valid = false;
-        if (memcmp(hdr.signature, "RIFF", 4) != 0) { return; }
-        if (memcmp(hdr.fileType, "WAVE", 4) != 0) { return; }
+
+        // Get the file size to validate the chunk sizes
+        file.seekg(0, std::ios::end);
+        fileSize = file.tellg();
+        file.seekg(0);
+
+        // Check the RIFF header, RF64 files keep their large sizes in a ds64 chunk
+        RIFFHeader_t riff;
+        file.read((char*)&riff, sizeof(RIFFHeader_t));
+        if (!file) { return; }
+        bool rf64 = !memcmp(riff.signature, RF64_SIGNATURE, 4);
+        if (memcmp(riff.signature, WAV_SIGNATURE, 4) && !rf64) { return; }
+        if (memcmp(riff.fileType, WAV_TYPE, 4)) { return; }
+
+        // Walk the chunks until the data chunk
+        uint64_t ds64DataSize = 0;
+        bool gotFormat = false;
+        while (true) {
+            ChunkHeader_t chunk;
+            file.read((char*)&chunk, sizeof(ChunkHeader_t));
+            if (!file) { return; }
+            uint64_t pos = file.tellg();
+
+            if (!memcmp(chunk.id, WAV_DS64_MARK, 4)) {
+                DS64Chunk_t ds64;
+                file.read((char*)&ds64, sizeof(DS64Chunk_t));
+                ds64DataSize = ds64.dataSize;
+            }
+            else if (!memcmp(chunk.id, WAV_FORMAT_MARK, 4)) {
+                file.read((char*)&hdr, sizeof(FormatHeader_t));
+
+                // Extensible formats keep the actual codec in the first two bytes of the sub-format GUID
+                if (hdr.sampleType == WAV_SAMPLE_TYPE_EXTENSIBLE && chunk.size >= sizeof(FormatHeader_t) + sizeof(FormatExtension_t)) {
+                    FormatExtension_t ext;
+                    file.read((char*)&ext, sizeof(FormatExtension_t));
+                    memcpy(&hdr.sampleType, ext.subFormat, sizeof(uint16_t));
+                }
+                gotFormat = true;
+            }
+            else if (!memcmp(chunk.id, WAV_DATA_MARK, 4)) {
+                if (!gotFormat) { return; }
+                dataStart = pos;
+                dataSize = (rf64 && chunk.size == WAV_SIZE_IN_DS64) ? ds64DataSize : chunk.size;
+
+                // An unfinished recording has no size yet, play it until the end
+                if (!dataSize || dataStart + dataSize > fileSize) { dataSize = fileSize - dataStart; }
+                break;
+            }
+
+            // Skip to the next chunk, chunks are word aligned
+            file.seekg(pos + chunk.size + (chunk.size & 1));
+        }
+        file.close();
+
+        // Only integer PCM of 8 to 32 bits and 32 bit float samples can be converted
+        bool pcm = (hdr.sampleType == WAV_SAMPLE_TYPE_PCM && (hdr.bitDepth == 8 || hdr.bitDepth == 16 || hdr.bitDepth == 24 || hdr.bitDepth == 32));
+        bool fp = (hdr.sampleType == WAV_SAMPLE_TYPE_FLOAT && hdr.bitDepth == 32);
+        if ((!pcm && !fp) || !hdr.channelCount) { return; }
+
+        // Only whole frames can be played
+        frameSize = std::max<int>((hdr.channelCount * hdr.bitDepth) / 8, 1);
+        dataSize -= dataSize % frameSize;
+        if (!dataSize) { return; }
+
+        if (!mapped.open(path)) { return; }
+        if (dataStart + dataSize > mapped.getSize()) {
+            mapped.close();
+            return;
+        }
+
         valid = true;
     }
 
+    ~WavReader() {
+        close();
+    }
+
     uint16_t getBitDepth() {
         return hdr.bitDepth;
     }
 
+    // The samples are 32 bit floats instead of integers
+    bool isFloat() {
+        return hdr.sampleType == WAV_SAMPLE_TYPE_FLOAT;
+    }
+
     uint16_t getChannelCount() {
         return hdr.channelCount;
     }
@@ -38,45 +124,102 @@ public:
         return valid;
     }
 
-    void readSamples(void* data, size_t size) {
-        char* _data = (char*)data;
-        file.read(_data, size);
-        int read = file.gcount();
-        if (read < size) {
-            file.clear();
-            file.seekg(sizeof(WavHeader_t));
-            file.read(&_data[read], size - read);
+    // Number of frames (one sample of every channel) in the file
+    uint64_t getSampleCount() {
+        return dataSize / frameSize;
+    }
+
+    // Frame that will be returned next
+    uint64_t tell() {
+        return dataPos / frameSize;
+    }
+
+    // Start over at the end of the data instead of stopping
+    void setLoop(bool enabled) {
+        loop = enabled;
+    }
+
+    // Go to any frame, nothing is read until the samples are needed
+    void seek(uint64_t sample) {
+        dataPos = std::min<uint64_t>(sample, getSampleCount()) * frameSize;
+        mapped.resetReadAhead();
+    }
+
+    /**
+     * Get the samples at the current position directly from the mapping and move past them.
+     * Loops back to the start at the end of the data if enabled.
+     * @param maxBytes Maximum number of bytes wanted, a multiple of the frame size.
+     * @param len Number of bytes available at the returned pointer, a multiple of the frame size.
+     * @return Pointer to the samples, valid until the next call. NULL at the end or if the data can't be mapped.
+     */
+    const uint8_t* readMapped(size_t maxBytes, size_t& len) {
+        len = 0;
+        if (!valid) { return NULL; }
+        if (dataPos >= dataSize) {
+            if (!loop) { return NULL; }
+            dataPos = 0;
         }
-        bytesRead += size;
+
+        const uint8_t* data = mapped.get(dataStart + dataPos, std::min<uint64_t>(maxBytes, dataSize - dataPos), len);
+        len -= len % frameSize;
+        if (!data || !len) { return NULL; }
+        dataPos += len;
+        return data;
     }
 
     void rewind() {
-        file.seekg(sizeof(WavHeader_t));
+        seek(0);
     }
 
     void close() {
-        file.close();
+        mapped.close();
+        valid = false;
     }
 
 private:
-    struct WavHeader_t {
-        char signature[4];           // "RIFF"
-        uint32_t fileSize;           // data bytes + sizeof(WavHeader_t) - 8
+#pragma pack(push, 1)
+    struct RIFFHeader_t {
+        char signature[4];           // "RIFF" or "RF64"
+        uint32_t fileSize;           // File size - 8, all ones for RF64
         char fileType[4];            // "WAVE"
-        char formatMarker[4];        // "fmt "
-        uint32_t formatHeaderLength; // Always 16
-        uint16_t sampleType;         // PCM (1)
+    };
+
+    struct ChunkHeader_t {
+        char id[4];
+        uint32_t size;
+    };
+
+    struct DS64Chunk_t {
+        uint64_t riffSize;
+        uint64_t dataSize;
+        uint64_t sampleCount;
+    };
+
+    struct FormatHeader_t {
+        uint16_t sampleType;         // PCM (1), float (3) or extensible (0xFFFE)
         uint16_t channelCount;
         uint32_t sampleRate;
         uint32_t bytesPerSecond;
         uint16_t bytesPerSample;
         uint16_t bitDepth;
-        char dataMarker[4]; // "data"
-        uint32_t dataSize;
     };
 
+    struct FormatExtension_t {
+        uint16_t extensionSize;
+        uint16_t validBits;
+        uint32_t channelMask;
+        uint8_t subFormat[16];
+    };
+#pragma pack(pop)
+
     bool valid = false;
-    std::ifstream file;
-    size_t bytesRead = 0;
-    WavHeader_t hdr;
-};
\ No newline at end of file
+    bool loop = true;
+    uint64_t fileSize = 0;
+    uint64_t dataStart = 0;
+    uint64_t dataSize = 0;
+    uint64_t dataPos = 0;
+    int frameSize = 1;
+    FormatHeader_t hdr = {};
+
+    MappedFile mapped;
+};
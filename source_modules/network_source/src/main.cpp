@@ -9,6 +9,7 @@
 #include <gui/smgui.h>
 #include <gui/widgets/stepped_slider.h>
 #include <utils/optionlist.h>
+#include "udp_receiver.h"
 
 #define CONCAT(a, b) ((std::string(a) + b).c_str())
 
@@ -105,6 +106,9 @@ public:
             port = config.conf[name]["port"];
             port = std::clamp<int>(port, 1, 65535);
         }
+        if (config.conf[name].contains("packetHeader")) {
+            packetHeader = config.conf[name]["packetHeader"];
+        }
         config.release();
 
         // Set menu IDs
@@ -178,8 +182,8 @@ private:
                 _this->sock = net::connect(_this->hostname, _this->port);
             }
             else if (_this->proto == PROTOCOL_UDP) {
-                // Open UDP socket
-                _this->sock = net::openudp("0.0.0.0", _this->port, _this->hostname, _this->port, true);
+                // Start the batching UDP receiver
+                _this->udpReceiver = std::make_unique<UDPReceiver>(_this->hostname, _this->port, _this->packetHeader);
             }
         }
         catch (const std::exception& e) {
@@ -188,7 +192,12 @@ private:
         }
 
         // Start receive worker
-        _this->workerThread = std::thread(&NetworkSourceModule::worker, _this);
+        if (_this->udpReceiver) {
+            _this->workerThread = std::thread(&NetworkSourceModule::udpWorker, _this);
+        }
+        else {
+            _this->workerThread = std::thread(&NetworkSourceModule::worker, _this);
+        }
 
         _this->running = true;
         flog::info("NetworkSourceModule '{0}': Start!", _this->name);
@@ -203,11 +212,13 @@ private:
 
         // Close connection
         if (_this->sock) { _this->sock->close(); }
+        if (_this->udpReceiver) { _this->udpReceiver->stop(); }
 
         // Stop worker thread
         _this->stream.stopWriter();
         if (_this->workerThread.joinable()) { _this->workerThread.join(); }
         _this->stream.clearWriteStop();
+        _this->udpReceiver.reset();
 
         _this->running = false;
         flog::info("NetworkSourceModule '{0}': Stop!", _this->name);
@@ -273,7 +284,27 @@ private:
             config.release(true);
         }
 
+        if (_this->proto == PROTOCOL_UDP) {
+            if (ImGui::Checkbox(("Packet header##iq_exporter_header_" + _this->name).c_str(), &_this->packetHeader)) {
+                config.acquire();
+                config.conf[_this->name]["packetHeader"] = _this->packetHeader;
+                config.release(true);
+            }
+        }
+
         if (_this->running) { SmGui::EndDisabled(); }
+
+        // Receive statistics
+        if (_this->udpReceiver) {
+            UDPReceiver* rx = _this->udpReceiver.get();
+            ImGui::Text("%s, buffer: %d KB", rx->isMulticast() ? "Multicast" : "Unicast", rx->getSocketBufferSize() / 1024);
+            ImGui::Text("Received: %llu", (unsigned long long)rx->getReceivedCount());
+            ImGui::Text("Overruns: %llu", (unsigned long long)rx->getOverrunCount());
+            if (_this->packetHeader) {
+                ImGui::Text("Lost: %llu, Late: %llu", (unsigned long long)rx->getLostCount(), (unsigned long long)rx->getLateCount());
+                ImGui::Text("Invalid: %llu", (unsigned long long)rx->getInvalidCount());
+            }
+        }
     }
 
     void worker() {
@@ -317,6 +348,48 @@ private:
         dsp::buffer::free(buffer);
     }
 
+    void udpWorker() {
+        int sampleSize = SAMPLE_TYPE_SIZE[sampType];
+
+        while (true) {
+            // Wait for the next datagram
+            int bytes, gap;
+            const uint8_t* buffer = udpReceiver->read(bytes, gap);
+            if (!buffer) { break; }
+            int count = bytes / sampleSize;
+
+            // Fill in missing datagrams with silence to keep the timing, assuming they were the same size
+            if (gap && count) {
+                int fill = std::min<int>(gap, UDP_RECEIVER_MAX_CONCEALED) * count;
+                fill = std::min<int>(fill, STREAM_BUFFER_SIZE);
+                memset(stream.writeBuf, 0, fill * sizeof(dsp::complex_t));
+                if (!stream.swap(fill)) { break; }
+            }
+
+            // Convert to CF32
+            switch (sampType) {
+            case SAMPLE_TYPE_INT8:
+                volk_8i_s32f_convert_32f((float*)stream.writeBuf, (int8_t*)buffer, 128.0f, count*2);
+                break;
+            case SAMPLE_TYPE_INT16:
+                volk_16i_s32f_convert_32f((float*)stream.writeBuf, (int16_t*)buffer, 32768.0f, count*2);
+                break;
+            case SAMPLE_TYPE_INT32:
+                volk_32i_s32f_convert_32f((float*)stream.writeBuf, (int32_t*)buffer, 2147483647.0f, count*2);
+                break;
+            case SAMPLE_TYPE_FLOAT32:
+                memcpy(stream.writeBuf, buffer, count * sizeof(dsp::complex_t));
+                break;
+            default:
+                break;
+            }
+            udpReceiver->release();
+
+            // Send out converted samples
+            if (count && !stream.swap(count)) { break; }
+        }
+    }
+
     std::string name;
     bool enabled = true;
     dsp::stream<dsp::complex_t> stream;
@@ -332,6 +405,7 @@ private:
     int sampTypeId;
     char hostname[1024] = "localhost";
     int port = 1234;
+    bool packetHeader = false;
 
     OptionList<int, int> samplerates;
     OptionList<std::string, Protocol> protocols;
@@ -343,6 +417,7 @@ private:
     std::mutex sockMtx;
     std::shared_ptr<net::Socket> sock;
     std::shared_ptr<net::Listener> listener;
+    std::unique_ptr<UDPReceiver> udpReceiver;
 };
 
 MOD_EXPORT void _INIT_() {
@@ -0,0 +1,172 @@
+#include "udp_receiver.h"
+#include <utils/flog.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <algorithm>
+
+UDPReceiver::UDPReceiver(std::string host, int port, bool header) {
+    this->header = header;
+    readIdx = 0;
+    writeIdx = 0;
+    readerWaiting = false;
+    stopWorker = false;
+    received = 0;
+    lost = 0;
+    late = 0;
+    overruns = 0;
+    invalid = 0;
+
+    // Open the socket, multicast groups are received on the any address
+    net::Address addr(host, port);
+    multicast = addr.isMulticast();
+    sock = net::openudp("0.0.0.0", port, multicast ? "0.0.0.0" : host, port, true);
+    if (multicast && !sock->joinMulticast(addr)) {
+        sock->close();
+        throw std::runtime_error("Could not join the multicast group");
+    }
+
+    // Ask for a large kernel buffer to ride out scheduling hiccups
+    sock->setBufferSizes(0, UDP_RECEIVER_SOCKET_BUFFER);
+    socketBufferSize = sock->getRecvBufferSize();
+    if (socketBufferSize < UDP_RECEIVER_SOCKET_BUFFER) {
+        flog::warn("[NetworkSource] The receive buffer was capped to {} bytes by the OS", socketBufferSize);
+    }
+
+    // Allocate the ring
+    ring.resize(UDP_RECEIVER_RING_SIZE * UDP_RECEIVER_SLOT_SIZE);
+    lengths.resize(UDP_RECEIVER_RING_SIZE);
+    gaps.resize(UDP_RECEIVER_RING_SIZE);
+
+    workerThread = std::thread(&UDPReceiver::worker, this);
+}
+
+UDPReceiver::~UDPReceiver() {
+    stop();
+    if (workerThread.joinable()) { workerThread.join(); }
+    sock->close();
+}
+
+const uint8_t* UDPReceiver::read(int& len, int& lost) {
+    while (true) {
+        uint32_t r = readIdx.load(std::memory_order_relaxed);
+
+        // Sleep until the receive thread publishes something
+        if (writeIdx.load() == r) {
+            std::unique_lock<std::mutex> lck(waitMtx);
+            readerWaiting = true;
+            waitCnd.wait(lck, [=]() { return writeIdx.load() != r || stopWorker; });
+            readerWaiting = false;
+            if (stopWorker) { return NULL; }
+            continue;
+        }
+
+        // Skip the datagrams that were rejected
+        int id = r & (UDP_RECEIVER_RING_SIZE - 1);
+        if (!lengths[id]) {
+            readIdx.store(r + 1, std::memory_order_release);
+            continue;
+        }
+
+        len = lengths[id];
+        lost = gaps[id];
+        return &ring[id * UDP_RECEIVER_SLOT_SIZE + (header ? sizeof(net::IQPacketHeader) : 0)];
+    }
+}
+
+void UDPReceiver::release() {
+    readIdx.store(readIdx.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void UDPReceiver::stop() {
+    stopWorker = true;
+    {
+        std::lock_guard<std::mutex> lck(waitMtx);
+    }
+    waitCnd.notify_all();
+}
+
+bool UDPReceiver::checkHeader(const uint8_t* data, int len, int& gap) {
+    gap = 0;
+    net::IQPacketHeader* hdr = (net::IQPacketHeader*)data;
+    if (len <= (int)sizeof(net::IQPacketHeader) || hdr->magic != IQ_PACKET_MAGIC) {
+        invalid++;
+        return false;
+    }
+
+    // Follow the sequence, resyncing if the sender was restarted
+    int32_t diff = (int32_t)(hdr->seq - expectedSeq);
+    if (!synced || std::abs(diff) > UDP_RECEIVER_RESYNC_GAP) {
+        synced = true;
+        diff = 0;
+    }
+    else if (diff < 0) {
+        // Duplicated or too late to be put back in place
+        late++;
+        return false;
+    }
+    expectedSeq = hdr->seq + 1;
+    gap = diff;
+    lost += diff;
+    return true;
+}
+
+void UDPReceiver::worker() {
+    uint8_t* datas[UDP_RECEIVER_BATCH_SIZE];
+    int lens[UDP_RECEIVER_BATCH_SIZE];
+    std::vector<uint8_t> scratch(UDP_RECEIVER_BATCH_SIZE * UDP_RECEIVER_SLOT_SIZE);
+
+    while (!stopWorker) {
+        // Receive straight into the free slots, or discard into the scratch buffer if the ring is full
+        uint32_t w = writeIdx.load(std::memory_order_relaxed);
+        int free = UDP_RECEIVER_RING_SIZE - (int)(w - readIdx.load(std::memory_order_acquire));
+        bool overrun = !free;
+        int n = overrun ? UDP_RECEIVER_BATCH_SIZE : std::min<int>(free, UDP_RECEIVER_BATCH_SIZE);
+        for (int i = 0; i < n; i++) {
+            datas[i] = overrun ? &scratch[i * UDP_RECEIVER_SLOT_SIZE] : &ring[((w + i) & (UDP_RECEIVER_RING_SIZE - 1)) * UDP_RECEIVER_SLOT_SIZE];
+        }
+
+        // Wake up regularly to check if stopped
+        int count = sock->recvmulti(datas, UDP_RECEIVER_SLOT_SIZE, lens, n, 100);
+        if (count <= 0) {
+            if (!sock->isOpen()) { break; }
+            continue;
+        }
+        received += count;
+
+        if (overrun) {
+            // Keep following the sequence so that these aren't reported as network loss
+            overruns += count;
+            if (!header) { continue; }
+            for (int i = 0; i < count; i++) {
+                int gap;
+                if (checkHeader(datas[i], lens[i], gap)) { pendingGap += gap + 1; }
+            }
+            continue;
+        }
+
+        // Check the headers and fill in the slot info
+        for (int i = 0; i < count; i++) {
+            int id = (w + i) & (UDP_RECEIVER_RING_SIZE - 1);
+            int gap = 0;
+            if (header && !checkHeader(datas[i], lens[i], gap)) {
+                lengths[id] = 0;
+                continue;
+            }
+            lengths[id] = header ? (lens[i] - sizeof(net::IQPacketHeader)) : lens[i];
+            gaps[id] = gap + pendingGap;
+            pendingGap = 0;
+        }
+
+        // Publish the batch and wake up the reader if it's asleep
+        writeIdx.store(w + count);
+        if (readerWaiting) {
+            {
+                std::lock_guard<std::mutex> lck(waitMtx);
+            }
+            waitCnd.notify_all();
+        }
+    }
+
+    // Make sure the reader doesn't wait for data that will never come
+    stop();
+}
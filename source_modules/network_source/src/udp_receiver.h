@@ -0,0 +1,98 @@
+#pragma once
+#include <utils/net.h>
+#include <utils/iq_packet.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+// Number of datagrams that can wait to be converted, must be a power of two
+#define UDP_RECEIVER_RING_SIZE      2048
+
+// Largest datagram accepted, enough for jumbo frames
+#define UDP_RECEIVER_SLOT_SIZE      9000
+
+// Maximum number of datagrams received with a single system call
+#define UDP_RECEIVER_BATCH_SIZE     64
+
+// Kernel receive buffer requested, the OS may cap it (net.core.rmem_max on Linux)
+#define UDP_RECEIVER_SOCKET_BUFFER  (32*1024*1024)
+
+// Maximum number of missing datagrams replaced with silence at once
+#define UDP_RECEIVER_MAX_CONCEALED  64
+
+// Sequence jumps larger than this are treated as a restart of the sender rather than as loss
+#define UDP_RECEIVER_RESYNC_GAP     65536
+
+/**
+ * Receives UDP datagrams on its own thread in batches (recvmmsg where available) into a
+ * single producer/single consumer ring, so that the socket is drained even when the
+ * conversion falls behind for a moment. When the optional packet header is enabled,
+ * sequence gaps are detected and reported to the consumer so it can fill them in.
+ * Multicast groups are joined automatically.
+ */
+class UDPReceiver {
+public:
+    UDPReceiver(std::string host, int port, bool header);
+    ~UDPReceiver();
+
+    /**
+     * Wait for the next datagram. release() must be called once done with it.
+     * @param len Length of the payload, header excluded.
+     * @param lost Number of datagrams missing right before this one.
+     * @return Payload of the datagram, NULL once stopped.
+     */
+    const uint8_t* read(int& len, int& lost);
+
+    // Give the slot returned by read back to the receive thread
+    void release();
+
+    // Stop receiving, wakes up read()
+    void stop();
+
+    uint64_t getReceivedCount() { return received; }
+    uint64_t getLostCount() { return lost; }
+    uint64_t getLateCount() { return late; }
+    uint64_t getOverrunCount() { return overruns; }
+    uint64_t getInvalidCount() { return invalid; }
+    int getSocketBufferSize() { return socketBufferSize; }
+    bool isMulticast() { return multicast; }
+
+private:
+    void worker();
+    bool checkHeader(const uint8_t* data, int len, int& gap);
+
+    std::shared_ptr<net::Socket> sock;
+    bool header;
+    bool multicast = false;
+    int socketBufferSize = 0;
+
+    // Ring of datagrams, writeIdx is only written by the receive thread and readIdx by the reader
+    std::vector<uint8_t> ring;
+    std::vector<int> lengths;
+    std::vector<int> gaps;
+    std::atomic<uint32_t> readIdx;
+    std::atomic<uint32_t> writeIdx;
+
+    // Only used to put the reader to sleep when the ring is empty
+    std::atomic<bool> readerWaiting;
+    std::mutex waitMtx;
+    std::condition_variable waitCnd;
+
+    // Sequence tracking, only touched by the receive thread
+    bool synced = false;
+    uint32_t expectedSeq = 0;
+    int pendingGap = 0;
+
+    std::atomic<bool> stopWorker;
+    std::thread workerThread;
+
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> lost;
+    std::atomic<uint64_t> late;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> invalid;
+};
@@ -35,6 +35,9 @@ public:
         sampleTypeList.define("Int8", dsp::compression::PCM_TYPE_I8);
         sampleTypeList.define("Int16", dsp::compression::PCM_TYPE_I16);
         sampleTypeList.define("Float32", dsp::compression::PCM_TYPE_F32);
+        sampleTypeList.define("BFP4", dsp::compression::PCM_TYPE_BFP4);
+        sampleTypeList.define("BFP6", dsp::compression::PCM_TYPE_BFP6);
+        sampleTypeList.define("BFP8", dsp::compression::PCM_TYPE_BFP8);
         sampleTypeId = sampleTypeList.valueId(dsp::compression::PCM_TYPE_I16);
 
         handler.ctx = this;
@@ -46,6 +49,13 @@ public:
         handler.tuneHandler = tune;
         handler.stream = &stream;
 
+        vfoCreatedHandler.ctx = this;
+        vfoCreatedHandler.handler = vfoCreated;
+        vfoDeleteHandler.ctx = this;
+        vfoDeleteHandler.handler = vfoDelete;
+        fftRedrawHandler.ctx = this;
+        fftRedrawHandler.handler = fftRedraw;
+
         // Load config
         config.acquire();
         std::string hostStr = config.conf["hostname"];
@@ -58,6 +68,7 @@ public:
 
     ~SDRPPServerSourceModule() {
         stop(this);
+        disableRemoteVFOs();
         sigpath::sourceManager.unregisterSource("SDR++ Server");
     }
 
@@ -150,7 +161,7 @@ private:
         gui::mainWindow.playButtonLocked = !connected;
 
         ImGui::GenericDialog("##sdrpp_srv_src_err_dialog", _this->serverBusy, GENERIC_DIALOG_BUTTONS_OK, [=](){
-            ImGui::TextUnformatted("This server is already in use.");
+            ImGui::TextUnformatted("This server is full.");
         });
 
         if (connected) { style::beginDisabled(); }
@@ -199,10 +210,89 @@ private:
                 config.release(true);
             }
 
-            bool dummy = true;
-            style::beginDisabled();
-            ImGui::Checkbox("Full IQ", &dummy);
-            style::endDisabled();
+            // Let the server lower the sample type and enable compression when the link is congested
+            if (ImGui::Checkbox("Adaptive bitrate", &_this->adaptive)) {
+                _this->client->setAdaptive(_this->adaptive);
+                config.acquire();
+                config.conf["servers"][_this->devConfName]["adaptive"] = _this->adaptive;
+                config.release(true);
+            }
+            if (_this->adaptive) {
+                server::StreamFormat fmt = _this->client->getStreamFormat();
+                if (fmt.level) {
+                    dsp::compression::PCMType type = (dsp::compression::PCMType)fmt.pcmType;
+                    std::string typeName = _this->sampleTypeList.valueExists(type) ? _this->sampleTypeList.name(_this->sampleTypeList.valueId(type)) : "?";
+                    ImGui::TextColored(ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "Reduced to %s%s", typeName.c_str(), fmt.compression ? " + compression" : "");
+                }
+            }
+
+            // Stream the data over UDP so that a lost packet doesn't hold back the ones behind it
+            if (ImGui::Checkbox("UDP data channel", &_this->udp)) {
+                _this->client->setUDP(_this->udp);
+                config.acquire();
+                config.conf["servers"][_this->devConfName]["udp"] = _this->udp;
+                config.release(true);
+            }
+            if (_this->udp) {
+                server::UDPStats ustats = _this->client->getUDPStats();
+                if (ustats.active) {
+                    uint64_t total = ustats.datagrams + ustats.lostDatagrams;
+                    float loss = total ? (100.0f * (float)ustats.lostDatagrams / (float)total) : 0.0f;
+                    ImGui::Text("Loss: %.2f%%, Recovered: %llu, Concealed: %llu", loss, (unsigned long long)ustats.recovered, (unsigned long long)ustats.lostPackets);
+                }
+                else {
+                    ImGui::TextColored(ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "Waiting for UDP data...");
+                }
+            }
+
+            // Buffer some of the stream to ride out the network jitter
+            ImGui::LeftLabel("Jitter buffer (ms)");
+            ImGui::FillWidth();
+            if (ImGui::InputInt("##sdrpp_srv_source_jitter_buf", &_this->jitterBufferMs, 10, 100)) {
+                _this->jitterBufferMs = std::clamp<int>(_this->jitterBufferMs, 0, CLIENT_MAX_JITTER_BUFFER_MS);
+                _this->client->setJitterBuffer(_this->jitterBufferMs);
+                config.acquire();
+                config.conf["servers"][_this->devConfName]["jitterBufferMs"] = _this->jitterBufferMs;
+                config.release(true);
+            }
+
+            // Without full IQ, only the VFOs are streamed after being extracted by the server
+            if (ImGui::Checkbox("Full IQ", &_this->fullIQ)) {
+                _this->client->setFullIQ(_this->fullIQ);
+                if (_this->fullIQ) {
+                    _this->disableRemoteVFOs();
+                }
+                else {
+                    _this->enableRemoteVFOs();
+                }
+                _this->applyServerFFT();
+
+                // Save config
+                config.acquire();
+                config.conf["servers"][_this->devConfName]["fullIQ"] = _this->fullIQ;
+                config.release(true);
+            }
+
+            // The spectrum can only come from the server when the full IQ isn't received
+            if (_this->fullIQ) { style::beginDisabled(); }
+            if (ImGui::Checkbox("Server spectrum", &_this->serverFFT)) {
+                _this->applyServerFFT();
+                config.acquire();
+                config.conf["servers"][_this->devConfName]["serverFFT"] = _this->serverFFT;
+                config.release(true);
+            }
+            if (_this->serverFFT) {
+                ImGui::LeftLabel("Averaging");
+                ImGui::FillWidth();
+                if (ImGui::InputInt("##sdrpp_srv_source_fft_avg", &_this->fftAveraging, 1, 4)) {
+                    _this->fftAveraging = std::clamp<int>(_this->fftAveraging, 1, 64);
+                    _this->applyServerFFT();
+                    config.acquire();
+                    config.conf["servers"][_this->devConfName]["fftAveraging"] = _this->fftAveraging;
+                    config.release(true);
+                }
+            }
+            if (_this->fullIQ) { style::endDisabled(); }
 
             // Calculate datarate
             _this->frametimeCounter += ImGui::GetIO().DeltaTime;
@@ -216,9 +306,27 @@ private:
             ImGui::SameLine();
             ImGui::TextColored(ImVec4(0.0f, 1.0f, 0.0f, 1.0f), "Connected (%.3f Mbit/s)", _this->datarate);
 
+            server::JitterStats jstats = _this->client->getJitterStats();
+            ImGui::Text("Jitter: %.1f ms, Buffered: %.0f ms", jstats.jitterMs, jstats.depthMs);
+            ImGui::Text("Underruns: %llu, Overruns: %llu", (unsigned long long)jstats.underruns, (unsigned long long)jstats.overruns);
+
+            // Only one client controls the remote source, the others can take over
+            bool controller = _this->client->isController();
+            ImGui::TextUnformatted("Role:");
+            ImGui::SameLine();
+            ImGui::TextUnformatted(controller ? "Controller" : "Observer");
+            if (!controller) {
+                ImGui::SameLine();
+                if (ImGui::Button("Request control##sdrpp_srv_source")) {
+                    _this->client->requestControl();
+                }
+            }
+
             ImGui::CollapsingHeader("Source [REMOTE]", ImGuiTreeNodeFlags_DefaultOpen);
 
+            if (!controller) { style::beginDisabled(); }
             _this->client->showMenu();
+            if (!controller) { style::endDisabled(); }
         }
         else {
             ImGui::TextUnformatted("Status:");
@@ -227,12 +335,103 @@ private:
         }
     }
 
+    static void vfoCreated(VFOManager::VFO* vfo, void* ctx) {
+        SDRPPServerSourceModule* _this = (SDRPPServerSourceModule*)ctx;
+        _this->addRemoteVFO(vfo);
+    }
+
+    static void vfoDelete(VFOManager::VFO* vfo, void* ctx) {
+        SDRPPServerSourceModule* _this = (SDRPPServerSourceModule*)ctx;
+        auto it = _this->remoteVFOs.find(vfo->getName());
+        if (it == _this->remoteVFOs.end()) { return; }
+        if (_this->client) { _this->client->removeVFO(it->second.id); }
+        _this->remoteVFOs.erase(it);
+    }
+
+    static void fftRedraw(ImGui::WaterFall::FFTRedrawArgs args, void* ctx) {
+        SDRPPServerSourceModule* _this = (SDRPPServerSourceModule*)ctx;
+        _this->syncRemoteVFOs();
+
+        // Follow changes of the FFT size
+        if (_this->serverFFT && _this->connected() && gui::waterfall.getRawFFTSize() != _this->serverFFTSize) {
+            _this->applyServerFFT();
+        }
+    }
+
+    void applyServerFFT() {
+        if (!connected()) { return; }
+        if (!serverFFT || fullIQ) {
+            client->setFFT(0, 0, 0);
+            serverFFTSize = 0;
+            return;
+        }
+        core::configManager.acquire();
+        double rate = core::configManager.conf["fftRate"];
+        core::configManager.release();
+        serverFFTSize = gui::waterfall.getRawFFTSize();
+        client->setFFT(serverFFTSize, rate, fftAveraging);
+    }
+
+    void enableRemoteVFOs() {
+        if (remoteVFOsEnabled) { return; }
+        remoteVFOsEnabled = true;
+
+        // Mirror the existing VFOs, then follow creations and deletions
+        for (auto const& [name, wtfVFO] : gui::waterfall.vfos) {
+            VFOManager::VFO* vfo = sigpath::vfoManager.getVFO(name);
+            if (vfo) { addRemoteVFO(vfo); }
+        }
+        sigpath::vfoManager.onVfoCreated.bindHandler(&vfoCreatedHandler);
+        sigpath::vfoManager.onVfoDelete.bindHandler(&vfoDeleteHandler);
+        gui::waterfall.onFFTRedraw.bindHandler(&fftRedrawHandler);
+    }
+
+    void disableRemoteVFOs() {
+        if (!remoteVFOsEnabled) { return; }
+        remoteVFOsEnabled = false;
+
+        sigpath::vfoManager.onVfoCreated.unbindHandler(&vfoCreatedHandler);
+        sigpath::vfoManager.onVfoDelete.unbindHandler(&vfoDeleteHandler);
+        gui::waterfall.onFFTRedraw.unbindHandler(&fftRedrawHandler);
+        for (auto const& [name, rvfo] : remoteVFOs) {
+            if (client) { client->removeVFO(rvfo.id); }
+        }
+        remoteVFOs.clear();
+    }
+
+    void addRemoteVFO(VFOManager::VFO* vfo) {
+        if (!client) { return; }
+        RemoteVFO rvfo;
+        rvfo.id = nextRemoteVFOId++;
+        rvfo.vfo = vfo;
+        rvfo.sampleRate = vfo->dspVFO->getOutSamplerate();
+        rvfo.bandwidth = vfo->dspVFO->getBandwidth();
+        rvfo.offset = vfo->dspVFO->getOffset();
+        client->addVFO(rvfo.id, rvfo.sampleRate, rvfo.bandwidth, rvfo.offset, vfo->output);
+        remoteVFOs[vfo->getName()] = rvfo;
+    }
+
+    void syncRemoteVFOs() {
+        if (!connected()) { return; }
+        for (auto& [name, rvfo] : remoteVFOs) {
+            double sampleRate = rvfo.vfo->dspVFO->getOutSamplerate();
+            double bandwidth = rvfo.vfo->dspVFO->getBandwidth();
+            double offset = rvfo.vfo->dspVFO->getOffset();
+            if (sampleRate == rvfo.sampleRate && bandwidth == rvfo.bandwidth && offset == rvfo.offset) { continue; }
+            rvfo.sampleRate = sampleRate;
+            rvfo.bandwidth = bandwidth;
+            rvfo.offset = offset;
+            client->setVFO(rvfo.id, sampleRate, bandwidth, offset);
+        }
+    }
+
     bool connected() {
         return client && client->isOpen();
     }
 
     void tryConnect() {
         try {
+            disableRemoteVFOs();
             if (client) { client.reset(); }
             client = server::connect(hostname, port, &stream);
             deviceInit();
@@ -258,10 +457,40 @@ private:
         if (config.conf["servers"][devConfName].contains("compression")) {
             compression = config.conf["servers"][devConfName]["compression"];
         }
+        fullIQ = true;
+        if (config.conf["servers"][devConfName].contains("fullIQ")) {
+            fullIQ = config.conf["servers"][devConfName]["fullIQ"];
+        }
+        adaptive = false;
+        if (config.conf["servers"][devConfName].contains("adaptive")) {
+            adaptive = config.conf["servers"][devConfName]["adaptive"];
+        }
+        serverFFT = false;
+        if (config.conf["servers"][devConfName].contains("serverFFT")) {
+            serverFFT = config.conf["servers"][devConfName]["serverFFT"];
+        }
+        fftAveraging = 1;
+        if (config.conf["servers"][devConfName].contains("fftAveraging")) {
+            fftAveraging = config.conf["servers"][devConfName]["fftAveraging"];
+        }
+        udp = false;
+        if (config.conf["servers"][devConfName].contains("udp")) {
+            udp = config.conf["servers"][devConfName]["udp"];
+        }
+        jitterBufferMs = 0;
+        if (config.conf["servers"][devConfName].contains("jitterBufferMs")) {
+            jitterBufferMs = config.conf["servers"][devConfName]["jitterBufferMs"];
+        }
 
         // Set settings
         client->setSampleType(sampleTypeList[sampleTypeId]);
         client->setCompression(compression);
+        client->setAdaptive(adaptive);
+        client->setJitterBuffer(jitterBufferMs);
+        if (udp) { client->setUDP(true); }
+        client->setFullIQ(fullIQ);
+        if (!fullIQ) { enableRemoteVFOs(); }
+        applyServerFFT();
     }
 
     std::string name;
@@ -284,8 +513,31 @@ private:
     OptionList<std::string, dsp::compression::PCMType> sampleTypeList;
     int sampleTypeId;
     bool compression = false;
+    bool adaptive = false;
+    bool fullIQ = true;
+    bool serverFFT = false;
+    int fftAveraging = 1;
+    int serverFFTSize = 0;
+    int jitterBufferMs = 0;
+    bool udp = false;
 
     std::shared_ptr<server::Client> client;
+
+    // Local VFOs mirrored on the server when not receiving the full IQ
+    struct RemoteVFO {
+        uint32_t id;
+        VFOManager::VFO* vfo;
+        double sampleRate;
+        double bandwidth;
+        double offset;
+    };
+    std::map<std::string, RemoteVFO> remoteVFOs;
+    uint32_t nextRemoteVFOId = 0;
+    bool remoteVFOsEnabled = false;
+
+    EventHandler<VFOManager::VFO*> vfoCreatedHandler;
+    EventHandler<VFOManager::VFO*> vfoDeleteHandler;
+    EventHandler<ImGui::WaterFall::FFTRedrawArgs> fftRedrawHandler;
 };
 
 MOD_EXPORT void _INIT_() {
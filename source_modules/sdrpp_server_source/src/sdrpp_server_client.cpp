@@ -1,19 +1,31 @@
 #include "sdrpp_server_client.h"
 #include <volk/volk.h>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include <utils/flog.h>
 #include <core.h>
+#include <gui/gui.h>
 
 using namespace std::chrono_literals;
 
 namespace server {
-    Client::Client(std::shared_ptr<net::Socket> sock, dsp::stream<dsp::complex_t>* out) {
+    Client::Client(std::shared_ptr<net::Socket> sock, dsp::stream<dsp::complex_t>* out, std::string host, int port) {
         this->sock = sock;
+        this->host = host;
+        this->port = port;
         output = out;
 
         // Allocate buffers
         rbuffer = new uint8_t[SERVER_MAX_PACKET_SIZE];
         sbuffer = new uint8_t[SERVER_MAX_PACKET_SIZE];
+        vfoBuffer = new uint8_t[STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8];
+        decodeBuffer = new uint8_t[STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8];
+        udpBuffer = new uint8_t[sizeof(DatagramHeader) + SERVER_UDP_PAYLOAD_SIZE];
+
+        // Fill the packet pool, the buffers grow to the size of the packets as they come in
+        packetPool.resize(CLIENT_PACKET_POOL_SIZE);
+        for (auto& pkt : packetPool) { freePackets.push_back(&pkt); }
 
         // Initialize headers
         r_pkt_hdr = (PacketHeader*)rbuffer;
@@ -26,18 +38,12 @@ namespace server {
         s_cmd_hdr = (CommandHeader*)s_pkt_data;
         s_cmd_data = &sbuffer[sizeof(PacketHeader) + sizeof(CommandHeader)];
 
-        // Initialize decompressor
+        // Initialize decompressors, the decode thread has its own context
         dctx = ZSTD_createDCtx();
+        decodeDctx = ZSTD_createDCtx();
 
-        // Initialize DSP
-        decompIn.setBufferSize(STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8);
-        decompIn.clearWriteStop();
-        decomp.init(&decompIn);
-        link.init(&decomp.out, output);
-        decomp.start();
-        link.start();
-
-        // Start worker thread
+        // Start worker threads
+        decodeThread = std::thread(&Client::decodeWorker, this);
         workerThread = std::thread(&Client::worker, this);
 
         // Ask for a UI
@@ -61,8 +67,12 @@ namespace server {
     Client::~Client() {
         close();
         ZSTD_freeDCtx(dctx);
+        ZSTD_freeDCtx(decodeDctx);
         delete[] rbuffer;
         delete[] sbuffer;
+        delete[] vfoBuffer;
+        delete[] decodeBuffer;
+        delete[] udpBuffer;
     }
 
     void Client::showMenu() {
@@ -133,6 +143,110 @@ namespace server {
         sendCommand(COMMAND_SET_COMPRESSION, 1);
     }
 
+    void Client::requestControl() {
+        if (!isOpen()) { return; }
+        sendCommand(COMMAND_REQUEST_CONTROL, 0);
+    }
+
+    bool Client::isController() {
+        return controller;
+    }
+
+    void Client::setFullIQ(bool enabled) {
+        if (!isOpen()) { return; }
+        s_cmd_data[0] = enabled;
+        sendCommand(COMMAND_SET_FULL_IQ, 1);
+    }
+
+    void Client::addVFO(uint32_t id, double sampleRate, double bandwidth, double offset, dsp::stream<dsp::complex_t>* out) {
+        {
+            std::lock_guard<std::mutex> lck(vfoMapMtx);
+            vfoOutputs[id] = out;
+        }
+        if (!isOpen()) { return; }
+        VFOConfig* cfg = (VFOConfig*)s_cmd_data;
+        cfg->id = id;
+        cfg->sampleRate = sampleRate;
+        cfg->bandwidth = bandwidth;
+        cfg->offset = offset;
+        sendCommand(COMMAND_ADD_VFO, sizeof(VFOConfig));
+    }
+
+    void Client::setVFO(uint32_t id, double sampleRate, double bandwidth, double offset) {
+        if (!isOpen()) { return; }
+        VFOConfig* cfg = (VFOConfig*)s_cmd_data;
+        cfg->id = id;
+        cfg->sampleRate = sampleRate;
+        cfg->bandwidth = bandwidth;
+        cfg->offset = offset;
+        sendCommand(COMMAND_SET_VFO, sizeof(VFOConfig));
+    }
+
+    void Client::removeVFO(uint32_t id) {
+        dsp::stream<dsp::complex_t>* out;
+        {
+            std::lock_guard<std::mutex> lck(vfoMapMtx);
+            auto it = vfoOutputs.find(id);
+            if (it == vfoOutputs.end()) { return; }
+            out = it->second;
+            vfoOutputs.erase(it);
+        }
+
+        // Unblock the worker if it's writing to this output and wait for it to be done with it
+        out->stopWriter();
+        { std::lock_guard<std::mutex> lck(vfoMtx); }
+        out->clearWriteStop();
+
+        if (!isOpen()) { return; }
+        *(uint32_t*)s_cmd_data = id;
+        sendCommand(COMMAND_REMOVE_VFO, sizeof(uint32_t));
+    }
+
+    void Client::setFFT(int size, double rate, int averaging) {
+        if (!isOpen()) { return; }
+        FFTConfig* cfg = (FFTConfig*)s_cmd_data;
+        cfg->size = size;
+        cfg->rate = rate;
+        cfg->averaging = averaging;
+        sendCommand(COMMAND_SET_FFT, sizeof(FFTConfig));
+    }
+
+    void Client::setAdaptive(bool enabled) {
+        if (!isOpen()) { return; }
+        s_cmd_data[0] = enabled;
+        sendCommand(COMMAND_SET_ADAPTIVE, 1);
+    }
+
+    StreamFormat Client::getStreamFormat() {
+        std::lock_guard<std::mutex> lck(streamFormatMtx);
+        return streamFormat;
+    }
+
+    void Client::setJitterBuffer(int ms) {
+        std::lock_guard<std::mutex> lck(jitterMtx);
+        jitterTargetMs = std::clamp<int>(ms, 0, CLIENT_MAX_JITTER_BUFFER_MS);
+    }
+
+    JitterStats Client::getJitterStats() {
+        std::lock_guard<std::mutex> lck(jitterMtx);
+        JitterStats stats = jitterStats;
+        stats.depthPackets = jitterQueue.size();
+        stats.depthMs = (double)jitterQueue.size() * packetDurationMs;
+        return stats;
+    }
+
+    void Client::setUDP(bool enabled) {
+        if (!enabled) { stopUDP(); }
+        if (!isOpen()) { return; }
+        s_cmd_data[0] = enabled;
+        sendCommand(COMMAND_SET_UDP, 1);
+    }
+
+    UDPStats Client::getUDPStats() {
+        std::lock_guard<std::mutex> lck(udpStatsMtx);
+        return udpStats;
+    }
+
     void Client::start() {
         if (!isOpen()) { return; }
         sendCommand(COMMAND_START, 0);
@@ -146,15 +260,28 @@ namespace server {
     }
 
     void Client::close() {
+        // Stop decode thread
+        {
+            std::lock_guard<std::mutex> lck(jitterMtx);
+            decodeStop = true;
+        }
+        jitterCnd.notify_all();
+        output->stopWriter();
+        if (decodeThread.joinable()) { decodeThread.join(); }
+        output->clearWriteStop();
+
         // Stop worker
-        decompIn.stopWriter();
+        {
+            std::lock_guard<std::mutex> lck(vfoMapMtx);
+            for (auto const& [id, out] : vfoOutputs) { out->stopWriter(); }
+        }
         if (sock) { sock->close(); }
         if (workerThread.joinable()) { workerThread.join(); }
-        decompIn.clearWriteStop();
-
-        // Stop DSP
-        decomp.stop();
-        link.stop();
+        stopUDP();
+        {
+            std::lock_guard<std::mutex> lck(vfoMapMtx);
+            for (auto const& [id, out] : vfoOutputs) { out->clearWriteStop(); }
+        }
     }
 
     bool Client::isOpen() {
@@ -168,6 +295,37 @@ namespace server {
                 break;
             }
 
+            if (r_pkt_hdr->size < sizeof(PacketHeader) || r_pkt_hdr->size > SERVER_MAX_PACKET_SIZE) {
+                flog::error("Invalid packet size: {0}", r_pkt_hdr->size);
+                break;
+            }
+
+            // Baseband is received straight into a pooled buffer and handed to the decode thread
+            if (r_pkt_hdr->type == PACKET_TYPE_BASEBAND || r_pkt_hdr->type == PACKET_TYPE_BASEBAND_COMPRESSED) {
+                PooledPacket* pkt = acquirePacket();
+                int len = r_pkt_hdr->size - sizeof(PacketHeader);
+
+                // No buffer left, skip the payload to stay in sync with the stream
+                if (!pkt) {
+                    if (len && sock->recv(&rbuffer[sizeof(PacketHeader)], len, true, PROTOCOL_TIMEOUT_MS) <= 0) { break; }
+                    bytes += r_pkt_hdr->size;
+                    continue;
+                }
+
+                if (pkt->data.size() < len) { pkt->data.resize(len); }
+                if (len && sock->recv(pkt->data.data(), len, true, PROTOCOL_TIMEOUT_MS) <= 0) {
+                    releasePacket(pkt);
+                    break;
+                }
+                bytes += r_pkt_hdr->size;
+
+                pkt->size = len;
+                pkt->compressed = (r_pkt_hdr->type == PACKET_TYPE_BASEBAND_COMPRESSED);
+                pkt->lost = false;
+                queueBaseband(pkt);
+                continue;
+            }
+
             // Receive remaining data
             if (sock->recv(&rbuffer[sizeof(PacketHeader)], r_pkt_hdr->size - sizeof(PacketHeader), true, PROTOCOL_TIMEOUT_MS) <= 0) {
                 break;
@@ -183,6 +341,16 @@ namespace server {
                     currentSampleRate = *(double*)r_cmd_data;
                     core::setInputSampleRate(currentSampleRate);
                 }
+                else if (r_cmd_hdr->cmd == COMMAND_SET_CONTROL && r_pkt_hdr->size == sizeof(PacketHeader) + sizeof(CommandHeader) + 1) {
+                    controller = r_cmd_data[0];
+                }
+                else if (r_cmd_hdr->cmd == COMMAND_SET_UDP_TOKEN && r_pkt_hdr->size == sizeof(PacketHeader) + sizeof(CommandHeader) + sizeof(uint64_t)) {
+                    startUDP(*(uint64_t*)r_cmd_data);
+                }
+                else if (r_cmd_hdr->cmd == COMMAND_SET_STREAM_FORMAT && r_pkt_hdr->size == sizeof(PacketHeader) + sizeof(CommandHeader) + sizeof(StreamFormat)) {
+                    std::lock_guard<std::mutex> lck(streamFormatMtx);
+                    streamFormat = *(StreamFormat*)r_cmd_data;
+                }
                 else if (r_cmd_hdr->cmd == COMMAND_DISCONNECT) {
                     flog::error("Asked to disconnect by the server");
                     serverBusy = true;
@@ -216,15 +384,11 @@ namespace server {
                     delete waiter;
                 }
             }
-            else if (r_pkt_hdr->type == PACKET_TYPE_BASEBAND) {
-                memcpy(decompIn.writeBuf, &rbuffer[sizeof(PacketHeader)], r_pkt_hdr->size - sizeof(PacketHeader));
-                if (!decompIn.swap(r_pkt_hdr->size - sizeof(PacketHeader))) { break; }
+            else if (r_pkt_hdr->type == PACKET_TYPE_VFO) {
+                handleVFOPacket(r_pkt_data, r_pkt_hdr->size - sizeof(PacketHeader));
             }
-            else if (r_pkt_hdr->type == PACKET_TYPE_BASEBAND_COMPRESSED) {
-                size_t outCount = ZSTD_decompressDCtx(dctx, decompIn.writeBuf, STREAM_BUFFER_SIZE*sizeof(dsp::complex_t)+8, r_pkt_data, r_pkt_hdr->size - sizeof(PacketHeader));
-                if (outCount) {
-                    if (!decompIn.swap(outCount)) { break; }
-                };
+            else if (r_pkt_hdr->type == PACKET_TYPE_FFT) {
+                handleFFTPacket(r_pkt_data, r_pkt_hdr->size - sizeof(PacketHeader));
             }
             else if (r_pkt_hdr->type == PACKET_TYPE_ERROR) {
                 flog::error("SDR++ Server Error: {0}", rbuffer[sizeof(PacketHeader)]);
@@ -235,6 +399,398 @@ namespace server {
         }
     }
 
+    void Client::handleVFOPacket(uint8_t* pktData, size_t pktLen) {
+        if (pktLen < sizeof(VFOHeader)) { return; }
+        VFOHeader* vhdr = (VFOHeader*)pktData;
+        uint8_t* data = &pktData[sizeof(VFOHeader)];
+        size_t len = pktLen - sizeof(VFOHeader);
+
+        std::lock_guard<std::mutex> lck(dataMtx);
+        std::lock_guard<std::mutex> lck2(vfoMtx);
+        dsp::stream<dsp::complex_t>* out;
+        {
+            std::lock_guard<std::mutex> lck3(vfoMapMtx);
+            auto it = vfoOutputs.find(vhdr->id);
+            if (it == vfoOutputs.end()) { return; }
+            out = it->second;
+        }
+
+        // Decompress if needed, then convert straight into the output stream
+        if (vhdr->compressed) {
+            len = ZSTD_decompressDCtx(dctx, vfoBuffer, STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8, data, len);
+            if (ZSTD_isError(len)) { return; }
+            data = vfoBuffer;
+        }
+        if (len < 8 || len > STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8) { return; }
+        int count = decomp.process(len, data, out->writeBuf);
+        if (count) { out->swap(count); }
+    }
+
+    void Client::handleFFTPacket(uint8_t* pktData, size_t pktLen) {
+        if (pktLen < sizeof(FFTHeader)) { return; }
+        FFTHeader* fhdr = (FFTHeader*)pktData;
+        if (fhdr->size > SERVER_MAX_PACKET_SIZE) { return; }
+
+        std::lock_guard<std::mutex> lck(dataMtx);
+        if (fftBins.size() != fhdr->size) { fftBins.resize(fhdr->size); }
+        size_t len = ZSTD_decompressDCtx(dctx, fftBins.data(), fftBins.size(), &pktData[sizeof(FFTHeader)], pktLen - sizeof(FFTHeader));
+        if (ZSTD_isError(len) || len != fhdr->size) { return; }
+
+        // Undo the delta coding and quantization straight into the waterfall
+        float* buf = gui::waterfall.getFFTBuffer();
+        if (!buf) { return; }
+        int count = std::min<int>(fhdr->size, gui::waterfall.getRawFFTSize());
+        uint8_t val = 0;
+        for (int i = 0; i < count; i++) {
+            val += fftBins[i];
+            buf[i] = fhdr->min + ((float)val * fhdr->step);
+        }
+        gui::waterfall.pushFFT();
+    }
+
+    void Client::decodeWorker() {
+        int lastCount = 0;
+        while (true) {
+            // Wait for a packet, after an underrun playout only resumes once the buffer is back at its target
+            PooledPacket* pkt;
+            {
+                std::unique_lock<std::mutex> lck(jitterMtx);
+                jitterCnd.wait(lck, [this]() {
+                    return decodeStop || (!jitterQueue.empty() && (!prebuffering || jitterQueue.size() >= jitterTargetPackets()));
+                });
+                if (decodeStop) { return; }
+                prebuffering = false;
+                pkt = jitterQueue.front();
+                jitterQueue.pop_front();
+            }
+
+            // Conceal packets lost on the UDP channel with silence of the same length as the last one
+            if (pkt->lost) {
+                releasePacket(pkt);
+                if (!lastCount) { continue; }
+                memset(output->writeBuf, 0, lastCount * sizeof(dsp::complex_t));
+                if (!output->swap(lastCount)) { return; }
+                continue;
+            }
+
+            // Decompress if needed, uncompressed packets are converted straight from the pooled buffer
+            const uint8_t* data = pkt->data.data();
+            size_t len = pkt->size;
+            if (pkt->compressed) {
+                len = ZSTD_decompressDCtx(decodeDctx, decodeBuffer, STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8, data, len);
+                if (ZSTD_isError(len)) { len = 0; }
+                data = decodeBuffer;
+            }
+            int count = 0;
+            if (len >= 8 && len <= STREAM_BUFFER_SIZE*sizeof(dsp::complex_t) + 8) {
+                count = decomp.process(len, data, output->writeBuf);
+            }
+            if (count) { lastCount = count; }
+            auto arrival = pkt->arrival;
+            releasePacket(pkt);
+
+            // Update the statistics, the jitter is smoothed as in RFC 3550
+            {
+                std::lock_guard<std::mutex> lck(jitterMtx);
+                double durationMs = 1000.0 * (double)count / currentSampleRate;
+                if (lastDurationMs > 0.0) {
+                    double intervalMs = std::chrono::duration<double, std::milli>(arrival - lastArrival).count();
+                    double d = fabs(intervalMs - lastDurationMs);
+                    jitterStats.jitterMs += (d - jitterStats.jitterMs) / 16.0;
+                }
+                if (count) {
+                    packetDurationMs = (packetDurationMs > 0.0) ? (packetDurationMs + (durationMs - packetDurationMs) / 16.0) : durationMs;
+                }
+                lastArrival = arrival;
+                lastDurationMs = durationMs;
+            }
+
+            if (count && !output->swap(count)) { return; }
+
+            // An empty buffer with a target set means the network fell behind
+            {
+                std::lock_guard<std::mutex> lck(jitterMtx);
+                if (jitterQueue.empty() && jitterTargetMs > 0) {
+                    jitterStats.underruns++;
+                    prebuffering = true;
+                }
+            }
+        }
+    }
+
+    void Client::queueBaseband(PooledPacket* pkt) {
+        pkt->arrival = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lck(jitterMtx);
+            jitterQueue.push_back(pkt);
+        }
+        jitterCnd.notify_all();
+    }
+
+    Client::PooledPacket* Client::acquirePacket() {
+        std::lock_guard<std::mutex> lck(jitterMtx);
+        if (!freePackets.empty()) {
+            PooledPacket* pkt = freePackets.back();
+            freePackets.pop_back();
+            return pkt;
+        }
+
+        // The decoder can't keep up, drop the oldest packet to keep the latency bounded.
+        // If every buffer is held elsewhere (decoder, UDP reassembly), the caller drops the new packet instead
+        jitterStats.overruns++;
+        if (jitterQueue.empty()) { return NULL; }
+        PooledPacket* pkt = jitterQueue.front();
+        jitterQueue.pop_front();
+        return pkt;
+    }
+
+    void Client::releasePacket(PooledPacket* pkt) {
+        std::lock_guard<std::mutex> lck(jitterMtx);
+        freePackets.push_back(pkt);
+    }
+
+    int Client::jitterTargetPackets() {
+        if (jitterTargetMs <= 0 || packetDurationMs <= 0.0) { return 0; }
+        return std::min<int>(ceil((double)jitterTargetMs / packetDurationMs), CLIENT_PACKET_POOL_SIZE / 2);
+    }
+
+    void Client::startUDP(uint64_t token) {
+        stopUDP();
+        std::lock_guard<std::mutex> lck(udpMtx);
+        try {
+            udpServerAddr = net::Address(host, port);
+            udpSock = net::openudp(udpServerAddr);
+        }
+        catch (const std::exception& e) {
+            flog::error("Could not open the UDP data channel: {}", e.what());
+            return;
+        }
+        udpToken = token;
+        udpStop = false;
+
+        // Start from a clean state
+        for (auto& [seq, ra] : reassembly) { releasePacket(ra.pkt); }
+        reassembly.clear();
+        packetSeqInit = false;
+        seqInit = false;
+        {
+            std::lock_guard<std::mutex> lck2(udpStatsMtx);
+            udpStats = {};
+        }
+
+        udpThread = std::thread(&Client::udpWorker, this);
+    }
+
+    void Client::stopUDP() {
+        std::lock_guard<std::mutex> lck(udpMtx);
+        udpStop = true;
+        if (udpThread.joinable()) { udpThread.join(); }
+        if (udpSock) {
+            udpSock->close();
+            udpSock.reset();
+        }
+        std::lock_guard<std::mutex> lck2(udpStatsMtx);
+        udpStats.active = false;
+    }
+
+    void Client::udpWorker() {
+        auto lastHello = std::chrono::steady_clock::time_point();
+        while (!udpStop && udpSock->isOpen()) {
+            // Keep saying hello, it registers our address with the server and keeps the NAT mapping open
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastHello >= std::chrono::milliseconds(SERVER_UDP_KEEPALIVE_MS)) {
+                DatagramHello hello;
+                hello.magic = SERVER_UDP_HELLO_MAGIC;
+                hello.token = udpToken;
+                udpSock->send((uint8_t*)&hello, sizeof(DatagramHello));
+                lastHello = now;
+            }
+
+            // Short timeout so that stopping doesn't take long
+            net::Address from;
+            int len = udpSock->recv(udpBuffer, sizeof(DatagramHeader) + SERVER_UDP_PAYLOAD_SIZE, false, 100, &from);
+            if (len < 0) { break; }
+            if (len < sizeof(DatagramHeader)) { continue; }
+
+            // The port is open to anyone, only take datagrams coming from the server
+            if (from.getIP() != udpServerAddr.getIP() || from.getPort() != udpServerAddr.getPort()) { continue; }
+            bytes += len;
+            handleDatagram(udpBuffer, len);
+        }
+    }
+
+    void Client::handleDatagram(uint8_t* buf, int len) {
+        DatagramHeader* dhdr = (DatagramHeader*)buf;
+        uint8_t* payload = &buf[sizeof(DatagramHeader)];
+        int payloadLen = len - sizeof(DatagramHeader);
+
+        // Estimate the datagram loss from the sequence numbers
+        {
+            std::lock_guard<std::mutex> lck(udpStatsMtx);
+            udpStats.active = true;
+            udpStats.datagrams++;
+            if (!seqInit) {
+                firstSeq = dhdr->seq;
+                highestSeq = dhdr->seq;
+                seqInit = true;
+            }
+            else if ((int32_t)(dhdr->seq - highestSeq) > 0) {
+                highestSeq = dhdr->seq;
+            }
+            uint64_t expected = (uint64_t)(highestSeq - firstSeq) + 1;
+            udpStats.lostDatagrams = (expected > udpStats.datagrams) ? (expected - udpStats.datagrams) : 0;
+        }
+
+        if (!packetSeqInit) {
+            nextPacketSeq = dhdr->packetSeq;
+            packetSeqInit = true;
+        }
+
+        // Resynchronize if the stream jumped far ahead, e.g. after a long outage
+        if ((int32_t)(dhdr->packetSeq - nextPacketSeq) > 1024) {
+            for (auto& [seq, ra] : reassembly) { releasePacket(ra.pkt); }
+            reassembly.clear();
+            nextPacketSeq = dhdr->packetSeq;
+        }
+
+        // Ignore datagrams of packets that were already delivered or given up on
+        if ((int32_t)(dhdr->packetSeq - nextPacketSeq) < 0) { return; }
+        // The fragment count must match the size, the offsets and lengths of the fragments are computed from it
+        int expectedFrags = std::max<int>((dhdr->packetSize + SERVER_UDP_PAYLOAD_SIZE - 1) / SERVER_UDP_PAYLOAD_SIZE, 1);
+        if (dhdr->packetSize > SERVER_MAX_PACKET_SIZE || dhdr->fragCount != expectedFrags) { return; }
+
+        // Start reassembling a new packet if needed
+        auto it = reassembly.find(dhdr->packetSeq);
+        if (it == reassembly.end()) {
+            int groups = (dhdr->fragCount + SERVER_UDP_FEC_GROUP - 1) / SERVER_UDP_FEC_GROUP;
+            Reassembly ra;
+            ra.pkt = acquirePacket();
+            if (!ra.pkt) { return; }
+            if (ra.pkt->data.size() < dhdr->packetSize) { ra.pkt->data.resize(dhdr->packetSize); }
+            ra.pkt->size = dhdr->packetSize;
+            ra.type = dhdr->type;
+            ra.fragCount = dhdr->fragCount;
+            ra.received = 0;
+            ra.have.resize(ra.fragCount, false);
+            ra.haveParity.resize(groups, false);
+            ra.parity.resize(groups * SERVER_UDP_PAYLOAD_SIZE, 0);
+            it = reassembly.emplace(dhdr->packetSeq, std::move(ra)).first;
+        }
+        Reassembly& ra = it->second;
+        if (dhdr->fragCount != ra.fragCount || dhdr->packetSize != ra.pkt->size) { return; }
+
+        // Store the fragment or the parity
+        int group;
+        if (dhdr->parity) {
+            group = dhdr->index;
+            if (group >= ra.haveParity.size() || ra.haveParity[group] || payloadLen > SERVER_UDP_PAYLOAD_SIZE) { return; }
+            memcpy(&ra.parity[group * SERVER_UDP_PAYLOAD_SIZE], payload, payloadLen);
+            ra.haveParity[group] = true;
+        }
+        else {
+            int offset = dhdr->index * SERVER_UDP_PAYLOAD_SIZE;
+            if (dhdr->index >= ra.fragCount || ra.have[dhdr->index] || payloadLen != std::min<int>(SERVER_UDP_PAYLOAD_SIZE, ra.pkt->size - offset)) { return; }
+            memcpy(&ra.pkt->data[offset], payload, payloadLen);
+            ra.have[dhdr->index] = true;
+            ra.received++;
+            group = dhdr->index / SERVER_UDP_FEC_GROUP;
+        }
+        recoverGroup(ra, group);
+
+        // Give up on the oldest packets once too many newer ones are coming in
+        deliverPackets((int32_t)(dhdr->packetSeq - nextPacketSeq) >= CLIENT_UDP_REORDER_WINDOW);
+    }
+
+    void Client::recoverGroup(Reassembly& ra, int group) {
+        if (!ra.haveParity[group]) { return; }
+
+        // A single missing fragment can be rebuilt from the others and the parity
+        int first = group * SERVER_UDP_FEC_GROUP;
+        int last = std::min<int>(first + SERVER_UDP_FEC_GROUP, ra.fragCount);
+        int missing = -1;
+        for (int i = first; i < last; i++) {
+            if (ra.have[i]) { continue; }
+            if (missing >= 0) { return; }
+            missing = i;
+        }
+        if (missing < 0) { return; }
+
+        uint8_t* rebuilt = &ra.parity[group * SERVER_UDP_PAYLOAD_SIZE];
+        for (int i = first; i < last; i++) {
+            if (i == missing) { continue; }
+            int offset = i * SERVER_UDP_PAYLOAD_SIZE;
+            int len = std::min<int>(SERVER_UDP_PAYLOAD_SIZE, ra.pkt->size - offset);
+            for (int j = 0; j < len; j++) { rebuilt[j] ^= ra.pkt->data[offset + j]; }
+        }
+        int offset = missing * SERVER_UDP_PAYLOAD_SIZE;
+        memcpy(&ra.pkt->data[offset], rebuilt, std::min<int>(SERVER_UDP_PAYLOAD_SIZE, ra.pkt->size - offset));
+        ra.have[missing] = true;
+        ra.received++;
+        ra.haveParity[group] = false;
+
+        std::lock_guard<std::mutex> lck(udpStatsMtx);
+        udpStats.recovered++;
+    }
+
+    void Client::deliverPackets(bool force) {
+        while (!reassembly.empty()) {
+            auto it = reassembly.find(nextPacketSeq);
+            bool complete = (it != reassembly.end() && it->second.received == it->second.fragCount);
+            if (!complete && !force) { return; }
+
+            if (complete) {
+                // Hand the packet over like if it came from the TCP connection
+                Reassembly& ra = it->second;
+                PooledPacket* pkt = ra.pkt;
+                lastWasBaseband = (ra.type == PACKET_TYPE_BASEBAND || ra.type == PACKET_TYPE_BASEBAND_COMPRESSED);
+                if (lastWasBaseband) {
+                    pkt->compressed = (ra.type == PACKET_TYPE_BASEBAND_COMPRESSED);
+                    pkt->lost = false;
+                    queueBaseband(pkt);
+                }
+                else {
+                    if (ra.type == PACKET_TYPE_VFO) {
+                        handleVFOPacket(pkt->data.data(), pkt->size);
+                    }
+                    else if (ra.type == PACKET_TYPE_FFT) {
+                        handleFFTPacket(pkt->data.data(), pkt->size);
+                    }
+                    releasePacket(pkt);
+                }
+            }
+            else {
+                // The packet is lost, keep the baseband timing by concealing it
+                bool baseband = lastWasBaseband;
+                PooledPacket* pkt;
+                if (it != reassembly.end()) {
+                    pkt = it->second.pkt;
+                    baseband = (it->second.type == PACKET_TYPE_BASEBAND || it->second.type == PACKET_TYPE_BASEBAND_COMPRESSED);
+                }
+                else {
+                    pkt = acquirePacket();
+                }
+                // Without a free buffer the loss can't be concealed, the overrun is already counted
+                if (pkt && baseband) {
+                    pkt->lost = true;
+                    queueBaseband(pkt);
+                }
+                else if (pkt) {
+                    releasePacket(pkt);
+                }
+                std::lock_guard<std::mutex> lck(udpStatsMtx);
+                udpStats.lostPackets++;
+            }
+
+            if (it != reassembly.end()) { reassembly.erase(it); }
+            nextPacketSeq++;
+
+            // Only force out packets until we're back within the window
+            if (force && !reassembly.empty()) {
+                force = (int32_t)(reassembly.rbegin()->first - nextPacketSeq) >= CLIENT_UDP_REORDER_WINDOW;
+            }
+        }
+    }
+
     int Client::getUI() {
         if (!isOpen()) { return -1; }
         auto waiter = awaitCommandAck(COMMAND_GET_UI);
@@ -281,6 +837,6 @@ namespace server {
     }
 
     std::shared_ptr<Client> connect(std::string host, uint16_t port, dsp::stream<dsp::complex_t>* out) {
-        return std::make_shared<Client>(net::connect(host, port), out);
+        return std::make_shared<Client>(net::connect(host, port), out, host, port);
     }
 }
@@ -3,6 +3,8 @@
 #include <dsp/stream.h>
 #include <dsp/types.h>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <queue>
 #include <server_protocol.h>
 #include <atomic>
@@ -10,11 +12,19 @@
 #include <vector>
 #include <dsp/compression/sample_stream_decompressor.h>
 #include <dsp/sink.h>
-#include <dsp/routing/stream_link.h>
 #include <zstd.h>
 
 #define PROTOCOL_TIMEOUT_MS             10000
 
+// Number of baseband packets that can be held between the receive and decode threads
+#define CLIENT_PACKET_POOL_SIZE         64
+
+// Limit of the jitter buffer target
+#define CLIENT_MAX_JITTER_BUFFER_MS     1000
+
+// Number of newer packets that can arrive over UDP before an incomplete one is given up on
+#define CLIENT_UDP_REORDER_WINDOW       4
+
 namespace server {
     class PacketWaiter {
     public:
@@ -71,6 +81,22 @@ namespace server {
         std::mutex handledMtx;
     };
 
+    struct JitterStats {
+        double jitterMs;
+        double depthMs;
+        int depthPackets;
+        uint64_t underruns;
+        uint64_t overruns;
+    };
+
+    struct UDPStats {
+        bool active;
+        uint64_t datagrams;
+        uint64_t lostDatagrams;
+        uint64_t recovered;
+        uint64_t lostPackets;
+    };
+
     enum ConnectionError {
         CONN_ERR_TIMEOUT    = -1,
         CONN_ERR_BUSY       = -2
@@ -78,7 +104,7 @@ namespace server {
 
     class Client {
     public:
-        Client(std::shared_ptr<net::Socket> sock, dsp::stream<dsp::complex_t>* out);
+        Client(std::shared_ptr<net::Socket> sock, dsp::stream<dsp::complex_t>* out, std::string host = "", int port = 0);
         ~Client();
 
         void showMenu();
@@ -88,6 +114,22 @@ namespace server {
         
         void setSampleType(dsp::compression::PCMType type);
         void setCompression(bool enabled);
+        void requestControl();
+        bool isController();
+
+        void setFullIQ(bool enabled);
+        void addVFO(uint32_t id, double sampleRate, double bandwidth, double offset, dsp::stream<dsp::complex_t>* out);
+        void setVFO(uint32_t id, double sampleRate, double bandwidth, double offset);
+        void removeVFO(uint32_t id);
+        void setFFT(int size, double rate, int averaging);
+        void setAdaptive(bool enabled);
+        StreamFormat getStreamFormat();
+
+        void setJitterBuffer(int ms);
+        JitterStats getJitterStats();
+
+        void setUDP(bool enabled);
+        UDPStats getUDPStats();
 
         void start();
         void stop();
@@ -99,7 +141,43 @@ namespace server {
         bool serverBusy = false;
 
     private:
+        // Baseband packet received straight from the socket, recycled through the pool
+        struct PooledPacket {
+            std::vector<uint8_t> data;
+            int size = 0;
+            bool compressed = false;
+            bool lost = false;
+            std::chrono::steady_clock::time_point arrival;
+        };
+
+        // Packet being put back together from its datagrams
+        struct Reassembly {
+            PooledPacket* pkt;
+            uint8_t type;
+            int fragCount;
+            int received;
+            std::vector<bool> have;
+            std::vector<bool> haveParity;
+            std::vector<uint8_t> parity;
+        };
+
         void worker();
+        void decodeWorker();
+
+        PooledPacket* acquirePacket();
+        void releasePacket(PooledPacket* pkt);
+        int jitterTargetPackets();
+        void queueBaseband(PooledPacket* pkt);
+
+        void handleVFOPacket(uint8_t* data, size_t len);
+        void handleFFTPacket(uint8_t* data, size_t len);
+
+        void startUDP(uint64_t token);
+        void stopUDP();
+        void udpWorker();
+        void handleDatagram(uint8_t* buf, int len);
+        void recoverGroup(Reassembly& ra, int group);
+        void deliverPackets(bool force);
 
         int getUI();
 
@@ -115,13 +193,13 @@ namespace server {
 
         std::shared_ptr<net::Socket> sock;
 
-        dsp::stream<uint8_t> decompIn;
         dsp::compression::SampleStreamDecompressor decomp;
-        dsp::routing::StreamLink<dsp::complex_t> link;
         dsp::stream<dsp::complex_t>* output;
 
         uint8_t* rbuffer = NULL;
         uint8_t* sbuffer = NULL;
+        uint8_t* vfoBuffer = NULL;
+        uint8_t* decodeBuffer = NULL;
 
         PacketHeader* r_pkt_hdr = NULL;
         uint8_t* r_pkt_data = NULL;
@@ -137,10 +215,61 @@ namespace server {
         std::mutex dlMtx;
 
         ZSTD_DCtx* dctx;
+        ZSTD_DCtx* decodeDctx;
+
+        // Jitter buffer, packets wait in the queue until the decode thread picks them up
+        std::vector<PooledPacket> packetPool;
+        std::vector<PooledPacket*> freePackets;
+        std::deque<PooledPacket*> jitterQueue;
+        std::mutex jitterMtx;
+        std::condition_variable jitterCnd;
+        bool decodeStop = false;
+        bool prebuffering = true;
+        int jitterTargetMs = 0;
+        double packetDurationMs = 0.0;
+        JitterStats jitterStats = {};
+        std::chrono::steady_clock::time_point lastArrival;
+        double lastDurationMs = 0.0;
+
+        // Outputs of the server-side VFOs, vfoMtx is held by the worker while writing to one
+        std::map<uint32_t, dsp::stream<dsp::complex_t>*> vfoOutputs;
+        std::mutex vfoMtx;
+        std::mutex vfoMapMtx;
+
+        // Decompressed bins of the server-side FFT
+        std::vector<uint8_t> fftBins;
+
+        // Held while decoding VFO and FFT packets, they can come from both the TCP and UDP threads
+        std::mutex dataMtx;
 
         std::thread workerThread;
+        std::thread decodeThread;
+
+        // UDP data channel, the reassembly state is only touched by the UDP thread
+        std::string host;
+        int port;
+        std::shared_ptr<net::Socket> udpSock;
+        std::thread udpThread;
+        std::mutex udpMtx;
+        std::atomic<bool> udpStop = false;
+        uint64_t udpToken = 0;
+        net::Address udpServerAddr;
+        uint8_t* udpBuffer = NULL;
+        std::map<uint32_t, Reassembly> reassembly;
+        uint32_t nextPacketSeq = 0;
+        bool packetSeqInit = false;
+        bool lastWasBaseband = false;
+        uint32_t highestSeq = 0;
+        uint32_t firstSeq = 0;
+        bool seqInit = false;
+        UDPStats udpStats = {};
+        std::mutex udpStatsMtx;
+
+        std::atomic<double> currentSampleRate = 1000000.0;
+        std::atomic<bool> controller = false;
 
-        double currentSampleRate = 1000000.0;
+        StreamFormat streamFormat = {};
+        std::mutex streamFormatMtx;
     };
 
     std::shared_ptr<Client> connect(std::string host, uint16_t port, dsp::stream<dsp::complex_t>* out);
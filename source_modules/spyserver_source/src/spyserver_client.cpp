@@ -7,21 +7,21 @@ using namespace std::chrono_literals;
 namespace spyserver {
     SpyServerClientClass::SpyServerClientClass(net::Conn conn, dsp::stream<dsp::complex_t>* out) {
         readBuf = new uint8_t[SPYSERVER_MAX_MESSAGE_BODY_SIZE];
-        writeBuf = new uint8_t[SPYSERVER_MAX_MESSAGE_BODY_SIZE];
         client = std::move(conn);
         output = out;
 
         output->clearWriteStop();
 
+        workerThread = std::thread(&SpyServerClientClass::worker, this);
+
         sendHandshake("SDR++");
 
-        client->readAsync(sizeof(SpyServerMessageHeader), (uint8_t*)&receivedHeader, dataHandler, this);
+        readHeader();
     }
 
     SpyServerClientClass::~SpyServerClientClass() {
         close();
         delete[] readBuf;
-        delete[] writeBuf;
     }
 
     void SpyServerClientClass::startStream() {
@@ -36,6 +36,12 @@ namespace spyserver {
 
     void SpyServerClientClass::close() {
         output->stopWriter();
+        {
+            std::lock_guard lck(workerMtx);
+            stopWorker = true;
+        }
+        workerCnd.notify_all();
+        if (workerThread.joinable()) { workerThread.join(); }
         client->close();
     }
 
@@ -67,11 +73,14 @@ namespace spyserver {
     }
 
     void SpyServerClientClass::sendCommand(uint32_t command, void* data, int len) {
-        SpyServerCommandHeader* hdr = (SpyServerCommandHeader*)writeBuf;
-        hdr->CommandType = command;
-        hdr->BodySize = len;
-        memcpy(&writeBuf[sizeof(SpyServerCommandHeader)], data, len);
-        client->write(sizeof(SpyServerCommandHeader) + len, writeBuf);
+        SpyServerCommandHeader hdr;
+        hdr.CommandType = command;
+        hdr.BodySize = len;
+        net::ConnBuffer bufs[2] = {
+            { sizeof(SpyServerCommandHeader), (uint8_t*)&hdr },
+            { len, (uint8_t*)data }
+        };
+        client->write(bufs, 2);
     }
 
     void SpyServerClientClass::sendHandshake(std::string appName) {
@@ -94,72 +103,97 @@ namespace spyserver {
         sendCommand(SPYSERVER_CMD_SET_SETTING, &target, sizeof(SpyServerSettingTarget));
     }
 
-    int SpyServerClientClass::readSize(int count, uint8_t* buffer) {
-        int read = 0;
-        int len = 0;
-        while (read < count) {
-            len = client->read(count - read, &buffer[read]);
-            if (len <= 0) { return len; }
-            read += len;
-        }
-        return read;
+    void SpyServerClientClass::readHeader() {
+        client->readAsync(sizeof(SpyServerMessageHeader), (uint8_t*)&receivedHeader, headerHandler, this);
     }
 
-    void SpyServerClientClass::dataHandler(int count, uint8_t* buf, void* ctx) {
+    void SpyServerClientClass::headerHandler(int count, uint8_t* buf, void* ctx) {
         SpyServerClientClass* _this = (SpyServerClientClass*)ctx;
 
-        if (count < sizeof(SpyServerMessageHeader)) {
-            _this->readSize(sizeof(SpyServerMessageHeader) - count, &buf[count]);
+        //printf("MSG Proto: 0x%08X, MsgType: 0x%08X, StreamType: 0x%08X, Seq: 0x%08X, Size: %d\n", _this->receivedHeader.ProtocolID, _this->receivedHeader.MessageType, _this->receivedHeader.StreamType, _this->receivedHeader.SequenceNumber, _this->receivedHeader.BodySize);
+
+        if (_this->receivedHeader.BodySize > SPYSERVER_MAX_MESSAGE_BODY_SIZE) {
+            printf("ERROR: Message too large\n");
+            return;
         }
 
-        int size = _this->readSize(_this->receivedHeader.BodySize, _this->readBuf);
-        if (size <= 0) {
-            printf("ERROR: Disconnected\n");
+        // Empty messages have no body to wait for
+        if (!_this->receivedHeader.BodySize) {
+            _this->handleMessage();
             return;
         }
+        _this->client->readAsync(_this->receivedHeader.BodySize, _this->readBuf, bodyHandler, _this);
+    }
 
-        //printf("MSG Proto: 0x%08X, MsgType: 0x%08X, StreamType: 0x%08X, Seq: 0x%08X, Size: %d\n", _this->receivedHeader.ProtocolID, _this->receivedHeader.MessageType, _this->receivedHeader.StreamType, _this->receivedHeader.SequenceNumber, _this->receivedHeader.BodySize);
+    void SpyServerClientClass::bodyHandler(int count, uint8_t* buf, void* ctx) {
+        SpyServerClientClass* _this = (SpyServerClientClass*)ctx;
+        _this->handleMessage();
+    }
 
-        int mtype = _this->receivedHeader.MessageType & 0xFFFF;
-        int mflags = (_this->receivedHeader.MessageType & 0xFFFF0000) >> 16;
+    void SpyServerClientClass::handleMessage() {
+        int mtype = receivedHeader.MessageType & 0xFFFF;
 
         if (mtype == SPYSERVER_MSG_TYPE_DEVICE_INFO) {
             {
-                std::lock_guard lck(_this->deviceInfoMtx);
-                SpyServerDeviceInfo* _devInfo = (SpyServerDeviceInfo*)_this->readBuf;
-                _this->devInfo = *_devInfo;
-                _this->deviceInfoAvailable = true;
+                std::lock_guard lck(deviceInfoMtx);
+                SpyServerDeviceInfo* _devInfo = (SpyServerDeviceInfo*)readBuf;
+                devInfo = *_devInfo;
+                deviceInfoAvailable = true;
             }
-            _this->deviceInfoCnd.notify_all();
+            deviceInfoCnd.notify_all();
         }
-        else if (mtype == SPYSERVER_MSG_TYPE_UINT8_IQ) {
-            int sampCount = _this->receivedHeader.BodySize / (sizeof(uint8_t) * 2);
-            float gain = pow(10, (double)mflags / 20.0);
-            float scale = 1.0f / (gain * 128.0f);
-            for (int i = 0; i < sampCount; i++) {
-                _this->output->writeBuf[i].re = ((float)_this->readBuf[(2 * i)] - 128.0f) * scale;
-                _this->output->writeBuf[i].im = ((float)_this->readBuf[(2 * i) + 1] - 128.0f) * scale;
+        else if (mtype == SPYSERVER_MSG_TYPE_UINT8_IQ || mtype == SPYSERVER_MSG_TYPE_INT16_IQ || mtype == SPYSERVER_MSG_TYPE_FLOAT_IQ) {
+            // Writing to the stream can block, hand the samples over to the worker which reads the next header when done
+            {
+                std::lock_guard lck(workerMtx);
+                messageReady = true;
             }
-            _this->output->swap(sampCount);
-        }
-        else if (mtype == SPYSERVER_MSG_TYPE_INT16_IQ) {
-            int sampCount = _this->receivedHeader.BodySize / (sizeof(int16_t) * 2);
-            float gain = pow(10, (double)mflags / 20.0);
-            volk_16i_s32f_convert_32f((float*)_this->output->writeBuf, (int16_t*)_this->readBuf, 32768.0 * gain, sampCount * 2);
-            _this->output->swap(sampCount);
+            workerCnd.notify_all();
+            return;
         }
         else if (mtype == SPYSERVER_MSG_TYPE_INT24_IQ) {
             printf("ERROR: IQ format not supported\n");
-            return;
         }
-        else if (mtype == SPYSERVER_MSG_TYPE_FLOAT_IQ) {
-            int sampCount = _this->receivedHeader.BodySize / sizeof(dsp::complex_t);
+
+        readHeader();
+    }
+
+    void SpyServerClientClass::worker() {
+        while (true) {
+            {
+                std::unique_lock lck(workerMtx);
+                workerCnd.wait(lck, [this]() { return messageReady || stopWorker; });
+                if (stopWorker) { break; }
+                messageReady = false;
+            }
+
+            // The header isn't touched by the network thread until the next read is started
+            int mtype = receivedHeader.MessageType & 0xFFFF;
+            int mflags = (receivedHeader.MessageType & 0xFFFF0000) >> 16;
             float gain = pow(10, (double)mflags / 20.0);
-            volk_32f_s32f_multiply_32f((float*)_this->output->writeBuf, (float*)_this->readBuf, gain, sampCount * 2);
-            _this->output->swap(sampCount);
-        }
 
-        _this->client->readAsync(sizeof(SpyServerMessageHeader), (uint8_t*)&_this->receivedHeader, dataHandler, _this);
+            if (mtype == SPYSERVER_MSG_TYPE_UINT8_IQ) {
+                int sampCount = receivedHeader.BodySize / (sizeof(uint8_t) * 2);
+                float scale = 1.0f / (gain * 128.0f);
+                for (int i = 0; i < sampCount; i++) {
+                    output->writeBuf[i].re = ((float)readBuf[(2 * i)] - 128.0f) * scale;
+                    output->writeBuf[i].im = ((float)readBuf[(2 * i) + 1] - 128.0f) * scale;
+                }
+                output->swap(sampCount);
+            }
+            else if (mtype == SPYSERVER_MSG_TYPE_INT16_IQ) {
+                int sampCount = receivedHeader.BodySize / (sizeof(int16_t) * 2);
+                volk_16i_s32f_convert_32f((float*)output->writeBuf, (int16_t*)readBuf, 32768.0 * gain, sampCount * 2);
+                output->swap(sampCount);
+            }
+            else if (mtype == SPYSERVER_MSG_TYPE_FLOAT_IQ) {
+                int sampCount = receivedHeader.BodySize / sizeof(dsp::complex_t);
+                volk_32f_s32f_multiply_32f((float*)output->writeBuf, (float*)readBuf, gain, sampCount * 2);
+                output->swap(sampCount);
+            }
+
+            readHeader();
+        }
     }
 
     SpyServerClient connect(std::string host, uint16_t port, dsp::stream<dsp::complex_t>* out) {
@@ -3,6 +3,7 @@
 #include <spyserver_protocol.h>
 #include <dsp/stream.h>
 #include <dsp/types.h>
+#include <thread>
 
 namespace spyserver {
     class SpyServerClientClass {
@@ -28,14 +29,16 @@ namespace spyserver {
         void sendCommand(uint32_t command, void* data, int len);
         void sendHandshake(std::string appName);
 
-        int readSize(int count, uint8_t* buffer);
+        void readHeader();
+        void handleMessage();
+        void worker();
 
-        static void dataHandler(int count, uint8_t* buf, void* ctx);
+        static void headerHandler(int count, uint8_t* buf, void* ctx);
+        static void bodyHandler(int count, uint8_t* buf, void* ctx);
 
         net::Conn client;
 
         uint8_t* readBuf;
-        uint8_t* writeBuf;
 
         bool deviceInfoAvailable = false;
         std::mutex deviceInfoMtx;
@@ -43,6 +46,13 @@ namespace spyserver {
 
         SpyServerMessageHeader receivedHeader;
 
+        // IQ messages are converted off the network thread, the next header is only read once done with readBuf
+        std::thread workerThread;
+        std::mutex workerMtx;
+        std::condition_variable workerCnd;
+        bool messageReady = false;
+        bool stopWorker = false;
+
         dsp::stream<dsp::complex_t>* output;
     };
 